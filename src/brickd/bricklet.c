@@ -24,28 +24,34 @@
 
 #include "bricklet_stack.h"
 
-#include <daemonlib/config.h>
+#include <daemonlib/array.h>
+#include <daemonlib/conf_file.h>
+#include <daemonlib/enum.h>
 #include <daemonlib/log.h>
+#include <daemonlib/macros.h>
 #include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <inttypes.h>
 
-#define BRICKLET_SPI_MAX_NUM              2
-#define BRICKLET_CS_MAX_NUM               10
+#define BRICKLET_CONFIG_MAX_NAME_LENGTH   64
 
-#define BRICKLET_CONFIG_STR_GROUP_POS     14
-#define BRICKLET_CONFIG_STR_CS_POS        (BRICKLET_CONFIG_STR_GROUP_POS + 4)
+#define BRICKLET_SLEEP_BETWEEN_READS_MIN  100
+#define BRICKLET_SLEEP_BETWEEN_READS_MAX  1000000
+#define BRICKLET_SLEEP_BETWEEN_READS      200
+#define BRICKLET_HAT_SLEEP_BETWEEN_READS  2000
 
 #define BRICKLET_RPI_HAT_SPIDEV           "/dev/spidev0.0"
-#define BRICKLET_RPI_HAT_SPIDEV_NUM       0
 #define BRICKLET_RPI_HAT_MASTER_CS        8
 
 #define BRICKLET_RPI_HAT_ZERO_SPIDEV      "/dev/spidev0.0"
-#define BRICKLET_RPI_HAT_ZERO_SPIDEV_NUM  0
 #define BRICKLET_RPI_HAT_ZERO_MASTER_CS   5
 
 #define BRICKLET_RPI_PRODUCT_ID_LENGTH    6
@@ -54,10 +60,30 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-// We support up to two parallel SPI hardware units, each one of those needs a mutex.
-static Mutex _bricklet_spi_mutex[BRICKLET_SPI_MAX_NUM];
-static int _bricklet_stack_num = 0;
-static BrickletStack _bricklet_stack[BRICKLET_SPI_MAX_NUM*BRICKLET_CS_MAX_NUM];
+static EnumValueName _chip_select_driver_enum_value_names[] = {
+	{ BRICKLET_CHIP_SELECT_DRIVER_HARDWARE, "hardware" },
+	{ BRICKLET_CHIP_SELECT_DRIVER_GPIO,     "gpio" },
+	{ BRICKLET_CHIP_SELECT_DRIVER_WIRINGPI, "wiringpi" },
+	{ -1,                                   NULL }
+};
+
+// Each SPI hardware unit (spidev) needs a mutex. Several groups can use the
+// same spidev, they share the mutex and the statistics then. Both arrays are
+// non-relocatable, because the Bricklet stacks and their SPI threads keep
+// pointers to the items.
+typedef struct {
+	char spi_device[64];
+	Mutex mutex;
+	BrickletStackSPIStatistics statistics;
+
+	// Copy of the statistics at the last bricklet_log_statistics call, so
+	// the logged rates cover the time since then. Only used by the main thread
+	BrickletStackSPIStatistics last_statistics;
+	uint64_t last_logged;
+} BrickletSPIBus;
+
+static Array _bricklet_spi_buses;
+static Array _bricklet_stacks;
 
 // The "connected to uid" can be overwritten if the UID of the HAT itself is known.
 // In this case the Bricklets will be shown as connected to the HAT in Brick Viewer.
@@ -136,6 +162,205 @@ bricklet.group0.cs4.name = gpio25
 bricklet.group0.cs4.num = 25
 *************************************/
 
+// The bricklet.* options are not part of the static config option table,
+// because the number of groups and chip selects is not known in advance.
+// Instead the config file is read here and all groups and chip selects that
+// are present in it are used
+
+// Returns the value of an integer option or the default value if the option
+// is not set or has an invalid value
+static int bricklet_config_get_integer(ConfFile *conf_file, const char *name,
+                                       int min, int max, int default_value) {
+	const char *string = conf_file_get_option_value(conf_file, name);
+	char *end = NULL;
+	int value;
+
+	if(string == NULL || string[0] == '\0') {
+		return default_value;
+	}
+
+	if(parse_int(string, &end, 10, &value) < 0 || *end != '\0' || value < min || value > max) {
+		log_warn("Value '%s' for %s option is invalid or not in [%d..%d] range, using default value %d",
+		         string, name, min, max, default_value);
+
+		return default_value;
+	}
+
+	return value;
+}
+
+// Returns the sleep_between_reads value of a chip select. The per chip select
+// option takes precedence over the per port option, ports are only named for
+// the first 26 chip selects
+static int bricklet_config_get_sleep_between_reads(ConfFile *conf_file, int group, int cs) {
+	char name[BRICKLET_CONFIG_MAX_NAME_LENGTH];
+	int value = BRICKLET_SLEEP_BETWEEN_READS;
+
+	if(cs < 26) {
+		snprintf(name, sizeof(name), "bricklet.port%c.sleep_between_reads", 'A' + cs);
+
+		value = bricklet_config_get_integer(conf_file, name,
+		                                    BRICKLET_SLEEP_BETWEEN_READS_MIN,
+		                                    BRICKLET_SLEEP_BETWEEN_READS_MAX,
+		                                    value);
+	}
+
+	snprintf(name, sizeof(name), "bricklet.group%d.cs%d.sleep_between_reads", group, cs);
+
+	return bricklet_config_get_integer(conf_file, name,
+	                                   BRICKLET_SLEEP_BETWEEN_READS_MIN,
+	                                   BRICKLET_SLEEP_BETWEEN_READS_MAX,
+	                                   value);
+}
+
+static int bricklet_compare_numbers(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+// Collects the distinct group numbers of all bricklet.groupN.spidev options
+// if group is -1, otherwise the distinct chip select numbers of all
+// bricklet.groupN.csM.driver options of the given group. The numbers are
+// sorted ascending
+static int bricklet_config_collect_numbers(ConfFile *conf_file, int group, Array *numbers) {
+	ConfFileLine *line;
+	int line_group;
+	int line_cs;
+	int consumed;
+	int number;
+	int *item;
+	int i;
+	int k;
+
+	for(i = 0; i < conf_file->lines.count; i++) {
+		line = array_get(&conf_file->lines, i);
+
+		if(line->name == NULL) {
+			continue;
+		}
+
+		consumed = 0;
+
+		if(group < 0) {
+			if(sscanf(line->name, "bricklet.group%d.spidev%n", &line_group, &consumed) != 1 ||
+			   consumed == 0 || line->name[consumed] != '\0') {
+				continue;
+			}
+
+			number = line_group;
+		} else {
+			if(sscanf(line->name, "bricklet.group%d.cs%d.driver%n", &line_group, &line_cs, &consumed) != 2 ||
+			   consumed == 0 || line->name[consumed] != '\0' || line_group != group) {
+				continue;
+			}
+
+			number = line_cs;
+		}
+
+		if(number < 0) {
+			continue;
+		}
+
+		for(k = 0; k < numbers->count; k++) {
+			if(*(int *)array_get(numbers, k) == number) {
+				break;
+			}
+		}
+
+		if(k < numbers->count) {
+			continue; // duplicate
+		}
+
+		item = array_append(numbers);
+
+		if(item == NULL) {
+			log_error("Could not append to config number array: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		*item = number;
+	}
+
+	qsort(numbers->bytes, numbers->count, numbers->size, bricklet_compare_numbers);
+
+	return 0;
+}
+
+static void bricklet_spi_bus_destroy(BrickletSPIBus *spi_bus) {
+	mutex_destroy(&spi_bus->mutex);
+}
+
+// Returns the bus of the given spidev, creates a new one for a new spidev
+static BrickletSPIBus *bricklet_get_spi_bus(const char *spi_device) {
+	BrickletSPIBus *spi_bus;
+	int i;
+
+	for(i = 0; i < _bricklet_spi_buses.count; i++) {
+		spi_bus = array_get(&_bricklet_spi_buses, i);
+
+		if(strcmp(spi_bus->spi_device, spi_device) == 0) {
+			return spi_bus;
+		}
+	}
+
+	spi_bus = array_append(&_bricklet_spi_buses);
+
+	if(spi_bus == NULL) {
+		log_error("Could not append to SPI bus array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return NULL;
+	}
+
+	memset(spi_bus, 0, sizeof(BrickletSPIBus));
+	snprintf(spi_bus->spi_device, sizeof(spi_bus->spi_device), "%s", spi_device);
+	mutex_create(&spi_bus->mutex);
+
+	spi_bus->last_logged = microseconds();
+
+	return spi_bus;
+}
+
+static int bricklet_add_stack(BrickletStackConfig *config) {
+	BrickletStack *bricklet_stack;
+
+	if(_bricklet_stacks.count >= BRICKLET_STACK_MAX_COUNT) {
+		log_error("Cannot add Bricklet stack for spidev %s, only %d Bricklet stacks (positions a to z) are supported",
+		          config->spi_device, BRICKLET_STACK_MAX_COUNT);
+
+		return -1;
+	}
+
+	config->num = _bricklet_stacks.count;
+
+	log_debug("Bricklet found: spidev %s, driver %d, name %s (num %d)",
+	          config->spi_device,
+	          config->chip_select_driver,
+	          config->chip_select_gpio_sysfs.name,
+	          config->chip_select_gpio_sysfs.num);
+
+	bricklet_stack = array_append(&_bricklet_stacks);
+
+	if(bricklet_stack == NULL) {
+		log_error("Could not append to Bricklet stack array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	// The Bricklet stack used to be a zero-initialized static variable
+	memset(bricklet_stack, 0, sizeof(BrickletStack));
+
+	if(bricklet_stack_init(bricklet_stack, config) < 0) {
+		array_remove(&_bricklet_stacks, _bricklet_stacks.count - 1, NULL);
+
+		return -1;
+	}
+
+	return 0;
+}
+
 // spidev1.x on RPi does not support CPHA:
 // https://www.raspberrypi.org/forums/viewtopic.php?t=186019
 // https://www.raspberrypi.org/forums/viewtopic.php?f=44&t=96069
@@ -145,16 +370,17 @@ bricklet.group0.cs4.num = 25
 // Additionally, on spidev0.x the SPI_NO_CS option does not work,
 // so we can't intermix hardware CS with gpio CS pins. Because
 // of this the HAT can only use pins for CS that are not HW CS pins...
-int bricklet_init_rpi_hat(const char *product_id_test, const char *spidev,
-                          const int spidev_num, const uint8_t *gpios,
+int bricklet_init_rpi_hat(ConfFile *conf_file,
+                          const char *product_id_test, const char *spidev,
+                          const uint8_t *gpios,
                           const int gpios_num, const int master_cs,
                           const char *name, const bool last) {
 	int fd;
 	int rc;
 	char product_id[BRICKLET_RPI_PRODUCT_ID_LENGTH+1] = "\0";
 	BrickletStackConfig config;
-	char str_sleep_between_reads_bricklet[] = "bricklet.portX.sleep_between_reads";
-	char str_sleep_between_reads_hat[]      = "bricklet.portHAT.sleep_between_reads";
+	BrickletSPIBus *spi_bus;
+	char str_sleep_between_reads[BRICKLET_CONFIG_MAX_NAME_LENGTH];
 
 	fd = open("/proc/device-tree/hat/product_id", O_RDONLY);
 
@@ -184,7 +410,15 @@ int bricklet_init_rpi_hat(const char *product_id_test, const char *spidev,
 
 	memset(&config, 0, sizeof(config));
 
-	config.mutex = &_bricklet_spi_mutex[spidev_num];
+	spi_bus = bricklet_get_spi_bus(spidev);
+
+	if(spi_bus == NULL) {
+		return -1;
+	}
+
+	config.mutex = &spi_bus->mutex;
+	config.spi_statistics = &spi_bus->statistics;
+
 	strcpy(config.spi_device, spidev);
 	config.connected_uid = &bricklet_connected_uid;
 
@@ -195,30 +429,28 @@ int bricklet_init_rpi_hat(const char *product_id_test, const char *spidev,
 			config.startup_wait_time = 1000;
 		}
 
-		config.num = _bricklet_stack_num;
 		config.chip_select_driver = BRICKLET_CHIP_SELECT_DRIVER_GPIO;
 		config.chip_select_gpio_sysfs.num = gpios[cs];
 
 		if(cs == gpios_num - 1) { // Last CS is the HAT itself
-			config.sleep_between_reads = config_get_option_value(str_sleep_between_reads_hat)->integer;
+			config.sleep_between_reads = bricklet_config_get_integer(conf_file, "bricklet.portHAT.sleep_between_reads",
+			                                                         BRICKLET_SLEEP_BETWEEN_READS_MIN,
+			                                                         BRICKLET_SLEEP_BETWEEN_READS_MAX,
+			                                                         BRICKLET_HAT_SLEEP_BETWEEN_READS);
 		} else {
-			str_sleep_between_reads_bricklet[13] = 'A' + cs;
-			config.sleep_between_reads = config_get_option_value(str_sleep_between_reads_bricklet)->integer;
+			snprintf(str_sleep_between_reads, sizeof(str_sleep_between_reads), "bricklet.port%c.sleep_between_reads", 'A' + cs);
+
+			config.sleep_between_reads = bricklet_config_get_integer(conf_file, str_sleep_between_reads,
+			                                                         BRICKLET_SLEEP_BETWEEN_READS_MIN,
+			                                                         BRICKLET_SLEEP_BETWEEN_READS_MAX,
+			                                                         BRICKLET_SLEEP_BETWEEN_READS);
 		}
 
 		sprintf(config.chip_select_gpio_sysfs.name, "gpio%d", config.chip_select_gpio_sysfs.num);
 
-		log_debug("Bricklet found: spidev %s, driver %d, name %s (num %d)",
-		          config.spi_device,
-		          config.chip_select_driver,
-		          config.chip_select_gpio_sysfs.name,
-		          config.chip_select_gpio_sysfs.num);
-
-		if(bricklet_stack_init(&_bricklet_stack[_bricklet_stack_num], &config) < 0) {
+		if(bricklet_add_stack(&config) < 0) {
 			return -1;
 		}
-
-		_bricklet_stack_num++;
 	}
 
 	return 0;
@@ -257,24 +489,196 @@ int bricklet_init_hctosys(void) {
 	return -1;
 }
 
-int bricklet_init(void) {
-	int rc;
-	int length = 0;
-	char str_spidev[]              = "bricklet.groupX.spidev";
-	char str_cs_driver[]           = "bricklet.groupX.csY.driver";
-	char str_cs_name[]             = "bricklet.groupX.csY.name";
-	char str_cs_num[]              = "bricklet.groupX.csY.num";
-	char str_sleep_between_reads[] = "bricklet.portX.sleep_between_reads";
+// Adds a Bricklet stack for each chip select of a group in the config
+static int bricklet_init_config_group(ConfFile *conf_file, int group, const char *spi_device) {
+	Array chip_selects;
+	int i;
+	int cs;
+	int driver;
+	const char *string;
+	char name[BRICKLET_CONFIG_MAX_NAME_LENGTH];
 	BrickletStackConfig config;
+	BrickletSPIBus *spi_bus;
+	int rc = -1;
+
+	if(strlen(spi_device) >= sizeof(config.spi_device)) {
+		log_warn("Value of bricklet.group%d.spidev option is too long, ignoring group %d",
+		         group, group);
+
+		return 0;
+	}
+
+	if(array_create(&chip_selects, 16, sizeof(int), true) < 0) {
+		log_error("Could not create chip select number array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if(bricklet_config_collect_numbers(conf_file, group, &chip_selects) < 0) {
+		goto cleanup;
+	}
 
-	mutex_create(&_bricklet_spi_mutex[0]);
-	mutex_create(&_bricklet_spi_mutex[1]);
+	for(i = 0; i < chip_selects.count; i++) {
+		cs = *(int *)array_get(&chip_selects, i);
+
+		memset(&config, 0, sizeof(config));
+
+		config.connected_uid = &bricklet_connected_uid;
+		config.startup_wait_time = 0;
+		config.sleep_between_reads = bricklet_config_get_sleep_between_reads(conf_file, group, cs);
+
+		snprintf(config.spi_device, sizeof(config.spi_device), "%s", spi_device);
+
+		snprintf(name, sizeof(name), "bricklet.group%d.cs%d.driver", group, cs);
+		string = conf_file_get_option_value(conf_file, name);
+
+		if(string == NULL || string[0] == '\0') {
+			continue;
+		}
+
+		if(enum_get_value(_chip_select_driver_enum_value_names, string, &driver, true) < 0) {
+			log_warn("Value '%s' for %s option is invalid, ignoring chip select", string, name);
+
+			continue;
+		}
+
+		config.chip_select_driver = driver;
+
+		if(config.chip_select_driver == CHIP_SELECT_GPIO) {
+			snprintf(name, sizeof(name), "bricklet.group%d.cs%d.num", group, cs);
+			config.chip_select_gpio_sysfs.num = bricklet_config_get_integer(conf_file, name, 0, UINT16_MAX, -1);
+
+			snprintf(name, sizeof(name), "bricklet.group%d.cs%d.name", group, cs);
+			string = conf_file_get_option_value(conf_file, name);
+
+			if(string == NULL || string[0] == '\0') {
+				continue;
+			}
+
+			if(strlen(string) >= sizeof(config.chip_select_gpio_sysfs.name)) {
+				log_warn("Value of %s option is too long, ignoring chip select", name);
+
+				continue;
+			}
+
+			snprintf(config.chip_select_gpio_sysfs.name, sizeof(config.chip_select_gpio_sysfs.name), "%s", string);
+		} else if(config.chip_select_driver != CHIP_SELECT_HARDWARE) {
+			continue;
+		}
+
+		spi_bus = bricklet_get_spi_bus(config.spi_device);
+
+		if(spi_bus == NULL) {
+			goto cleanup;
+		}
+
+		config.mutex = &spi_bus->mutex;
+		config.spi_statistics = &spi_bus->statistics;
+
+		if(bricklet_add_stack(&config) < 0) {
+			goto cleanup;
+		}
+	}
+
+	rc = 0;
+
+cleanup:
+	array_destroy(&chip_selects, NULL);
+
+	return rc;
+}
+
+// Reads the Bricklet stack configuration of all groups and chip selects
+// that are present in the config file
+static int bricklet_init_config(ConfFile *conf_file) {
+	Array groups;
+	int i;
+	int group;
+	const char *spi_device;
+	char name[BRICKLET_CONFIG_MAX_NAME_LENGTH];
+	int rc = -1;
+
+	if(array_create(&groups, 4, sizeof(int), true) < 0) {
+		log_error("Could not create group number array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if(bricklet_config_collect_numbers(conf_file, -1, &groups) < 0) {
+		goto cleanup;
+	}
+
+	for(i = 0; i < groups.count; i++) {
+		group = *(int *)array_get(&groups, i);
+
+		snprintf(name, sizeof(name), "bricklet.group%d.spidev", group);
+		spi_device = conf_file_get_option_value(conf_file, name);
+
+		if(spi_device == NULL || spi_device[0] == '\0') {
+			continue;
+		}
+
+		if(bricklet_init_config_group(conf_file, group, spi_device) < 0) {
+			goto cleanup;
+		}
+	}
+
+	rc = 0;
+
+cleanup:
+	array_destroy(&groups, NULL);
+
+	return rc;
+}
+
+int bricklet_init(const char *config_filename) {
+	int phase = 0;
+	int rc;
+	ConfFile conf_file;
+
+	if(conf_file_create(&conf_file) < 0) {
+		log_error("Could not create Bricklet conf object: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	// A missing config file was already reported by config_init, it just
+	// means that there are no bricklet.* options
+	if(conf_file_read(&conf_file, config_filename, NULL, NULL) < 0 && errno != ENOENT) {
+		log_error("Could not read config file '%s': %s (%d)",
+		          config_filename, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	if(array_create(&_bricklet_spi_buses, 4, sizeof(BrickletSPIBus), false) < 0) {
+		log_error("Could not create SPI bus array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if(array_create(&_bricklet_stacks, 16, sizeof(BrickletStack), false) < 0) {
+		log_error("Could not create Bricklet stack array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
 
 	// First we try to find out if this brickd is installed on a RPi with raspbian
 	// and a Tinkerforge HAT Brick is on top
-	rc = bricklet_init_rpi_hat(BRICKLET_RPI_HAT_PRODUCT_ID,
+	rc = bricklet_init_rpi_hat(&conf_file,
+	                           BRICKLET_RPI_HAT_PRODUCT_ID,
 	                           BRICKLET_RPI_HAT_SPIDEV,
-	                           BRICKLET_RPI_HAT_SPIDEV_NUM,
 	                           bricklet_stack_rpi_hat_gpios,
 	                           sizeof(bricklet_stack_rpi_hat_gpios),
 	                           BRICKLET_RPI_HAT_MASTER_CS,
@@ -282,18 +686,20 @@ int bricklet_init(void) {
 	                           false);
 
 	if(rc < 0) {
-		return -1;
+		goto cleanup;
 	} else if(rc == 0) {
 		// The HAT Brick has a RTC.
 		// If we find one, we update the system time with the RTC time.
 		bricklet_init_hctosys();
-		return 0;
+		phase = 4;
+
+		goto cleanup;
 	}
 
 	// or a Tinkerforge HAT Zero Brick is on top
-	rc = bricklet_init_rpi_hat(BRICKLET_RPI_HAT_ZERO_PRODUCT_ID,
+	rc = bricklet_init_rpi_hat(&conf_file,
+	                           BRICKLET_RPI_HAT_ZERO_PRODUCT_ID,
 	                           BRICKLET_RPI_HAT_ZERO_SPIDEV,
-	                           BRICKLET_RPI_HAT_ZERO_SPIDEV_NUM,
 	                           bricklet_stack_rpi_hat_zero_gpios,
 	                           sizeof(bricklet_stack_rpi_hat_zero_gpios),
 	                           BRICKLET_RPI_HAT_ZERO_MASTER_CS,
@@ -301,79 +707,120 @@ int bricklet_init(void) {
 	                           true);
 
 	if(rc < 0) {
-		return -1;
+		goto cleanup;
 	} else if(rc == 0) {
-		return 0;
+		phase = 4;
+
+		goto cleanup;
 	}
 
 	// If there is no HAT we try to read the SPI configuration from the config
-	for(uint8_t i = 0; i < BRICKLET_SPI_MAX_NUM; i++) {
-		memset(&config, 0, sizeof(config));
+	if(bricklet_init_config(&conf_file) < 0) {
+		goto cleanup;
+	}
 
-		config.mutex = &_bricklet_spi_mutex[i],
-		config.connected_uid = &bricklet_connected_uid,
-		config.startup_wait_time = 0,
+	phase = 4;
 
-		str_spidev[BRICKLET_CONFIG_STR_GROUP_POS] = '0' + i;
-		length = strlen(config_get_option_value(str_spidev)->string);
+cleanup:
+	switch(phase) { // no breaks, all cases fall through intentionally
+	case 3:
+		array_destroy(&_bricklet_stacks, (ItemDestroyFunction)bricklet_stack_exit);
+		// fall through
 
-		if(length == 0) {
-			continue;
-		}
+	case 2:
+		array_destroy(&_bricklet_spi_buses, (ItemDestroyFunction)bricklet_spi_bus_destroy);
+		// fall through
 
-		memcpy(config.spi_device, config_get_option_value(str_spidev)->string, length);
+	case 1:
+		conf_file_destroy(&conf_file);
+		// fall through
 
-		for(uint8_t cs = 0; cs < BRICKLET_CS_MAX_NUM; cs++) {
-			config.num = _bricklet_stack_num;
+	default:
+		break;
+	}
 
-			str_cs_driver[BRICKLET_CONFIG_STR_GROUP_POS] = '0' + i;
-			str_cs_driver[BRICKLET_CONFIG_STR_CS_POS]    = '0' + cs;
-			config.chip_select_driver = config_get_option_value(str_cs_driver)->symbol;
+	if(phase == 4) {
+		conf_file_destroy(&conf_file);
+	}
 
-			str_sleep_between_reads[13] = 'A' + cs;
-			config.sleep_between_reads = config_get_option_value(str_sleep_between_reads)->integer;
+	return phase == 4 ? 0 : -1;
+}
 
-			if(config.chip_select_driver == CHIP_SELECT_GPIO) {
-				str_cs_num[BRICKLET_CONFIG_STR_GROUP_POS] = '0' + i;
-				str_cs_num[BRICKLET_CONFIG_STR_CS_POS]    = '0' + cs;
-				config.chip_select_gpio_sysfs.num = config_get_option_value(str_cs_num)->integer;
+void bricklet_exit(void) {
+	array_destroy(&_bricklet_stacks, (ItemDestroyFunction)bricklet_stack_exit);
+	array_destroy(&_bricklet_spi_buses, (ItemDestroyFunction)bricklet_spi_bus_destroy);
+}
 
-				str_cs_name[BRICKLET_CONFIG_STR_GROUP_POS] = '0' + i;
-				str_cs_name[BRICKLET_CONFIG_STR_CS_POS]    = '0' + cs;
-				length = strlen(config_get_option_value(str_cs_name)->string);
+// Starts a new probe burst on all Bricklet stacks that have not found their
+// Bricklet yet. Has to be called from the event loop thread
+void bricklet_request_probe(void) {
+	int i;
 
-				if(length == 0) {
-					continue;
-				}
+	for(i = 0; i < _bricklet_stacks.count; i++) {
+		bricklet_stack_request_probe(array_get(&_bricklet_stacks, i));
+	}
+}
 
-				memset(config.chip_select_gpio_sysfs.name, 0, sizeof(config.chip_select_gpio_sysfs.name));
-				memcpy(config.chip_select_gpio_sysfs.name, config_get_option_value(str_cs_name)->string, length);
-			} else if(config.chip_select_driver != CHIP_SELECT_HARDWARE) {
-				continue;
-			}
+// Logs the usage of each spidev since the last call. A high share of empty
+// polls means that sleep_between_reads can be increased, a high busy or wait
+// time means that the spidev is the bottleneck
+void bricklet_log_statistics(void) {
+	BrickletSPIBus *spi_bus;
+	BrickletStackSPIStatistics current;
+	BrickletStack *bricklet_stack;
+	uint64_t discovery_duration;
+	uint32_t discovery_probes;
+	uint32_t discovery_bursts;
+	bool known_empty;
+	uint64_t now;
+	uint64_t elapsed;
+	uint64_t transfers;
+	uint64_t empty_polls;
+	int i;
+
+	for(i = 0; i < _bricklet_spi_buses.count; i++) {
+		spi_bus = array_get(&_bricklet_spi_buses, i);
+
+		mutex_lock(&spi_bus->mutex);
+		memcpy(&current, &spi_bus->statistics, sizeof(current));
+		spi_bus->statistics.max_time_waited = 0;
+		mutex_unlock(&spi_bus->mutex);
+
+		now = microseconds();
+		elapsed = MAX(now - spi_bus->last_logged, 1);
+		transfers = current.transfers - spi_bus->last_statistics.transfers;
+		empty_polls = current.empty_polls - spi_bus->last_statistics.empty_polls;
+
+		log_info("SPI statistics for %s (transfers: %.1f/s, empty polls: %.1f%%, busy: %.1f%%, waited: %.1f%%, max wait: %"PRIu64" us)",
+		         spi_bus->spi_device,
+		         transfers * 1000000.0 / elapsed,
+		         transfers > 0 ? empty_polls * 100.0 / transfers : 0.0,
+		         (current.time_held - spi_bus->last_statistics.time_held) * 100.0 / elapsed,
+		         (current.time_waited - spi_bus->last_statistics.time_waited) * 100.0 / elapsed,
+		         current.max_time_waited);
+
+		memcpy(&spi_bus->last_statistics, &current, sizeof(current));
+		spi_bus->last_logged = now;
+	}
 
-			log_debug("Bricklet found: spidev %s, driver %d, name %s (num %d)",
-			          config.spi_device,
-			          config.chip_select_driver,
-			          config.chip_select_gpio_sysfs.name,
-			          config.chip_select_gpio_sysfs.num);
+	for(i = 0; i < _bricklet_stacks.count; i++) {
+		bricklet_stack = array_get(&_bricklet_stacks, i);
 
-			if(bricklet_stack_init(&_bricklet_stack[_bricklet_stack_num], &config) < 0) {
-				return -1;
-			}
+		mutex_lock(&bricklet_stack->request_queue_mutex);
+		discovery_duration = bricklet_stack->discovery_duration;
+		discovery_probes = bricklet_stack->discovery_probes;
+		discovery_bursts = bricklet_stack->discovery_bursts;
+		known_empty = bricklet_stack->known_empty;
+		mutex_unlock(&bricklet_stack->request_queue_mutex);
 
-			_bricklet_stack_num++;
+		if(discovery_duration > 0) {
+			log_info("Discovery statistics for position '%c' on %s (found after: %"PRIu64" ms, probes: %u, bursts: %u)",
+			         'a' + bricklet_stack->config.num, bricklet_stack->config.spi_device,
+			         discovery_duration / 1000, discovery_probes, discovery_bursts);
+		} else {
+			log_info("Discovery statistics for position '%c' on %s (%s, probes: %u, bursts: %u)",
+			         'a' + bricklet_stack->config.num, bricklet_stack->config.spi_device,
+			         known_empty ? "empty" : "probing", discovery_probes, discovery_bursts);
 		}
 	}
-
-	return 0;
-}
-
-void bricklet_exit(void) {
-	for(int i = 0; i < _bricklet_stack_num; i++) {
-		bricklet_stack_exit(&_bricklet_stack[i]);
-	}
-
-	mutex_destroy(&_bricklet_spi_mutex[0]);
-	mutex_destroy(&_bricklet_spi_mutex[1]);
 }
@@ -29,7 +29,11 @@ typedef enum {
 	BRICKLET_CHIP_SELECT_DRIVER_WIRINGPI,
 } BrickletChipSelectDriver;
 
-int bricklet_init(void);
+int bricklet_init(const char *config_filename);
 void bricklet_exit(void);
 
+void bricklet_request_probe(void);
+
+void bricklet_log_statistics(void);
+
 #endif // BRICKD_BRICKLET_H
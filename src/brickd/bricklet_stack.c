@@ -31,10 +31,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
-#include <sys/eventfd.h>
 #include <math.h>
 #include <time.h>
 #include <inttypes.h>
@@ -49,8 +50,11 @@
 #include <daemonlib/pearson_hash.h>
 #include <daemonlib/pipe.h>
 
+#include "bricklet.h"
+#include "completion_queue.h"
 #include "hardware.h"
 #include "network.h"
+#include "purge.h"
 
 #define BRICKLET_STACK_SPI_CONFIG_MODE           SPI_MODE_3
 #define BRICKLET_STACK_SPI_CONFIG_LSB_FIRST      0
@@ -70,26 +74,72 @@ typedef enum {
 	SPITFP_STATE_MESSAGE_CHECKSUM
 } SPITFPState;
 
+typedef struct {
+	Packet packet;
+	PurgeTag tag;
+} BrickletStackQueuedRequest;
+
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 static char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
+// Has to be called with the request queue mutex locked
+static Packet *bricklet_stack_get_queue_head(BrickletStack *bricklet_stack) {
+	BrickletStackQueuedRequest *queued_request = queue_peek(&bricklet_stack->request_queue);
+
+	return queued_request != NULL ? &queued_request->packet : NULL;
+}
+
+// Replaces an older request queued for the same UID and function ID, if
+// squashing is enabled for them. The SPI thread might be sending the request
+// at the head of the queue, that one is kept. Has to be called with the
+// request queue mutex locked
+static bool bricklet_stack_squash_request(BrickletStack *bricklet_stack, Packet *request) {
+	Packet *replaced_request = squash_index_replace(&bricklet_stack->squash_index, request,
+	                                                bricklet_stack_get_queue_head(bricklet_stack));
+
+	if (replaced_request == NULL) {
+		return false;
+	}
+
+	purge_tag(&containerof(replaced_request, BrickletStackQueuedRequest, packet)->tag);
+
+	return true;
+}
+
 // New packet from brickd event loop is queued to be written to BrickletStack via SPI
 static int bricklet_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipient *recipient) {
 	BrickletStack *bricklet_stack = (BrickletStack*)stack;
-	Packet *queued_request;
+	BrickletStackQueuedRequest *queued_request;
 
 	if((request->header.uid != 0) && (recipient == NULL)) {
 		return 0;
 	}
 
 	if (!bricklet_stack->data_seen) {
+		// A client is looking for devices, probe again if the port is empty
+		if (request->header.function_id == FUNCTION_ENUMERATE) {
+			bricklet_stack_request_probe(bricklet_stack);
+		}
+
 		return 0;
 	}
 
 	mutex_lock(&bricklet_stack->request_queue_mutex);
+
+	if (bricklet_stack_squash_request(bricklet_stack, request)) {
+		mutex_unlock(&bricklet_stack->request_queue_mutex);
+
+		log_packet_debug("Replaced older queued request with request (%s)",
+		                 packet_get_request_signature(packet_signature, request));
+
+		return 0;
+	}
+
 	queued_request = queue_push(&bricklet_stack->request_queue);
-	memcpy(queued_request, request, request->header.length);
+	memcpy(&queued_request->packet, request, request->header.length);
+	purge_tag(&queued_request->tag);
+	squash_index_add(&bricklet_stack->squash_index, &queued_request->packet);
 	mutex_unlock(&bricklet_stack->request_queue_mutex);
 
 	log_packet_debug("Packet is queued to be send over SPI (%s)",
@@ -98,76 +148,114 @@ static int bricklet_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipie
 	return 0;
 }
 
-// New packet from BrickletStack is send into brickd event loop
-static void bricklet_stack_dispatch_from_spi(void *opaque) {
-	BrickletStack *bricklet_stack = opaque;
+// Several packets from one client read are queued with a single lock, so the
+// SPI thread can send them back-to-back. Returns the number of packets that
+// were queued (or squashed), if queuing fails the remaining packets are left
+// to the caller
+static int bricklet_stack_dispatch_batch_to_spi(Stack *stack, Packet **requests,
+                                                Recipient **recipients, int count) {
+	BrickletStack *bricklet_stack = (BrickletStack*)stack;
+	BrickletStackQueuedRequest *queued_request;
 	int i;
-	eventfd_t ev;
-	Packet *packet;
-
-	// handle at most 5 queued responses at once to avoid blocking the event
-	// loop for too long
-	for (i = 0; i < 5; ++i) {
-		if (eventfd_read(bricklet_stack->notification_event, &ev) < 0) {
-			if (errno_would_block()) {
-				return; // no queue responses left
-			}
 
-			log_error("Could not read from SPI notification event: %s (%d)",
-			          get_errno_name(errno), errno);
+	(void)recipients; // only requests with known recipient are in the batch
 
-			return;
+	if (!bricklet_stack->data_seen) {
+		return count;
+	}
+
+	mutex_lock(&bricklet_stack->request_queue_mutex);
+
+	for (i = 0; i < count; ++i) {
+		if (bricklet_stack_squash_request(bricklet_stack, requests[i])) {
+			continue;
 		}
 
-		mutex_lock(&bricklet_stack->response_queue_mutex);
-		packet = queue_peek(&bricklet_stack->response_queue);
-		mutex_unlock(&bricklet_stack->response_queue_mutex);
+		queued_request = queue_push(&bricklet_stack->request_queue);
 
-		if (packet == NULL) { // eventfd indicates a response but queue is empty
-			log_error("Response queue and notification event are out-of-sync");
+		if (queued_request == NULL) {
+			log_error("Could not queue request to be send over SPI, %d of %d packet(s) left unqueued: %s (%d)",
+			          count - i, count, get_errno_name(errno), errno);
 
-			return;
+			break;
 		}
 
-		// Update routing table (this is necessary for Co-MCU Bricklets)
-		if (packet->header.function_id == CALLBACK_ENUMERATE) {
-			stack_add_recipient(&bricklet_stack->base, packet->header.uid, 0);
-		}
+		memcpy(&queued_request->packet, requests[i], requests[i]->header.length);
+		purge_tag(&queued_request->tag);
+		squash_index_add(&bricklet_stack->squash_index, &queued_request->packet);
+	}
 
-		if ((packet->header.function_id == CALLBACK_ENUMERATE) ||
-		    (packet->header.function_id == FUNCTION_GET_IDENTITY)) {
-			EnumerateCallback *ec = (EnumerateCallback*)packet;
+	mutex_unlock(&bricklet_stack->request_queue_mutex);
 
-			// If the Bricklet is a HAT Brick (ID 111) or HAT Zero Brick (ID 112)
-			// we update the connected_uid.
-			if((ec->device_identifier == 111) || (ec->device_identifier == 112)) {
-				*bricklet_stack->config.connected_uid = ec->header.uid;
-			}
+	log_packet_debug("%d packet(s) are queued to be send over SPI", i);
 
-			// If the Bricklet is connected to an isolator we don't have to
-			// update the position and the connected UID. this is already
-			// done by the isolator itself.
-			if(ec->position != 'Z' || ec->connected_uid[0] == '\0') {
-				memcpy(ec->connected_uid, PACKET_NO_CONNECTED_UID_STR, PACKET_NO_CONNECTED_UID_STR_LENGTH);
+	return i;
+}
 
-				if((*bricklet_stack->config.connected_uid != 0) && (ec->device_identifier != 111) && (ec->device_identifier != 112)) {
-					char base58[BASE58_MAX_LENGTH];
-					base58_encode(base58, uint32_from_le(*bricklet_stack->config.connected_uid));
-					strncpy(ec->connected_uid, base58, BASE58_MAX_LENGTH);
-				}
+// New packet from BrickletStack is send into brickd event loop
+static void bricklet_stack_handle_response(Stack *stack, Packet *packet, uint32_t opaque) {
+	BrickletStack *bricklet_stack = containerof(stack, BrickletStack, base);
+	uint64_t discovery_duration;
+	uint32_t discovery_probes;
+	bool known_empty;
 
-				ec->position = 'a' + bricklet_stack->config.num;
+	(void)opaque;
+
+	// Update routing table (this is necessary for Co-MCU Bricklets)
+	if (packet->header.function_id == CALLBACK_ENUMERATE) {
+		stack_add_recipient(&bricklet_stack->base, packet->header.uid, 0);
+	}
+
+	if ((packet->header.function_id == CALLBACK_ENUMERATE) ||
+	    (packet->header.function_id == FUNCTION_GET_IDENTITY)) {
+		EnumerateCallback *ec = (EnumerateCallback*)packet;
+
+		// If the Bricklet is a HAT Brick (ID 111) or HAT Zero Brick (ID 112)
+		// we update the connected_uid.
+		if((ec->device_identifier == 111) || (ec->device_identifier == 112)) {
+			*bricklet_stack->config.connected_uid = ec->header.uid;
+		}
+
+		// If the Bricklet is connected to an isolator we don't have to
+		// update the position and the connected UID. this is already
+		// done by the isolator itself.
+		if(ec->position != 'Z' || ec->connected_uid[0] == '\0') {
+			memcpy(ec->connected_uid, PACKET_NO_CONNECTED_UID_STR, PACKET_NO_CONNECTED_UID_STR_LENGTH);
+
+			if((*bricklet_stack->config.connected_uid != 0) && (ec->device_identifier != 111) && (ec->device_identifier != 112)) {
+				char base58[BASE58_MAX_LENGTH];
+				base58_encode(base58, uint32_from_le(*bricklet_stack->config.connected_uid));
+				strncpy(ec->connected_uid, base58, BASE58_MAX_LENGTH);
 			}
+
+			ec->position = 'a' + bricklet_stack->config.num;
 		}
+	}
+
+	if (!bricklet_stack->data_seen) {
+		mutex_lock(&bricklet_stack->request_queue_mutex);
+
+		bricklet_stack->discovery_duration = MAX(microseconds() - bricklet_stack->discovery_started, 1);
+		discovery_duration = bricklet_stack->discovery_duration;
+		discovery_probes = bricklet_stack->discovery_probes;
+		known_empty = bricklet_stack->known_empty;
+
+		mutex_unlock(&bricklet_stack->request_queue_mutex);
+
+		log_info("Found Bricklet at position '%c' on %s after %"PRIu64" ms (%u probe(s)%s)",
+		         'a' + bricklet_stack->config.num, bricklet_stack->config.spi_device,
+		         discovery_duration / 1000, discovery_probes,
+		         known_empty ? ", was known empty" : "");
 
-		// Send message into brickd dispatcher
-		network_dispatch_response(packet);
 		bricklet_stack->data_seen = true;
 
-		mutex_lock(&bricklet_stack->response_queue_mutex);
-		queue_pop(&bricklet_stack->response_queue, NULL);
-		mutex_unlock(&bricklet_stack->response_queue_mutex);
+		// Bricklets that boot late typically boot together, so all other
+		// Bricklet stacks that are still empty are probed again
+		bricklet_request_probe();
 	}
+
+	// Send message into brickd dispatcher
+	network_dispatch_response(packet);
 }
 
 static bool bricklet_stack_is_time_elapsed_ms(const uint64_t start_measurement, const uint64_t time_to_be_elapsed) {
@@ -272,13 +360,25 @@ static void bricklet_stack_check_request_queue(BrickletStack *bricklet_stack) {
 	}
 
 	mutex_lock(&bricklet_stack->request_queue_mutex);
-	Packet *request = queue_peek(&bricklet_stack->request_queue);
+	Packet *request = bricklet_stack_get_queue_head(bricklet_stack);
+
+	// Drop requests that became stale while waiting in the queue
+	while (request != NULL &&
+	       purge_is_stale(request, &containerof(request, BrickletStackQueuedRequest, packet)->tag,
+	                      bricklet_stack->base.name)) {
+		squash_index_remove(&bricklet_stack->squash_index, request);
+		queue_pop(&bricklet_stack->request_queue, NULL);
+
+		request = bricklet_stack_get_queue_head(bricklet_stack);
+	}
+
 	mutex_unlock(&bricklet_stack->request_queue_mutex);
 
 	if(request != NULL) {
 		bricklet_stack_send_ack_and_message(bricklet_stack, (uint8_t*)request, request->header.length);
 
 		mutex_lock(&bricklet_stack->request_queue_mutex);
+		squash_index_remove(&bricklet_stack->squash_index, request);
 		queue_pop(&bricklet_stack->request_queue, NULL);
 		mutex_unlock(&bricklet_stack->request_queue_mutex);
 	}
@@ -291,22 +391,8 @@ static void bricklet_stack_handle_protocol_error(BrickletStack *bricklet_stack)
 }
 
 static bool bricklet_stack_handle_message_from_bricklet(BrickletStack *bricklet_stack, uint8_t *data, const uint8_t length) {
-	Packet *queued_response;
-	eventfd_t ev = 1;
-
-	mutex_lock(&bricklet_stack->response_queue_mutex);
-	queued_response = queue_push(&bricklet_stack->response_queue);
-	memcpy(queued_response, data, length);
-	mutex_unlock(&bricklet_stack->response_queue_mutex);
-
-	if (eventfd_write(bricklet_stack->notification_event, ev) < 0) {
-		log_error("Could not write to Bricklet stack SPI notification event: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		return false;
-	}
-
-	return true;
+	return completion_queue_post(&bricklet_stack->base, bricklet_stack_handle_response,
+	                             (Packet *)data, length, 0) >= 0;
 }
 
 static void bricklet_stack_send_ack(BrickletStack *bricklet_stack) {
@@ -532,17 +618,96 @@ static void bricklet_stack_check_message(BrickletStack *bricklet_stack) {
 	}
 }
 
+static void bricklet_stack_send_stack_enumerate(BrickletStack *bricklet_stack) {
+	// The "StackEnumerate"-Packet triggers an initial enumeration in the Bricklet.
+	PacketHeader header = {
+		.uid                         = 0,
+		.length                      = sizeof(PacketHeader),
+		.function_id                 = FUNCTION_STACK_ENUMERATE,
+		.sequence_number_and_options = 0x08, // return expected
+		.error_code_and_future_use   = 0
+	};
+
+	bricklet_stack_send_ack_and_message(bricklet_stack, (uint8_t*)&header, sizeof(PacketHeader));
+
+	bricklet_stack->wait_for_ack = false;
+}
+
+static void bricklet_stack_start_probe_burst(BrickletStack *bricklet_stack, const uint32_t tries) {
+	bricklet_stack->first_message_tries = 0;
+	bricklet_stack->probe_burst_tries = tries;
+	bricklet_stack->probe_backoff = BRICKLET_STACK_PROBE_BACKOFF_MIN;
+
+	mutex_lock(&bricklet_stack->request_queue_mutex);
+	bricklet_stack->discovery_bursts++;
+	mutex_unlock(&bricklet_stack->request_queue_mutex);
+
+	bricklet_stack_send_stack_enumerate(bricklet_stack);
+}
+
+// As long as we have not seen any data from the Bricklet we send the initial
+// message every 1ms for a burst of tries. If the burst ends without an answer
+// we assume that there is no Bricklet, mark the port as known empty and stop
+// sending the initial message (if a Bricklet is hotplugged it will send a
+// enumerate itself). A client enumerate request or another port finding its
+// Bricklet starts a new burst. For ports known to be empty this burst is short.
+static void bricklet_stack_check_probe(BrickletStack *bricklet_stack) {
+	eventfd_t ev;
+
+	// Reading the probe event also clears requests that arrive during a burst
+	if(eventfd_read(bricklet_stack->probe_event, &ev) == 0 &&
+	   bricklet_stack->first_message_tries >= bricklet_stack->probe_burst_tries) {
+		log_debug("Probing Bricklet stack %s (num %d) again",
+		          bricklet_stack->config.spi_device, bricklet_stack->config.num);
+
+		bricklet_stack_start_probe_burst(bricklet_stack, bricklet_stack->known_empty ?
+		                                 BRICKLET_STACK_REPROBE_MESSAGE_TRIES :
+		                                 BRICKLET_STACK_FIRST_MESSAGE_TRIES);
+	}
+
+	if(bricklet_stack->first_message_tries < bricklet_stack->probe_burst_tries) {
+		bricklet_stack->first_message_tries++;
+
+		return;
+	}
+
+	if(!bricklet_stack->known_empty) {
+		log_debug("No Bricklet found on %s (num %d) after %"PRIu64" ms (%u probe(s)), backing off",
+		          bricklet_stack->config.spi_device, bricklet_stack->config.num,
+		          (microseconds() - bricklet_stack->discovery_started) / 1000,
+		          bricklet_stack->discovery_probes);
+
+		mutex_lock(&bricklet_stack->request_queue_mutex);
+		bricklet_stack->known_empty = true;
+		mutex_unlock(&bricklet_stack->request_queue_mutex);
+	}
+
+	bricklet_stack->buffer_send_length = 0;
+}
+
+// Sleeps like microsleep, but wakes up as soon as a probe burst is requested
+static void bricklet_stack_wait_for_probe_request(BrickletStack *bricklet_stack, const uint32_t sleep_us) {
+	struct pollfd pollfd = {
+		.fd = bricklet_stack->probe_event,
+		.events = POLLIN,
+		.revents = 0
+	};
+
+	if(poll(&pollfd, 1, (sleep_us + 999) / 1000) < 0 && errno != EINTR) {
+		log_error("Could not wait for probe request: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		microsleep(sleep_us);
+	}
+}
+
 static void bricklet_stack_transceive(BrickletStack *bricklet_stack) {
-	// If we have not seen any data from the Bricklet we increase a counter.
-	// If the counter reaches BRICKLET_STACK_FIRST_MESSAGE_TRIES we assume that
-	// there is no Bricklet and we stop trying to send to initial message (if a
-	// Bricklet is hotplugged it will send a enumerate itself).
 	if(!bricklet_stack->data_seen) {
-		if(bricklet_stack->first_message_tries < BRICKLET_STACK_FIRST_MESSAGE_TRIES) {
-			bricklet_stack->first_message_tries++;
-		} else {
-			bricklet_stack->buffer_send_length = 0;
-		}
+		mutex_lock(&bricklet_stack->request_queue_mutex);
+		bricklet_stack->discovery_probes++;
+		mutex_unlock(&bricklet_stack->request_queue_mutex);
+
+		bricklet_stack_check_probe(bricklet_stack);
 	}
 
 	const uint16_t length_read = bricklet_stack_check_missing_length(bricklet_stack);
@@ -571,21 +736,28 @@ static void bricklet_stack_transceive(BrickletStack *bricklet_stack) {
 		uint32_t sleep_us = 0;
 
 		if(!bricklet_stack->data_seen) {
-			// If we have never seen any data, we will first poll every 1ms with the StackEnumerate message
-			// and switch to polling every 500ms after we tried BRICKLET_STACK_FIRST_MESSAGE_TRIES times.
-			// In this case there is likely no Bricklet connected. If a Bricklet is hotpluged "data_seen"
-			// will be true and we will switch to polling every 200us immediately.
-			if(bricklet_stack->first_message_tries < BRICKLET_STACK_FIRST_MESSAGE_TRIES) {
+			// If we have never seen any data, we will poll every 1ms with the StackEnumerate message
+			// during a probe burst. After the burst there is likely no Bricklet connected and we poll
+			// with exponential backoff from 10ms up to 500ms, so that a Bricklet that boots late is
+			// still found quickly. A probe request ends the backoff right away. If a Bricklet is
+			// hotpluged "data_seen" will be true and we will switch to polling every 200us immediately.
+			if(bricklet_stack->first_message_tries < bricklet_stack->probe_burst_tries) {
 				sleep_us = 1000;
 			} else {
-				sleep_us = 500000;
+				sleep_us = bricklet_stack->probe_backoff;
+				bricklet_stack->probe_backoff = MIN(bricklet_stack->probe_backoff * 2, BRICKLET_STACK_PROBE_BACKOFF_MAX);
 			}
 		}
 
 		// If we have nothing to send and we are currently not awaiting data from the Bricklet, we will
 		// poll every Xus (default is 200us).
 		sleep_us = MAX(bricklet_stack->config.sleep_between_reads, sleep_us);
-		microsleep(sleep_us);
+
+		if(!bricklet_stack->data_seen && bricklet_stack->first_message_tries >= bricklet_stack->probe_burst_tries) {
+			bricklet_stack_wait_for_probe_request(bricklet_stack, sleep_us);
+		} else {
+			microsleep(sleep_us);
+		}
 	}
 
 	memcpy(tx, bricklet_stack->buffer_send, length_write);
@@ -597,8 +769,12 @@ static void bricklet_stack_transceive(BrickletStack *bricklet_stack) {
 	};
 
 	// Make sure that we only access SPI once at a time
+	uint64_t lock_requested = microseconds();
+
 	mutex_lock(bricklet_stack->config.mutex);
 
+	uint64_t lock_acquired = microseconds();
+
 	// Do chip select by hand if necessary
 	if(bricklet_stack->config.chip_select_driver == CHIP_SELECT_GPIO) {
 		// Use direct write call on buffered fd to save some CPU time
@@ -609,6 +785,7 @@ static void bricklet_stack_transceive(BrickletStack *bricklet_stack) {
 	}
 
 	int rc = ioctl(bricklet_stack->spi_fd, SPI_IOC_MESSAGE(1), &spi_transfer);
+	bool empty_poll = (length == 1) && (rx[0] == 0) && (length_write == 0);
 
 	// If the length is 1 (i.e. we wanted to see if the SPI slave has data for us)
 	// and he does have data for us, we will immediately retrieve the data without
@@ -642,6 +819,18 @@ static void bricklet_stack_transceive(BrickletStack *bricklet_stack) {
 		}
 	}
 
+	BrickletStackSPIStatistics *statistics = bricklet_stack->config.spi_statistics;
+	uint64_t lock_released = microseconds();
+
+	statistics->transfers++;
+	statistics->time_held += lock_released - lock_acquired;
+	statistics->time_waited += lock_acquired - lock_requested;
+	statistics->max_time_waited = MAX(statistics->max_time_waited, lock_acquired - lock_requested);
+
+	if(empty_poll) {
+		statistics->empty_polls++;
+	}
+
 	mutex_unlock(bricklet_stack->config.mutex);
 
 	if (rc < 0) {
@@ -677,19 +866,14 @@ static void bricklet_stack_spi_thread(void *opaque) {
 	millisleep(bricklet_stack->config.startup_wait_time);
 
 	// Pre-fill the send buffer with the "StackEnumerate"-Packet.
-	// This packet will trigger an initial enumeration in the Bricklet.
 	// If the Brick Daemon is restarted, we need to
 	// trigger the initial enumeration, since the Bricklet does not know
 	// that it has to enumerate itself again.
-	PacketHeader header = {
-		.uid                         = 0,
-		.length                      = sizeof(PacketHeader),
-		.function_id                 = FUNCTION_STACK_ENUMERATE,
-		.sequence_number_and_options = 0x08, // return expected
-		.error_code_and_future_use   = 0
-	};
+	mutex_lock(&bricklet_stack->request_queue_mutex);
+	bricklet_stack->discovery_started = microseconds();
+	mutex_unlock(&bricklet_stack->request_queue_mutex);
 
-	bricklet_stack_send_ack_and_message(bricklet_stack, (uint8_t*)&header, sizeof(PacketHeader));
+	bricklet_stack_start_probe_burst(bricklet_stack, BRICKLET_STACK_FIRST_MESSAGE_TRIES);
 
 	while (bricklet_stack->spi_thread_running) {
 		bricklet_stack_transceive(bricklet_stack);
@@ -791,6 +975,8 @@ int bricklet_stack_init(BrickletStack *bricklet_stack, BrickletStackConfig *conf
 		goto cleanup;
 	}
 
+	bricklet_stack->base.dispatch_request_batch = bricklet_stack_dispatch_batch_to_spi;
+
 	phase = 1;
 
 	// add to stacks array
@@ -800,74 +986,67 @@ int bricklet_stack_init(BrickletStack *bricklet_stack, BrickletStackConfig *conf
 
 	phase = 2;
 
-	if ((bricklet_stack->notification_event = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE)) < 0) {
-		log_error("Could not create Bricklet notification event: %s (%d)",
-		          get_errno_name(errno), errno);
-
+	if (completion_queue_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 3;
 
-	// Add notification pipe as event source.
-	// Event is used to dispatch packets.
-	if (event_add_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC,
-	                     "bricklet-stack-notification", EVENT_READ,
-	                     bricklet_stack_dispatch_from_spi, bricklet_stack) < 0) {
-		log_error("Could not add Bricklet notification pipe as event source");
+	// Initialize SPI packet queues
+	if (queue_create(&bricklet_stack->request_queue, sizeof(BrickletStackQueuedRequest)) < 0) {
+		log_error("Could not create SPI request queue: %s (%d)",
+		          get_errno_name(errno), errno);
 
 		goto cleanup;
 	}
 
-	phase = 4;
-
-	// Initialize SPI packet queues
-	if (queue_create(&bricklet_stack->request_queue, sizeof(Packet)) < 0) {
-		log_error("Could not create SPI request queue: %s (%d)",
-		          get_errno_name(errno), errno);
+	if (squash_index_create(&bricklet_stack->squash_index) < 0) {
+		queue_destroy(&bricklet_stack->request_queue, NULL);
 
 		goto cleanup;
 	}
 
 	mutex_create(&bricklet_stack->request_queue_mutex);
 
-	phase = 5;
+	phase = 4;
 
-	if (queue_create(&bricklet_stack->response_queue, sizeof(Packet)) < 0) {
-		log_error("Could not create SPI response queue: %s (%d)",
+	bricklet_stack->probe_event = eventfd(0, EFD_NONBLOCK);
+
+	if (bricklet_stack->probe_event < 0) {
+		log_error("Could not create Bricklet stack probe event: %s (%d)",
 		          get_errno_name(errno), errno);
 
 		goto cleanup;
 	}
 
-	mutex_create(&bricklet_stack->response_queue_mutex);
+	bricklet_stack->known_empty = false;
+	bricklet_stack->discovery_started = 0;
+	bricklet_stack->discovery_duration = 0;
+	bricklet_stack->discovery_probes = 0;
+	bricklet_stack->discovery_bursts = 0;
 
-	phase = 6;
+	phase = 5;
 
 	if (bricklet_stack_init_spi(bricklet_stack) < 0) {
 		goto cleanup;
 	}
 
-	phase = 7;
+	phase = 6;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 6:
-		mutex_destroy(&bricklet_stack->response_queue_mutex);
-		queue_destroy(&bricklet_stack->response_queue, NULL);
-		// fall through
-
 	case 5:
-		mutex_destroy(&bricklet_stack->request_queue_mutex);
-		queue_destroy(&bricklet_stack->request_queue, NULL);
+		robust_close(bricklet_stack->probe_event);
 		// fall through
 
 	case 4:
-		event_remove_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC);
+		mutex_destroy(&bricklet_stack->request_queue_mutex);
+		squash_index_destroy(&bricklet_stack->squash_index);
+		queue_destroy(&bricklet_stack->request_queue, NULL);
 		// fall through
 
 	case 3:
-		robust_close(bricklet_stack->notification_event);
+		completion_queue_exit();
 		// fall through
 
 	case 2:
@@ -882,32 +1061,48 @@ cleanup:
 		break;
 	}
 
-	return phase == 7 ? 0 : -1;
+	return phase == 6 ? 0 : -1;
 }
 
 void bricklet_stack_exit(BrickletStack *bricklet_stack) {
-	// Remove event as possible poll source
-	event_remove_source(bricklet_stack->notification_event, EVENT_SOURCE_TYPE_GENERIC);
-
 	// Make sure that Thread shuts down properly
 	if (bricklet_stack->spi_thread_running) {
 		bricklet_stack->spi_thread_running = false;
 
+		// Wake up the SPI thread if it is backing off
+		eventfd_write(bricklet_stack->probe_event, 1);
+
 		thread_join(&bricklet_stack->spi_thread);
 		thread_destroy(&bricklet_stack->spi_thread);
 	}
 
+	// the SPI thread is gone, drop its responses that were not handled yet
+	completion_queue_remove_stack(&bricklet_stack->base);
+	completion_queue_exit();
+
 	hardware_remove_stack(&bricklet_stack->base);
 	stack_destroy(&bricklet_stack->base);
 
+	squash_index_destroy(&bricklet_stack->squash_index);
 	queue_destroy(&bricklet_stack->request_queue, NULL);
 	mutex_destroy(&bricklet_stack->request_queue_mutex);
 
-	queue_destroy(&bricklet_stack->response_queue, NULL);
-	mutex_destroy(&bricklet_stack->response_queue_mutex);
-
 	// Close file descriptors
-	robust_close(bricklet_stack->notification_event);
+	robust_close(bricklet_stack->probe_event);
 	robust_close(bricklet_stack->spi_fd);
 	robust_close(bricklet_stack->config.chip_select_gpio_fd);
 }
+
+// Starts a new probe burst if no Bricklet was found yet. Has to be called
+// from the event loop thread
+void bricklet_stack_request_probe(BrickletStack *bricklet_stack) {
+	if (bricklet_stack->data_seen) {
+		return;
+	}
+
+	if (eventfd_write(bricklet_stack->probe_event, 1) < 0) {
+		log_error("Could not request probe of Bricklet stack %s (num %d): %s (%d)",
+		          bricklet_stack->config.spi_device, bricklet_stack->config.num,
+		          get_errno_name(errno), errno);
+	}
+}
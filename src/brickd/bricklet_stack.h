@@ -32,12 +32,21 @@
 #include <daemonlib/ringbuffer.h>
 #include <daemonlib/gpio_sysfs.h>
 
+#include "squash.h"
 #include "stack.h"
 
 #define BRICKLET_STACK_SPI_RECEIVE_BUFFER_LENGTH 1024 // keep as power of 2
 #define BRICKLET_STACK_SPI_RECEIVE_BUFFER_MASK   (BRICKLET_STACK_SPI_RECEIVE_BUFFER_LENGTH-1)
 
+// The position of a Bricklet stack in its enumerate callback is 'a' + num,
+// so there can be at most 26 of them (positions a to z)
+#define BRICKLET_STACK_MAX_COUNT 26
+
 #define BRICKLET_STACK_FIRST_MESSAGE_TRIES 1000
+#define BRICKLET_STACK_REPROBE_MESSAGE_TRIES 50
+
+#define BRICKLET_STACK_PROBE_BACKOFF_MIN 10000 // in microseconds
+#define BRICKLET_STACK_PROBE_BACKOFF_MAX 500000 // in microseconds
 
 #define TFP_MESSAGE_MIN_LENGTH 8
 #define TFP_MESSAGE_MAX_LENGTH 80
@@ -55,6 +64,16 @@ typedef enum {
 	CHIP_SELECT_WIRINGPI // TODO
 } BrickletStackChipSelectDriver;
 
+// Usage of one spidev, shared by all Bricklet stacks on it. Only accessed
+// while holding the mutex of the spidev.
+typedef struct {
+	uint64_t transfers;
+	uint64_t empty_polls; // 1 byte poll without data in either direction
+	uint64_t time_held; // in microseconds
+	uint64_t time_waited; // in microseconds
+	uint64_t max_time_waited; // in microseconds
+} BrickletStackSPIStatistics;
+
 typedef struct {
     char spi_device[64]; // e.g. "/dev/spidev0.0";
 	int mode;
@@ -69,6 +88,7 @@ typedef struct {
 	// One mutex per spidev, so that we can use several SPI hardware units in parallel.
 	// Has to be properly managed during initialization.
 	Mutex *mutex;
+	BrickletStackSPIStatistics *spi_statistics;
 
 	uint32_t *connected_uid;
 	uint8_t num;
@@ -80,12 +100,9 @@ typedef struct {
 	Stack base;
 
 	Queue request_queue;
-	Mutex request_queue_mutex;
-
-	Queue response_queue;
-	Mutex response_queue_mutex;
+	Mutex request_queue_mutex; // protects request_queue, squash_index and the discovery statistics
+	SquashIndex squash_index;
 
-	int notification_event;
 	int spi_fd;
 	bool spi_thread_running;
 	Thread spi_thread;
@@ -116,10 +133,28 @@ typedef struct {
 	uint32_t error_count_frame;
 	uint32_t error_count_overflow;
 
+	// Discovery related variables. As long as no data was seen the port is
+	// probed in bursts, between bursts it is polled with exponential backoff.
+	// These are only used by the SPI thread
 	uint32_t first_message_tries;
+	uint32_t probe_burst_tries;
+	uint32_t probe_backoff;
+
+	// Written by the event loop thread to start a new probe burst, also wakes
+	// up the SPI thread while it is backing off
+	int probe_event;
+
+	// Discovery statistics, protected by request_queue_mutex
+	bool known_empty;
+	uint64_t discovery_started;
+	uint64_t discovery_duration; // in microseconds, 0 until the Bricklet answered
+	uint32_t discovery_probes;
+	uint32_t discovery_bursts;
 } BrickletStack;
 
 int bricklet_stack_init(BrickletStack *bricklet_stack, BrickletStackConfig *config);
 void bricklet_stack_exit(BrickletStack *bricklet_stack);
 
+void bricklet_stack_request_probe(BrickletStack *bricklet_stack);
+
 #endif // BRICKD_BRICKLET_STACK_H
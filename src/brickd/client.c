@@ -32,12 +32,15 @@
 
 #include "client.h"
 
+#include "flash_job.h"
 #include "hardware.h"
 #include "hmac.h"
 #include "network.h"
+#include "purge.h"
 #ifdef BRICKD_WITH_RED_BRICK
 	#include "red_usb_gadget.h"
 #endif
+#include "session.h"
 #include "zombie.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -46,6 +49,8 @@ extern uint8_t _redapid_version[3];
 
 #define UID_BRICK_DAEMON 1
 
+static uint32_t _next_id = 1;
+
 static void client_handle_get_authentication_nonce_request(Client *client,
                                                            GetAuthenticationNonceRequest *request) {
 	union {
@@ -165,7 +170,140 @@ static void client_handle_authenticate_request(Client *client,
 	}
 }
 
-static void client_handle_request(Client *client, Packet *request) {
+static void client_handle_get_session_token_request(Client *client,
+                                                    GetSessionTokenRequest *request) {
+	uint32_t lifetime;
+	union {
+		GetSessionTokenResponse response;
+		Packet packet;
+	} u;
+
+	if (client->authentication_state != CLIENT_AUTHENTICATION_STATE_DONE) {
+		log_error("Client ("CLIENT_SIGNATURE_FORMAT") requested a session token without being authenticated, disconnecting client",
+		          client_expand_signature(client));
+
+		client->disconnected = true;
+
+		return;
+	}
+
+	// without a response the client would not get the token, so creating one
+	// would only use up an entry
+	if (!packet_header_get_response_expected(&request->header)) {
+		log_debug("Client ("CLIENT_SIGNATURE_FORMAT") requested a session token without response expected, ignoring request",
+		          client_expand_signature(client));
+
+		return;
+	}
+
+	u.response.header = request->header;
+	u.response.header.length = sizeof(u.response);
+	u.response.status = session_create_token(u.response.token, &lifetime);
+	u.response.lifetime = uint32_to_le(lifetime);
+
+	packet_header_set_error_code(&u.response.header, PACKET_E_SUCCESS);
+
+	log_debug("Created session token for client ("CLIENT_SIGNATURE_FORMAT"): %s",
+	          client_expand_signature(client),
+	          session_get_status_name(u.response.status));
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+	packet_add_trace(&u.packet);
+	client_dispatch_response(client, NULL, &u.packet, false, false);
+}
+
+// a resume request can be the first request of a connection. the client can
+// send its actual requests right after it, they are handled in order
+static void client_handle_resume_session_request(Client *client,
+                                                 ResumeSessionRequest *request) {
+	SessionStatus status;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	union {
+		ResumeSessionResponse response;
+		Packet packet;
+	} u;
+
+	if (client->authentication_state == CLIENT_AUTHENTICATION_STATE_DISABLED) {
+		log_error("Client ("CLIENT_SIGNATURE_FORMAT") tries to resume a session, but authentication is disabled, disconnecting client",
+		          client_expand_signature(client));
+
+		client->disconnected = true;
+
+		return;
+	}
+
+	// only a fresh connection can resume a session. an authentication that is
+	// in progress or done is not replaced or undone by a resume request
+	if (client->authentication_state != CLIENT_AUTHENTICATION_STATE_ENABLED) {
+		log_error("Client ("CLIENT_SIGNATURE_FORMAT") performed invalid authentication sequence (%s -> %s), disconnecting client",
+		          client_expand_signature(client),
+		          client_get_authentication_state_name(client->authentication_state),
+		          client_get_authentication_state_name(CLIENT_AUTHENTICATION_STATE_DONE));
+
+		client->disconnected = true;
+
+		return;
+	}
+
+	status = session_resume(request->token, uint32_from_le(request->counter),
+	                        request->digest);
+
+	if (status == SESSION_STATUS_INVALID) {
+		log_error("Resume session request (%s) from client ("CLIENT_SIGNATURE_FORMAT") did not contain the expected data, disconnecting client",
+		          packet_get_request_signature(packet_signature, (Packet *)request),
+		          client_expand_signature(client));
+
+		client->disconnected = true;
+
+		return;
+	}
+
+	if (status == SESSION_STATUS_OK) {
+		client->authentication_state = CLIENT_AUTHENTICATION_STATE_DONE;
+
+		log_info("Client ("CLIENT_SIGNATURE_FORMAT") successfully resumed session",
+		         client_expand_signature(client));
+	} else {
+		// expired and replayed tokens are not fatal, the state stays unchanged
+		// and the client can still do the full authentication handshake on
+		// this connection
+		log_warn("Client ("CLIENT_SIGNATURE_FORMAT") could not resume session: %s",
+		         client_expand_signature(client), session_get_status_name(status));
+	}
+
+	if (packet_header_get_response_expected(&request->header)) {
+		u.response.header = request->header;
+		u.response.header.length = sizeof(u.response);
+		u.response.status = status;
+
+		packet_header_set_error_code(&u.response.header, PACKET_E_SUCCESS);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+		u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+		packet_add_trace(&u.packet);
+		client_dispatch_response(client, NULL, &u.packet, false, true);
+	}
+}
+
+static void client_flush_request_batch(Client *client, Packet *batch, int *batch_length) {
+	if (*batch_length > 0) {
+		purge_set_origin(client->id);
+		hardware_dispatch_request_batch(batch, *batch_length);
+		purge_set_origin(0);
+
+		*batch_length = 0;
+	}
+}
+
+// requests for the hardware are collected in the batch to be dispatched
+// together at the end of the current read
+static void client_handle_request(Client *client, Packet *request,
+                                  Packet *batch, int *batch_length) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	union {
 		EmptyResponse response;
@@ -176,6 +314,20 @@ static void client_handle_request(Client *client, Packet *request) {
 
 	// handle requests meant for brickd
 	if (uint32_from_le(request->header.uid) == UID_BRICK_DAEMON) {
+		// flash jobs send requests to the hardware, keep them in order
+		client_flush_request_batch(client, batch, batch_length);
+
+		// flash jobs talk to the hardware, only allow them after authentication
+		if (flash_job_is_function(request->header.function_id) &&
+		    client->authentication_state != CLIENT_AUTHENTICATION_STATE_DISABLED &&
+		    client->authentication_state != CLIENT_AUTHENTICATION_STATE_DONE) {
+			log_packet_debug("Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
+			                 client_expand_signature(client),
+			                 packet_get_request_signature(packet_signature, request));
+
+			return;
+		}
+
 		// add as pending request if response is expected
 		if (packet_header_get_response_expected(&request->header)) {
 			network_client_expects_response(client, request);
@@ -205,6 +357,50 @@ static void client_handle_request(Client *client, Packet *request) {
 			}
 
 			client_handle_authenticate_request(client, (AuthenticateRequest *)request);
+		} else if (request->header.function_id == FUNCTION_GET_SESSION_TOKEN) {
+			if (request->header.length != sizeof(GetSessionTokenRequest)) {
+				log_error("Received get-session-token request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_get_session_token_request(client, (GetSessionTokenRequest *)request);
+		} else if (request->header.function_id == FUNCTION_RESUME_SESSION) {
+			if (request->header.length != sizeof(ResumeSessionRequest)) {
+				log_error("Received resume-session request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_resume_session_request(client, (ResumeSessionRequest *)request);
+		} else if (flash_job_is_function(request->header.function_id)) {
+			if (client->flash_job == NULL) {
+				client->flash_job = malloc(sizeof(FlashJob));
+
+				if (client->flash_job == NULL) {
+					log_error("Could not allocate flash job: %s (%d)",
+					          get_errno_name(ENOMEM), ENOMEM);
+
+					return;
+				}
+
+				if (flash_job_create(client->flash_job, client) < 0) {
+					free(client->flash_job);
+					client->flash_job = NULL;
+
+					return;
+				}
+			}
+
+			flash_job_handle_request(client->flash_job, request);
 		} else if (packet_header_get_response_expected(&request->header)) {
 			u.response.header = request->header;
 			u.response.header.length = sizeof(u.response);
@@ -228,7 +424,24 @@ static void client_handle_request(Client *client, Packet *request) {
 
 		// ...then dispatch it to the hardware
 		packet_add_trace(request);
-		hardware_dispatch_request(request);
+
+		if (request->header.uid == 0) {
+			// broadcasts go to all stacks anyway, keep them in order
+			client_flush_request_batch(client, batch, batch_length);
+			purge_set_origin(client->id);
+			hardware_dispatch_request(request);
+			purge_set_origin(0);
+		} else {
+			memcpy(&batch[*batch_length], request, request->header.length);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+			batch[*batch_length].trace_id = request->trace_id;
+#endif
+
+			if (++*batch_length == STACK_MAX_BATCH_SIZE) {
+				client_flush_request_batch(client, batch, batch_length);
+			}
+		}
 	} else {
 		log_packet_debug("Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
 		                 client_expand_signature(client),
@@ -243,6 +456,8 @@ static void client_handle_read(void *opaque) {
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	Packet request;
+	Packet batch[STACK_MAX_BATCH_SIZE];
+	int batch_length = 0;
 
 	length = io_read(client->io, client->request_buffer + client->request_buffer_used,
 	                 sizeof(client->request_buffer) - client->request_buffer_used);
@@ -296,7 +511,7 @@ static void client_handle_read(void *opaque) {
 
 				client->disconnected = true;
 
-				return;
+				break;
 			}
 
 			client->request_header_checked = true;
@@ -323,7 +538,7 @@ static void client_handle_read(void *opaque) {
 			                 packet_get_request_signature(packet_signature, &request),
 			                 client_expand_signature(client));
 
-			client_handle_request(client, &request);
+			client_handle_request(client, &request, batch, &batch_length);
 		}
 
 		memmove(client->request_buffer, client->request_buffer + length, client->request_buffer_used - length);
@@ -331,6 +546,9 @@ static void client_handle_read(void *opaque) {
 		client->request_buffer_used -= length;
 		client->request_header_checked = false;
 	}
+
+	// requests received before a protocol error are still valid
+	client_flush_request_batch(client, batch, &batch_length);
 }
 
 void pending_request_remove_and_free(PendingRequest *pending_request) {
@@ -375,14 +593,101 @@ static void client_recipient_disconnect(void *opaque) {
 	client->disconnected = true;
 }
 
+// move held back callbacks to the response writer as long as its backlog is
+// short. if force_one is true then at least one callback is moved regardless
+// of the writer backlog, this bounds the starvation of callbacks
+static void client_move_callbacks_to_writer(Client *client, bool force_one) {
+	Packet *callback;
+
+	while (client->callback_backlog.count > 0 && !client->disconnected) {
+		if (!force_one &&
+		    client->response_writer.backlog.count >= CLIENT_MAX_WRITER_BACKLOG_FOR_CALLBACKS) {
+			break;
+		}
+
+		force_one = false;
+		callback = queue_peek(&client->callback_backlog);
+
+		if (writer_write(&client->response_writer, callback) < 0) {
+			break;
+		}
+
+		queue_pop(&client->callback_backlog, NULL);
+
+		client->responses_since_callback = 0;
+	}
+
+	if (client->disconnected) {
+		while (client->callback_backlog.count > 0) {
+			queue_pop(&client->callback_backlog, NULL);
+		}
+	}
+}
+
+// returns -1 on error, 0 if the callback was sent and 1 if it was enqueued
+static int client_write_callback(Client *client, Packet *callback) {
+	Packet *queued_callback;
+
+	if (client->callback_backlog.count == 0 &&
+	    client->response_writer.backlog.count < CLIENT_MAX_WRITER_BACKLOG_FOR_CALLBACKS) {
+		return writer_write(&client->response_writer, callback);
+	}
+
+	if (client->callback_backlog.count >= client->max_callback_backlog) {
+		if (client->dropped_callbacks == 0) {
+			log_warn("Callback backlog of client ("CLIENT_SIGNATURE_FORMAT") is full, dropping oldest callbacks",
+			         client_expand_signature(client));
+		}
+
+		queue_pop(&client->callback_backlog, NULL);
+
+		++client->dropped_callbacks;
+	}
+
+	queued_callback = queue_push(&client->callback_backlog);
+
+	if (queued_callback == NULL) {
+		log_error("Could not push to callback backlog of client ("CLIENT_SIGNATURE_FORMAT"): %s (%d)",
+		          client_expand_signature(client), get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	memcpy(queued_callback, callback, callback->header.length);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	queued_callback->trace_id = callback->trace_id;
+#endif
+
+	return 1;
+}
+
+// called at the end of each event loop iteration. while callbacks are held
+// back the response writer has a backlog and waits for the client to become
+// writable, so the held back callbacks are moved to the writer right after the
+// writer could write to the client
+void client_flush_callback_backlog(Client *client) {
+	if (client->callback_backlog.count > 0) {
+		client_move_callbacks_to_writer(client, false);
+	}
+}
+
 int client_create(Client *client, const char *name, IO *io,
                   uint32_t authentication_nonce,
                   ClientDestroyDoneFunction destroy_done) {
+	int phase = 0;
+
 	log_debug("Creating client from %s (handle: %d/%d)",
 	          io->type, io->read_handle, io->write_handle);
 
 	string_copy(client->name, sizeof(client->name), name, -1);
 
+	client->id = _next_id++;
+
+	if (_next_id == 0) {
+		_next_id = 1; // 0 means no client
+	}
+
 	client->io = io;
 	client->disconnected = false;
 	client->request_buffer_used = 0;
@@ -392,6 +697,12 @@ int client_create(Client *client, const char *name, IO *io,
 	client->authentication_state = CLIENT_AUTHENTICATION_STATE_DISABLED;
 	client->authentication_nonce = authentication_nonce;
 	client->destroy_done = destroy_done;
+	client->flash_job = NULL;
+	client->max_callback_backlog = config_get_option_value("callbacks.max_backlog")->integer;
+	client->responses_since_callback = 0;
+	client->dropped_callbacks = 0;
+	client->reading_paused = false;
+	client->dropped_responses_while_paused = 0;
 
 	if (config_get_option_value("authentication.secret")->string != NULL) {
 		client->authentication_state = CLIENT_AUTHENTICATION_STATE_ENABLED;
@@ -399,6 +710,16 @@ int client_create(Client *client, const char *name, IO *io,
 
 	node_reset(&client->pending_request_sentinel);
 
+	// create callback backlog
+	if (queue_create(&client->callback_backlog, sizeof(Packet)) < 0) {
+		log_error("Could not create callback backlog: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
 	// create response writer
 	if (writer_create(&client->response_writer, client->io,
 	                  "response", packet_get_response_signature,
@@ -407,18 +728,46 @@ int client_create(Client *client, const char *name, IO *io,
 		log_error("Could not create response writer: %s (%d)",
 		          get_errno_name(errno), errno);
 
-		return -1;
+		goto cleanup;
 	}
 
+	phase = 2;
+
 	// add I/O object as event source
-	return event_add_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC,
-	                        "client", EVENT_READ, client_handle_read, client);
+	if (event_add_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     "client", EVENT_READ, client_handle_read, client) < 0) {
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	purge_add_client(client->id);
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		writer_destroy(&client->response_writer);
+		// fall through
+
+	case 1:
+		queue_destroy(&client->callback_backlog, NULL);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 3 ? 0 : -1;
 }
 
 void client_destroy(Client *client) {
 	bool destroy_pending_requests = false;
 	PendingRequest *pending_request;
 
+	// queued requests with response expected of this client are dropped from
+	// now on, before they are written to a device
+	purge_remove_client(client->id);
+
 	if (client->pending_request_count > 0) {
 		log_warn("Destroying client ("CLIENT_SIGNATURE_FORMAT") while %d request(s) are still pending",
 		         client_expand_signature(client), client->pending_request_count);
@@ -431,6 +780,23 @@ void client_destroy(Client *client) {
 		}
 	}
 
+	if (client->flash_job != NULL) {
+		flash_job_destroy(client->flash_job);
+		free(client->flash_job);
+	}
+
+	if (client->callback_backlog.count > 0) {
+		log_debug("Dropping %d held back callback(s) of client ("CLIENT_SIGNATURE_FORMAT")",
+		          client->callback_backlog.count, client_expand_signature(client));
+	}
+
+	if (client->dropped_callbacks > 0) {
+		log_warn("Dropped %u callback(s) of client ("CLIENT_SIGNATURE_FORMAT") because of a full callback backlog",
+		         client->dropped_callbacks, client_expand_signature(client));
+	}
+
+	queue_destroy(&client->callback_backlog, NULL);
+
 	writer_destroy(&client->response_writer);
 
 	event_remove_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC);
@@ -450,6 +816,45 @@ void client_destroy(Client *client) {
 	}
 }
 
+// stop reading requests from the client until client_resume_reading is called.
+// used to apply backpressure if the client cannot take responses fast enough
+int client_pause_reading(Client *client) {
+	if (client->reading_paused) {
+		return 0;
+	}
+
+	if (event_modify_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                        EVENT_READ, 0, NULL, NULL) < 0) {
+		return -1;
+	}
+
+	client->reading_paused = true;
+
+	return 0;
+}
+
+int client_resume_reading(Client *client) {
+	if (!client->reading_paused) {
+		return 0;
+	}
+
+	if (event_modify_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                        0, EVENT_READ, client_handle_read, client) < 0) {
+		return -1;
+	}
+
+	client->reading_paused = false;
+
+	if (client->dropped_responses_while_paused > 0) {
+		log_warn("Dropped %u response(s) to client ("CLIENT_SIGNATURE_FORMAT") while reading was paused",
+		         client->dropped_responses_while_paused, client_expand_signature(client));
+
+		client->dropped_responses_while_paused = 0;
+	}
+
+	return 0;
+}
+
 void client_dispatch_response(Client *client, PendingRequest *pending_request,
                               Packet *response, bool force, bool ignore_authentication) {
 	Node *pending_request_client_node = NULL;
@@ -497,7 +902,30 @@ void client_dispatch_response(Client *client, PendingRequest *pending_request,
 	}
 
 	if (force || pending_request != NULL) {
-		enqueued = writer_write(&client->response_writer, response);
+		// the client cannot take responses and no new requests are read from
+		// it, don't let the writer backlog grow without bound meanwhile
+		if (client->reading_paused &&
+		    client->response_writer.backlog.count >= CLIENT_MAX_WRITER_BACKLOG_WHILE_PAUSED) {
+			++client->dropped_responses_while_paused;
+
+			log_packet_debug("Dropping response to paused client ("CLIENT_SIGNATURE_FORMAT"), writer backlog is full",
+			                 client_expand_signature(client));
+
+			goto cleanup;
+		}
+
+		if (pending_request == NULL &&
+		    packet_header_get_sequence_number(&response->header) == 0) {
+			// callbacks go behind responses
+			enqueued = client_write_callback(client, response);
+		} else {
+			if (client->callback_backlog.count > 0 &&
+			    ++client->responses_since_callback >= CLIENT_MAX_RESPONSES_PER_CALLBACK) {
+				client_move_callbacks_to_writer(client, true);
+			}
+
+			enqueued = writer_write(&client->response_writer, response);
+		}
 
 		if (enqueued < 0) {
 			goto cleanup;
@@ -34,13 +34,26 @@
 #include <daemonlib/io.h>
 #include <daemonlib/node.h>
 #include <daemonlib/packet.h>
+#include <daemonlib/queue.h>
 #include <daemonlib/writer.h>
 
 #define CLIENT_MAX_NAME_LENGTH 128
 #define CLIENT_MAX_PENDING_REQUESTS 32768
 
+// callbacks are held back in the client while the response writer has this
+// many packets queued, so responses don't have to wait behind a callback flood.
+// the number of held back callbacks is limited by the callbacks.max_backlog
+// option, if it is exceeded the oldest callbacks are dropped
+#define CLIENT_MAX_WRITER_BACKLOG_FOR_CALLBACKS 8
+// after this many responses one held back callback is written in any case
+#define CLIENT_MAX_RESPONSES_PER_CALLBACK 16
+// while reading requests is paused the response writer backlog is limited to
+// this many packets, further responses are dropped
+#define CLIENT_MAX_WRITER_BACKLOG_WHILE_PAUSED 256
+
 typedef struct _Client Client;
 typedef struct _Zombie Zombie;
+typedef struct _FlashJob FlashJob;
 
 typedef enum {
 	CLIENT_AUTHENTICATION_STATE_DISABLED = 0,
@@ -62,6 +75,7 @@ struct _PendingRequest {
 };
 
 struct _Client {
+	uint32_t id; // never 0
 	char name[CLIENT_MAX_NAME_LENGTH]; // for display purpose
 	IO *io;
 	bool disconnected;
@@ -75,9 +89,16 @@ struct _Client {
 	int pending_request_count;
 	uint32_t dropped_pending_requests;
 	Writer response_writer;
+	Queue callback_backlog;
+	int max_callback_backlog;
+	int responses_since_callback;
+	uint32_t dropped_callbacks;
+	bool reading_paused;
+	uint32_t dropped_responses_while_paused;
 	ClientAuthenticationState authentication_state;
 	uint32_t authentication_nonce; // server
 	ClientDestroyDoneFunction destroy_done;
+	FlashJob *flash_job; // created on first use
 };
 
 #define CLIENT_SIGNATURE_FORMAT "N: %s, T: %s, H: %d/%d, B: %d, P: %d, A: %s"
@@ -95,9 +116,14 @@ int client_create(Client *client, const char *name, IO *io,
                   ClientDestroyDoneFunction destroy_done);
 void client_destroy(Client *client);
 
+void client_flush_callback_backlog(Client *client);
+
 void client_dispatch_response(Client *client, PendingRequest *pending_request,
                               Packet *response, bool force, bool ignore_authentication);
 
+int client_pause_reading(Client *client);
+int client_resume_reading(Client *client);
+
 #ifdef BRICKD_WITH_RED_BRICK
 
 void client_send_red_brick_enumerate(Client *client, EnumerationType type);
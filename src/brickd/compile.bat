@@ -68,6 +68,7 @@
  config_options.c^
  event_winapi.c^
  fixes_msvc.c^
+ flash_job.c^
  hardware.c^
  hmac.c^
  log_winapi.c^
@@ -76,8 +77,13 @@
  mesh_stack.c^
  main_winapi.c^
  network.c^
+ purge.c^
+ resolver.c^
+ rules.c^
  service.c^
+ session.c^
  sha1.c^
+ squash.c^
  stack.c^
  usb.c^
  usb_stack.c^
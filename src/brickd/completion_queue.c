@@ -0,0 +1,362 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * completion_queue.c: Shared queue for packets from device threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the Bricklet stack threads and the RED Brick SPI stack thread post the
+ * packets they receive into one queue. the event loop thread is woken up by a
+ * single eventfd and drains the queue in batches. the eventfd is only written
+ * if the queue was empty before, so under load many packets from many threads
+ * are handled with one wakeup.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/macros.h>
+#include <daemonlib/queue.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "completion_queue.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+// packets taken from the queue per lock and handled per wakeup. handling is
+// limited to avoid blocking the event loop for too long
+#define COMPLETION_QUEUE_BATCH_SIZE 16
+#define COMPLETION_QUEUE_MAX_BATCHES_PER_WAKEUP 4
+
+typedef struct {
+	Stack *stack;
+	CompletionQueueHandleFunction handle;
+	uint32_t opaque;
+	uint64_t posted; // in microseconds
+	Packet packet;
+} CompletionQueueEntry;
+
+static int _users = 0;
+static int _notification_event = -1;
+static Queue _queue;
+static Mutex _mutex;
+static uint64_t _wakeups = 0;
+static uint64_t _packets = 0;
+static uint64_t _dropped = 0; // protected by _mutex
+
+// time from posting a packet until it is handled in the event loop thread,
+// this includes the wakeup of the event loop thread. only used in the event
+// loop thread
+static uint64_t _latency_total = 0; // in microseconds
+static uint64_t _latency_max = 0; // in microseconds, since the last log
+
+static void completion_queue_notify(void) {
+	eventfd_t ev = 1;
+
+	if (eventfd_write(_notification_event, ev) < 0) {
+		log_error("Could not write to completion queue notification event: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void completion_queue_handle_notification(void *opaque) {
+	eventfd_t ev;
+	CompletionQueueEntry batch[COMPLETION_QUEUE_BATCH_SIZE];
+	CompletionQueueEntry *entry;
+	int count;
+	int batches;
+	int i;
+	bool more = false;
+	uint64_t now;
+	uint64_t latency;
+
+	(void)opaque;
+
+	if (eventfd_read(_notification_event, &ev) < 0) {
+		if (errno_would_block()) {
+			return;
+		}
+
+		log_error("Could not read from completion queue notification event: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	++_wakeups;
+
+	for (batches = 0; batches < COMPLETION_QUEUE_MAX_BATCHES_PER_WAKEUP; ++batches) {
+		mutex_lock(&_mutex);
+
+		for (count = 0; count < COMPLETION_QUEUE_BATCH_SIZE; ++count) {
+			entry = queue_peek(&_queue);
+
+			if (entry == NULL) {
+				break;
+			}
+
+			memcpy(&batch[count], entry, sizeof(CompletionQueueEntry));
+			queue_pop(&_queue, NULL);
+		}
+
+		more = _queue.count > 0;
+
+		mutex_unlock(&_mutex);
+
+		now = microseconds();
+
+		for (i = 0; i < count; ++i) {
+			latency = now - batch[i].posted;
+			_latency_total += latency;
+			_latency_max = MAX(_latency_max, latency);
+
+			batch[i].handle(batch[i].stack, &batch[i].packet, batch[i].opaque);
+		}
+
+		_packets += count;
+
+		if (!more) {
+			break;
+		}
+	}
+
+	// producers only notify if the queue was empty, so a leftover has to be
+	// announced here to get handled in the next event loop iteration
+	if (more) {
+		completion_queue_notify();
+	}
+}
+
+int completion_queue_init(void) {
+	int phase = 0;
+
+	if (_users++ > 0) {
+		return 0;
+	}
+
+	log_debug("Initializing completion queue subsystem");
+
+	_notification_event = eventfd(0, EFD_NONBLOCK);
+
+	if (_notification_event < 0) {
+		log_error("Could not create completion queue notification event: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (queue_create(&_queue, sizeof(CompletionQueueEntry)) < 0) {
+		log_error("Could not create completion queue: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	mutex_create(&_mutex);
+
+	phase = 2;
+
+	if (event_add_source(_notification_event, EVENT_SOURCE_TYPE_GENERIC,
+	                     "completion-queue-notification", EVENT_READ,
+	                     completion_queue_handle_notification, NULL) < 0) {
+		log_error("Could not add completion queue notification event as event source");
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		mutex_destroy(&_mutex);
+		queue_destroy(&_queue, NULL);
+		// fall through
+
+	case 1:
+		robust_close(_notification_event);
+		// fall through
+
+	default:
+		break;
+	}
+
+	if (phase != 3) {
+		--_users;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void completion_queue_exit(void) {
+	if (_users <= 0 || --_users > 0) {
+		return;
+	}
+
+	log_debug("Shutting down completion queue subsystem, handled %"PRIu64" packet(s) in %"PRIu64" wakeup(s)",
+	          _packets, _wakeups);
+
+	event_remove_source(_notification_event, EVENT_SOURCE_TYPE_GENERIC);
+
+	if (_queue.count > 0) {
+		log_warn("Dropping %d packet(s) from completion queue", _queue.count);
+	}
+
+	queue_destroy(&_queue, NULL);
+	mutex_destroy(&_mutex);
+
+	robust_close(_notification_event);
+}
+
+// called from device threads. the length is the number of bytes that the
+// device thread received, a packet whose header disagrees with it is dropped.
+// returns 0 if the packet was queued or dropped, -1 on error
+int completion_queue_post(Stack *stack, CompletionQueueHandleFunction handle,
+                          Packet *packet, int length, uint32_t opaque) {
+	CompletionQueueEntry *entry;
+	bool was_empty;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (length < (int)sizeof(PacketHeader) || length > (int)sizeof(Packet) ||
+	    packet->header.length != length) {
+		mutex_lock(&_mutex);
+		++_dropped;
+		mutex_unlock(&_mutex);
+
+		log_error("Dropping packet (%s) from %s with invalid length (actual: %d, header: %d)",
+		          packet_get_response_signature(packet_signature, packet),
+		          stack->name, length, packet->header.length);
+
+		return 0;
+	}
+
+	mutex_lock(&_mutex);
+
+	was_empty = _queue.count == 0;
+	entry = queue_push(&_queue);
+
+	if (entry == NULL) {
+		mutex_unlock(&_mutex);
+
+		log_error("Could not push to completion queue: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	entry->stack = stack;
+	entry->handle = handle;
+	entry->opaque = opaque;
+	entry->posted = microseconds();
+
+	memcpy(&entry->packet, packet, length);
+
+	mutex_unlock(&_mutex);
+
+	if (was_empty) {
+		completion_queue_notify();
+	}
+
+	return 0;
+}
+
+// drop all packets posted for a stack that is about to be destroyed. has to be
+// called after the device thread of the stack was joined
+void completion_queue_remove_stack(Stack *stack) {
+	Queue remaining;
+	CompletionQueueEntry *entry;
+	CompletionQueueEntry *copy;
+	int dropped = 0;
+
+	mutex_lock(&_mutex);
+
+	if (_queue.count == 0) {
+		mutex_unlock(&_mutex);
+
+		return;
+	}
+
+	if (queue_create(&remaining, sizeof(CompletionQueueEntry)) < 0) {
+		mutex_unlock(&_mutex);
+
+		log_error("Could not create temporary completion queue: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	while ((entry = queue_peek(&_queue)) != NULL) {
+		if (entry->stack == stack) {
+			++dropped;
+		} else {
+			copy = queue_push(&remaining);
+
+			if (copy != NULL) {
+				memcpy(copy, entry, sizeof(CompletionQueueEntry));
+			}
+		}
+
+		queue_pop(&_queue, NULL);
+	}
+
+	while ((entry = queue_peek(&remaining)) != NULL) {
+		copy = queue_push(&_queue);
+
+		if (copy != NULL) {
+			memcpy(copy, entry, sizeof(CompletionQueueEntry));
+		}
+
+		queue_pop(&remaining, NULL);
+	}
+
+	queue_destroy(&remaining, NULL);
+
+	mutex_unlock(&_mutex);
+
+	if (dropped > 0) {
+		log_debug("Dropped %d pending packet(s) of %s from completion queue",
+		          dropped, stack->name);
+	}
+}
+
+void completion_queue_log_statistics(void) {
+	uint64_t dropped;
+
+	if (_users <= 0) {
+		return;
+	}
+
+	mutex_lock(&_mutex);
+	dropped = _dropped;
+	mutex_unlock(&_mutex);
+
+	log_info("Completion queue statistics (packets: %"PRIu64", wakeups: %"PRIu64", packets per wakeup: %.1f, avg latency: %.0f us, max latency: %"PRIu64" us, dropped: %"PRIu64")",
+	         _packets, _wakeups, _wakeups > 0 ? (double)_packets / _wakeups : 0.0,
+	         _packets > 0 ? (double)_latency_total / _packets : 0.0, _latency_max, dropped);
+
+	_latency_max = 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * completion_queue.h: Shared queue for packets from device threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_COMPLETION_QUEUE_H
+#define BRICKD_COMPLETION_QUEUE_H
+
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+#include "stack.h"
+
+// called in the event loop thread for each packet posted by a device thread
+typedef void (*CompletionQueueHandleFunction)(Stack *stack, Packet *packet, uint32_t opaque);
+
+int completion_queue_init(void);
+void completion_queue_exit(void);
+
+int completion_queue_post(Stack *stack, CompletionQueueHandleFunction handle,
+                          Packet *packet, int length, uint32_t opaque);
+void completion_queue_remove_stack(Stack *stack);
+
+void completion_queue_log_statistics(void);
+
+#endif // BRICKD_COMPLETION_QUEUE_H
@@ -27,10 +27,6 @@
 	#include <daemonlib/red_led.h>
 #endif
 
-#ifdef BRICKD_WITH_BRICKLET
-	#include "bricklet.h"
-#endif
-
 
 #ifdef BRICKD_WITH_RED_BRICK
 
@@ -54,32 +50,21 @@ static const char *config_format_red_led_trigger(int value) {
 
 #endif
 
-#ifdef BRICKD_WITH_BRICKLET
-
-static EnumValueName _bricklet_chip_select_driver_enum_value_names[] = {
-	{ BRICKLET_CHIP_SELECT_DRIVER_HARDWARE, "hardware" },
-	{ BRICKLET_CHIP_SELECT_DRIVER_GPIO,     "gpio" },
-	{ BRICKLET_CHIP_SELECT_DRIVER_WIRINGPI, "wiringpi" },
-	{ -1,                                   NULL }
-};
-
-static int config_parse_bricklet_chip_select_driver(const char *string, int *value) {
-	return enum_get_value(_bricklet_chip_select_driver_enum_value_names, string, value, true);
-}
-
-static const char *config_format_bricklet_chip_select_driver(int value) {
-	return enum_get_name(_bricklet_chip_select_driver_enum_value_names, value, "<unknown>");
-}
-
-#endif
-
 ConfigOption config_options[] = {
 	CONFIG_OPTION_STRING_INITIALIZER("listen.address", 1, -1, "0.0.0.0"),
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.plain_port", 1, UINT16_MAX, 4223),
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.websocket_port", 0, UINT16_MAX, 0), // default to enable: 4280
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.mesh_gateway_port", 1, UINT16_MAX, 4240),
 	CONFIG_OPTION_BOOLEAN_INITIALIZER("listen.dual_stack", false),
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("listen.resolve_client_names", true),
 	CONFIG_OPTION_STRING_INITIALIZER("authentication.secret", 0, 64, NULL),
+	CONFIG_OPTION_INTEGER_INITIALIZER("authentication.session_lifetime", 0, 604800, 3600), // seconds
+	CONFIG_OPTION_STRING_INITIALIZER("flash_job.image_directory", 0, -1, NULL),
+	CONFIG_OPTION_STRING_INITIALIZER("rules.file", 0, -1, NULL),
+	CONFIG_OPTION_STRING_INITIALIZER("squash.requests", 0, -1, NULL),
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("purge.disconnected_clients", true),
+	CONFIG_OPTION_INTEGER_INITIALIZER("purge.deadline", 0, 3600000, 0), // milliseconds
+	CONFIG_OPTION_INTEGER_INITIALIZER("callbacks.max_backlog", 1, 32768, 32768), // packets
 	CONFIG_OPTION_SYMBOL_INITIALIZER("log.level", config_parse_log_level, config_format_log_level, LOG_LEVEL_INFO),
 	CONFIG_OPTION_STRING_INITIALIZER("log.debug_filter", 0, -1, NULL),
 #ifdef BRICKD_WITH_RED_BRICK
@@ -87,85 +72,7 @@ ConfigOption config_options[] = {
 	CONFIG_OPTION_SYMBOL_INITIALIZER("led_trigger.red", config_parse_red_led_trigger, config_format_red_led_trigger, RED_LED_TRIGGER_OFF),
 	CONFIG_OPTION_INTEGER_INITIALIZER("poll_delay.spi", 50, INT32_MAX, 50), // microseconds
 	CONFIG_OPTION_INTEGER_INITIALIZER("poll_delay.rs485", 50, INT32_MAX, 4000), // microseconds
-#endif
-#ifdef BRICKD_WITH_BRICKLET
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portA.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portB.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portC.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portD.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portE.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portF.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portG.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portH.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portI.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portJ.sleep_between_reads", 100, 1000000, 200),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.portHAT.sleep_between_reads", 100, 1000000, 2000),
-
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.spidev", 0, 64, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.spidev", 0, 64, ""),
-
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs0.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs1.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs2.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs3.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs4.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs5.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs6.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs7.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs8.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group0.cs9.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs0.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs1.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs2.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs3.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs4.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs5.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs6.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs7.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs8.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-	CONFIG_OPTION_SYMBOL_INITIALIZER("bricklet.group1.cs9.driver", config_parse_bricklet_chip_select_driver, config_format_bricklet_chip_select_driver, -1),
-
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs0.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs1.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs2.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs3.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs4.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs5.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs6.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs7.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs8.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group0.cs9.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs0.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs1.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs2.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs3.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs4.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs5.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs6.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs7.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs8.num", 0, UINT16_MAX, -1),
-	CONFIG_OPTION_INTEGER_INITIALIZER("bricklet.group1.cs9.num", 0, UINT16_MAX, -1),
-
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs0.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs1.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs2.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs3.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs4.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs5.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs6.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs7.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs8.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group0.cs9.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs0.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs1.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs2.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs3.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs4.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs5.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs6.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs7.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs8.name", 0, 32, ""),
-	CONFIG_OPTION_STRING_INITIALIZER("bricklet.group1.cs9.name", 0, 32, ""),
+	CONFIG_OPTION_INTEGER_INITIALIZER("poll_batch.rs485", 1, 64, 4), // exchanges per slave turn
 #endif
 	CONFIG_OPTION_NULL_INITIALIZER // end of list
 };
\ No newline at end of file
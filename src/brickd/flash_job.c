@@ -0,0 +1,640 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * flash_job.c: Server-side flashing of Bricklet firmwares and plugins
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a client uploads the image once, either with a stream of write-image
+ * requests (without response expected) or by naming a file in the configured
+ * flash_job.image_directory. after the start request brickd streams the chunks
+ * to the device itself, keeping FLASH_JOB_MAX_CHUNKS_IN_FLIGHT chunks in flight,
+ * and reports the progress to the client with the flash-job-progress callback.
+ *
+ * switching a co-processor Bricklet into and out of bootloader mode is still
+ * done by the client. the flash job only transfers the firmware.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/base58.h>
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/macros.h>
+#include <daemonlib/utils.h>
+
+#include "flash_job.h"
+
+#include "hardware.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define UID_BRICK_DAEMON 1
+
+#define FLASH_JOB_TIMEOUT 2000000 // 2 seconds in microseconds
+
+#define FUNCTION_SET_WRITE_FIRMWARE_POINTER 237
+#define FUNCTION_WRITE_FIRMWARE             238
+#define FUNCTION_WRITE_BRICKLET_PLUGIN      246
+
+#define COPROCESSOR_FIRMWARE_CHUNK_LENGTH 64
+#define BRICKLET_PLUGIN_CHUNK_LENGTH      32
+#define BRICKLET_PLUGIN_MAX_CHUNKS        256 // offset is a chunk index in one byte
+#define BRICKLET_PLUGIN_MIN_PORT          'a'
+#define BRICKLET_PLUGIN_MAX_PORT          'd'
+
+#define COPROCESSOR_WRITE_FIRMWARE_STATUS_OK 0
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint32_t pointer;
+} ATTRIBUTE_PACKED SetWriteFirmwarePointerRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t data[COPROCESSOR_FIRMWARE_CHUNK_LENGTH];
+} ATTRIBUTE_PACKED WriteFirmwareRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t status;
+} ATTRIBUTE_PACKED WriteFirmwareResponse;
+
+typedef struct {
+	PacketHeader header;
+	char port;
+	uint8_t offset;
+	uint8_t chunk[BRICKLET_PLUGIN_CHUNK_LENGTH];
+} ATTRIBUTE_PACKED WriteBrickletPluginRequest;
+
+#include <daemonlib/packed_end.h>
+
+// responses carry no client ID, so they are routed by device UID to the
+// running flash jobs. there is at most one running flash job per device
+static Node _running_flash_jobs = { &_running_flash_jobs, &_running_flash_jobs };
+
+static const char *flash_job_get_state_name(FlashJobState state) {
+	switch (state) {
+	case FLASH_JOB_STATE_IDLE:    return "idle";
+	case FLASH_JOB_STATE_RUNNING: return "running";
+	case FLASH_JOB_STATE_DONE:    return "done";
+	case FLASH_JOB_STATE_FAILED:  return "failed";
+	case FLASH_JOB_STATE_ABORTED: return "aborted";
+
+	default:                      return "<unknown>";
+	}
+}
+
+static void flash_job_send_response(FlashJob *flash_job, Packet *request,
+                                    FlashJobStatus status) {
+	union {
+		FlashJobResponse response;
+		Packet packet;
+	} u;
+
+	if (!packet_header_get_response_expected(&request->header)) {
+		return;
+	}
+
+	memset(&u.packet, 0, sizeof(u.packet));
+
+	u.response.header = request->header;
+	u.response.header.length = sizeof(u.response);
+	u.response.status = status;
+
+	packet_header_set_error_code(&u.response.header, PACKET_E_SUCCESS);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+	packet_add_trace(&u.packet);
+	client_dispatch_response(flash_job->client, NULL, &u.packet, false, false);
+}
+
+static void flash_job_send_progress(FlashJob *flash_job, FlashJobStatus status) {
+	union {
+		FlashJobProgressCallback callback;
+		Packet packet;
+	} u;
+	uint32_t written = (uint32_t)flash_job->chunks_acked * flash_job->chunk_length;
+
+	memset(&u.packet, 0, sizeof(u.packet));
+
+	u.callback.header.uid = uint32_to_le(UID_BRICK_DAEMON);
+	u.callback.header.length = sizeof(u.callback);
+	u.callback.header.function_id = CALLBACK_FLASH_JOB_PROGRESS;
+	packet_header_set_sequence_number(&u.callback.header, 0);
+	packet_header_set_response_expected(&u.callback.header, true);
+
+	u.callback.state = flash_job->state;
+	u.callback.status = status;
+	u.callback.written = uint32_to_le(MIN(written, flash_job->total));
+	u.callback.total = uint32_to_le(flash_job->total);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+	packet_add_trace(&u.packet);
+	client_dispatch_response(flash_job->client, NULL, &u.packet, true, false);
+}
+
+static void flash_job_finish(FlashJob *flash_job, FlashJobState state,
+                             FlashJobStatus status) {
+	char base58[BASE58_MAX_LENGTH];
+	uint64_t duration = microseconds() - flash_job->started;
+
+	flash_job->state = state;
+
+	node_remove(&flash_job->running_node);
+
+	if (timer_configure(&flash_job->timer, 0, 0) < 0) {
+		log_error("Could not stop flash job timer: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+
+	if (state == FLASH_JOB_STATE_DONE) {
+		log_info("Flash job for device (uid: %s) of client ("CLIENT_SIGNATURE_FORMAT") done, flashed %u byte(s) in %.3f sec",
+		         base58_encode(base58, uint32_from_le(flash_job->uid)),
+		         client_expand_signature(flash_job->client),
+		         flash_job->total, duration / 1000000.0);
+	} else {
+		log_warn("Flash job for device (uid: %s) of client ("CLIENT_SIGNATURE_FORMAT") %s after %d of %d chunk(s) (status: %d)",
+		         base58_encode(base58, uint32_from_le(flash_job->uid)),
+		         client_expand_signature(flash_job->client),
+		         flash_job_get_state_name(state), flash_job->chunks_acked,
+		         flash_job->chunk_count, status);
+	}
+
+	flash_job_send_progress(flash_job, status);
+}
+
+static uint8_t flash_job_get_next_sequence_number(FlashJob *flash_job) {
+	if (++flash_job->sequence_number > 15) {
+		flash_job->sequence_number = 1;
+	}
+
+	return flash_job->sequence_number;
+}
+
+static void flash_job_create_request_header(FlashJob *flash_job, PacketHeader *header,
+                                            uint8_t length, uint8_t function_id,
+                                            bool response_expected) {
+	memset(header, 0, sizeof(PacketHeader));
+
+	header->uid = flash_job->uid;
+	header->length = length;
+	header->function_id = function_id;
+
+	packet_header_set_sequence_number(header, flash_job_get_next_sequence_number(flash_job));
+	packet_header_set_response_expected(header, response_expected);
+}
+
+static void flash_job_send_chunk(FlashJob *flash_job) {
+	int chunk = flash_job->chunks_sent;
+	uint32_t offset = (uint32_t)chunk * flash_job->chunk_length;
+	union {
+		SetWriteFirmwarePointerRequest set_write_firmware_pointer;
+		WriteFirmwareRequest write_firmware;
+		WriteBrickletPluginRequest write_bricklet_plugin;
+		Packet packet;
+	} u;
+
+	memset(&u.packet, 0, sizeof(u.packet));
+
+	if (flash_job->type == FLASH_JOB_TYPE_COPROCESSOR_FIRMWARE) {
+		// the pointer request needs no response, the device handles its
+		// requests in order and the write-firmware response covers both
+		flash_job_create_request_header(flash_job, &u.set_write_firmware_pointer.header,
+		                                sizeof(u.set_write_firmware_pointer),
+		                                FUNCTION_SET_WRITE_FIRMWARE_POINTER, false);
+
+		u.set_write_firmware_pointer.pointer = uint32_to_le(offset);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+		u.packet.trace_id = packet_get_next_request_trace_id();
+#endif
+
+		packet_add_trace(&u.packet);
+		hardware_dispatch_request(&u.packet);
+
+		memset(&u.packet, 0, sizeof(u.packet));
+
+		flash_job_create_request_header(flash_job, &u.write_firmware.header,
+		                                sizeof(u.write_firmware),
+		                                FUNCTION_WRITE_FIRMWARE, true);
+
+		memcpy(u.write_firmware.data, flash_job->image + offset,
+		       COPROCESSOR_FIRMWARE_CHUNK_LENGTH);
+	} else {
+		flash_job_create_request_header(flash_job, &u.write_bricklet_plugin.header,
+		                                sizeof(u.write_bricklet_plugin),
+		                                FUNCTION_WRITE_BRICKLET_PLUGIN, true);
+
+		u.write_bricklet_plugin.port = flash_job->port;
+		u.write_bricklet_plugin.offset = (uint8_t)chunk;
+
+		// the last chunk is padded with zeros
+		memcpy(u.write_bricklet_plugin.chunk, flash_job->image + offset,
+		       MIN(BRICKLET_PLUGIN_CHUNK_LENGTH, flash_job->total - offset));
+	}
+
+	flash_job->in_flight_sequence_numbers[chunk % FLASH_JOB_MAX_CHUNKS_IN_FLIGHT] =
+		packet_header_get_sequence_number(&u.packet.header);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	u.packet.trace_id = packet_get_next_request_trace_id();
+#endif
+
+	packet_add_trace(&u.packet);
+	hardware_dispatch_request(&u.packet);
+
+	++flash_job->chunks_sent;
+}
+
+static void flash_job_send_chunks(FlashJob *flash_job) {
+	while (flash_job->chunks_sent < flash_job->chunk_count &&
+	       flash_job->chunks_sent - flash_job->chunks_acked < FLASH_JOB_MAX_CHUNKS_IN_FLIGHT) {
+		flash_job_send_chunk(flash_job);
+	}
+
+	if (timer_configure(&flash_job->timer, FLASH_JOB_TIMEOUT, 0) < 0) {
+		log_error("Could not start flash job timer: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void flash_job_handle_timeout(void *opaque) {
+	FlashJob *flash_job = opaque;
+
+	if (flash_job->state == FLASH_JOB_STATE_RUNNING) {
+		flash_job_finish(flash_job, FLASH_JOB_STATE_FAILED, FLASH_JOB_STATUS_TIMEOUT);
+	}
+}
+
+static FlashJobStatus flash_job_reserve_image(FlashJob *flash_job, uint32_t length) {
+	uint8_t *image;
+
+	if (length > FLASH_JOB_MAX_IMAGE_LENGTH) {
+		return FLASH_JOB_STATUS_INVALID_IMAGE;
+	}
+
+	if (length <= flash_job->image_allocated) {
+		return FLASH_JOB_STATUS_OK;
+	}
+
+	// grow in steps of 64 KiB to avoid a realloc per write-image request
+	length = MIN((length + 65535) & ~(uint32_t)65535, FLASH_JOB_MAX_IMAGE_LENGTH);
+	image = realloc(flash_job->image, length);
+
+	if (image == NULL) {
+		log_error("Could not allocate flash job image: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return FLASH_JOB_STATUS_NO_MEMORY;
+	}
+
+	flash_job->image = image;
+	flash_job->image_allocated = length;
+
+	return FLASH_JOB_STATUS_OK;
+}
+
+static FlashJobStatus flash_job_handle_write_image(FlashJob *flash_job,
+                                                   WriteFlashJobImageRequest *request) {
+	uint32_t offset = uint32_from_le(request->offset);
+	FlashJobStatus status;
+
+	if (request->length > sizeof(request->data)) {
+		return FLASH_JOB_STATUS_INVALID_PARAMETER;
+	}
+
+	// offset + length could wrap around otherwise
+	if (offset > (uint32_t)FLASH_JOB_MAX_IMAGE_LENGTH - request->length) {
+		return FLASH_JOB_STATUS_INVALID_PARAMETER;
+	}
+
+	status = flash_job_reserve_image(flash_job, offset + request->length);
+
+	if (status != FLASH_JOB_STATUS_OK) {
+		return status;
+	}
+
+	// a write at offset 0 starts a new image
+	if (offset == 0) {
+		flash_job->image_length = 0;
+	}
+
+	if (offset > flash_job->image_length) {
+		memset(flash_job->image + flash_job->image_length, 0, offset - flash_job->image_length);
+	}
+
+	memcpy(flash_job->image + offset, request->data, request->length);
+
+	flash_job->image_length = MAX(flash_job->image_length, offset + request->length);
+
+	return FLASH_JOB_STATUS_OK;
+}
+
+static FlashJobStatus flash_job_handle_set_image_file(FlashJob *flash_job,
+                                                      SetFlashJobImageFileRequest *request) {
+	const char *directory = config_get_option_value("flash_job.image_directory")->string;
+	char name[sizeof(request->path) + 1];
+	char path[1024];
+	FILE *fp;
+	size_t length;
+	FlashJobStatus status;
+
+	// reading files is only allowed from the configured directory
+	if (directory == NULL || *directory == '\0') {
+		log_warn("Client ("CLIENT_SIGNATURE_FORMAT") tries to flash an image file, but flash_job.image_directory is not set",
+		         client_expand_signature(flash_job->client));
+
+		return FLASH_JOB_STATUS_FILE_ERROR;
+	}
+
+	string_copy(name, sizeof(name), request->path, sizeof(request->path));
+
+	if (*name == '\0' || strstr(name, "..") != NULL || strchr(name, '/') != NULL ||
+	    strchr(name, '\\') != NULL) {
+		return FLASH_JOB_STATUS_INVALID_PARAMETER;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+	status = flash_job_reserve_image(flash_job, FLASH_JOB_MAX_IMAGE_LENGTH);
+
+	if (status != FLASH_JOB_STATUS_OK) {
+		return status;
+	}
+
+	fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		log_error("Could not open flash job image file '%s': %s (%d)",
+		          path, get_errno_name(errno), errno);
+
+		return FLASH_JOB_STATUS_FILE_ERROR;
+	}
+
+	length = fread(flash_job->image, 1, FLASH_JOB_MAX_IMAGE_LENGTH, fp);
+
+	if (ferror(fp)) {
+		log_error("Could not read flash job image file '%s'", path);
+
+		fclose(fp);
+
+		return FLASH_JOB_STATUS_FILE_ERROR;
+	}
+
+	if (!feof(fp) && fgetc(fp) != EOF) {
+		fclose(fp);
+
+		return FLASH_JOB_STATUS_INVALID_IMAGE;
+	}
+
+	fclose(fp);
+
+	flash_job->image_length = (uint32_t)length;
+
+	log_debug("Loaded flash job image file '%s' (length: %u)", path, flash_job->image_length);
+
+	return FLASH_JOB_STATUS_OK;
+}
+
+static FlashJob *flash_job_find_running(uint32_t uid) {
+	Node *running_node = _running_flash_jobs.next;
+	FlashJob *flash_job;
+
+	while (running_node != &_running_flash_jobs) {
+		flash_job = containerof(running_node, FlashJob, running_node);
+
+		if (flash_job->uid == uid) {
+			return flash_job;
+		}
+
+		running_node = running_node->next;
+	}
+
+	return NULL;
+}
+
+static FlashJobStatus flash_job_handle_start(FlashJob *flash_job,
+                                             StartFlashJobRequest *request) {
+	uint32_t image_length = uint32_from_le(request->image_length);
+	char base58[BASE58_MAX_LENGTH];
+
+	if (request->uid == 0 || uint32_from_le(request->uid) == UID_BRICK_DAEMON) {
+		return FLASH_JOB_STATUS_INVALID_PARAMETER;
+	}
+
+	// another client is flashing this device already
+	if (flash_job_find_running(request->uid) != NULL) {
+		return FLASH_JOB_STATUS_BUSY;
+	}
+
+	if (image_length == 0 || image_length != flash_job->image_length) {
+		return FLASH_JOB_STATUS_INVALID_IMAGE;
+	}
+
+	switch (request->type) {
+	case FLASH_JOB_TYPE_COPROCESSOR_FIRMWARE:
+		if (image_length % COPROCESSOR_FIRMWARE_CHUNK_LENGTH != 0) {
+			return FLASH_JOB_STATUS_INVALID_IMAGE;
+		}
+
+		flash_job->chunk_length = COPROCESSOR_FIRMWARE_CHUNK_LENGTH;
+
+		break;
+
+	case FLASH_JOB_TYPE_BRICKLET_PLUGIN:
+		if (request->port < BRICKLET_PLUGIN_MIN_PORT || request->port > BRICKLET_PLUGIN_MAX_PORT) {
+			return FLASH_JOB_STATUS_INVALID_PARAMETER;
+		}
+
+		if (image_length > BRICKLET_PLUGIN_CHUNK_LENGTH * BRICKLET_PLUGIN_MAX_CHUNKS) {
+			return FLASH_JOB_STATUS_INVALID_IMAGE;
+		}
+
+		flash_job->chunk_length = BRICKLET_PLUGIN_CHUNK_LENGTH;
+
+		break;
+
+	default:
+		return FLASH_JOB_STATUS_INVALID_PARAMETER;
+	}
+
+	flash_job->state = FLASH_JOB_STATE_RUNNING;
+	flash_job->type = request->type;
+	flash_job->uid = request->uid;
+	flash_job->port = request->port;
+	flash_job->total = image_length;
+	flash_job->chunk_count = (image_length + flash_job->chunk_length - 1) / flash_job->chunk_length;
+	flash_job->chunks_sent = 0;
+	flash_job->chunks_acked = 0;
+	flash_job->last_progress = 0;
+	flash_job->started = microseconds();
+
+	node_insert_before(&_running_flash_jobs, &flash_job->running_node);
+
+	log_info("Starting flash job for device (uid: %s) of client ("CLIENT_SIGNATURE_FORMAT"), %u byte(s) in %d chunk(s)",
+	         base58_encode(base58, uint32_from_le(flash_job->uid)),
+	         client_expand_signature(flash_job->client),
+	         flash_job->total, flash_job->chunk_count);
+
+	flash_job_send_chunks(flash_job);
+
+	return FLASH_JOB_STATUS_OK;
+}
+
+int flash_job_create(FlashJob *flash_job, Client *client) {
+	memset(flash_job, 0, sizeof(FlashJob));
+
+	flash_job->client = client;
+	flash_job->state = FLASH_JOB_STATE_IDLE;
+
+	node_reset(&flash_job->running_node);
+
+	if (timer_create_(&flash_job->timer, flash_job_handle_timeout, flash_job) < 0) {
+		log_error("Could not create flash job timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void flash_job_destroy(FlashJob *flash_job) {
+	if (flash_job->state == FLASH_JOB_STATE_RUNNING) {
+		log_warn("Aborting flash job of client ("CLIENT_SIGNATURE_FORMAT") after %d of %d chunk(s)",
+		         client_expand_signature(flash_job->client),
+		         flash_job->chunks_acked, flash_job->chunk_count);
+
+		node_remove(&flash_job->running_node);
+	}
+
+	timer_destroy(&flash_job->timer);
+	free(flash_job->image);
+}
+
+bool flash_job_is_function(uint8_t function_id) {
+	return function_id == FUNCTION_WRITE_FLASH_JOB_IMAGE ||
+	       function_id == FUNCTION_SET_FLASH_JOB_IMAGE_FILE ||
+	       function_id == FUNCTION_START_FLASH_JOB ||
+	       function_id == FUNCTION_ABORT_FLASH_JOB;
+}
+
+void flash_job_handle_request(FlashJob *flash_job, Packet *request) {
+	int expected_length;
+	FlashJobStatus status;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	switch (request->header.function_id) {
+	case FUNCTION_WRITE_FLASH_JOB_IMAGE:    expected_length = sizeof(WriteFlashJobImageRequest);   break;
+	case FUNCTION_SET_FLASH_JOB_IMAGE_FILE: expected_length = sizeof(SetFlashJobImageFileRequest); break;
+	case FUNCTION_START_FLASH_JOB:          expected_length = sizeof(StartFlashJobRequest);        break;
+	default:                                expected_length = sizeof(AbortFlashJobRequest);        break;
+	}
+
+	if (request->header.length != expected_length) {
+		log_error("Received flash job request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+		          packet_get_request_signature(packet_signature, request),
+		          client_expand_signature(flash_job->client));
+
+		flash_job->client->disconnected = true;
+
+		return;
+	}
+
+	if (request->header.function_id == FUNCTION_ABORT_FLASH_JOB) {
+		if (flash_job->state == FLASH_JOB_STATE_RUNNING) {
+			flash_job_finish(flash_job, FLASH_JOB_STATE_ABORTED, FLASH_JOB_STATUS_OK);
+		}
+
+		status = FLASH_JOB_STATUS_OK;
+	} else if (flash_job->state == FLASH_JOB_STATE_RUNNING) {
+		status = FLASH_JOB_STATUS_BUSY;
+	} else if (request->header.function_id == FUNCTION_WRITE_FLASH_JOB_IMAGE) {
+		status = flash_job_handle_write_image(flash_job, (WriteFlashJobImageRequest *)request);
+	} else if (request->header.function_id == FUNCTION_SET_FLASH_JOB_IMAGE_FILE) {
+		status = flash_job_handle_set_image_file(flash_job, (SetFlashJobImageFileRequest *)request);
+	} else {
+		status = flash_job_handle_start(flash_job, (StartFlashJobRequest *)request);
+	}
+
+	flash_job_send_response(flash_job, request, status);
+}
+
+// returns true if the response belongs to a chunk of a running flash job
+bool flash_job_dispatch_response(Packet *response) {
+	FlashJob *flash_job = flash_job_find_running(response->header.uid);
+	uint8_t expected_function_id;
+	uint8_t expected_sequence_number;
+	int progress;
+
+	if (flash_job == NULL || flash_job->chunks_acked >= flash_job->chunks_sent) {
+		return false;
+	}
+
+	expected_function_id = flash_job->type == FLASH_JOB_TYPE_COPROCESSOR_FIRMWARE ?
+	                       FUNCTION_WRITE_FIRMWARE : FUNCTION_WRITE_BRICKLET_PLUGIN;
+	expected_sequence_number =
+		flash_job->in_flight_sequence_numbers[flash_job->chunks_acked % FLASH_JOB_MAX_CHUNKS_IN_FLIGHT];
+
+	if (response->header.function_id != expected_function_id ||
+	    packet_header_get_sequence_number(&response->header) != expected_sequence_number) {
+		return false;
+	}
+
+	if (packet_header_get_error_code(&response->header) != PACKET_E_SUCCESS ||
+	    (flash_job->type == FLASH_JOB_TYPE_COPROCESSOR_FIRMWARE &&
+	     (response->header.length < sizeof(WriteFirmwareResponse) ||
+	      ((WriteFirmwareResponse *)response)->status != COPROCESSOR_WRITE_FIRMWARE_STATUS_OK))) {
+		flash_job_finish(flash_job, FLASH_JOB_STATE_FAILED, FLASH_JOB_STATUS_DEVICE_ERROR);
+
+		return true;
+	}
+
+	++flash_job->chunks_acked;
+
+	if (flash_job->chunks_acked == flash_job->chunk_count) {
+		flash_job_finish(flash_job, FLASH_JOB_STATE_DONE, FLASH_JOB_STATUS_OK);
+
+		return true;
+	}
+
+	// report progress in steps of one percent
+	progress = (int)((int64_t)flash_job->chunks_acked * 100 / flash_job->chunk_count);
+
+	if (progress != flash_job->last_progress) {
+		flash_job->last_progress = progress;
+
+		flash_job_send_progress(flash_job, FLASH_JOB_STATUS_OK);
+	}
+
+	flash_job_send_chunks(flash_job);
+
+	return true;
+}
@@ -0,0 +1,144 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * flash_job.h: Server-side flashing of Bricklet firmwares and plugins
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_FLASH_JOB_H
+#define BRICKD_FLASH_JOB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/node.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/timer.h>
+
+#include "client.h"
+
+// brickd functions (UID 1) to upload an image once and let brickd stream it
+// to the device, instead of one network round trip per chunk
+#define FUNCTION_WRITE_FLASH_JOB_IMAGE    10
+#define FUNCTION_SET_FLASH_JOB_IMAGE_FILE 11
+#define FUNCTION_START_FLASH_JOB          12
+#define FUNCTION_ABORT_FLASH_JOB          13
+#define CALLBACK_FLASH_JOB_PROGRESS       14
+
+#define FLASH_JOB_MAX_IMAGE_LENGTH (1024 * 1024)
+
+// chunks that are sent to the device before the first one has to be acked.
+// each co-processor chunk uses two sequence numbers, all sequence numbers in
+// flight have to be distinct to match the responses
+#define FLASH_JOB_MAX_CHUNKS_IN_FLIGHT 6
+
+typedef enum {
+	FLASH_JOB_TYPE_COPROCESSOR_FIRMWARE = 0, // Bricklet in bootloader mode
+	FLASH_JOB_TYPE_BRICKLET_PLUGIN = 1 // Bricklet plugin written through its Brick
+} FlashJobType;
+
+typedef enum {
+	FLASH_JOB_STATE_IDLE = 0,
+	FLASH_JOB_STATE_RUNNING,
+	FLASH_JOB_STATE_DONE,
+	FLASH_JOB_STATE_FAILED,
+	FLASH_JOB_STATE_ABORTED
+} FlashJobState;
+
+typedef enum {
+	FLASH_JOB_STATUS_OK = 0,
+	FLASH_JOB_STATUS_BUSY,
+	FLASH_JOB_STATUS_INVALID_PARAMETER,
+	FLASH_JOB_STATUS_INVALID_IMAGE,
+	FLASH_JOB_STATUS_FILE_ERROR,
+	FLASH_JOB_STATUS_NO_MEMORY,
+	FLASH_JOB_STATUS_DEVICE_ERROR,
+	FLASH_JOB_STATUS_TIMEOUT
+} FlashJobStatus;
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	uint32_t offset;
+	uint8_t length;
+	uint8_t data[64];
+} ATTRIBUTE_PACKED WriteFlashJobImageRequest;
+
+typedef struct {
+	PacketHeader header;
+	char path[64];
+} ATTRIBUTE_PACKED SetFlashJobImageFileRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint32_t uid; // always little endian
+	uint8_t type;
+	char port; // only used for Bricklet plugins
+	uint32_t image_length;
+} ATTRIBUTE_PACKED StartFlashJobRequest;
+
+typedef struct {
+	PacketHeader header;
+} ATTRIBUTE_PACKED AbortFlashJobRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t status;
+} ATTRIBUTE_PACKED FlashJobResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t state;
+	uint8_t status;
+	uint32_t written;
+	uint32_t total;
+} ATTRIBUTE_PACKED FlashJobProgressCallback;
+
+#include <daemonlib/packed_end.h>
+
+struct _FlashJob {
+	Client *client;
+	FlashJobState state;
+	FlashJobType type;
+	uint32_t uid; // always little endian
+	char port;
+	uint8_t *image;
+	uint32_t image_length; // bytes uploaded or loaded from file
+	uint32_t image_allocated;
+	uint32_t total; // bytes to flash
+	int chunk_length;
+	int chunk_count;
+	int chunks_sent;
+	int chunks_acked;
+	uint8_t sequence_number;
+	uint8_t in_flight_sequence_numbers[FLASH_JOB_MAX_CHUNKS_IN_FLIGHT];
+	int last_progress; // in percent
+	uint64_t started;
+	Timer timer;
+	Node running_node; // only linked while the flash job is running
+};
+
+int flash_job_create(FlashJob *flash_job, Client *client);
+void flash_job_destroy(FlashJob *flash_job);
+
+bool flash_job_is_function(uint8_t function_id);
+
+void flash_job_handle_request(FlashJob *flash_job, Packet *request);
+bool flash_job_dispatch_response(Packet *response);
+
+#endif // BRICKD_FLASH_JOB_H
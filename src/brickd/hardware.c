@@ -29,6 +29,8 @@
 
 #include "hardware.h"
 
+#include "purge.h"
+#include "squash.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -38,11 +40,24 @@ static Array _stacks;
 int hardware_init(void) {
 	log_debug("Initializing hardware subsystem");
 
+	if (squash_init() < 0) {
+		return -1;
+	}
+
+	if (purge_init() < 0) {
+		squash_exit();
+
+		return -1;
+	}
+
 	// create stack array
 	if (array_create(&_stacks, 32, sizeof(Stack *), true) < 0) {
 		log_error("Could not create stack array: %s (%d)",
 		          get_errno_name(errno), errno);
 
+		purge_exit();
+		squash_exit();
+
 		return -1;
 	}
 
@@ -57,6 +72,9 @@ void hardware_exit(void) {
 	}
 
 	array_destroy(&_stacks, NULL);
+
+	purge_exit();
+	squash_exit();
 }
 
 int hardware_add_stack(Stack *stack) {
@@ -164,6 +182,75 @@ void hardware_dispatch_request(Packet *request) {
 	}
 }
 
+// dispatches the requests from one client read. requests to the same stack
+// are grouped, so stacks with a batch function can send them at once. the
+// order of requests to the same UID is kept. requests with a UID that no
+// stack claims to know are broadcast one by one
+void hardware_dispatch_request_batch(Packet *requests, int count) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	bool dispatched[STACK_MAX_BATCH_SIZE];
+	int i;
+	int k;
+	Stack *stack;
+
+	while (count > STACK_MAX_BATCH_SIZE) {
+		hardware_dispatch_request_batch(requests, STACK_MAX_BATCH_SIZE);
+
+		requests += STACK_MAX_BATCH_SIZE;
+		count -= STACK_MAX_BATCH_SIZE;
+	}
+
+	if (count <= 0) {
+		return;
+	}
+
+	if (count == 1) {
+		hardware_dispatch_request(&requests[0]);
+
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		packet_add_trace(&requests[i]);
+
+		dispatched[i] = false;
+	}
+
+	if (_stacks.count == 0) {
+		log_packet_debug("No stacks connected, dropping %d request(s)", count);
+
+		return;
+	}
+
+	log_packet_debug("Dispatching %d request(s) to %d stack(s)", count, _stacks.count);
+
+	// dispatch to all stacks, not only the first one that might claim to
+	// know the UID
+	for (i = 0; i < _stacks.count; ++i) {
+		stack = *(Stack **)array_get(&_stacks, i);
+
+		stack_dispatch_request_batch(stack, requests, count, dispatched);
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (dispatched[i]) {
+			continue;
+		}
+
+		log_packet_debug("Broadcasting request (%s) because UID is currently unknown",
+		                 packet_get_request_signature(packet_signature, &requests[i]));
+
+		packet_add_trace(&requests[i]);
+
+		// broadcast to all stacks, as no stack claimed to know the UID
+		for (k = 0; k < _stacks.count; ++k) {
+			stack = *(Stack **)array_get(&_stacks, k);
+
+			stack_dispatch_request(stack, &requests[i], true);
+		}
+	}
+}
+
 void hardware_announce_disconnect(void) {
 	int i;
 	Stack *stack;
@@ -174,3 +261,20 @@ void hardware_announce_disconnect(void) {
 		stack_announce_disconnect(stack);
 	}
 }
+
+void hardware_log_statistics(void) {
+	int recipients = 0;
+	Stack *stack;
+	int i;
+
+	for (i = 0; i < _stacks.count; ++i) {
+		stack = *(Stack **)array_get(&_stacks, i);
+		recipients += stack->recipients.count;
+	}
+
+	log_info("Hardware statistics (stacks: %d, recipients: %d)",
+	         _stacks.count, recipients);
+
+	squash_log_statistics();
+	purge_log_statistics();
+}
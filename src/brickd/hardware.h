@@ -33,7 +33,10 @@ int hardware_add_stack(Stack *stack);
 int hardware_remove_stack(Stack *stack);
 
 void hardware_dispatch_request(Packet *request);
+void hardware_dispatch_request_batch(Packet *requests, int count);
 
 void hardware_announce_disconnect(void);
 
+void hardware_log_statistics(void);
+
 #endif // BRICKD_HARDWARE_H
@@ -160,3 +160,17 @@ void hmac_sha1(uint8_t *secret, int secret_length,
 	sha1_update(&sha1, inner_digest, SHA1_DIGEST_LENGTH);
 	sha1_final(&sha1, digest);
 }
+
+// compares two digests in constant time. memcmp returns at the first differing
+// byte, the time it takes would tell an attacker how many leading bytes of a
+// forged digest are correct
+bool hmac_compare(const uint8_t *a, const uint8_t *b, int length) {
+	uint8_t difference = 0;
+	int i;
+
+	for (i = 0; i < length; ++i) {
+		difference |= a[i] ^ b[i];
+	}
+
+	return difference == 0;
+}
@@ -23,6 +23,7 @@
 #ifndef BRICKD_HMAC_H
 #define BRICKD_HMAC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "sha1.h"
@@ -33,4 +34,6 @@ void hmac_sha1(uint8_t *secret, int secret_length,
                uint8_t *data, int data_length,
                uint8_t digest[SHA1_DIGEST_LENGTH]);
 
+bool hmac_compare(const uint8_t *a, const uint8_t *b, int length);
+
 #endif // BRICKD_HMAC_H
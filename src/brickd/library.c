@@ -0,0 +1,455 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * library.c: Brick Daemon subsystems for applications embedding brickd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * an application links libbrickd and runs the same subsystems as the brickd
+ * daemon in its own process:
+ *
+ *   library_init(config_filename);
+ *   local_client = local_client_create(...);
+ *   library_run(); // in a thread of the application, until library_stop
+ *   local_client_close(local_client);
+ *   library_exit();
+ *
+ * the library doesn't daemonize, doesn't acquire a PID file and doesn't
+ * install signal handlers, that is up to the application. the event loop runs
+ * in the thread that calls library_run, all brickd functions except
+ * local_client_send, local_client_close and library_stop have to be called
+ * from that thread or before library_run.
+ *
+ * main_linux.c is a wrapper around the library. it initializes config and log
+ * itself, because it has to daemonize in between. then it initializes the
+ * event loop and the subsystems in two steps, to install its signal handlers
+ * before the subsystems start:
+ *
+ *   library_init_event_loop();
+ *   signal_init(...);
+ *   library_init_subsystems(config_filename);
+ *   library_run();
+ *   library_exit_subsystems();
+ *   signal_exit();
+ *   library_exit_event_loop();
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/pipe.h>
+#ifdef BRICKD_WITH_RED_BRICK
+	#include <daemonlib/gpio_red.h>
+	#include <daemonlib/red_led.h>
+#endif
+#include <daemonlib/utils.h>
+
+#include "library.h"
+
+#include "hardware.h"
+#include "network.h"
+#ifdef BRICKD_WITH_RED_BRICK
+	#include "redapid.h"
+	#include "red_stack.h"
+	#include "red_usb_gadget.h"
+	#include "red_extension.h"
+#endif
+#ifdef BRICKD_WITH_LIBUDEV
+	#include "udev.h"
+#endif
+#ifdef BRICKD_WITH_BRICKLET
+	#include "bricklet.h"
+#endif
+#include "usb.h"
+#include "mesh.h"
+#include "version.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+static int _phase = 0; // of library_init
+static int _event_loop_phase = 0;
+static int _subsystems_phase = 0;
+static Pipe _stop_pipe;
+#ifdef BRICKD_WITH_LIBUDEV
+static bool _initialized_udev = false;
+#endif
+
+static void library_handle_stop(void *opaque) {
+	uint8_t byte;
+
+	(void)opaque;
+
+	if (pipe_read(&_stop_pipe, &byte, sizeof(byte)) < 0) {
+		if (!errno_would_block()) {
+			log_error("Could not read from stop pipe: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+
+		return;
+	}
+
+	event_stop();
+}
+
+static void library_handle_event_cleanup(void) {
+	network_cleanup_clients_and_zombies();
+	mesh_cleanup_stacks();
+
+#ifdef BRICKD_WITH_RED_BRICK
+	red_usb_gadget_flush();
+#endif
+}
+
+// initializes config, log, the event loop and all subsystems. on error
+// everything that was initialized is cleaned up again
+int library_init(const char *config_filename) {
+	_phase = 0;
+
+	config_init(config_filename);
+
+	_phase = 1;
+
+	if (config_has_error()) {
+		fprintf(stderr, "Error(s) occurred while reading config file '%s'\n",
+		        config_filename);
+
+		goto error;
+	}
+
+	log_init();
+
+	_phase = 2;
+
+	log_info("Brick Daemon %s library initializing", VERSION_STRING);
+	log_debug("Using config file: %s", config_filename);
+
+	if (config_has_warning()) {
+		log_warn("Warning(s) in config file '%s', run brickd with --check-config option for details",
+		         config_filename);
+	}
+
+	if (library_init_event_loop() < 0) {
+		goto error;
+	}
+
+	_phase = 3;
+
+	if (library_init_subsystems(config_filename) < 0) {
+		goto error;
+	}
+
+	_phase = 4;
+
+	return 0;
+
+error:
+	library_exit();
+
+	return -1;
+}
+
+void library_exit(void) {
+	switch (_phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		library_exit_subsystems();
+		// fall through
+
+	case 3:
+		library_exit_event_loop();
+		// fall through
+
+	case 2:
+		log_info("Brick Daemon %s library exited", VERSION_STRING);
+		log_exit();
+		// fall through
+
+	case 1:
+		config_exit();
+		// fall through
+
+	default:
+		break;
+	}
+
+	_phase = 0;
+}
+
+// config and log have to be initialized already. on error everything that was
+// initialized is cleaned up again
+int library_init_event_loop(void) {
+	_event_loop_phase = 0;
+
+#ifdef BRICKD_WITH_LIBUSB_DLOPEN
+	if (libusb_init_dlopen() < 0) {
+		goto error;
+	}
+#endif
+
+	_event_loop_phase = 1;
+
+	if (event_init() < 0) {
+		goto error;
+	}
+
+	_event_loop_phase = 2;
+
+	// library_stop can be called from any thread, it wakes up the event loop
+	// through this pipe
+	if (pipe_create(&_stop_pipe, PIPE_FLAG_NON_BLOCKING_READ) < 0) {
+		log_error("Could not create stop pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto error;
+	}
+
+	_event_loop_phase = 3;
+
+	if (event_add_source(_stop_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     "library-stop", EVENT_READ, library_handle_stop, NULL) < 0) {
+		goto error;
+	}
+
+	_event_loop_phase = 4;
+
+	return 0;
+
+error:
+	library_exit_event_loop();
+
+	return -1;
+}
+
+void library_exit_event_loop(void) {
+	switch (_event_loop_phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		event_remove_source(_stop_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		// fall through
+
+	case 3:
+		pipe_destroy(&_stop_pipe);
+		// fall through
+
+	case 2:
+		event_exit();
+		// fall through
+
+	case 1:
+#ifdef BRICKD_WITH_LIBUSB_DLOPEN
+		libusb_exit_dlopen();
+#endif
+		// fall through
+
+	default:
+		break;
+	}
+
+	_event_loop_phase = 0;
+}
+
+// the event loop has to be initialized already. on error all subsystems that
+// were initialized are cleaned up again, the event loop is kept
+int library_init_subsystems(const char *config_filename) {
+	_subsystems_phase = 0;
+
+	if (hardware_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 1;
+
+	if (usb_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 2;
+
+#ifdef BRICKD_WITH_LIBUDEV
+	_initialized_udev = false;
+
+	if (!usb_has_hotplug()) {
+		if (udev_init() < 0) {
+			goto error;
+		}
+
+		_initialized_udev = true;
+	}
+#endif
+
+	_subsystems_phase = 3;
+
+	if (network_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 4;
+
+	if (mesh_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 5;
+
+#ifdef BRICKD_WITH_RED_BRICK
+	if (gpio_red_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 6;
+
+	if (redapid_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 7;
+
+	if (red_stack_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 8;
+
+	if (red_extension_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 9;
+
+	if (red_usb_gadget_init() < 0) {
+		goto error;
+	}
+
+	_subsystems_phase = 10;
+
+	red_led_set_trigger(RED_LED_GREEN, config_get_option_value("led_trigger.green")->symbol);
+	red_led_set_trigger(RED_LED_RED, config_get_option_value("led_trigger.red")->symbol);
+#endif
+
+#ifdef BRICKD_WITH_BRICKLET
+	if (bricklet_init(config_filename) < 0) {
+		goto error;
+	}
+#else
+	(void)config_filename;
+#endif
+
+	_subsystems_phase = 11;
+
+	return 0;
+
+error:
+	library_exit_subsystems();
+
+	return -1;
+}
+
+void library_exit_subsystems(void) {
+	switch (_subsystems_phase) { // no breaks, all cases fall through intentionally
+	case 11:
+#ifdef BRICKD_WITH_BRICKLET
+		bricklet_exit();
+#endif
+		// fall through
+
+#ifdef BRICKD_WITH_RED_BRICK
+	case 10:
+		red_usb_gadget_exit();
+		// fall through
+
+	case 9:
+		red_extension_exit();
+		// fall through
+
+	case 8:
+		red_stack_exit();
+		// fall through
+
+	case 7:
+		redapid_exit();
+		// fall through
+
+	case 6:
+		//gpio_red_exit();
+#endif
+		// fall through
+
+	case 5:
+		mesh_exit();
+		// fall through
+
+	case 4:
+		network_exit();
+		// fall through
+
+	case 3:
+#ifdef BRICKD_WITH_LIBUDEV
+		if (_initialized_udev) {
+			udev_exit();
+		}
+#endif
+		// fall through
+
+	case 2:
+		usb_exit();
+		// fall through
+
+	case 1:
+		hardware_exit();
+		// fall through
+
+	default:
+		break;
+	}
+
+	_subsystems_phase = 0;
+}
+
+// runs the event loop in the calling thread until library_stop is called
+int library_run(void) {
+	int rc;
+
+	if (_event_loop_phase != 4 || _subsystems_phase != 11) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	rc = event_run(library_handle_event_cleanup);
+
+#ifdef BRICKD_WITH_RED_BRICK
+	hardware_announce_disconnect();
+	network_announce_red_brick_disconnect();
+	red_usb_gadget_announce_red_brick_disconnect();
+#endif
+
+	return rc;
+}
+
+// can be called from any thread
+void library_stop(void) {
+	uint8_t byte = 0;
+
+	if (pipe_write(&_stop_pipe, &byte, sizeof(byte)) < 0) {
+		log_error("Could not write to stop pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
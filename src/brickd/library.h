@@ -0,0 +1,37 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * library.h: Brick Daemon subsystems for applications embedding brickd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_LIBRARY_H
+#define BRICKD_LIBRARY_H
+
+int library_init(const char *config_filename);
+void library_exit(void);
+
+int library_init_event_loop(void);
+void library_exit_event_loop(void);
+
+int library_init_subsystems(const char *config_filename);
+void library_exit_subsystems(void);
+
+int library_run(void);
+void library_stop(void);
+
+#endif // BRICKD_LIBRARY_H
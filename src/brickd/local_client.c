@@ -0,0 +1,302 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * local_client.c: In-process client for applications embedding brickd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * an application that links libbrickd and runs the brickd subsystems in its
+ * own process (see library.h) can use a local client instead of a TCP/IP
+ * connection to localhost. requests are passed through a pipe, so
+ * local_client_send can be called from any thread. responses and callbacks
+ * are handed to the response function directly from the client's writer,
+ * without a socket in between. otherwise a local client behaves like any
+ * other client, it takes part in authentication and the pending request
+ * handling.
+ *
+ * the LocalClient is shared between the host and the Client object in brickd
+ * that owns the LocalClientIO. each side holds one reference. the host gives
+ * up its reference with local_client_close, the client gives up its reference
+ * when it gets removed and its I/O object is destroyed. which side goes first
+ * doesn't matter, the last one frees the local client.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/io.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "local_client.h"
+
+#include "network.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+// owned by the Client object, freed by client_destroy
+typedef struct {
+	IO base;
+
+	LocalClient *local_client;
+} LocalClientIO;
+
+static void local_client_release(LocalClient *local_client) {
+	int ref_count;
+
+	mutex_lock(&local_client->mutex);
+
+	ref_count = --local_client->ref_count;
+
+	mutex_unlock(&local_client->mutex);
+
+	if (ref_count > 0) {
+		return;
+	}
+
+	pipe_destroy(&local_client->request_pipe);
+	mutex_destroy(&local_client->callback_mutex);
+	mutex_destroy(&local_client->mutex);
+
+	free(local_client);
+}
+
+// called by client_destroy in the event loop thread. the client doesn't read
+// from the pipe anymore at this point
+static void local_client_io_destroy(LocalClientIO *io) {
+	LocalClient *local_client = io->local_client;
+	bool closed;
+
+	mutex_lock(&local_client->mutex);
+
+	local_client->disconnected = true;
+	closed = local_client->closed;
+
+	mutex_unlock(&local_client->mutex);
+
+	if (!closed && local_client->disconnect != NULL) {
+		mutex_lock(&local_client->callback_mutex);
+		local_client->disconnect(local_client->opaque);
+		mutex_unlock(&local_client->callback_mutex);
+	}
+
+	local_client_release(local_client);
+}
+
+static int local_client_io_read(LocalClientIO *io, void *buffer, int length) {
+	return pipe_read(&io->local_client->request_pipe, buffer, length);
+}
+
+static int local_client_io_write(LocalClientIO *io, const void *buffer, int length) {
+	LocalClient *local_client = io->local_client;
+	Packet response;
+	bool closed;
+
+	if (length < (int)sizeof(PacketHeader) || length > (int)sizeof(Packet)) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	// the writer hands over exactly one packet per write
+	memcpy(&response, buffer, length);
+
+	mutex_lock(&local_client->callback_mutex);
+	mutex_lock(&local_client->mutex);
+
+	closed = local_client->closed;
+
+	mutex_unlock(&local_client->mutex);
+
+	// nobody is interested in responses after the host closed the local client
+	if (!closed) {
+		local_client->response(&response, local_client->opaque);
+	}
+
+	mutex_unlock(&local_client->callback_mutex);
+
+	return length;
+}
+
+// has to be called in the event loop thread or before library_run. the
+// returned local client stays valid until local_client_close is called, also
+// if brickd disconnects the client before
+LocalClient *local_client_create(const char *name,
+                                 LocalClientResponseFunction response,
+                                 LocalClientDisconnectFunction disconnect,
+                                 void *opaque) {
+	int phase = 0;
+	LocalClient *local_client;
+	LocalClientIO *io = NULL;
+
+	local_client = calloc(1, sizeof(LocalClient));
+
+	if (local_client == NULL) {
+		log_error("Could not allocate local client: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	// the write end is non-blocking too. the event loop thread is the only one
+	// that empties the pipe, a blocking write from the response function would
+	// wait for itself once the pipe is full
+	if (pipe_create(&local_client->request_pipe,
+	                PIPE_FLAG_NON_BLOCKING_READ | PIPE_FLAG_NON_BLOCKING_WRITE) < 0) {
+		log_error("Could not create local client request pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	mutex_create(&local_client->mutex);
+	mutex_create(&local_client->callback_mutex);
+
+	local_client->ref_count = 2; // host and client
+	local_client->closed = false;
+	local_client->disconnected = false;
+	local_client->response = response;
+	local_client->disconnect = disconnect;
+	local_client->opaque = opaque;
+
+	phase = 2;
+
+	io = calloc(1, sizeof(LocalClientIO));
+
+	if (io == NULL) {
+		log_error("Could not allocate local client I/O object: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	if (io_create(&io->base, "local-client",
+	              (IODestroyFunction)local_client_io_destroy,
+	              (IOReadFunction)local_client_io_read,
+	              (IOWriteFunction)local_client_io_write) < 0) {
+		log_error("Could not create local client I/O object: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	// responses are never written to the pipe. the write end belongs to the
+	// host, so the client only gets to know the read end
+	io->base.read_handle = local_client->request_pipe.base.read_handle;
+	io->base.write_handle = local_client->request_pipe.base.read_handle;
+	io->local_client = local_client;
+
+	// create new client that takes ownership of the I/O object
+	if (network_create_client(name, &io->base) == NULL) {
+		goto cleanup;
+	}
+
+	phase = 4;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 3:
+		free(io);
+		// fall through
+
+	case 2:
+		mutex_destroy(&local_client->callback_mutex);
+		mutex_destroy(&local_client->mutex);
+		pipe_destroy(&local_client->request_pipe);
+		// fall through
+
+	case 1:
+		free(local_client);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 4 ? local_client : NULL;
+}
+
+// can be called from any thread, also from the response function. requests
+// are small enough to be written to the pipe atomically. if the pipe is full
+// then nothing is written and -1 is returned with errno_would_block() being
+// true. the request can be sent again after brickd read some of the pending
+// requests. in the response function this means not before a later call of it
+int local_client_send(LocalClient *local_client, Packet *request) {
+	int rc;
+
+	if (request->header.length < sizeof(PacketHeader) ||
+	    request->header.length > sizeof(Packet)) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	mutex_lock(&local_client->mutex);
+
+	if (local_client->closed || local_client->disconnected) {
+		mutex_unlock(&local_client->mutex);
+
+		errno = EPIPE;
+
+		return -1;
+	}
+
+	rc = pipe_write(&local_client->request_pipe, request, request->header.length);
+
+	mutex_unlock(&local_client->mutex);
+
+	if (rc < 0) {
+		if (!errno_would_block()) {
+			log_error("Could not write request to local client request pipe: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// has to be called exactly once, from any thread but not from the response or
+// disconnect function. closing the write end of the request pipe makes the
+// client see an end-of-file. it then gets marked as disconnected and removed
+// as usual. the response and disconnect functions are not called anymore after
+// this returns and the local client must not be used anymore
+void local_client_close(LocalClient *local_client) {
+	mutex_lock(&local_client->mutex);
+
+	local_client->closed = true;
+
+	robust_close(local_client->request_pipe.base.write_handle);
+
+	local_client->request_pipe.base.write_handle = IO_HANDLE_INVALID;
+
+	mutex_unlock(&local_client->mutex);
+
+	// wait for a response or disconnect function that might be running in the
+	// event loop thread right now
+	mutex_lock(&local_client->callback_mutex);
+	mutex_unlock(&local_client->callback_mutex);
+
+	local_client_release(local_client);
+}
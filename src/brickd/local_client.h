@@ -0,0 +1,61 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * local_client.h: In-process client for applications embedding brickd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_LOCAL_CLIENT_H
+#define BRICKD_LOCAL_CLIENT_H
+
+#include <stdbool.h>
+
+#include <daemonlib/packet.h>
+#include <daemonlib/pipe.h>
+#include <daemonlib/threads.h>
+
+// called in the event loop thread for each response and callback
+typedef void (*LocalClientResponseFunction)(Packet *response, void *opaque);
+
+// called in the event loop thread if brickd disconnected the client, for
+// example because of an invalid request. not called after local_client_close
+typedef void (*LocalClientDisconnectFunction)(void *opaque);
+
+// the host owns the local client until it calls local_client_close. the
+// client inside of brickd holds a second reference until it is removed, the
+// local client is freed when both references are released
+typedef struct {
+	Mutex mutex; // protects ref_count, closed, disconnected and the write end of request_pipe
+	Mutex callback_mutex; // held while the response or disconnect function is called
+	int ref_count;
+	bool closed; // by the host
+	bool disconnected; // by brickd
+	Pipe request_pipe;
+	LocalClientResponseFunction response;
+	LocalClientDisconnectFunction disconnect;
+	void *opaque;
+} LocalClient;
+
+LocalClient *local_client_create(const char *name,
+                                 LocalClientResponseFunction response,
+                                 LocalClientDisconnectFunction disconnect,
+                                 void *opaque);
+
+int local_client_send(LocalClient *local_client, Packet *request);
+void local_client_close(LocalClient *local_client);
+
+#endif // BRICKD_LOCAL_CLIENT_H
@@ -34,32 +34,14 @@
 
 #include <daemonlib/config.h>
 #include <daemonlib/daemon.h>
-#include <daemonlib/event.h>
 #include <daemonlib/log.h>
 #include <daemonlib/pid_file.h>
-#ifdef BRICKD_WITH_RED_BRICK
-	#include <daemonlib/gpio_red.h>
-	#include <daemonlib/red_led.h>
-#endif
 #include <daemonlib/signal.h>
 #include <daemonlib/utils.h>
 
-#include "hardware.h"
-#include "network.h"
-#ifdef BRICKD_WITH_RED_BRICK
-	#include "redapid.h"
-	#include "red_stack.h"
-	#include "red_usb_gadget.h"
-    #include "red_extension.h"
-#endif
-#ifdef BRICKD_WITH_LIBUDEV
-	#include "udev.h"
-#endif
-#ifdef BRICKD_WITH_BRICKLET
-	#include "bricklet.h"
-#endif
+#include "library.h"
+#include "statistics.h"
 #include "usb.h"
-#include "mesh.h"
 #include "version.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -210,11 +192,6 @@ static void handle_sigusr1(void) {
 #endif
 }
 
-static void handle_event_cleanup(void) {
-	network_cleanup_clients_and_zombies();
-	mesh_cleanup_stacks();
-}
-
 int main(int argc, char **argv) {
 	int phase = 0;
 	int exit_code = EXIT_FAILURE;
@@ -225,9 +202,6 @@ int main(int argc, char **argv) {
 	bool daemon = false;
 	const char *debug_filter = NULL;
 	int pid_fd = -1;
-#ifdef BRICKD_WITH_LIBUDEV
-	bool initialized_udev = false;
-#endif
 
 	for (i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "--help") == 0) {
@@ -352,186 +326,52 @@ int main(int argc, char **argv) {
 		         _config_filename);
 	}
 
-#ifdef BRICKD_WITH_LIBUSB_DLOPEN
-	if (libusb_init_dlopen() < 0) {
+	if (library_init_event_loop() < 0) {
 		goto cleanup;
 	}
 
 	phase = 4;
-#endif
 
-	if (event_init() < 0) {
+	if (signal_init(handle_sighup, handle_sigusr1) < 0) {
 		goto cleanup;
 	}
 
 	phase = 5;
 
-	if (signal_init(handle_sighup, handle_sigusr1) < 0) {
+	if (statistics_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 6;
 
-	if (hardware_init() < 0) {
+	if (library_init_subsystems(_config_filename) < 0) {
 		goto cleanup;
 	}
 
 	phase = 7;
 
-	if (usb_init() < 0) {
-		goto cleanup;
-	}
-
-	phase = 8;
-
-#ifdef BRICKD_WITH_LIBUDEV
-	if (!usb_has_hotplug()) {
-		if (udev_init() < 0) {
-			goto cleanup;
-		}
-
-		initialized_udev = true;
-	}
-
-	phase = 9;
-#endif
-
-	if (network_init() < 0) {
-		goto cleanup;
-	}
-
-	phase = 10;
-
-	if (mesh_init() < 0) {
-		goto cleanup;
-	}
-
-	phase = 11;
-
-#ifdef BRICKD_WITH_RED_BRICK
-	if (gpio_red_init() < 0) {
-		goto cleanup;
-	}
-
-	phase = 12;
-
-	if (redapid_init() < 0) {
-		goto cleanup;
-	}
-
-	phase = 13;
-
-	if (red_stack_init() < 0) {
-		goto cleanup;
-	}
-
-	phase = 14;
-
-	if (red_extension_init() < 0) {
-		goto cleanup;
-	}
-
-	phase = 15;
-
-	if (red_usb_gadget_init() < 0) {
+	if (library_run() < 0) {
 		goto cleanup;
 	}
 
-	phase = 16;
-
-	red_led_set_trigger(RED_LED_GREEN, config_get_option_value("led_trigger.green")->symbol);
-	red_led_set_trigger(RED_LED_RED, config_get_option_value("led_trigger.red")->symbol);
-#endif
-
-#ifdef BRICKD_WITH_BRICKLET
-
-	if (bricklet_init() < 0) {
-		goto cleanup;
-	}
-
-	phase = 17;
-#endif
-
-	if (event_run(handle_event_cleanup) < 0) {
-		goto cleanup;
-	}
-
-#ifdef BRICKD_WITH_RED_BRICK
-	hardware_announce_disconnect();
-	network_announce_red_brick_disconnect();
-	red_usb_gadget_announce_red_brick_disconnect();
-#endif
-
 	exit_code = EXIT_SUCCESS;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-#ifdef BRICKD_WITH_BRICKLET
-	case 17:
-		bricklet_exit();
-#endif
-		// fall through
-
-#ifdef BRICKD_WITH_RED_BRICK
-	case 16:
-		red_usb_gadget_exit();
-		// fall through
-
-	case 15:
-		red_extension_exit();
-		// fall through
-
-	case 14:
-		red_stack_exit();
-		// fall through
-
-	case 13:
-		redapid_exit();
-		// fall through
-
-	case 12:
-		//gpio_red_exit();
-#endif
-		// fall through
-
-	case 11:
-		mesh_exit();
-		// fall through
-
-	case 10:
-		network_exit();
-
-#ifdef BRICKD_WITH_LIBUDEV
-		// fall through
-
-	case 9:
-		if (initialized_udev) {
-			udev_exit();
-		}
-#endif
-		// fall through
-
-	case 8:
-		usb_exit();
-		// fall through
-
 	case 7:
-		hardware_exit();
+		library_exit_subsystems();
 		// fall through
 
 	case 6:
-		signal_exit();
+		statistics_exit();
 		// fall through
 
 	case 5:
-		event_exit();
-
-#ifdef BRICKD_WITH_LIBUSB_DLOPEN
+		signal_exit();
 		// fall through
 
 	case 4:
-		libusb_exit_dlopen();
-#endif
+		library_exit_event_loop();
 		// fall through
 
 	case 3:
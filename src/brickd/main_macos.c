@@ -43,6 +43,7 @@
 #include "network.h"
 #include "usb.h"
 #include "mesh.h"
+#include "statistics.h"
 #include "version.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -241,36 +242,42 @@ int main(int argc, char **argv) {
 
 	phase = 5;
 
-	if (hardware_init() < 0) {
+	if (statistics_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 6;
 
-	if (usb_init() < 0) {
+	if (hardware_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 7;
 
-	if (iokit_init() < 0) {
+	if (usb_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 8;
 
-	if (network_init() < 0) {
+	if (iokit_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 9;
 
-	if (mesh_init() < 0) {
+	if (network_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 10;
 
+	if (mesh_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 11;
+
 	if (event_run(handle_event_cleanup) < 0) {
 		goto cleanup;
 	}
@@ -279,26 +286,30 @@ int main(int argc, char **argv) {
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 10:
+	case 11:
 		mesh_exit();
 		// fall through
 
-	case 9:
+	case 10:
 		network_exit();
 		// fall through
 
-	case 8:
+	case 9:
 		iokit_exit();
 		// fall through
 
-	case 7:
+	case 8:
 		usb_exit();
 		// fall through
 
-	case 6:
+	case 7:
 		hardware_exit();
 		// fall through
 
+	case 6:
+		statistics_exit();
+		// fall through
+
 	case 5:
 		signal_exit();
 		// fall through
@@ -38,6 +38,7 @@
 #include "mesh.h"
 
 #include "mesh_stack.h"
+#include "resolver.h"
 
 Array mesh_stacks;
 
@@ -82,9 +83,7 @@ void mesh_handle_accept(void *opaque) {
 	Socket *client_socket;
 	struct sockaddr_storage address;
 	socklen_t length = sizeof(address);
-	char hostname[NI_MAXHOST];
-	char port[NI_MAXSERV];
-	char buffer[NI_MAXHOST + NI_MAXSERV + 4]; // 4 == strlen("[]:") + 1
+	char buffer[RESOLVER_MAX_NAME_LENGTH];
 	char *name = "<unknown>";
 
 	(void)opaque;
@@ -103,21 +102,10 @@ void mesh_handle_accept(void *opaque) {
 		return;
 	}
 
-	if (socket_address_to_hostname((struct sockaddr *)&address,
-	                               length,
-	                               hostname,
-	                               sizeof(hostname),
-	                               port,
-	                               sizeof(port)) < 0) {
-		log_warn("Could not get hostname and port of mesh client (socket: %d): %s (%d)",
-		         client_socket->handle, get_errno_name(errno), errno);
-	} else {
-		if (address.ss_family == AF_INET6) {
-			snprintf(buffer, sizeof(buffer), "[%s]:%s", hostname, port);
-		} else {
-			snprintf(buffer, sizeof(buffer), "%s:%s", hostname, port);
-		}
-
+	// mesh stacks are named by their numeric address only, a reverse lookup
+	// could block the event loop
+	if (resolver_format_numeric_name((struct sockaddr *)&address, length,
+	                                 buffer, sizeof(buffer)) == 0) {
 		name = buffer;
 	}
 
@@ -188,3 +176,17 @@ void mesh_cleanup_stacks(void) {
 		}
 	}
 }
+
+void mesh_log_statistics(void) {
+	int i;
+
+	if (mesh_stacks.count == 0) {
+		log_info("No mesh stacks connected");
+
+		return;
+	}
+
+	for (i = 0; i < mesh_stacks.count; ++i) {
+		mesh_stack_log_statistics(array_get(&mesh_stacks, i));
+	}
+}
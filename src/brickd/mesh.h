@@ -30,5 +30,6 @@ void mesh_exit(void);
 void mesh_handle_accept(void *opaque);
 int mesh_start_listening(void);
 void mesh_cleanup_stacks(void);
+void mesh_log_statistics(void);
 
 #endif // BRICKD_MESH_H
@@ -43,6 +43,12 @@ void mesh_packet_header_set_direction(MeshPacketHeader *header, MeshPacketDirect
 	header->flags |= ((uint16_t)direction & 0x01) << 8;
 }
 
+// the layer of the source node in the ESP-mesh tree, the root node is on layer
+// 1. the firmware sets it in upward packets, older firmware leaves it as 0
+uint8_t mesh_packet_header_get_layer(MeshPacketHeader *header) {
+	return header->flags & 0xFF;
+}
+
 bool mesh_packet_header_get_p2p(MeshPacketHeader *header) {
 	return ((header->flags >> 9) & 0x01) == 0x01;
 }
@@ -128,6 +134,14 @@ bool mesh_packet_header_is_valid_response(MeshPacketHeader *header, const char *
 			return false;
 		}
 
+		if (header->length > sizeof(MeshPayloadPacket)) {
+			if (message != NULL) {
+				*message = "Length is too big";
+			}
+
+			return false;
+		}
+
 		break;
 
 	default:
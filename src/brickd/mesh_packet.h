@@ -52,7 +52,7 @@ typedef enum {
 #include <daemonlib/packed_begin.h>
 
 typedef struct {
-	uint16_t flags; // 6 bit protocol, 1 bit p2p, 1 bit direction, 8 bit unused
+	uint16_t flags; // 6 bit protocol, 1 bit p2p, 1 bit direction, 8 bit layer
 	uint16_t length; // packet length including header
 	uint8_t dst_addr[ESP_MESH_ADDRESS_LEN]; // Destination address.
 	uint8_t src_addr[ESP_MESH_ADDRESS_LEN]; // Source address.
@@ -91,6 +91,8 @@ typedef struct {
 MeshPacketDirection mesh_packet_header_get_direction(MeshPacketHeader *header);
 void mesh_packet_header_set_direction(MeshPacketHeader *header, MeshPacketDirection direction);
 
+uint8_t mesh_packet_header_get_layer(MeshPacketHeader *header);
+
 bool mesh_packet_header_get_p2p(MeshPacketHeader *header);
 void mesh_packet_header_set_p2p(MeshPacketHeader *header, bool p2p);
 
@@ -21,6 +21,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -39,10 +40,109 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 extern Array mesh_stacks;
 
+// returns NULL if the node is unknown and cannot be added anymore
+static MeshNode *mesh_stack_get_node(MeshStack *mesh_stack, uint8_t *addr) {
+	MeshNode *node;
+	int i;
+
+	for (i = 0; i < mesh_stack->nodes.count; ++i) {
+		node = array_get(&mesh_stack->nodes, i);
+
+		if (memcmp(node->addr, addr, ESP_MESH_ADDRESS_LEN) == 0) {
+			return node;
+		}
+	}
+
+	if (mesh_stack->nodes.count >= MESH_STACK_MAX_NODES) {
+		return NULL;
+	}
+
+	node = array_append(&mesh_stack->nodes);
+
+	if (node == NULL) {
+		log_error("Could not append to mesh node array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return NULL;
+	}
+
+	memset(node, 0, sizeof(MeshNode));
+	memcpy(node->addr, addr, ESP_MESH_ADDRESS_LEN);
+
+	return node;
+}
+
+static void mesh_stack_count_sent(MeshStack *mesh_stack, uint8_t *addr, int length) {
+	MeshNode *node = mesh_stack_get_node(mesh_stack, addr);
+
+	if (node != NULL) {
+		++node->packets_sent;
+		node->bytes_sent += length;
+	}
+}
+
+static void mesh_node_add_rtt(MeshNode *node, uint64_t rtt) {
+	uint32_t value = rtt > UINT32_MAX ? UINT32_MAX : (uint32_t)rtt;
+
+	if (node->rtt_count == 0 || value < node->rtt_min) {
+		node->rtt_min = value;
+	}
+
+	if (value > node->rtt_max) {
+		node->rtt_max = value;
+	}
+
+	node->rtt_last = value;
+	node->rtt_sum += value;
+	++node->rtt_count;
+}
+
+// remember the send time of a request to measure the round trip on response.
+// if more requests are in flight than can be remembered the oldest one is
+// overwritten and its response is not timed
+static void mesh_node_add_timed_request(MeshNode *node, Packet *request) {
+	MeshNodeTimedRequest *timed_request = &node->timed_requests[node->timed_request_next];
+
+	timed_request->uid = request->header.uid;
+	timed_request->function_id = request->header.function_id;
+	timed_request->sequence_number = packet_header_get_sequence_number(&request->header);
+	timed_request->sent = microseconds();
+
+	node->timed_request_next = (node->timed_request_next + 1) % MESH_NODE_MAX_TIMED_REQUESTS;
+}
+
+static void mesh_node_handle_timed_response(MeshNode *node, Packet *response) {
+	MeshNodeTimedRequest *timed_request;
+	uint8_t sequence_number = packet_header_get_sequence_number(&response->header);
+	int i;
+
+	if (sequence_number == 0) {
+		return; // callbacks have no request
+	}
+
+	for (i = 0; i < MESH_NODE_MAX_TIMED_REQUESTS; ++i) {
+		timed_request = &node->timed_requests[i];
+
+		if (timed_request->uid != 0 &&
+		    timed_request->uid == response->header.uid &&
+		    timed_request->function_id == response->header.function_id &&
+		    timed_request->sequence_number == sequence_number) {
+			mesh_node_add_rtt(node, microseconds() - timed_request->sent);
+
+			timed_request->uid = 0;
+
+			return;
+		}
+	}
+}
+
 static void mesh_stack_recv_handler(void *opaque) {
 	int length = 0;
+	int available;
 	uint8_t mesh_pkt_type = 0;
 	MeshStack *mesh_stack = (MeshStack *)opaque;
+	MeshNode *node;
+	uint8_t layer;
 	const char *message = NULL;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
@@ -93,17 +193,23 @@ static void mesh_stack_recv_handler(void *opaque) {
 
 	mesh_stack->response_buffer_used += length;
 
-	while (!mesh_stack->cleanup && mesh_stack->response_buffer_used > 0) {
-		if (mesh_stack->response_buffer_used < (int)sizeof(MeshPacketHeader)) {
+	// handle all complete packets in place. instead of moving the remaining
+	// data to the front of the buffer after each packet only the start offset
+	// is advanced. the incomplete tail (if any) is moved once after the loop
+	while (!mesh_stack->cleanup && mesh_stack->response_buffer_used > mesh_stack->response_buffer_start) {
+		available = mesh_stack->response_buffer_used - mesh_stack->response_buffer_start;
+		mesh_stack->response = mesh_stack->response_buffer + mesh_stack->response_buffer_start;
+
+		if (available < (int)sizeof(MeshPacketHeader)) {
 			// wait for complete header
 			break;
 		}
 
 		// Now we have a complete mesh header.
 		if (!mesh_stack->response_header_checked) {
-			if (!mesh_packet_header_is_valid_response(&mesh_stack->response_header, &message)) {
+			if (!mesh_packet_header_is_valid_response(mesh_stack->response_header, &message)) {
 				log_error("Received invalid mesh response (packet: %s) from mesh stack (N: %s), disconnecting mesh stack: %s",
-				          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response_buffer, mesh_stack->response_buffer_used),
+				          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response, available),
 				          mesh_stack->name, message);
 
 				mesh_stack->cleanup = true;
@@ -114,16 +220,30 @@ static void mesh_stack_recv_handler(void *opaque) {
 			mesh_stack->response_header_checked = true;
 		}
 
-		length = mesh_stack->response_header.length;
-
-		// FIXME: add mesh_header->len validation
+		// the header check limits the length to the packet type, so a packet
+		// always fits into the response buffer
+		length = mesh_stack->response_header->length;
 
-		if (mesh_stack->response_buffer_used < length) {
+		if (available < length) {
 			// wait for complete packet
 			break;
 		}
 
-		mesh_pkt_type = mesh_stack->response_header.type;
+		node = mesh_stack_get_node(mesh_stack, mesh_stack->response_header->src_addr);
+
+		if (node != NULL) {
+			++node->packets_received;
+			node->bytes_received += length;
+
+			layer = mesh_packet_header_get_layer(mesh_stack->response_header);
+
+			// the node can move in the tree, keep the latest layer
+			if (layer > 0) {
+				node->hop_count = layer;
+			}
+		}
+
+		mesh_pkt_type = mesh_stack->response_header->type;
 
 		// Handle mesh hello packet.
 		if (mesh_pkt_type == MESH_PACKET_TYPE_HELLO) {
@@ -139,11 +259,11 @@ static void mesh_stack_recv_handler(void *opaque) {
 		}
 		// Handle TFP packet.
 		else if (mesh_pkt_type == MESH_PACKET_TYPE_PAYLOAD) {
-			if (mesh_stack->payload_response.header.length != sizeof(MeshPacketHeader) + mesh_stack->payload_response.payload.header.length) {
+			if (mesh_stack->payload_response->header.length != sizeof(MeshPacketHeader) + mesh_stack->payload_response->payload.header.length) {
 				log_error("Received mesh response (packet: %s) with length mismatch (outer: %d != header + inner: %d) from mesh stack (N: %s), disconnecting mesh stack",
-				          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response_buffer, mesh_stack->response_buffer_used),
-				          mesh_stack->payload_response.header.length,
-				          (int)sizeof(MeshPacketHeader) + mesh_stack->payload_response.payload.header.length,
+				          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response, available),
+				          mesh_stack->payload_response->header.length,
+				          (int)sizeof(MeshPacketHeader) + mesh_stack->payload_response->payload.header.length,
 				          mesh_stack->name);
 
 				mesh_stack->cleanup = true;
@@ -151,9 +271,9 @@ static void mesh_stack_recv_handler(void *opaque) {
 				return;
 			}
 
-			if (!packet_header_is_valid_response(&mesh_stack->payload_response.payload.header, &message)) {
+			if (!packet_header_is_valid_response(&mesh_stack->payload_response->payload.header, &message)) {
 				log_error("Received invalid response (packet: %s) from mesh stack (N: %s), disconnecting mesh stack: %s",
-				          packet_get_dump(packet_dump, &mesh_stack->payload_response.payload, mesh_stack->response_buffer_used - sizeof(MeshPacketHeader)),
+				          packet_get_dump(packet_dump, &mesh_stack->payload_response->payload, available - sizeof(MeshPacketHeader)),
 				          mesh_stack->name,
 				          message);
 
@@ -167,16 +287,33 @@ static void mesh_stack_recv_handler(void *opaque) {
 		// Packet type is unknown.
 		else {
 			log_error("Unknown mesh packet (packet: %s) type received: %d",
-			          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response_buffer, mesh_stack->response_buffer_used),
+			          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response, available),
 			          mesh_pkt_type);
 		}
 
-		memmove(mesh_stack->response_buffer, mesh_stack->response_buffer + length,
-		        mesh_stack->response_buffer_used - length);
-
-		mesh_stack->response_buffer_used -= length;
+		mesh_stack->response_buffer_start += length;
 		mesh_stack->response_header_checked = false;
 	}
+
+	mesh_stack->response = NULL;
+
+	if (mesh_stack->cleanup) {
+		return;
+	}
+
+	if (mesh_stack->response_buffer_start == mesh_stack->response_buffer_used) {
+		mesh_stack->response_buffer_start = 0;
+		mesh_stack->response_buffer_used = 0;
+	} else if (mesh_stack->response_buffer_start > 0) {
+		// move the incomplete packet to the front of the buffer. this copies
+		// less than one packet and only happens once per read
+		memmove(mesh_stack->response_buffer,
+		        mesh_stack->response_buffer + mesh_stack->response_buffer_start,
+		        mesh_stack->response_buffer_used - mesh_stack->response_buffer_start);
+
+		mesh_stack->response_buffer_used -= mesh_stack->response_buffer_start;
+		mesh_stack->response_buffer_start = 0;
+	}
 }
 
 static void timer_wait_hello_handler(void *opaque) {
@@ -238,6 +375,10 @@ void timer_hb_do_ping_handler(void *opaque) {
 
 		mesh_stack->cleanup = true;
 	} else {
+		mesh_stack->ping_sent = microseconds();
+
+		mesh_stack_count_sent(mesh_stack, mesh_stack->root_node_addr, pkt_mesh_hb.header.length);
+
 		log_debug("Arming wait pong timer for mesh stack (N: %s)",
 		          mesh_stack->name);
 
@@ -264,7 +405,8 @@ void timer_hb_wait_pong_handler(void *opaque) {
 
 void hello_recv_handler(MeshStack *mesh_stack) {
 	char prefix_str[17];
-	MeshHelloPacket *pkt_mesh_hello = &mesh_stack->hello_response;
+	MeshHelloPacket *pkt_mesh_hello = mesh_stack->hello_response;
+	MeshNode *node;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	log_debug("Received mesh packet (T: HELLO, L: %d, packet: %s) from mesh stack (N: %s)",
@@ -274,6 +416,18 @@ void hello_recv_handler(MeshStack *mesh_stack) {
 
 	timer_configure(&mesh_stack->timer_wait_hello, 0, 0);
 
+	node = mesh_stack_get_node(mesh_stack, pkt_mesh_hello->header.src_addr);
+
+	if (node != NULL) {
+		node->is_root = pkt_mesh_hello->is_root_node != 0;
+
+		// older firmware doesn't report the layer, but the root node is
+		// always on layer 1
+		if (node->is_root && node->hop_count == 0) {
+			node->hop_count = 1;
+		}
+	}
+
 	if (pkt_mesh_hello->is_root_node) {
 		memset(&prefix_str, 0, sizeof(prefix_str));
 		memcpy(&prefix_str, &pkt_mesh_hello->prefix, sizeof(pkt_mesh_hello->prefix));
@@ -331,7 +485,8 @@ void hello_recv_handler(MeshStack *mesh_stack) {
 
 void tfp_recv_handler(MeshStack *mesh_stack) {
 	uint64_t mesh_src_addr = 0;
-	MeshPayloadPacket *pkt_mesh_tfp = &mesh_stack->payload_response;
+	MeshPayloadPacket *pkt_mesh_tfp = mesh_stack->payload_response;
+	MeshNode *node;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	// FIXME: the stack is not fully initialized until the hello packet is received
@@ -370,6 +525,12 @@ void tfp_recv_handler(MeshStack *mesh_stack) {
 		return;
 	}
 
+	node = mesh_stack_get_node(mesh_stack, pkt_mesh_tfp->header.src_addr);
+
+	if (node != NULL) {
+		mesh_node_handle_timed_response(node, &pkt_mesh_tfp->payload);
+	}
+
 	network_dispatch_response(&pkt_mesh_tfp->payload);
 
 	log_debug("TFP packet dispatched (L: %d)", pkt_mesh_tfp->payload.header.length);
@@ -399,6 +560,8 @@ void mesh_stack_destroy(MeshStack *mesh_stack) {
 		stack_destroy(&mesh_stack->base);
 	}
 
+	array_destroy(&mesh_stack->nodes, NULL);
+
 	if (mesh_stack->state == MESH_STACK_STATE_WAIT_HELLO) {
 		log_info("Mesh stack %s released (S: WAIT_HELLO)",
 		         mesh_stack->name);
@@ -429,6 +592,16 @@ int mesh_stack_create(char *name, Socket *sock) {
 	 */
 	mesh_stack->state = MESH_STACK_STATE_WAIT_HELLO;
 
+	if (array_create(&mesh_stack->nodes, 8, sizeof(MeshNode), true) < 0) {
+		log_error("Could not create mesh node array: %s (%d)",
+		          get_errno_name(errno),
+		          errno);
+
+		array_remove(&mesh_stacks, mesh_stacks.count - 1, NULL);
+
+		return -1;
+	}
+
 	if (event_add_source(sock->handle, EVENT_SOURCE_TYPE_GENERIC, "mesh-stack",
 	                     EVENT_READ, mesh_stack_recv_handler, mesh_stack) < 0) {
 		log_error("Failed to add stack receive event");
@@ -443,8 +616,13 @@ int mesh_stack_create(char *name, Socket *sock) {
 	// Initialise the mesh stack.
 	mesh_stack->sock = sock;
 	mesh_stack->cleanup = false;
+	mesh_stack->response_buffer_start = 0;
 	mesh_stack->response_buffer_used = 0;
 	mesh_stack->response_header_checked = false;
+	mesh_stack->response = NULL;
+	mesh_stack->ping_sent = 0;
+	mesh_stack->broadcast_packets_sent = 0;
+	mesh_stack->broadcast_bytes_sent = 0;
 
 	snprintf(mesh_stack->name, sizeof(mesh_stack->name), "%s", name);
 
@@ -524,7 +702,7 @@ int mesh_stack_create(char *name, Socket *sock) {
 
 void hb_ping_recv_handler(MeshStack *mesh_stack) {
 	MeshHeartBeatPacket pkt_mesh_hb_pong;
-	MeshHeartBeatPacket *pkt_mesh_hb_ping = &mesh_stack->heart_beat_response;
+	MeshHeartBeatPacket *pkt_mesh_hb_ping = mesh_stack->heart_beat_response;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	log_debug("Received mesh ping packet (T: PING, L: %d, A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
@@ -548,6 +726,8 @@ void hb_ping_recv_handler(MeshStack *mesh_stack) {
 	if (socket_send(mesh_stack->sock, &pkt_mesh_hb_pong, pkt_mesh_hb_pong.header.length) < 0) {
 		log_error("Failed to send mesh pong packet");
 	} else {
+		mesh_stack_count_sent(mesh_stack, pkt_mesh_hb_pong.header.dst_addr, pkt_mesh_hb_pong.header.length);
+
 		log_debug("Sent mesh pong packet (A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
 		          pkt_mesh_hb_pong.header.dst_addr[0],
 		          pkt_mesh_hb_pong.header.dst_addr[1],
@@ -560,11 +740,22 @@ void hb_ping_recv_handler(MeshStack *mesh_stack) {
 }
 
 void hb_pong_recv_handler(MeshStack *mesh_stack) {
-	MeshHeartBeatPacket *pkt_mesh_hb = &mesh_stack->heart_beat_response;
+	MeshHeartBeatPacket *pkt_mesh_hb = mesh_stack->heart_beat_response;
+	MeshNode *node;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	timer_configure(&mesh_stack->timer_hb_wait_pong, 0, 0);
 
+	if (mesh_stack->ping_sent != 0) {
+		node = mesh_stack_get_node(mesh_stack, pkt_mesh_hb->header.src_addr);
+
+		if (node != NULL) {
+			mesh_node_add_rtt(node, microseconds() - mesh_stack->ping_sent);
+		}
+
+		mesh_stack->ping_sent = 0;
+	}
+
 	log_debug("Received mesh pong packet (T: PONG, L: %d, A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
 	          pkt_mesh_hb->header.length,
 	          pkt_mesh_hb->header.src_addr[0],
@@ -625,7 +816,7 @@ bool hello_root_recv_handler(MeshStack *mesh_stack) {
 	char prefix_str[17];
 	MeshOllehPacket olleh_mesh_pkt;
 	MeshStack *mesh_stack_from_list = NULL;
-	MeshHelloPacket *hello_mesh_pkt = &mesh_stack->hello_response;
+	MeshHelloPacket *hello_mesh_pkt = mesh_stack->hello_response;
 	int i;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
@@ -887,6 +1078,7 @@ int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipi
 	char base58[BASE58_MAX_LENGTH];
 	uint8_t dst_addr[ESP_MESH_ADDRESS_LEN];
 	MeshStack *mesh_stack = (MeshStack *)stack;
+	MeshNode *node;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	memset(&dst_addr, 0, sizeof(dst_addr));
@@ -951,6 +1143,22 @@ int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipi
 
 		return -1;
 	} else {
+		if (is_broadcast) {
+			++mesh_stack->broadcast_packets_sent;
+			mesh_stack->broadcast_bytes_sent += tfp_mesh_pkt.header.length;
+		} else {
+			node = mesh_stack_get_node(mesh_stack, dst_addr);
+
+			if (node != NULL) {
+				++node->packets_sent;
+				node->bytes_sent += tfp_mesh_pkt.header.length;
+
+				if (packet_header_get_response_expected(&request->header)) {
+					mesh_node_add_timed_request(node, request);
+				}
+			}
+		}
+
 		if (is_broadcast) {
 			log_debug("TFP packet sent to mesh (L: %d, B: %d, packet: %s)",
 			          request->header.length,
@@ -990,7 +1198,7 @@ void arm_timer_cleanup_after_reset_sent(MeshStack *mesh_stack) {
 
 bool hello_non_root_recv_handler(MeshStack *mesh_stack) {
 	MeshOllehPacket olleh_mesh_pkt;
-	MeshHelloPacket *hello_mesh_pkt = &mesh_stack->hello_response;
+	MeshHelloPacket *hello_mesh_pkt = mesh_stack->hello_response;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	// Prepare the olleh packet.
@@ -1035,3 +1243,38 @@ bool hello_non_root_recv_handler(MeshStack *mesh_stack) {
 
 	return true;
 }
+
+void mesh_stack_log_statistics(MeshStack *mesh_stack) {
+	MeshNode *node;
+	int i;
+
+	log_info("Mesh stack %s statistics (nodes: %d, broadcasts sent: %u packet(s), %"PRIu64" byte(s))",
+	         mesh_stack->name,
+	         mesh_stack->nodes.count,
+	         mesh_stack->broadcast_packets_sent,
+	         mesh_stack->broadcast_bytes_sent);
+
+	for (i = 0; i < mesh_stack->nodes.count; ++i) {
+		node = array_get(&mesh_stack->nodes, i);
+
+		log_info("Mesh node of mesh stack %s (A: %02X-%02X-%02X-%02X-%02X-%02X, R: %d, H: %d, sent: %u packet(s) %"PRIu64" byte(s), received: %u packet(s) %"PRIu64" byte(s), RTT: %u sample(s) last/min/avg/max %u/%u/%u/%u us)",
+		         mesh_stack->name,
+		         node->addr[0],
+		         node->addr[1],
+		         node->addr[2],
+		         node->addr[3],
+		         node->addr[4],
+		         node->addr[5],
+		         node->is_root ? 1 : 0,
+		         node->hop_count,
+		         node->packets_sent,
+		         node->bytes_sent,
+		         node->packets_received,
+		         node->bytes_received,
+		         node->rtt_count,
+		         node->rtt_last,
+		         node->rtt_min,
+		         node->rtt_count > 0 ? (uint32_t)(node->rtt_sum / node->rtt_count) : 0,
+		         node->rtt_max);
+	}
+}
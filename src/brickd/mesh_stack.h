@@ -23,6 +23,9 @@
 #ifndef BRICKD_MESH_STACK_H
 #define BRICKD_MESH_STACK_H
 
+#include <stdint.h>
+
+#include <daemonlib/array.h>
 #include <daemonlib/timer.h>
 #include <daemonlib/socket.h>
 
@@ -31,6 +34,9 @@
 
 #define MAX_MESH_STACKS 64
 
+// big enough to receive callbacks from many mesh nodes with a single read
+#define MESH_STACK_RESPONSE_BUFFER_SIZE 4096
+
 #define MESH_STACK_STATE_WAIT_HELLO 1
 #define MESH_STACK_STATE_OPERATIONAL 2
 
@@ -40,6 +46,38 @@
 #define TIME_HB_WAIT_PONG (TIME_HB_DO_PING/2)
 #define TIME_CLEANUP_AFTER_RESET_SENT 4000000
 
+// per mesh stack telemetry is kept for up to this many nodes
+#define MESH_STACK_MAX_NODES 64
+// requests per node whose send time is remembered to measure the round trip
+#define MESH_NODE_MAX_TIMED_REQUESTS 8
+
+typedef struct {
+	uint32_t uid; // always little endian, 0 if unused
+	uint8_t function_id;
+	uint8_t sequence_number;
+	uint64_t sent; // in microseconds
+} MeshNodeTimedRequest;
+
+// the hop count is the layer of the node in the ESP-mesh tree as reported in
+// its packets, that is the number of hops to the router. round trip times are
+// measured from heartbeats (root node only) and from request/response pairs
+typedef struct {
+	uint8_t addr[ESP_MESH_ADDRESS_LEN];
+	bool is_root;
+	uint8_t hop_count; // 0 if unknown
+	uint32_t packets_sent;
+	uint32_t packets_received;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	uint32_t rtt_count;
+	uint64_t rtt_sum; // in microseconds
+	uint32_t rtt_min; // in microseconds
+	uint32_t rtt_max; // in microseconds
+	uint32_t rtt_last; // in microseconds
+	MeshNodeTimedRequest timed_requests[MESH_NODE_MAX_TIMED_REQUESTS];
+	int timed_request_next;
+} MeshNode;
+
 // Mesh stack struct.
 typedef struct {
 	/*
@@ -57,18 +95,25 @@ typedef struct {
 	Timer timer_hb_wait_pong;
 	char name[STACK_MAX_NAME_LENGTH];
 	Timer timer_cleanup_after_reset_sent;
+	uint64_t ping_sent; // in microseconds, 0 if no pong is expected
+	Array nodes;
+	uint32_t broadcast_packets_sent;
+	uint64_t broadcast_bytes_sent;
 	uint8_t root_node_firmware_version[3];
 	uint8_t gw_addr[ESP_MESH_ADDRESS_LEN];
 	uint8_t root_node_addr[ESP_MESH_ADDRESS_LEN];
+	uint8_t response_buffer[MESH_STACK_RESPONSE_BUFFER_SIZE];
+	int response_buffer_start; // offset of the first unprocessed byte
+	int response_buffer_used; // offset of the first unused byte
+	bool response_header_checked;
+	// points into the response buffer at the packet that is currently handled
 	union {
-		uint8_t response_buffer[512];
-		MeshPacketHeader response_header;
-		MeshHelloPacket hello_response;
-		MeshHeartBeatPacket heart_beat_response;
-		MeshPayloadPacket payload_response;
+		uint8_t *response;
+		MeshPacketHeader *response_header;
+		MeshHelloPacket *hello_response;
+		MeshHeartBeatPacket *heart_beat_response;
+		MeshPayloadPacket *payload_response;
 	};
-	int response_buffer_used;
-	bool response_header_checked;
 } MeshStack;
 
 void timer_hb_do_ping_handler(void *opaque);
@@ -85,5 +130,6 @@ bool hello_root_recv_handler(MeshStack *mesh_stack);
 bool hello_non_root_recv_handler(MeshStack *mesh_stack);
 void arm_timer_cleanup_after_reset_sent(MeshStack *mesh_stack);
 int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipient);
+void mesh_stack_log_statistics(MeshStack *mesh_stack);
 
 #endif // BRICKD_MESH_STACK_H
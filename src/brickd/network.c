@@ -43,7 +43,10 @@
 
 #include "network.h"
 
+#include "flash_job.h"
 #include "hmac.h"
+#include "resolver.h"
+#include "rules.h"
 #include "websocket.h"
 #include "zombie.h"
 
@@ -54,16 +57,41 @@ static Array _zombies;
 static Array _plain_server_sockets;
 static Array _websocket_server_sockets;
 static uint32_t _next_authentication_nonce = 0;
-static Node _pending_request_sentinel;
+
+// the global pending request list is sharded by UID. matching a response only
+// walks the shard of its UID instead of all pending requests of all clients.
+// requests for the same UID stay in the order they were received in. the
+// pending request benchmark compares this with a single shard
+#ifndef PENDING_REQUEST_SHARD_COUNT
+	#define PENDING_REQUEST_SHARD_COUNT 64 // keep as power of 2
+#endif
+
+static Node _pending_request_shards[PENDING_REQUEST_SHARD_COUNT];
+
+static Node *network_get_pending_request_shard(uint32_t uid /* always little endian */) {
+	// mix all bits of the UID into the shard index
+	uid ^= uid >> 16;
+	uid *= 0x45d9f3b;
+	uid ^= uid >> 16;
+
+	return &_pending_request_shards[uid & (PENDING_REQUEST_SHARD_COUNT - 1)];
+}
+
+static void network_handle_resolved_name(void *opaque, const char *name) {
+	Client *client = opaque;
+
+	log_debug("Resolved host name of client ("CLIENT_SIGNATURE_FORMAT") to %s",
+	          client_expand_signature(client), name);
+
+	string_copy(client->name, sizeof(client->name), name, -1);
+}
 
 static void network_handle_accept(void *opaque) {
 	Socket *server_socket = opaque;
 	Socket *client_socket;
 	struct sockaddr_storage address;
 	socklen_t length = sizeof(address);
-	char hostname[NI_MAXHOST];
-	char port[NI_MAXSERV];
-	char buffer[NI_MAXHOST + NI_MAXSERV + 4]; // 4 == strlen("[]:") + 1
+	char buffer[RESOLVER_MAX_NAME_LENGTH];
 	char *name = "<unknown>";
 	Client *client;
 
@@ -79,18 +107,10 @@ static void network_handle_accept(void *opaque) {
 		return;
 	}
 
-	if (socket_address_to_hostname((struct sockaddr *)&address, length,
-	                               hostname, sizeof(hostname),
-	                               port, sizeof(port)) < 0) {
-		log_warn("Could not get hostname and port of client (socket: %d): %s (%d)",
-		         client_socket->handle, get_errno_name(errno), errno);
-	} else {
-		if (address.ss_family == AF_INET6) {
-			snprintf(buffer, sizeof(buffer), "[%s]:%s", hostname, port);
-		} else {
-			snprintf(buffer, sizeof(buffer), "%s:%s", hostname, port);
-		}
-
+	// name the client by its numeric address for now. looking up the host
+	// name here could block the event loop for seconds
+	if (resolver_format_numeric_name((struct sockaddr *)&address, length,
+	                                 buffer, sizeof(buffer)) == 0) {
 		name = buffer;
 	}
 
@@ -104,6 +124,12 @@ static void network_handle_accept(void *opaque) {
 		return;
 	}
 
+	if (resolver_resolve_name((struct sockaddr *)&address, length,
+	                          network_handle_resolved_name, client) < 0) {
+		log_warn("Could not queue host name lookup for client ("CLIENT_SIGNATURE_FORMAT")",
+		         client_expand_signature(client));
+	}
+
 #ifdef BRICKD_WITH_RED_BRICK
 	client_send_red_brick_enumerate(client, ENUMERATION_TYPE_CONNECTED);
 #endif
@@ -145,14 +171,15 @@ static void network_destroy_server_socket(Socket *server_socket) {
 	socket_destroy(server_socket);
 }
 
-// drop all pending requests for the given UID from the global list
+// drop all pending requests for the given UID from its shard of the global list
 static int network_drop_pending_requests(uint32_t uid) {
-	Node *pending_request_global_node = _pending_request_sentinel.next;
+	Node *pending_request_shard = network_get_pending_request_shard(uid);
+	Node *pending_request_global_node = pending_request_shard->next;
 	Node *pending_request_global_node_next;
 	PendingRequest *pending_request;
 	int count = 0;
 
-	while (pending_request_global_node != &_pending_request_sentinel) {
+	while (pending_request_global_node != pending_request_shard) {
 		pending_request = containerof(pending_request_global_node,
 		                              PendingRequest, global_node);
 		pending_request_global_node_next = pending_request_global_node->next;
@@ -171,12 +198,15 @@ static int network_drop_pending_requests(uint32_t uid) {
 
 int network_init(void) {
 	int phase = 0;
+	int i;
 	uint16_t plain_port = (uint16_t)config_get_option_value("listen.plain_port")->integer;
 	uint16_t websocket_port = (uint16_t)config_get_option_value("listen.websocket_port")->integer;
 
 	log_debug("Initializing network subsystem");
 
-	node_reset(&_pending_request_sentinel);
+	for (i = 0; i < PENDING_REQUEST_SHARD_COUNT; ++i) {
+		node_reset(&_pending_request_shards[i]);
+	}
 
 	if (config_get_option_value("authentication.secret")->string != NULL) {
 		log_info("Authentication is enabled");
@@ -246,8 +276,25 @@ int network_init(void) {
 
 	phase = 5;
 
+	if (rules_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 6;
+
+	if (resolver_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 7;
+
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 6:
+		rules_exit();
+		// fall through
+
+	case 5:
 	case 4:
 		array_destroy(&_websocket_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 		// fall through
@@ -268,12 +315,15 @@ cleanup:
 		break;
 	}
 
-	return phase == 5 ? 0 : -1;
+	return phase == 7 ? 0 : -1;
 }
 
 void network_exit(void) {
 	log_debug("Shutting down network subsystem");
 
+	resolver_exit(); // before the clients are destroyed, no lookup can finish afterwards
+	rules_exit();
+
 	array_destroy(&_websocket_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 	array_destroy(&_plain_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 	array_destroy(&_clients, (ItemDestroyFunction)client_destroy); // might call network_create_zombie
@@ -345,7 +395,11 @@ void network_cleanup_clients_and_zombies(void) {
 			log_debug("Removing disconnected client ("CLIENT_SIGNATURE_FORMAT")",
 			          client_expand_signature(client));
 
+			resolver_cancel(client);
+
 			array_remove(&_clients, i, (ItemDestroyFunction)client_destroy);
+		} else {
+			client_flush_callback_backlog(client);
 		}
 	}
 
@@ -392,7 +446,8 @@ void network_client_expects_response(Client *client, Packet *request) {
 		return;
 	}
 
-	node_insert_before(&_pending_request_sentinel, &pending_request->global_node);
+	node_insert_before(network_get_pending_request_shard(request->header.uid),
+	                   &pending_request->global_node);
 	node_insert_before(&client->pending_request_sentinel, &pending_request->client_node);
 
 	++client->pending_request_count;
@@ -414,12 +469,15 @@ void network_dispatch_response(Packet *response) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	int i;
 	Client *client;
+	Node *pending_request_shard;
 	Node *pending_request_global_node;
 	PendingRequest *pending_request;
 
 	packet_add_trace(response);
 
 	if (packet_header_get_sequence_number(&response->header) == 0) {
+		rules_handle_callback(response);
+
 		if (response->header.function_id == CALLBACK_ENUMERATE) {
 			enumerate_callback = (EnumerateCallback *)response;
 
@@ -473,14 +531,19 @@ void network_dispatch_response(Packet *response) {
 
 			client_dispatch_response(client, NULL, response, true, false);
 		}
+	} else if (flash_job_dispatch_response(response)) {
+		// responses to the requests of a flash job are consumed by that job
+		log_packet_debug("Dispatched response (%s) to flash job",
+		                 packet_get_response_signature(packet_signature, response));
 	} else if (_clients.count + _zombies.count > 0) {
 		log_packet_debug("Dispatching response (%s) to %d client(s) and %d zombies(s)",
 		                 packet_get_response_signature(packet_signature, response),
 		                 _clients.count, _zombies.count);
 
-		pending_request_global_node = _pending_request_sentinel.next;
+		pending_request_shard = network_get_pending_request_shard(response->header.uid);
+		pending_request_global_node = pending_request_shard->next;
 
-		while (pending_request_global_node != &_pending_request_sentinel) {
+		while (pending_request_global_node != pending_request_shard) {
 			pending_request = containerof(pending_request_global_node,
 			                              PendingRequest, global_node);
 
@@ -536,3 +599,19 @@ void network_announce_red_brick_disconnect(void) {
 }
 
 #endif
+
+void network_log_statistics(void) {
+	int pending_requests = 0;
+	int i;
+
+	for (i = 0; i < _clients.count; ++i) {
+		pending_requests += ((Client *)array_get(&_clients, i))->pending_request_count;
+	}
+
+	for (i = 0; i < _zombies.count; ++i) {
+		pending_requests += ((Zombie *)array_get(&_zombies, i))->pending_request_count;
+	}
+
+	log_info("Network statistics (clients: %d, zombies: %d, pending requests: %d)",
+	         _clients.count, _zombies.count, pending_requests);
+}
@@ -38,6 +38,8 @@ void network_cleanup_clients_and_zombies(void);
 void network_client_expects_response(Client *client, Packet *request);
 void network_dispatch_response(Packet *response);
 
+void network_log_statistics(void);
+
 #ifdef BRICKD_WITH_RED_BRICK
 
 void network_announce_red_brick_disconnect(void);
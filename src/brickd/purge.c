@@ -0,0 +1,237 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * purge.c: Purging of queued requests of disconnected clients and expired
+ *          deadlines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * requests can wait in a device queue for a long time if a client sends them
+ * faster than the device can take them. each queued request is tagged with
+ * the ID of the client it came from and the time it was queued. right before
+ * a request is written to the device it is checked and dropped if it became
+ * stale meanwhile:
+ *
+ * - a request with response expected from a client that disconnected already.
+ *   nobody is waiting for its response anymore. the pending request for it
+ *   belongs to a zombie now that drops it after a timeout
+ * - a request without response expected that waited longer than the deadline
+ *   configured by the purge.deadline option
+ *
+ * requests with response expected from connected clients are never dropped,
+ * even if they waited longer than the deadline. the client still waits for
+ * the response and its pending request would never get one.
+ *
+ * the check is done in the thread that writes to the device, this is not the
+ * event loop thread for the Bricklet and RED Brick SPI stacks. to keep it
+ * cheap each connected client occupies the slot client_id % PURGE_CLIENT_SLOTS
+ * in a fixed table. a client is connected as long as its slot holds its ID,
+ * so the check is a single lookup without a lock. the slots are written by the
+ * event loop thread and read by the device threads concurrently, therefore
+ * they are accessed atomically. relaxed ordering is enough: a device thread
+ * that still sees the ID of a client that just disconnected writes one more
+ * of its requests to the device, the same as if the client had disconnected a
+ * moment later. nothing else is published through the slots.
+ *
+ * client IDs are assigned in ascending order, two connected clients only
+ * collide if one of them stays connected while PURGE_CLIENT_SLOTS newer
+ * clients connect. the newer one is not tracked then and its requests are
+ * never dropped for being stale, the same as without this check. only the
+ * counters are protected by a mutex, they are only updated if a request gets
+ * dropped
+ */
+
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "purge.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define PURGE_CLIENT_SLOTS 1024
+
+static bool _purge_disconnected_clients = true;
+static uint64_t _deadline = 0; // in microseconds, 0 disables the deadline
+static uint32_t _origin = 0; // only used in the event loop thread
+static uint32_t _client_slots[PURGE_CLIENT_SLOTS]; // client IDs, 0 if free
+static Mutex _mutex; // protects the counters
+static uint32_t _dropped_of_disconnected_clients = 0;
+static uint32_t _dropped_after_deadline = 0;
+
+#ifdef _MSC_VER
+
+// MSVC doesn't have the __atomic builtins. aligned 32-bit loads and stores are
+// atomic on all architectures it targets, volatile keeps them from being
+// split, merged or cached in a register
+
+static uint32_t load_client_slot(uint32_t client_id) {
+	return *(volatile uint32_t *)&_client_slots[client_id % PURGE_CLIENT_SLOTS];
+}
+
+static void store_client_slot(uint32_t client_id, uint32_t value) {
+	*(volatile uint32_t *)&_client_slots[client_id % PURGE_CLIENT_SLOTS] = value;
+}
+
+#else
+
+static uint32_t load_client_slot(uint32_t client_id) {
+	return __atomic_load_n(&_client_slots[client_id % PURGE_CLIENT_SLOTS], __ATOMIC_RELAXED);
+}
+
+static void store_client_slot(uint32_t client_id, uint32_t value) {
+	__atomic_store_n(&_client_slots[client_id % PURGE_CLIENT_SLOTS], value, __ATOMIC_RELAXED);
+}
+
+#endif
+
+int purge_init(void) {
+	log_debug("Initializing purge subsystem");
+
+	_purge_disconnected_clients = config_get_option_value("purge.disconnected_clients")->boolean;
+	_deadline = (uint64_t)config_get_option_value("purge.deadline")->integer * 1000;
+	_origin = 0;
+	_dropped_of_disconnected_clients = 0;
+	_dropped_after_deadline = 0;
+
+	memset(_client_slots, 0, sizeof(_client_slots));
+
+	mutex_create(&_mutex);
+
+	if (_deadline > 0) {
+		log_info("Dropping queued requests without response expected after %u millisecond(s)",
+		         (uint32_t)(_deadline / 1000));
+	}
+
+	return 0;
+}
+
+void purge_exit(void) {
+	log_debug("Shutting down purge subsystem");
+
+	mutex_destroy(&_mutex);
+}
+
+// has to be called in the event loop thread
+void purge_add_client(uint32_t client_id) {
+	uint32_t occupant;
+
+	if (!_purge_disconnected_clients) {
+		return;
+	}
+
+	occupant = load_client_slot(client_id);
+
+	if (occupant != 0) {
+		log_debug("Not tracking client (id: %u), its slot is occupied by client (id: %u)",
+		          client_id, occupant);
+
+		return;
+	}
+
+	store_client_slot(client_id, client_id);
+}
+
+// has to be called in the event loop thread
+void purge_remove_client(uint32_t client_id) {
+	if (load_client_slot(client_id) == client_id) {
+		store_client_slot(client_id, 0);
+	}
+}
+
+// sets the ID of the client whose requests are dispatched next, 0 for
+// requests that don't originate from a client
+void purge_set_origin(uint32_t client_id) {
+	_origin = client_id;
+}
+
+// has to be called in the event loop thread for each request that is queued
+// and for each queued request that gets replaced by a newer one
+void purge_tag(PurgeTag *tag) {
+	// requests of a client that is not tracked are tagged as if they don't
+	// originate from a client, so they are not dropped for being stale
+	if (_origin != 0 && load_client_slot(_origin) == _origin) {
+		tag->client_id = _origin;
+	} else {
+		tag->client_id = 0;
+	}
+
+	tag->enqueue_time = microseconds();
+}
+
+// returns true if the queued request has to be dropped instead of being
+// written to the device. can be called from any thread
+bool purge_is_stale(Packet *request, PurgeTag *tag, const char *queue_name) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (packet_header_get_response_expected(&request->header)) {
+		if (!_purge_disconnected_clients || tag->client_id == 0) {
+			return false;
+		}
+
+		if (load_client_slot(tag->client_id) == tag->client_id) {
+			return false;
+		}
+
+		mutex_lock(&_mutex);
+
+		++_dropped_of_disconnected_clients;
+
+		mutex_unlock(&_mutex);
+
+		log_packet_debug("Dropping request (%s) of disconnected client (id: %u) from %s",
+		                 packet_get_request_signature(packet_signature, request),
+		                 tag->client_id, queue_name);
+
+		return true;
+	}
+
+	if (_deadline == 0 || microseconds() - tag->enqueue_time <= _deadline) {
+		return false;
+	}
+
+	mutex_lock(&_mutex);
+
+	++_dropped_after_deadline;
+
+	mutex_unlock(&_mutex);
+
+	log_packet_debug("Dropping request (%s) from %s, it was queued for longer than %u millisecond(s)",
+	                 packet_get_request_signature(packet_signature, request),
+	                 queue_name, (uint32_t)(_deadline / 1000));
+
+	return true;
+}
+
+void purge_log_statistics(void) {
+	uint32_t dropped_of_disconnected_clients;
+	uint32_t dropped_after_deadline;
+
+	mutex_lock(&_mutex);
+
+	dropped_of_disconnected_clients = _dropped_of_disconnected_clients;
+	dropped_after_deadline = _dropped_after_deadline;
+
+	mutex_unlock(&_mutex);
+
+	log_info("Purge statistics (dropped requests: %u of disconnected clients, %u after deadline)",
+	         dropped_of_disconnected_clients, dropped_after_deadline);
+}
@@ -0,0 +1,50 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * purge.h: Purging of queued requests of disconnected clients and expired
+ *          deadlines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_PURGE_H
+#define BRICKD_PURGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+// attached to each request in a device queue
+typedef struct {
+	uint32_t client_id; // 0 if the request doesn't originate from a tracked client
+	uint64_t enqueue_time; // monotonic, in microseconds
+} PurgeTag;
+
+int purge_init(void);
+void purge_exit(void);
+
+void purge_add_client(uint32_t client_id);
+void purge_remove_client(uint32_t client_id);
+
+void purge_set_origin(uint32_t client_id);
+
+void purge_tag(PurgeTag *tag);
+bool purge_is_stale(Packet *request, PurgeTag *tag, const char *queue_name);
+
+void purge_log_statistics(void);
+
+#endif // BRICKD_PURGE_H
@@ -48,11 +48,14 @@
 #include <daemonlib/threads.h>
 #include <daemonlib/timer.h>
 #include <daemonlib/conf_file.h>
+#include <daemonlib/utils.h>
 
 #include "red_rs485_extension.h"
 
 #include "hardware.h"
 #include "network.h"
+#include "purge.h"
+#include "squash.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -80,6 +83,13 @@ static Timer crc_error_count_update_timer;
 static uint64_t TIMEOUT = 0;
 // delay between polls in nanoseconds. configurable with brickd.conf option poll_delay.rs485 in microseconds
 static uint64_t MASTER_POLL_SLAVE_INTERVAL = 40000000;
+// silence between two exchanges with the same slave in nanoseconds. calculated
+// from the baudrate as 3.5 character times, as the modbus RTU framing requires
+static uint64_t MASTER_EXCHANGE_GAP = 50000;
+// max exchanges with a slave that has pending work before moving on to the
+// next slave. configurable with brickd.conf option poll_batch.rs485
+static int MASTER_EXCHANGES_PER_TURN = 4;
+static uint64_t master_poll_interval_length = 0;
 static uint32_t TIMEOUT_BYTES = 86;
 static uint64_t last_timer_enable_at_us = 0;
 static uint64_t time_passed_from_last_timer_enable = 0;
@@ -156,12 +166,14 @@ static const uint8_t table_crc_lo[] = {
 typedef struct {
 	Packet packet;
 	uint8_t tries_left;
+	PurgeTag tag; // only set for requests from the brickd event loop
 } RS485ExtensionPacket;
 
 typedef struct {
 	uint8_t address;
 	uint8_t sequence;
 	Queue packet_queue;
+	SquashIndex squash_index;
 } RS485Slave;
 
 typedef struct {
@@ -182,6 +194,7 @@ static int _red_rs485_serial_fd = -1; // Serial interface file descriptor
 // Variables tracking current states
 static char current_request_as_byte_array[sizeof(Packet) + RS485_FRAME_OVERHEAD] = {0};
 static int master_current_slave_to_process = -1; // Only used used by master
+static int master_exchanges_in_turn = 0; // Only used used by master
 
 // Receive buffer
 #include <daemonlib/packed_begin.h>
@@ -213,6 +226,7 @@ static bool _initialized = false;
 static uint8_t sent_ack_of_data_packet = 0;
 static uint8_t send_verify_flag = 0;
 static bool master_poll_interval = false;
+static bool master_poll_same_slave = false;
 
 // RX GPIO pin definitions
 static GPIOREDPin _rx_pin; // Active low
@@ -225,13 +239,17 @@ void send_packet(void);
 void init_rxe_pin_state(int);
 void serial_data_available_handler(void*);
 void master_poll_slave(void);
+void master_poll_current_slave(void);
+void master_finish_exchange(bool data_exchanged);
 void master_timeout_handler(void*);
 int red_rs485_extension_dispatch_to_rs485(Stack*, Packet*, Recipient*);
 void disable_master_timer(void);
+void pop_current_slave_queue_head(void);
 void pop_packet_from_slave_queue(void);
 bool is_current_request_empty(void);
 void seq_pop_poll(void);
 void arm_master_poll_slave_interval_timer(void);
+void arm_master_poll_interval_timer(uint64_t interval, bool same_slave);
 bool init_crc_error_count_to_fs(void);
 static void update_crc_error_count_to_fs(void *opaque);
 
@@ -435,11 +453,11 @@ void verify_buffer(void) {
 			if (sent_ack_of_data_packet == 1) {
 				log_packet_debug("Processed current request");
 				++_red_rs485_extension.slaves[master_current_slave_to_process].sequence;
-				queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+				pop_current_slave_queue_head();
 			}
 
-			// Poll next slave after the configured timeout
-			arm_master_poll_slave_interval_timer();
+			// The slave sent data, it might have more
+			master_finish_exchange(true);
 
 			return;
 		} else if (_receive_buffer_used == frame_length) {
@@ -518,6 +536,8 @@ void verify_buffer(void) {
 
 	// Received empty packet from the other side (UID=0, FID=0)
 	if (_receive.packet.header.uid == 0 && _receive.packet.header.function_id == 0) {
+		bool request_was_empty = is_current_request_empty();
+
 		// Checking current sequence number
 		if (_receive.frame.sequence_number != current_request_as_byte_array[2]) {
 			// Move on to next slave
@@ -538,10 +558,9 @@ void verify_buffer(void) {
 		++_red_rs485_extension.slaves[master_current_slave_to_process].sequence;
 
 		// Popping slave's packet queue
-		queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+		pop_current_slave_queue_head();
 
-		// Poll next slave after the configured timeout
-		arm_master_poll_slave_interval_timer();
+		master_finish_exchange(!request_was_empty);
 	}
 	// Received data packet from the other side
 	else if (_receive.packet.header.uid != 0 && _receive.packet.header.function_id != 0) {
@@ -732,18 +751,42 @@ void serial_data_available_handler(void* opaque) {
 
 // Master polling slave event handler
 void master_poll_slave(void) {
-	RS485ExtensionPacket* slave_queue_packet;
-	sent_ack_of_data_packet = 0;
-	_receive_buffer_used = 0;
-	memset(_receive.buffer, 0, RECEIVE_BUFFER_SIZE);
-
 	// Updating current slave to process
 	if (++master_current_slave_to_process >= _red_rs485_extension.slave_num) {
 		master_current_slave_to_process = 0;
 	}
 
+	master_exchanges_in_turn = 0;
+
 	log_debug("Updated current RS485 slave's index");
 
+	master_poll_current_slave();
+}
+
+// Drops requests at the head of the current slave's queue that became stale
+// while waiting. Requests that were already tried are in the middle of an
+// exchange and are kept
+static void drop_stale_slave_queue_packets(void) {
+	RS485Slave *current_slave = &_red_rs485_extension.slaves[master_current_slave_to_process];
+	RS485ExtensionPacket *current_slave_queue_packet;
+
+	while ((current_slave_queue_packet = queue_peek(&current_slave->packet_queue)) != NULL &&
+	       current_slave_queue_packet->tries_left == RS485_FRAME_TRIES_DATA &&
+	       purge_is_stale(&current_slave_queue_packet->packet, &current_slave_queue_packet->tag,
+	                      _red_rs485_extension.base.name)) {
+		pop_current_slave_queue_head();
+	}
+}
+
+// Start the next exchange with the current slave
+void master_poll_current_slave(void) {
+	RS485ExtensionPacket* slave_queue_packet;
+	sent_ack_of_data_packet = 0;
+	_receive_buffer_used = 0;
+	memset(_receive.buffer, 0, RECEIVE_BUFFER_SIZE);
+
+	drop_stale_slave_queue_packets();
+
 	if (_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue.count == 0) {
 		// Nothing to send in the slave's queue. So send a poll packet
 		slave_queue_packet = queue_push(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue);
@@ -777,6 +820,30 @@ void master_poll_slave(void) {
 	}
 }
 
+// Called after a successful exchange with the current slave. A slave with
+// pending work (queued requests or data in the last exchange) gets up to
+// MASTER_EXCHANGES_PER_TURN exchanges in a row, so that e.g. a firmware flash
+// does not advance by only one packet per bus cycle. After that the master
+// moves on to the next slave, so that other slaves are not starved.
+void master_finish_exchange(bool data_exchanged) {
+	RS485Slave *current_slave = &_red_rs485_extension.slaves[master_current_slave_to_process];
+
+	++master_exchanges_in_turn;
+
+	if (master_exchanges_in_turn < MASTER_EXCHANGES_PER_TURN &&
+	    (data_exchanged || current_slave->packet_queue.count > 0)) {
+		log_debug("Slave has pending work (exchange %d of max %d in this turn)",
+		          master_exchanges_in_turn + 1, MASTER_EXCHANGES_PER_TURN);
+
+		arm_master_poll_interval_timer(MASTER_EXCHANGE_GAP, true);
+
+		return;
+	}
+
+	// Poll next slave after the configured timeout
+	arm_master_poll_slave_interval_timer();
+}
+
 // Master timer event handler
 void master_timeout_handler(void* opaque) {
 	(void)opaque;
@@ -789,20 +856,26 @@ void master_timeout_handler(void* opaque) {
 		// until we find the real problem
 		time_passed_from_last_timer_enable = (microtime() - last_timer_enable_at_us) * 1000;
 
-		if (time_passed_from_last_timer_enable < MASTER_POLL_SLAVE_INTERVAL) {
+		if (time_passed_from_last_timer_enable < master_poll_interval_length) {
 			master_timer.it_interval.tv_sec = 0;
 			master_timer.it_interval.tv_nsec = 0;
 			master_timer.it_value.tv_sec = 0;
-			master_timer.it_value.tv_nsec = MASTER_POLL_SLAVE_INTERVAL;
+			master_timer.it_value.tv_nsec = master_poll_interval_length;
 			timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
 			last_timer_enable_at_us = microtime();
 
 			return;
 		}
 
-		log_debug("Master poll slave interval timed out... time to poll next slave");
 		master_poll_interval = false;
-		master_poll_slave();
+
+		if (master_poll_same_slave) {
+			log_debug("Master exchange gap timed out... time to poll same slave again");
+			master_poll_current_slave();
+		} else {
+			log_debug("Master poll slave interval timed out... time to poll next slave");
+			master_poll_slave();
+		}
 
 		return;
 	}
@@ -836,12 +909,23 @@ void master_timeout_handler(void* opaque) {
 	arm_master_poll_slave_interval_timer();
 }
 
+void pop_current_slave_queue_head(void) {
+	RS485Slave *current_slave = &_red_rs485_extension.slaves[master_current_slave_to_process];
+	RS485ExtensionPacket *current_slave_queue_packet = queue_peek(&current_slave->packet_queue);
+
+	if (current_slave_queue_packet != NULL) {
+		squash_index_remove(&current_slave->squash_index, &current_slave_queue_packet->packet);
+	}
+
+	queue_pop(&current_slave->packet_queue, NULL);
+}
+
 void pop_packet_from_slave_queue(void) {
 	RS485ExtensionPacket* current_slave_queue_packet;
 	current_slave_queue_packet = queue_peek(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue);
 
 	if (current_slave_queue_packet != NULL && --current_slave_queue_packet->tries_left == 0) {
-		queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+		pop_current_slave_queue_head();
 	}
 }
 
@@ -872,16 +956,42 @@ void seq_pop_poll(void) {
 
 void arm_master_poll_slave_interval_timer(void) {
 	log_debug("Waiting before polling next slave");
+
+	arm_master_poll_interval_timer(MASTER_POLL_SLAVE_INTERVAL, false);
+}
+
+void arm_master_poll_interval_timer(uint64_t interval, bool same_slave) {
 	master_poll_interval = true;
+	master_poll_interval_length = interval;
+	master_poll_same_slave = same_slave;
 
 	master_timer.it_interval.tv_sec = 0;
 	master_timer.it_interval.tv_nsec = 0;
 	master_timer.it_value.tv_sec = 0;
-	master_timer.it_value.tv_nsec = MASTER_POLL_SLAVE_INTERVAL;
+	master_timer.it_value.tv_nsec = interval;
 	timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
 	last_timer_enable_at_us = microtime();
 }
 
+// Replaces an older request queued for the same UID and function ID, if
+// squashing is enabled for them. The request at the head of the queue might
+// be in the middle of an exchange, that one is kept
+static bool squash_slave_request(RS485Slave *slave, Packet *request) {
+	RS485ExtensionPacket *in_flight_request = queue_peek(&slave->packet_queue);
+	Packet *replaced_request;
+
+	replaced_request = squash_index_replace(&slave->squash_index, request,
+	                                        in_flight_request != NULL ? &in_flight_request->packet : NULL);
+
+	if (replaced_request == NULL) {
+		return false;
+	}
+
+	purge_tag(&containerof(replaced_request, RS485ExtensionPacket, packet)->tag);
+
+	return true;
+}
+
 // New packet from brickd event loop is queued to be sent via RS485 interface
 int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipient *recipient) {
 	RS485ExtensionPacket* queued_request;
@@ -893,6 +1003,10 @@ int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipie
 		log_packet_debug("Broadcasting to all available slaves");
 
 		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
+			if (squash_slave_request(&_red_rs485_extension.slaves[i], request)) {
+				continue;
+			}
+
 			queued_request = queue_push(&_red_rs485_extension.slaves[i].packet_queue);
 
 			if (queued_request == NULL) {
@@ -906,6 +1020,8 @@ int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipie
 
 			queued_request->tries_left = RS485_FRAME_TRIES_DATA;
 			memcpy(&queued_request->packet, request, request->header.length);
+			purge_tag(&queued_request->tag);
+			squash_index_add(&_red_rs485_extension.slaves[i].squash_index, &queued_request->packet);
 
 			log_packet_debug("Broadcast... Packet is queued to be sent to slave %d. Function signature = (%s)",
 			                 _red_rs485_extension.slaves[i].address,
@@ -914,6 +1030,14 @@ int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipie
 	} else if (recipient != NULL) {
 		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
 			if (_red_rs485_extension.slaves[i].address == recipient->opaque) {
+				if (squash_slave_request(&_red_rs485_extension.slaves[i], request)) {
+					log_packet_debug("Replaced older request queued for slave %d with request (%s)",
+					                 _red_rs485_extension.slaves[i].address,
+					                 packet_get_request_signature(packet_signature, request));
+
+					break;
+				}
+
 				queued_request = queue_push(&_red_rs485_extension.slaves[i].packet_queue);
 
 				if (queued_request == NULL) {
@@ -927,6 +1051,8 @@ int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipie
 
 				queued_request->tries_left = RS485_FRAME_TRIES_DATA;
 				memcpy(&queued_request->packet, request, request->header.length);
+				purge_tag(&queued_request->tag);
+				squash_index_add(&_red_rs485_extension.slaves[i].squash_index, &queued_request->packet);
 
 				log_packet_debug("Packet is queued to be sent to slave %d over. Function signature = (%s)",
 				                 _red_rs485_extension.slaves[i].address,
@@ -950,6 +1076,7 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 	log_info("Initializing extension subsystem");
 
 	MASTER_POLL_SLAVE_INTERVAL = (uint64_t)config_get_option_value("poll_delay.rs485")->integer * 1000;
+	MASTER_EXCHANGES_PER_TURN = config_get_option_value("poll_batch.rs485")->integer;
 
 	// Create base stack
 	if (stack_create(&_red_rs485_extension.base, "red_rs485_extension",
@@ -988,6 +1115,11 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 				          get_errno_name(errno), errno);
 				goto cleanup;
 			}
+
+			if (squash_index_create(&_red_rs485_extension.slaves[i].squash_index) < 0) {
+				queue_destroy(&_red_rs485_extension.slaves[i].packet_queue, NULL);
+				goto cleanup;
+			}
 		}
 	} else {
 		log_error("Only master mode supported");
@@ -999,6 +1131,10 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 	TIMEOUT = (((double)(TIMEOUT_BYTES / (double)(_red_rs485_extension.baudrate / 8)) *
 	            (double)1000000000) * (double)2) + (double)8000000;
 
+	// Silence of 3.5 characters (11 bits each, including start, parity and stop bits)
+	MASTER_EXCHANGE_GAP = MAX((uint64_t)(((double)3.5 * 11 / (double)_red_rs485_extension.baudrate) *
+	                                     (double)1000000000), MASTER_EXCHANGE_GAP);
+
 	// Configuring serial interface from the configs
 	if (serial_interface_init(RS485_EXTENSION_SERIAL_DEVICE) < 0) {
 		goto cleanup;
@@ -1078,6 +1214,7 @@ cleanup:
 	case 3:
 		if (_red_rs485_extension.address == 0) {
 			for (i = 0; i < _red_rs485_extension.slave_num; i++) {
+				squash_index_destroy(&_red_rs485_extension.slaves[i].squash_index);
 				queue_destroy(&_red_rs485_extension.slaves[i].packet_queue, NULL);
 			}
 		}
@@ -1125,6 +1262,7 @@ void red_rs485_extension_exit(void) {
 
 	if (_red_rs485_extension.address == 0) {
 		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
+			squash_index_destroy(&_red_rs485_extension.slaves[i].squash_index);
 			queue_destroy(&_red_rs485_extension.slaves[i].packet_queue, NULL);
 		}
 	}
@@ -32,7 +32,6 @@
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
-#include <sys/eventfd.h>
 
 #include <daemonlib/base58.h>
 #include <daemonlib/config.h>
@@ -45,12 +44,16 @@
 #include <daemonlib/pipe.h>
 #include <daemonlib/gpio_red.h>
 #include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
 
 #include "red_stack.h"
 
+#include "completion_queue.h"
 #include "hardware.h"
 #include "network.h"
 #include "red_usb_gadget.h"
+#include "purge.h"
+#include "squash.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -119,7 +122,6 @@ static pthread_cond_t _red_stack_wait_for_reset_cond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t _red_stack_wait_for_reset_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int _red_stack_wait_for_reset_helper = 0;
 
-static int _red_stack_notification_event;
 static int _red_stack_reset_fd;
 static int _red_stack_reset_detected = 0;
 
@@ -143,7 +145,8 @@ typedef struct {
 	REDStackSlaveStatus status;
 	GPIOREDPin slave_select_pin;
 	Queue request_queue;
-	Mutex request_queue_mutex;
+	Mutex request_queue_mutex; // protects request_queue and squash_index
+	SquashIndex squash_index;
 	bool next_packet_empty;
 } REDStackSlave;
 
@@ -151,24 +154,36 @@ typedef struct {
 	Stack base;
 	REDStackSlave slaves[RED_STACK_SPI_MAX_SLAVES];
 	uint8_t slave_num;
-
-	Queue response_queue;
-	Mutex response_queue_mutex;
 } REDStack;
 
 typedef struct {
 	REDStackSlave *slave;
 	Packet packet;
 	REDStackRequestStatus status;
+	PurgeTag tag;
 } REDStackRequest;
 
 typedef struct {
 	Packet packet;
+	uint8_t length; // number of bytes received
 	uint8_t stack_address;
 } REDStackResponse;
 
+// Usage of the SPI bus shared by all slaves. Updated by the SPI thread and
+// logged by red_stack_log_statistics in the brickd main thread
+typedef struct {
+	uint64_t transfers;
+	uint64_t empty_polls; // nothing send and nothing received
+	uint64_t time_busy; // in microseconds
+} REDStackSPIStatistics;
+
 static REDStack _red_stack;
 
+static pthread_mutex_t _red_stack_spi_statistics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static REDStackSPIStatistics _red_stack_spi_statistics;
+static REDStackSPIStatistics _red_stack_spi_last_statistics; // only used by the main thread
+static uint64_t _red_stack_spi_last_logged = 0;
+
 static const GPIOREDPin _red_stack_reset_stack_pin = {GPIO_RED_PORT_B, GPIO_RED_PIN_5};
 static const GPIOREDPin _red_stack_master_high_pin = {GPIO_RED_PORT_B, GPIO_RED_PIN_11};
 static const GPIOREDPin _red_stack_slave_select_pins[RED_STACK_SPI_MAX_SLAVES] = {
@@ -205,24 +220,12 @@ static void red_stack_increase_master_sequence_number(REDStackSlave *slave) {
 	}
 }
 
-// Get "red_stack_dispatch_from_spi" called from main brickd event thread
-static int red_stack_spi_request_dispatch_response_event(REDStackResponse *response) {
-	REDStackResponse *queued_response;
-	eventfd_t ev = 1;
-
-	mutex_lock(&_red_stack.response_queue_mutex);
-	queued_response = queue_push(&_red_stack.response_queue);
-	memcpy(queued_response, response, sizeof(REDStackResponse));
-	mutex_unlock(&_red_stack.response_queue_mutex);
+static void red_stack_handle_response(Stack *stack, Packet *packet, uint32_t opaque);
 
-	if (eventfd_write(_red_stack_notification_event, ev) < 0) {
-		log_error("Could not write to red stack spi notification event: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		return -1;
-	}
-
-	return 0;
+// Get "red_stack_handle_response" called from main brickd event thread
+static int red_stack_spi_request_dispatch_response_event(REDStackResponse *response) {
+	return completion_queue_post(&_red_stack.base, red_stack_handle_response,
+	                             &response->packet, response->length, response->stack_address);
 }
 
 // Calculates a Pearson Hash for the given data
@@ -266,6 +269,7 @@ static int red_stack_spi_transceive_message(REDStackRequest *packet_send, REDSta
 	// We assume that we don't receive anything. If we receive a packet the
 	// length will be overwritten again
 	packet_recv->packet.header.length = 0;
+	packet_recv->length = 0;
 
 	// Set stack address for packet
 	packet_recv->stack_address = slave->stack_address;
@@ -436,7 +440,8 @@ static int red_stack_spi_transceive_message(REDStackRequest *packet_send, REDSta
 			retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_NONE;
 		} else {
 			// Everything seems OK, we can copy to buffer
-			memcpy(&packet_recv->packet, rx+2, length - RED_STACK_SPI_PACKET_EMPTY_SIZE);
+			packet_recv->length = length - RED_STACK_SPI_PACKET_EMPTY_SIZE;
+			memcpy(&packet_recv->packet, rx+2, packet_recv->length);
 
 #ifdef DAEMONLIB_WITH_PACKET_TRACE
 			packet_recv->packet.trace_id = packet_get_next_response_trace_id();
@@ -480,6 +485,7 @@ static void red_stack_spi_create_routing_table(void) {
 				0
 			}, {0}, {0}},
 			RED_STACK_REQUEST_STATUS_ADDED,
+			{0, 0} // not tagged, the request doesn't originate from a client
 		};
 
 		// We have to assume that the slave is available
@@ -592,9 +598,15 @@ static void red_stack_spi_handle_reset(void) {
 
 		// Unfortunately we have to discard all of the queued packets.
 		// we can't be sure that the packets are for the correct slave after a reset.
+		mutex_lock(&_red_stack.slaves[slave].request_queue_mutex);
+
+		squash_index_clear(&_red_stack.slaves[slave].squash_index);
+
 		while (queue_peek(&_red_stack.slaves[slave].request_queue) != NULL) {
 			queue_pop(&_red_stack.slaves[slave].request_queue, NULL);
 		}
+
+		mutex_unlock(&_red_stack.slaves[slave].request_queue_mutex);
 	}
 }
 
@@ -628,6 +640,7 @@ static void red_stack_spi_thread(void *opaque) {
 			REDStackSlave *slave = &_red_stack.slaves[stack_address_cycle];
 			REDStackRequest *request = NULL;
 			REDStackResponse response;
+			uint64_t transfer_started;
 
 			// Get packet from queue. The queue contains request that are to
 			// be send over SPI. It is filled through from the main brickd
@@ -639,6 +652,15 @@ static void red_stack_spi_thread(void *opaque) {
 			} else {
 				mutex_lock(&slave->request_queue_mutex);
 				request = queue_peek(&slave->request_queue);
+
+				// Drop requests that became stale while waiting in the queue
+				while (request != NULL && purge_is_stale(&request->packet, &request->tag, _red_stack.base.name)) {
+					squash_index_remove(&slave->squash_index, &request->packet);
+					queue_pop(&slave->request_queue, NULL);
+
+					request = queue_peek(&slave->request_queue);
+				}
+
 				mutex_unlock(&slave->request_queue_mutex);
 			}
 
@@ -654,8 +676,21 @@ static void red_stack_spi_thread(void *opaque) {
 				                 packet_get_request_signature(packet_signature, &request->packet));
 			}
 
+			transfer_started = microseconds();
+
 			ret = red_stack_spi_transceive_message(request, &response, slave);
 
+			pthread_mutex_lock(&_red_stack_spi_statistics_mutex);
+
+			_red_stack_spi_statistics.transfers++;
+			_red_stack_spi_statistics.time_busy += microseconds() - transfer_started;
+
+			if (request == NULL && (ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_NONE) {
+				_red_stack_spi_statistics.empty_polls++;
+			}
+
+			pthread_mutex_unlock(&_red_stack_spi_statistics_mutex);
+
 			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_SEND) == RED_STACK_TRANSCEIVE_RESULT_SEND_OK) {
 				if (!((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_ERROR)) {
 					// If we send a packet it must have come from the queue, so we can
@@ -663,6 +698,7 @@ static void red_stack_spi_thread(void *opaque) {
 					// If the sending didn't work (for whatever reason), we don't pop it
 					// and therefore we will automatically try to send it again in the next cycle.
 					mutex_lock(&slave->request_queue_mutex);
+					squash_index_remove(&slave->squash_index, &request->packet);
 					queue_pop(&slave->request_queue, NULL);
 					mutex_unlock(&slave->request_queue_mutex);
 				}
@@ -785,49 +821,34 @@ static int red_stack_init_spi(void) {
 }
 
 // New packet from SPI stack is send into brickd event loop
-static void red_stack_dispatch_from_spi(void *opaque) {
-	int i;
-	eventfd_t ev;
-	REDStackResponse *response;
-
-	(void)opaque;
-
-	// handle at most 5 queued responses at once to avoid blocking the event
-	// lopp for too long
-	for (i = 0; i < 5; ++i) {
-		if (eventfd_read(_red_stack_notification_event, &ev) < 0) {
-			if (errno_would_block()) {
-				return; // no queue responses left
-			}
-
-			log_error("Could not read from SPI notification event: %s (%d)",
-			          get_errno_name(errno), errno);
-
-			return;
-		}
+static void red_stack_handle_response(Stack *stack, Packet *packet, uint32_t opaque) {
+	// Update routing table (this is necessary for Co MCU Bricklets)
+	if (packet->header.function_id == CALLBACK_ENUMERATE) {
+		stack_add_recipient(stack, packet->header.uid, opaque);
+	}
 
-		mutex_lock(&_red_stack.response_queue_mutex);
-		response = queue_peek(&_red_stack.response_queue);
-		mutex_unlock(&_red_stack.response_queue_mutex);
+	// Send message into brickd dispatcher
+	network_dispatch_response(packet);
+}
 
-		if (response == NULL) { // eventfd indicates a reponsed but queue is empty
-			log_error("Response queue and notification event are out-of-sync");
+// Replaces an older request queued for the same UID and function ID, if
+// squashing is enabled for them. The SPI thread might be sending the request
+// at the head of the queue, that one is kept. Has to be called with the
+// request queue mutex of the slave locked
+static bool red_stack_squash_request(REDStackSlave *slave, Packet *request) {
+	REDStackRequest *in_flight_request = queue_peek(&slave->request_queue);
+	Packet *replaced_request;
 
-			return;
-		}
+	replaced_request = squash_index_replace(&slave->squash_index, request,
+	                                        in_flight_request != NULL ? &in_flight_request->packet : NULL);
 
-		// Update routing table (this is necessary for Co MCU Bricklets)
-		if (response->packet.header.function_id == CALLBACK_ENUMERATE) {
-			stack_add_recipient(&_red_stack.base, response->packet.header.uid, response->stack_address);
-		}
+	if (replaced_request == NULL) {
+		return false;
+	}
 
-		// Send message into brickd dispatcher
-		network_dispatch_response(&response->packet);
+	purge_tag(&containerof(replaced_request, REDStackRequest, packet)->tag);
 
-		mutex_lock(&_red_stack.response_queue_mutex);
-		queue_pop(&_red_stack.response_queue, NULL);
-		mutex_unlock(&_red_stack.response_queue_mutex);
-	}
+	return true;
 }
 
 // New packet from brickd event loop is queued to be written to stack via SPI
@@ -842,10 +863,19 @@ static int red_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipient *r
 
 		for (is = 0; is < _red_stack.slave_num; is++) {
 			mutex_lock(&_red_stack.slaves[is].request_queue_mutex);
+
+			if (red_stack_squash_request(&_red_stack.slaves[is], request)) {
+				mutex_unlock(&_red_stack.slaves[is].request_queue_mutex);
+
+				continue;
+			}
+
 			queued_request = queue_push(&_red_stack.slaves[is].request_queue);
 			queued_request->status = RED_STACK_REQUEST_STATUS_ADDED;
 			queued_request->slave = &_red_stack.slaves[is];
 			memcpy(&queued_request->packet, request, request->header.length);
+			purge_tag(&queued_request->tag);
+			squash_index_add(&_red_stack.slaves[is].squash_index, &queued_request->packet);
 			mutex_unlock(&_red_stack.slaves[is].request_queue_mutex);
 
 			log_packet_debug("Request is queued to be broadcast to slave %d (%s)",
@@ -856,10 +886,23 @@ static int red_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipient *r
 		REDStackSlave *slave = &_red_stack.slaves[recipient->opaque];
 
 		mutex_lock(&slave->request_queue_mutex);
+
+		if (red_stack_squash_request(slave, request)) {
+			mutex_unlock(&slave->request_queue_mutex);
+
+			log_packet_debug("Replaced older request queued for slave %d with request (%s)",
+			                 slave->stack_address,
+			                 packet_get_request_signature(packet_signature, request));
+
+			return 0;
+		}
+
 		queued_request = queue_push(&slave->request_queue);
 		queued_request->status = RED_STACK_REQUEST_STATUS_ADDED;
 		queued_request->slave = slave;
 		memcpy(&queued_request->packet, request, request->header.length);
+		purge_tag(&queued_request->tag);
+		squash_index_add(&slave->squash_index, &queued_request->packet);
 		mutex_unlock(&slave->request_queue_mutex);
 
 		log_packet_debug("Packet is queued to be send to slave %d over SPI (%s)",
@@ -901,6 +944,7 @@ int red_stack_init(void) {
 	log_debug("Initializing RED Brick SPI Stack subsystem");
 
 	_red_stack_spi_poll_delay = config_get_option_value("poll_delay.spi")->integer;
+	_red_stack_spi_last_logged = microseconds();
 
 	if (gpio_sysfs_export(&red_stack_reset_pin) < 0) {
 		// Just issue a warning, RED Brick will work without reset interrupt
@@ -935,27 +979,12 @@ int red_stack_init(void) {
 
 	phase = 2;
 
-	if ((_red_stack_notification_event = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE)) < 0) {
-		log_error("Could not create red stack notification event: %s (%d)",
-		          get_errno_name(errno), errno);
-
+	if (completion_queue_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 3;
 
-	// Add notification pipe as event source.
-	// Event is used to dispatch packets.
-	if (event_add_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC,
-	                     "red-stack-notification", EVENT_READ,
-	                     red_stack_dispatch_from_spi, NULL) < 0) {
-		log_error("Could not add red stack notification pipe as event source");
-
-		goto cleanup;
-	}
-
-	phase = 4;
-
 	// Initialize SPI packet queues
 	for (k = 0; k < RED_STACK_SPI_MAX_SLAVES; k++) {
 		if (queue_create(&_red_stack.slaves[k].request_queue, sizeof(REDStackRequest)) < 0) {
@@ -964,24 +993,19 @@ int red_stack_init(void) {
 
 			goto cleanup;
 		}
-	}
 
-	phase = 5;
+		if (squash_index_create(&_red_stack.slaves[k].squash_index) < 0) {
+			queue_destroy(&_red_stack.slaves[k].request_queue, NULL);
 
-	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
-		mutex_create(&_red_stack.slaves[i].request_queue_mutex);
+			goto cleanup;
+		}
 	}
 
-	mutex_create(&_red_stack.response_queue_mutex);
-
-	if (queue_create(&_red_stack.response_queue, sizeof(REDStackResponse)) < 0) {
-		log_error("Could not create SPI response queue: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		goto cleanup;
+	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
+		mutex_create(&_red_stack.slaves[i].request_queue_mutex);
 	}
 
-	phase = 6;
+	phase = 4;
 
 	if (red_stack_init_spi() < 0) {
 		goto cleanup;
@@ -1002,33 +1026,24 @@ int red_stack_init(void) {
 		}
 	}
 
-	phase = 7;
+	phase = 5;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 6:
-		queue_destroy(&_red_stack.response_queue, NULL);
-		// fall through
-
-	case 5:
-		mutex_destroy(&_red_stack.response_queue_mutex);
-
+	case 4:
 		for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
 			mutex_destroy(&_red_stack.slaves[i].request_queue_mutex);
 		}
 
 		// fall through
 
-	case 4:
+	case 3:
 		for (k--; k >= 0; k--) {
+			squash_index_destroy(&_red_stack.slaves[k].squash_index);
 			queue_destroy(&_red_stack.slaves[k].request_queue, NULL);
 		}
 
-		event_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
-		// fall through
-
-	case 3:
-		robust_close(_red_stack_notification_event);
+		completion_queue_exit();
 		// fall through
 
 	case 2:
@@ -1043,7 +1058,7 @@ cleanup:
 		break;
 	}
 
-	return phase == 7 ? 0 : -1;
+	return phase == 5 ? 0 : -1;
 }
 
 void red_stack_exit(void) {
@@ -1055,15 +1070,9 @@ void red_stack_exit(void) {
 		event_remove_source(_red_stack_reset_fd, EVENT_SOURCE_TYPE_GENERIC);
 	}
 
-	// Remove event as possible poll source
-	event_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
-
 	// Make sure that Thread shuts down properly
 	if (_red_stack_spi_thread_running) {
 		_red_stack_spi_thread_running = false;
-		// Write in eventfd to make sure that we are not blocking the Thread
-		eventfd_t ev = 1;
-		eventfd_write(_red_stack_notification_event, ev);
 
 		thread_join(&_red_stack_spi_thread);
 		thread_destroy(&_red_stack_spi_thread);
@@ -1074,8 +1083,13 @@ void red_stack_exit(void) {
 		red_stack_spi_deselect(&_red_stack.slaves[slave]);
 	}
 
+	// Drop responses of the SPI thread that were not handled yet
+	completion_queue_remove_stack(&_red_stack.base);
+	completion_queue_exit();
+
 	// We can also free the queue and stack now, nobody will use them anymore
 	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
+		squash_index_destroy(&_red_stack.slaves[i].squash_index);
 		queue_destroy(&_red_stack.slaves[i].request_queue, NULL);
 	}
 
@@ -1086,10 +1100,36 @@ void red_stack_exit(void) {
 		mutex_destroy(&_red_stack.slaves[i].request_queue_mutex);
 	}
 
-	queue_destroy(&_red_stack.response_queue, NULL);
-	mutex_destroy(&_red_stack.response_queue_mutex);
-
 	// Close file descriptors
-	robust_close(_red_stack_notification_event);
 	robust_close(_red_stack_spi_fd);
 }
+
+// Logs the usage of the SPI bus since the last call. A high share of empty
+// polls with a high busy time means that poll_delay.spi can be increased
+void red_stack_log_statistics(void) {
+	REDStackSPIStatistics current;
+	uint64_t now = microseconds();
+	uint64_t elapsed = now - _red_stack_spi_last_logged;
+	uint64_t transfers;
+	uint64_t empty_polls;
+
+	if (elapsed == 0) {
+		elapsed = 1;
+	}
+
+	pthread_mutex_lock(&_red_stack_spi_statistics_mutex);
+	memcpy(&current, &_red_stack_spi_statistics, sizeof(current));
+	pthread_mutex_unlock(&_red_stack_spi_statistics_mutex);
+
+	transfers = current.transfers - _red_stack_spi_last_statistics.transfers;
+	empty_polls = current.empty_polls - _red_stack_spi_last_statistics.empty_polls;
+
+	log_info("RED Brick SPI statistics (slaves: %d, transfers: %.1f/s, empty polls: %.1f%%, busy: %.1f%%)",
+	         _red_stack.slave_num,
+	         transfers * 1000000.0 / elapsed,
+	         transfers > 0 ? empty_polls * 100.0 / transfers : 0.0,
+	         (current.time_busy - _red_stack_spi_last_statistics.time_busy) * 100.0 / elapsed);
+
+	memcpy(&_red_stack_spi_last_statistics, &current, sizeof(current));
+	_red_stack_spi_last_logged = now;
+}
@@ -26,4 +26,6 @@
 int red_stack_init(void);
 void red_stack_exit(void);
 
+void red_stack_log_statistics(void);
+
 #endif // BRICKD_RED_STACK_H
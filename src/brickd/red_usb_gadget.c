@@ -37,6 +37,15 @@
  * the enumerate-available packet for the RED Brick is send by redapid.c that
  * connects to the RED Brick API Daemon and acts as a stack. this way all
  * clients connected to brickd can receive it.
+ *
+ * responses to the USB gadget driver are not written one packet at a time.
+ * the File object that wraps /dev/g_red_brick_data collects all responses of
+ * one event loop iteration in a write buffer that is flushed with a single
+ * write call at the end of the iteration. the host side reads up to 1024 bytes
+ * per USB transfer and can handle multiple packets per transfer. if the USB
+ * gadget driver cannot take more data then reading requests from the host is
+ * paused until the write buffer could be flushed. this way the host is slowed
+ * down instead of responses being dropped.
  */
 
 #include <errno.h>
@@ -49,6 +58,7 @@
 #include <daemonlib/event.h>
 #include <daemonlib/file.h>
 #include <daemonlib/log.h>
+#include <daemonlib/timer.h>
 #include <daemonlib/utils.h>
 
 #include "red_usb_gadget.h"
@@ -57,64 +67,240 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-#define G_RED_BRICK_STATE_FILENAME "/proc/g_red_brick_state"
-#define G_RED_BRICK_DATA_FILENAME "/dev/g_red_brick_data"
+// both filenames can be overridden at compile time to test the USB gadget
+// transport with a pty or FIFO instead of the actual USB gadget driver
+#ifndef G_RED_BRICK_STATE_FILENAME
+	#define G_RED_BRICK_STATE_FILENAME "/proc/g_red_brick_state"
+#endif
+
+#ifndef G_RED_BRICK_DATA_FILENAME
+	#define G_RED_BRICK_DATA_FILENAME "/dev/g_red_brick_data"
+#endif
+
+#define WRITE_BUFFER_SIZE 1024 // matches the host side USB read transfer size
+#define FLUSH_RETRY_INTERVAL 1000 // 1 millisecond in microseconds
+#define RECONNECT_MIN_DELAY 100000 // 100 milliseconds in microseconds
+#define RECONNECT_MAX_DELAY 5000000 // 5 seconds in microseconds
+#define RECONNECT_MAX_TRIES 10
+// a connection has to last this long before the reconnect tries are reset,
+// otherwise a connection that breaks right away would be retried forever
+#define RECONNECT_STABLE_PERIOD 10000000 // 10 seconds in microseconds
 
 typedef enum {
 	RED_USB_GADGET_STATE_DISCONNECTED = 0,
 	RED_USB_GADGET_STATE_CONNECTED = 1
 } REDUSBGadgetState;
 
+typedef struct {
+	File base;
+
+	uint8_t write_buffer[WRITE_BUFFER_SIZE];
+	int write_buffer_used;
+	bool congested;
+} REDUSBGadgetData;
+
 static uint32_t _uid = 0; // always little endian
 static File _state_file;
 static Client *_client = NULL;
+static REDUSBGadgetData *_data = NULL;
+static Timer _flush_timer;
+static Timer _reconnect_timer;
+static int _reconnect_tries = 0;
+static uint64_t _connect_time = 0; // in microseconds
+
+// writes as much of the write buffer to the USB gadget driver as possible.
+// returns -1 with errno set to EWOULDBLOCK if the driver cannot take more data
+static int red_usb_gadget_data_flush(REDUSBGadgetData *data) {
+	int length;
+
+	if (data->write_buffer_used == 0) {
+		return 0;
+	}
+
+	length = file_write(&data->base, data->write_buffer, data->write_buffer_used);
+
+	if (length < 0) {
+		return -1;
+	}
+
+	memmove(data->write_buffer, data->write_buffer + length,
+	        data->write_buffer_used - length);
+
+	data->write_buffer_used -= length;
+
+	if (data->write_buffer_used > 0) {
+		errno = EWOULDBLOCK;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void red_usb_gadget_data_set_congested(REDUSBGadgetData *data, bool congested) {
+	if (data->congested == congested || _client == NULL) {
+		return;
+	}
+
+	data->congested = congested;
+
+	if (congested) {
+		log_debug("RED Brick USB gadget cannot take more data, pausing requests from host");
+
+		client_pause_reading(_client);
+
+		if (timer_configure(&_flush_timer, FLUSH_RETRY_INTERVAL, FLUSH_RETRY_INTERVAL) < 0) {
+			log_error("Could not start RED Brick USB gadget flush timer: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+	} else {
+		log_debug("RED Brick USB gadget can take data again, resuming requests from host");
+
+		timer_configure(&_flush_timer, 0, 0);
+
+		client_resume_reading(_client);
+	}
+}
+
+static int red_usb_gadget_data_write(REDUSBGadgetData *data, const void *buffer, int length) {
+	if (length > (int)sizeof(data->write_buffer)) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	if (data->write_buffer_used + length > (int)sizeof(data->write_buffer)) {
+		if (red_usb_gadget_data_flush(data) < 0) {
+			if (errno_would_block()) {
+				red_usb_gadget_data_set_congested(data, true);
+			}
+
+			return -1;
+		}
+	}
+
+	memcpy(data->write_buffer + data->write_buffer_used, buffer, length);
+
+	data->write_buffer_used += length;
+
+	return length;
+}
+
+static void red_usb_gadget_data_destroy(REDUSBGadgetData *data) {
+	if (_data == data) {
+		_data = NULL;
+
+		timer_configure(&_flush_timer, 0, 0);
+	}
+
+	file_destroy(&data->base);
+}
+
+static void red_usb_gadget_handle_flush(void *opaque) {
+	(void)opaque;
+
+	red_usb_gadget_flush();
+}
 
 static int red_usb_gadget_create_client(void);
 
 static void red_usb_gadget_client_destroy_done(void) {
-	log_debug("Trying to reconnect to RED Brick USB gadget");
+	uint64_t delay;
 
 	_client = NULL;
 
-	red_usb_gadget_create_client();
+	if (_connect_time > 0 && microseconds() - _connect_time >= RECONNECT_STABLE_PERIOD) {
+		_reconnect_tries = 0;
+	}
+
+	_connect_time = 0;
+
+	if (_reconnect_tries >= RECONNECT_MAX_TRIES) {
+		log_error("Could not reconnect to RED Brick USB gadget after %d tries, giving up",
+		          _reconnect_tries);
+
+		_reconnect_tries = 0;
+
+		return;
+	}
+
+	// exponential backoff, starting at 100 milliseconds, limited to 5 seconds
+	delay = (uint64_t)RECONNECT_MIN_DELAY << _reconnect_tries;
+
+	if (delay > RECONNECT_MAX_DELAY) {
+		delay = RECONNECT_MAX_DELAY;
+	}
+
+	++_reconnect_tries;
+
+	log_debug("Trying to reconnect to RED Brick USB gadget in %u msec (try %d of %d)",
+	          (uint32_t)(delay / 1000), _reconnect_tries, RECONNECT_MAX_TRIES);
+
+	if (timer_configure(&_reconnect_timer, delay, 0) < 0) {
+		log_error("Could not start RED Brick USB gadget reconnect timer: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void red_usb_gadget_handle_reconnect(void *opaque) {
+	(void)opaque;
+
+	if (_client != NULL) {
+		return;
+	}
+
+	if (red_usb_gadget_create_client() < 0) {
+		// schedule next try
+		red_usb_gadget_client_destroy_done();
+	}
 }
 
 static int red_usb_gadget_create_client(void) {
-	File *file;
+	REDUSBGadgetData *data;
 
 	log_debug("Connecting to RED Brick USB gadget");
 
-	file = calloc(1, sizeof(File));
+	data = calloc(1, sizeof(REDUSBGadgetData));
 
-	if (file == NULL) {
+	if (data == NULL) {
 		log_error("Could not allocate file object: %s (%d)",
 		          get_errno_name(ENOMEM), ENOMEM);
 
 		return -1;
 	}
 
-	if (file_create(file, G_RED_BRICK_DATA_FILENAME,
+	if (file_create(&data->base, G_RED_BRICK_DATA_FILENAME,
 	                O_RDWR | O_NONBLOCK, 0) < 0) {
 		log_error("Could not create file object for '%s': %s (%d)",
 		          G_RED_BRICK_DATA_FILENAME, get_errno_name(errno), errno);
 
-		free(file);
+		free(data);
 
 		return -1;
 	}
 
-	_client = network_create_client("g_red_brick", &file->base);
+	// route writes through the write buffer
+	data->base.base.type = "g_red_brick";
+	data->base.base.destroy = (IODestroyFunction)red_usb_gadget_data_destroy;
+	data->base.base.write = (IOWriteFunction)red_usb_gadget_data_write;
+
+	_data = data;
+	_client = network_create_client("g_red_brick", &data->base.base);
 
 	if (_client == NULL) {
-		file_destroy(file);
-		free(file);
+		_data = NULL;
+
+		file_destroy(&data->base);
+		free(data);
 
 		return -1;
 	}
 
-	_client->destroy_done = red_usb_gadget_client_destroy_done; // FIXME: this will only do one reconnect try
+	_client->destroy_done = red_usb_gadget_client_destroy_done;
 	_client->authentication_state = CLIENT_AUTHENTICATION_STATE_DISABLED;
 
+	_connect_time = microseconds();
+
 	log_info("Connected to RED Brick USB gadget");
 
 	return 0;
@@ -136,9 +322,13 @@ static int red_usb_gadget_connect(void) {
 }
 
 static void red_usb_gadget_disconnect(void) {
+	red_usb_gadget_flush();
+
 	_client->destroy_done = NULL;
 	_client->disconnected = true;
 	_client = NULL;
+	_reconnect_tries = 0;
+	_connect_time = 0;
 
 	log_info("Disconnected from RED Brick USB gadget");
 }
@@ -178,6 +368,12 @@ static void red_usb_gadget_handle_state_change(void *opaque) {
 
 	case RED_USB_GADGET_STATE_DISCONNECTED:
 		if (_client == NULL) {
+			// stop pending reconnect tries
+			timer_configure(&_reconnect_timer, 0, 0);
+
+			_reconnect_tries = 0;
+			_connect_time = 0;
+
 			log_warn("Already disconnected from RED Brick USB gadget");
 
 			return;
@@ -212,6 +408,24 @@ int red_usb_gadget_init(void) {
 	          base58_encode(base58, uint32_from_le(_uid)),
 	          uint32_from_le(_uid));
 
+	if (timer_create_(&_flush_timer, red_usb_gadget_handle_flush, NULL) < 0) {
+		log_error("Could not create RED Brick USB gadget flush timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (timer_create_(&_reconnect_timer, red_usb_gadget_handle_reconnect, NULL) < 0) {
+		log_error("Could not create RED Brick USB gadget reconnect timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
 	// read current USB gadget state from /proc/g_red_brick_state
 	if (file_create(&_state_file, G_RED_BRICK_STATE_FILENAME,
 	                O_RDONLY | O_NONBLOCK, 0) < 0) {
@@ -221,14 +435,14 @@ int red_usb_gadget_init(void) {
 		goto cleanup;
 	}
 
-	phase = 1;
+	phase = 3;
 
 	if (event_add_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC, "usb-gadget",
 	                     EVENT_READ, red_usb_gadget_handle_state_change, NULL) < 0) {
 		goto cleanup;
 	}
 
-	phase = 2;
+	phase = 4;
 
 	if (file_read(&_state_file, &state, sizeof(state)) != sizeof(state)) {
 		log_error("Could not read from '%s': %s (%d)",
@@ -241,23 +455,31 @@ int red_usb_gadget_init(void) {
 		goto cleanup;
 	}
 
-	phase = 3;
+	phase = 5;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 2:
+	case 4:
 		event_remove_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC);
 		// fall through
 
-	case 1:
+	case 3:
 		file_destroy(&_state_file);
 		// fall through
 
+	case 2:
+		timer_destroy(&_reconnect_timer);
+		// fall through
+
+	case 1:
+		timer_destroy(&_flush_timer);
+		// fall through
+
 	default:
 		break;
 	}
 
-	return phase == 3 ? 0 : -1;
+	return phase == 5 ? 0 : -1;
 }
 
 void red_usb_gadget_exit(void) {
@@ -270,6 +492,9 @@ void red_usb_gadget_exit(void) {
 	event_remove_source(_state_file.handle, EVENT_SOURCE_TYPE_GENERIC);
 
 	file_destroy(&_state_file);
+
+	timer_destroy(&_reconnect_timer);
+	timer_destroy(&_flush_timer);
 }
 
 void red_usb_gadget_announce_red_brick_disconnect(void) {
@@ -281,6 +506,36 @@ void red_usb_gadget_announce_red_brick_disconnect(void) {
 	          G_RED_BRICK_DATA_FILENAME);
 
 	client_send_red_brick_enumerate(_client, ENUMERATION_TYPE_DISCONNECTED);
+
+	// the event loop is not running anymore, flush now
+	red_usb_gadget_flush();
+}
+
+// called at the end of each event loop iteration to write all responses that
+// got collected during this iteration with a single write call
+void red_usb_gadget_flush(void) {
+	if (_data == NULL) {
+		return;
+	}
+
+	if (red_usb_gadget_data_flush(_data) < 0) {
+		if (errno_would_block()) {
+			red_usb_gadget_data_set_congested(_data, true);
+		} else {
+			log_error("Could not write to '%s', disconnecting RED Brick USB gadget: %s (%d)",
+			          G_RED_BRICK_DATA_FILENAME, get_errno_name(errno), errno);
+
+			_data->write_buffer_used = 0;
+
+			if (_client != NULL) {
+				_client->disconnected = true;
+			}
+		}
+
+		return;
+	}
+
+	red_usb_gadget_data_set_congested(_data, false);
 }
 
 uint32_t red_usb_gadget_get_uid(void) {
@@ -30,6 +30,7 @@ int red_usb_gadget_init(void);
 void red_usb_gadget_exit(void);
 
 void red_usb_gadget_announce_red_brick_disconnect(void);
+void red_usb_gadget_flush(void);
 
 uint32_t red_usb_gadget_get_uid(void);
 
@@ -42,15 +42,18 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 #define RECONNECT_INTERVAL 2000000 // 2 seconds in microseconds
 #define SOCKET_FILENAME "/var/run/redapid-brickd.socket"
 
+// redapid traffic (program output, file transfers) is much heavier than the
+// traffic of a single Brick. use a buffer that can hold many packets, so a
+// single read can receive a whole burst of responses
+#define RESPONSE_BUFFER_SIZE 16384
+
 typedef struct {
 	Stack base;
 
 	Socket socket;
-	union {
-		uint8_t response_buffer[512];
-		Packet response;
-	};
-	int response_buffer_used;
+	uint8_t response_buffer[RESPONSE_BUFFER_SIZE];
+	int response_buffer_start; // offset of the first unprocessed byte
+	int response_buffer_used; // offset of the first unused byte
 	bool response_header_checked;
 	Writer request_writer;
 } REDBrickAPIDaemon;
@@ -83,6 +86,7 @@ static void redapid_disconnect(bool reconnect) {
 
 static void redapid_handle_read(void *opaque) {
 	int length;
+	Packet *response;
 	const char *message = NULL;
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
@@ -119,16 +123,22 @@ static void redapid_handle_read(void *opaque) {
 
 	_redapid.response_buffer_used += length;
 
-	while (_connected && _redapid.response_buffer_used > 0) {
-		if (_redapid.response_buffer_used < (int)sizeof(PacketHeader)) {
+	// dispatch all complete packets in place. instead of moving the remaining
+	// data to the front of the buffer after each packet only the start offset
+	// is advanced. the incomplete tail (if any) is moved once after the loop
+	while (_connected && _redapid.response_buffer_used > _redapid.response_buffer_start) {
+		length = _redapid.response_buffer_used - _redapid.response_buffer_start;
+		response = (Packet *)(_redapid.response_buffer + _redapid.response_buffer_start);
+
+		if (length < (int)sizeof(PacketHeader)) {
 			// wait for complete header
 			break;
 		}
 
 		if (!_redapid.response_header_checked) {
-			if (!packet_header_is_valid_response(&_redapid.response.header, &message)) {
+			if (!packet_header_is_valid_response(&response->header, &message)) {
 				log_error("Received invalid response (packet: %s) from RED Brick API Daemon, disconnecting redapid: %s",
-				          packet_get_dump(packet_dump, &_redapid.response, _redapid.response_buffer_used),
+				          packet_get_dump(packet_dump, response, length),
 				          message);
 
 				redapid_disconnect(true);
@@ -139,27 +149,39 @@ static void redapid_handle_read(void *opaque) {
 			_redapid.response_header_checked = true;
 		}
 
-		length = _redapid.response.header.length;
-
-		if (_redapid.response_buffer_used < length) {
+		if (length < response->header.length) {
 			// wait for complete packet
 			break;
 		}
 
 		log_packet_debug("Received %s (%s) from RED Brick API Daemon",
-		                 packet_get_response_type(&_redapid.response),
-		                 packet_get_response_signature(packet_signature, &_redapid.response));
+		                 packet_get_response_type(response),
+		                 packet_get_response_signature(packet_signature, response));
 
-		stack_add_recipient(&_redapid.base, _redapid.response.header.uid, 0);
+		stack_add_recipient(&_redapid.base, response->header.uid, 0);
 
-		network_dispatch_response(&_redapid.response);
+		network_dispatch_response(response);
 
-		memmove(_redapid.response_buffer, _redapid.response_buffer + length,
-		        _redapid.response_buffer_used - length);
-
-		_redapid.response_buffer_used -= length;
+		_redapid.response_buffer_start += response->header.length;
 		_redapid.response_header_checked = false;
 	}
+
+	if (!_connected) {
+		return;
+	}
+
+	if (_redapid.response_buffer_start == _redapid.response_buffer_used) {
+		_redapid.response_buffer_start = 0;
+		_redapid.response_buffer_used = 0;
+	} else if (_redapid.response_buffer_start > 0) {
+		// move the incomplete packet to the front of the buffer. this copies
+		// less than one packet and only happens once per read
+		memmove(_redapid.response_buffer, _redapid.response_buffer + _redapid.response_buffer_start,
+		        _redapid.response_buffer_used - _redapid.response_buffer_start);
+
+		_redapid.response_buffer_used -= _redapid.response_buffer_start;
+		_redapid.response_buffer_start = 0;
+	}
 }
 
 static int redapid_dispatch_request(Stack *stack, Packet *request,
@@ -239,6 +261,7 @@ static void redapid_handle_reconnect(void *opaque) {
 
 	(void)opaque;
 
+	_redapid.response_buffer_start = 0;
 	_redapid.response_buffer_used = 0;
 	_redapid.response_header_checked = false;
 
@@ -0,0 +1,388 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * resolver.c: Client address formatting and host name resolution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a reverse lookup can take seconds if the name service is slow or
+ * misconfigured. doing it in the event loop thread on accept would stall all
+ * USB, SPI and client I/O meanwhile. therefore new clients are named by their
+ * numeric address right away and the host name is looked up by a worker
+ * thread afterwards. the result is passed back to the event loop thread
+ * through a pipe. lookups are done one after the other, a slow name service
+ * only delays the names, not the clients.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+	#include <netdb.h>
+#endif
+
+#include <daemonlib/array.h>
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/pipe.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "resolver.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+typedef struct {
+	struct sockaddr_storage address;
+	socklen_t length;
+	ResolverDoneFunction done;
+	void *opaque;
+	char name[RESOLVER_MAX_NAME_LENGTH]; // only used for results
+} ResolverJob;
+
+static bool _enabled = false;
+static bool _running = false;
+static Mutex _mutex; // protects _running, _jobs, _results and _current_opaque
+static Semaphore _semaphore; // released once per queued job
+static Array _jobs;
+static Array _results;
+static void *_current_opaque = NULL; // job being resolved, NULL if none or canceled
+static Pipe _notification_pipe;
+static Thread _thread;
+
+static int resolver_format_name(struct sockaddr *address, socklen_t length,
+                                char *name, int name_length, int flags) {
+	char host[NI_MAXHOST];
+	char port[NI_MAXSERV];
+	int rc;
+
+	rc = getnameinfo(address, length, host, sizeof(host), port, sizeof(port),
+	                 flags | NI_NUMERICSERV);
+
+	if (rc != 0) {
+		return rc;
+	}
+
+	if (address->sa_family == AF_INET6) {
+		snprintf(name, name_length, "[%s]:%s", host, port);
+	} else {
+		snprintf(name, name_length, "%s:%s", host, port);
+	}
+
+	return 0;
+}
+
+static void resolver_handle_results(void *opaque) {
+	uint8_t byte;
+	ResolverJob result;
+
+	(void)opaque;
+
+	if (pipe_read(&_notification_pipe, &byte, sizeof(byte)) < 0) {
+		log_error("Could not read from resolver notification pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	for (;;) {
+		mutex_lock(&_mutex);
+
+		if (_results.count == 0) {
+			mutex_unlock(&_mutex);
+
+			break;
+		}
+
+		memcpy(&result, array_get(&_results, 0), sizeof(result));
+		array_remove(&_results, 0, NULL);
+
+		mutex_unlock(&_mutex);
+
+		result.done(result.opaque, result.name);
+	}
+}
+
+static void resolver_run(void *opaque) {
+	ResolverJob job;
+	ResolverJob *result;
+	uint8_t byte = 0;
+	int rc;
+
+	(void)opaque;
+
+	for (;;) {
+		semaphore_acquire(&_semaphore);
+
+		mutex_lock(&_mutex);
+
+		if (!_running) {
+			mutex_unlock(&_mutex);
+
+			break;
+		}
+
+		if (_jobs.count == 0) { // canceled meanwhile
+			mutex_unlock(&_mutex);
+
+			continue;
+		}
+
+		memcpy(&job, array_get(&_jobs, 0), sizeof(job));
+		array_remove(&_jobs, 0, NULL);
+
+		_current_opaque = job.opaque;
+
+		mutex_unlock(&_mutex);
+
+		rc = resolver_format_name((struct sockaddr *)&job.address, job.length,
+		                          job.name, sizeof(job.name), NI_NAMEREQD);
+
+		mutex_lock(&_mutex);
+
+		if (rc != 0) {
+			log_debug("Could not resolve host name: %s (%d)",
+			          gai_strerror(rc), rc);
+		} else if (_current_opaque != NULL) {
+			result = array_append(&_results);
+
+			if (result == NULL) {
+				log_error("Could not append to resolver result array: %s (%d)",
+				          get_errno_name(errno), errno);
+			} else {
+				memcpy(result, &job, sizeof(job));
+
+				if (_results.count == 1 &&
+				    pipe_write(&_notification_pipe, &byte, sizeof(byte)) < 0) {
+					log_error("Could not write to resolver notification pipe: %s (%d)",
+					          get_errno_name(errno), errno);
+				}
+			}
+		}
+
+		_current_opaque = NULL;
+
+		mutex_unlock(&_mutex);
+	}
+}
+
+int resolver_init(void) {
+	int phase = 0;
+
+	_enabled = config_get_option_value("listen.resolve_client_names")->boolean;
+
+	if (!_enabled) {
+		return 0;
+	}
+
+	log_debug("Initializing resolver subsystem");
+
+	if (array_create(&_jobs, 32, sizeof(ResolverJob), true) < 0) {
+		log_error("Could not create resolver job array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (array_create(&_results, 32, sizeof(ResolverJob), true) < 0) {
+		log_error("Could not create resolver result array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (pipe_create(&_notification_pipe, 0) < 0) {
+		log_error("Could not create resolver notification pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	if (event_add_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     "resolver", EVENT_READ, resolver_handle_results, NULL) < 0) {
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	if (semaphore_create(&_semaphore) < 0) {
+		log_error("Could not create resolver semaphore: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	mutex_create(&_mutex);
+
+	_running = true;
+
+	thread_create(&_thread, resolver_run, NULL);
+
+	phase = 5;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		event_remove_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		// fall through
+
+	case 3:
+		pipe_destroy(&_notification_pipe);
+		// fall through
+
+	case 2:
+		array_destroy(&_results, NULL);
+		// fall through
+
+	case 1:
+		array_destroy(&_jobs, NULL);
+		// fall through
+
+	default:
+		break;
+	}
+
+	if (phase != 5) {
+		_enabled = false;
+	}
+
+	return phase == 5 ? 0 : -1;
+}
+
+void resolver_exit(void) {
+	if (!_enabled) {
+		return;
+	}
+
+	log_debug("Shutting down resolver subsystem");
+
+	mutex_lock(&_mutex);
+	_running = false;
+	mutex_unlock(&_mutex);
+
+	// if the thread is in the middle of a lookup then this waits for the
+	// lookup to time out
+	semaphore_release(&_semaphore);
+	thread_join(&_thread);
+	thread_destroy(&_thread);
+
+	event_remove_source(_notification_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	pipe_destroy(&_notification_pipe);
+
+	array_destroy(&_results, NULL);
+	array_destroy(&_jobs, NULL);
+
+	semaphore_destroy(&_semaphore);
+	mutex_destroy(&_mutex);
+
+	_enabled = false;
+}
+
+// never blocks, the address is not looked up in any name service
+int resolver_format_numeric_name(struct sockaddr *address, socklen_t length,
+                                 char *name, int name_length) {
+	int rc = resolver_format_name(address, length, name, name_length, NI_NUMERICHOST);
+
+	if (rc != 0) {
+		log_warn("Could not format numeric address: %s (%d)", gai_strerror(rc), rc);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// queues a host name lookup. done is only called if the lookup succeeds and
+// resolver_cancel was not called for opaque in the meantime
+int resolver_resolve_name(struct sockaddr *address, socklen_t length,
+                          ResolverDoneFunction done, void *opaque) {
+	ResolverJob *job;
+
+	if (!_enabled) {
+		return 0;
+	}
+
+	if (length > (socklen_t)sizeof(job->address)) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	mutex_lock(&_mutex);
+
+	job = array_append(&_jobs);
+
+	if (job == NULL) {
+		mutex_unlock(&_mutex);
+
+		log_error("Could not append to resolver job array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	memcpy(&job->address, address, length);
+
+	job->length = length;
+	job->done = done;
+	job->opaque = opaque;
+
+	mutex_unlock(&_mutex);
+
+	semaphore_release(&_semaphore);
+
+	return 0;
+}
+
+// drops all queued, running and finished lookups for opaque. has to be called
+// before opaque becomes invalid
+void resolver_cancel(void *opaque) {
+	int i;
+
+	if (!_enabled) {
+		return;
+	}
+
+	mutex_lock(&_mutex);
+
+	for (i = _jobs.count - 1; i >= 0; --i) {
+		if (((ResolverJob *)array_get(&_jobs, i))->opaque == opaque) {
+			array_remove(&_jobs, i, NULL);
+		}
+	}
+
+	if (_current_opaque == opaque) {
+		_current_opaque = NULL;
+	}
+
+	for (i = _results.count - 1; i >= 0; --i) {
+		if (((ResolverJob *)array_get(&_results, i))->opaque == opaque) {
+			array_remove(&_results, i, NULL);
+		}
+	}
+
+	mutex_unlock(&_mutex);
+}
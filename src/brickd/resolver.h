@@ -0,0 +1,44 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * resolver.h: Client address formatting and host name resolution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_RESOLVER_H
+#define BRICKD_RESOLVER_H
+
+#include <daemonlib/socket.h>
+
+// large enough for "[<numeric IPv6 address>]:<port>"
+#define RESOLVER_MAX_NAME_LENGTH 128
+
+// called in the event loop thread. name has the same format as the one from
+// resolver_format_numeric_name, but with the host name instead of the address
+typedef void (*ResolverDoneFunction)(void *opaque, const char *name);
+
+int resolver_init(void);
+void resolver_exit(void);
+
+int resolver_format_numeric_name(struct sockaddr *address, socklen_t length,
+                                 char *name, int name_length);
+
+int resolver_resolve_name(struct sockaddr *address, socklen_t length,
+                          ResolverDoneFunction done, void *opaque);
+void resolver_cancel(void *opaque);
+
+#endif // BRICKD_RESOLVER_H
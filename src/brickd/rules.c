@@ -0,0 +1,435 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * rules.c: Rules that react on callbacks without a client round trip
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * rules are loaded from the file given by the rules.file option. each rule
+ * matches a callback by UID and function ID plus a condition on one value in
+ * the callback payload. if a rule matches then its action request is sent to
+ * the hardware directly, instead of going to a client and back:
+ *
+ *   rule0.name = overheat
+ *   rule0.match.uid = XYZ
+ *   rule0.match.function_id = 8
+ *   rule0.match.type = int16
+ *   rule0.match.offset = 0
+ *   rule0.match.condition = >
+ *   rule0.match.value = 3000
+ *   rule0.action.uid = ABC
+ *   rule0.action.function_id = 1
+ *   rule0.action.payload = 01 00
+ *   rule0.min_interval = 1000
+ *
+ * the action is sent without response expected. min_interval (in milliseconds)
+ * limits how often a rule can trigger, matches in between are counted as
+ * suppressed.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/base58.h>
+#include <daemonlib/conf_file.h>
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "rules.h"
+
+#include "hardware.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+static Rule _rules[RULES_MAX_COUNT];
+static int _rule_count = 0;
+
+static const char *_value_type_names[] = {
+	"uint8", "int8", "uint16", "int16", "uint32", "int32"
+};
+
+static const int _value_type_sizes[] = {
+	1, 1, 2, 2, 4, 4
+};
+
+static const char *_condition_names[] = {
+	"<", "<=", "==", "!=", ">=", ">"
+};
+
+static int rules_parse_integer(const char *string, int64_t min, int64_t max,
+                               int64_t *value) {
+	char *end = NULL;
+	long long parsed;
+
+	errno = 0;
+	parsed = strtoll(string, &end, 0);
+
+	if (errno != 0 || end == string || *end != '\0' || parsed < min || parsed > max) {
+		return -1;
+	}
+
+	*value = parsed;
+
+	return 0;
+}
+
+static int rules_parse_name(const char *string, const char **names, int count) {
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (strcmp(string, names[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// payload is given as hex bytes separated by whitespace, e.g. "01 00 ff"
+static int rules_parse_payload(const char *string, uint8_t *payload, int max_length) {
+	int length = 0;
+	char *end;
+	unsigned long byte;
+
+	for (;;) {
+		while (*string == ' ' || *string == '\t') {
+			++string;
+		}
+
+		if (*string == '\0') {
+			return length;
+		}
+
+		if (length >= max_length) {
+			return -1;
+		}
+
+		errno = 0;
+		byte = strtoul(string, &end, 16);
+
+		if (errno != 0 || end == string || byte > 255 ||
+		    (*end != '\0' && *end != ' ' && *end != '\t')) {
+			return -1;
+		}
+
+		payload[length++] = (uint8_t)byte;
+		string = end;
+	}
+}
+
+static const char *rules_get_option(ConfFile *conf_file, int index, const char *name) {
+	char option[64];
+
+	snprintf(option, sizeof(option), "rule%d.%s", index, name);
+
+	return conf_file_get_option_value(conf_file, option);
+}
+
+// returns -1 on error, 0 if the rule does not exist and 1 if it was loaded
+static int rules_load_rule(ConfFile *conf_file, int index, Rule *rule) {
+	const char *match_uid = rules_get_option(conf_file, index, "match.uid");
+	const char *name;
+	const char *string;
+	uint32_t uid;
+	int64_t value;
+	int payload_length;
+	int i;
+
+	if (match_uid == NULL) {
+		return 0;
+	}
+
+	memset(rule, 0, sizeof(Rule));
+
+	name = rules_get_option(conf_file, index, "name");
+
+	if (name != NULL && *name != '\0') {
+		string_copy(rule->name, sizeof(rule->name), name, -1);
+	} else {
+		snprintf(rule->name, sizeof(rule->name), "rule%d", index);
+	}
+
+	if (base58_decode(&uid, match_uid) < 0) {
+		log_error("Rule '%s' has invalid match.uid '%s'", rule->name, match_uid);
+
+		return -1;
+	}
+
+	rule->uid = uint32_to_le(uid);
+
+	string = rules_get_option(conf_file, index, "match.function_id");
+
+	if (string == NULL || rules_parse_integer(string, 1, 255, &value) < 0) {
+		log_error("Rule '%s' has missing or invalid match.function_id", rule->name);
+
+		return -1;
+	}
+
+	rule->function_id = (uint8_t)value;
+
+	string = rules_get_option(conf_file, index, "match.type");
+	i = string != NULL ? rules_parse_name(string, _value_type_names, sizeof(_value_type_names) / sizeof(_value_type_names[0])) : -1;
+
+	if (i < 0) {
+		log_error("Rule '%s' has missing or invalid match.type", rule->name);
+
+		return -1;
+	}
+
+	rule->value_type = (RuleValueType)i;
+
+	string = rules_get_option(conf_file, index, "match.offset");
+
+	if (string == NULL) {
+		string = "0";
+	}
+
+	if (rules_parse_integer(string, 0, (int)sizeof(rule->action.payload) - _value_type_sizes[rule->value_type], &value) < 0) {
+		log_error("Rule '%s' has invalid match.offset '%s'", rule->name, string);
+
+		return -1;
+	}
+
+	rule->offset = (int)value;
+
+	string = rules_get_option(conf_file, index, "match.condition");
+	i = string != NULL ? rules_parse_name(string, _condition_names, sizeof(_condition_names) / sizeof(_condition_names[0])) : -1;
+
+	if (i < 0) {
+		log_error("Rule '%s' has missing or invalid match.condition", rule->name);
+
+		return -1;
+	}
+
+	rule->condition = (RuleCondition)i;
+
+	string = rules_get_option(conf_file, index, "match.value");
+
+	if (string == NULL || rules_parse_integer(string, INT32_MIN, UINT32_MAX, &rule->value) < 0) {
+		log_error("Rule '%s' has missing or invalid match.value", rule->name);
+
+		return -1;
+	}
+
+	string = rules_get_option(conf_file, index, "action.uid");
+
+	if (string == NULL || base58_decode(&uid, string) < 0) {
+		log_error("Rule '%s' has missing or invalid action.uid", rule->name);
+
+		return -1;
+	}
+
+	rule->action.header.uid = uint32_to_le(uid);
+
+	string = rules_get_option(conf_file, index, "action.function_id");
+
+	if (string == NULL || rules_parse_integer(string, 1, 255, &value) < 0) {
+		log_error("Rule '%s' has missing or invalid action.function_id", rule->name);
+
+		return -1;
+	}
+
+	rule->action.header.function_id = (uint8_t)value;
+
+	string = rules_get_option(conf_file, index, "action.payload");
+	payload_length = 0;
+
+	if (string != NULL) {
+		payload_length = rules_parse_payload(string, rule->action.payload,
+		                                     sizeof(rule->action.payload));
+
+		if (payload_length < 0) {
+			log_error("Rule '%s' has invalid action.payload '%s'", rule->name, string);
+
+			return -1;
+		}
+	}
+
+	rule->action.header.length = sizeof(PacketHeader) + payload_length;
+
+	// sequence number 0 is reserved for callbacks
+	packet_header_set_sequence_number(&rule->action.header, 1);
+	packet_header_set_response_expected(&rule->action.header, false);
+
+	string = rules_get_option(conf_file, index, "min_interval");
+
+	if (string == NULL) {
+		string = "0";
+	}
+
+	if (rules_parse_integer(string, 0, INT32_MAX, &value) < 0) {
+		log_error("Rule '%s' has invalid min_interval '%s'", rule->name, string);
+
+		return -1;
+	}
+
+	rule->min_interval = (uint64_t)value * 1000;
+
+	return 1;
+}
+
+int rules_init(void) {
+	const char *filename = config_get_option_value("rules.file")->string;
+	ConfFile conf_file;
+	int i;
+	int rc;
+
+	_rule_count = 0;
+
+	if (filename == NULL || *filename == '\0') {
+		return 0;
+	}
+
+	log_debug("Initializing rules subsystem");
+
+	if (conf_file_create(&conf_file) < 0) {
+		log_error("Could not create rules conf object: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (conf_file_read(&conf_file, filename, NULL, NULL) < 0) {
+		log_error("Could not read rules file '%s': %s (%d)",
+		          filename, get_errno_name(errno), errno);
+
+		conf_file_destroy(&conf_file);
+
+		return -1;
+	}
+
+	for (i = 0; i < RULES_MAX_COUNT; ++i) {
+		rc = rules_load_rule(&conf_file, i, &_rules[_rule_count]);
+
+		if (rc < 0) {
+			conf_file_destroy(&conf_file);
+
+			_rule_count = 0;
+
+			return -1;
+		}
+
+		if (rc > 0) {
+			++_rule_count;
+		}
+	}
+
+	conf_file_destroy(&conf_file);
+
+	log_info("Loaded %d rule(s) from '%s'", _rule_count, filename);
+
+	return 0;
+}
+
+void rules_exit(void) {
+	int i;
+	Rule *rule;
+
+	if (_rule_count == 0) {
+		return;
+	}
+
+	log_debug("Shutting down rules subsystem");
+
+	for (i = 0; i < _rule_count; ++i) {
+		rule = &_rules[i];
+
+		log_debug("Rule '%s' triggered %u time(s), %u time(s) suppressed by min_interval",
+		          rule->name, rule->triggered, rule->suppressed);
+	}
+
+	_rule_count = 0;
+}
+
+static bool rules_is_matching(Rule *rule, Packet *callback) {
+	uint8_t *data = callback->payload + rule->offset;
+	int64_t value;
+
+	if (callback->header.uid != rule->uid ||
+	    callback->header.function_id != rule->function_id ||
+	    callback->header.length < (int)sizeof(PacketHeader) + rule->offset + _value_type_sizes[rule->value_type]) {
+		return false;
+	}
+
+	switch (rule->value_type) {
+	case RULE_VALUE_TYPE_UINT8:  value = data[0];                                       break;
+	case RULE_VALUE_TYPE_INT8:   value = (int8_t)data[0];                               break;
+	case RULE_VALUE_TYPE_UINT16: value = (uint16_t)(data[0] | (data[1] << 8));          break;
+	case RULE_VALUE_TYPE_INT16:  value = (int16_t)(uint16_t)(data[0] | (data[1] << 8)); break;
+	case RULE_VALUE_TYPE_UINT32: value = (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+	                                     ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24); break;
+	case RULE_VALUE_TYPE_INT32:  value = (int32_t)((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+	                                               ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24)); break;
+
+	default:                     return false;
+	}
+
+	switch (rule->condition) {
+	case RULE_CONDITION_LESS:          return value < rule->value;
+	case RULE_CONDITION_LESS_EQUAL:    return value <= rule->value;
+	case RULE_CONDITION_EQUAL:         return value == rule->value;
+	case RULE_CONDITION_NOT_EQUAL:     return value != rule->value;
+	case RULE_CONDITION_GREATER_EQUAL: return value >= rule->value;
+	case RULE_CONDITION_GREATER:       return value > rule->value;
+
+	default:                           return false;
+	}
+}
+
+void rules_handle_callback(Packet *callback) {
+	int i;
+	Rule *rule;
+	uint64_t now = 0;
+	Packet request;
+
+	for (i = 0; i < _rule_count; ++i) {
+		rule = &_rules[i];
+
+		if (!rules_is_matching(rule, callback)) {
+			continue;
+		}
+
+		if (now == 0) {
+			now = microseconds();
+		}
+
+		if (rule->triggered > 0 && now - rule->last_triggered < rule->min_interval) {
+			++rule->suppressed;
+
+			continue;
+		}
+
+		rule->last_triggered = now;
+		++rule->triggered;
+
+		log_packet_debug("Rule '%s' triggered, sending action request", rule->name);
+
+		// the request might get modified while being dispatched
+		memcpy(&request, &rule->action, sizeof(Packet));
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+		request.trace_id = packet_get_next_request_trace_id();
+#endif
+
+		hardware_dispatch_request(&request);
+	}
+}
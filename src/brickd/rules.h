@@ -0,0 +1,75 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * rules.h: Rules that react on callbacks without a client round trip
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_RULES_H
+#define BRICKD_RULES_H
+
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+#define RULES_MAX_COUNT 32
+#define RULES_MAX_NAME_LENGTH 32
+
+typedef enum {
+	RULE_VALUE_TYPE_UINT8 = 0,
+	RULE_VALUE_TYPE_INT8,
+	RULE_VALUE_TYPE_UINT16,
+	RULE_VALUE_TYPE_INT16,
+	RULE_VALUE_TYPE_UINT32,
+	RULE_VALUE_TYPE_INT32
+} RuleValueType;
+
+typedef enum {
+	RULE_CONDITION_LESS = 0,
+	RULE_CONDITION_LESS_EQUAL,
+	RULE_CONDITION_EQUAL,
+	RULE_CONDITION_NOT_EQUAL,
+	RULE_CONDITION_GREATER_EQUAL,
+	RULE_CONDITION_GREATER
+} RuleCondition;
+
+typedef struct {
+	char name[RULES_MAX_NAME_LENGTH]; // for display purpose
+
+	// matched against incoming callbacks
+	uint32_t uid; // always little endian
+	uint8_t function_id;
+	RuleValueType value_type;
+	int offset; // in the payload
+	RuleCondition condition;
+	int64_t value;
+
+	// request that is sent to the hardware if the rule matches
+	Packet action;
+
+	uint64_t min_interval; // in microseconds
+	uint64_t last_triggered;
+	uint32_t triggered;
+	uint32_t suppressed;
+} Rule;
+
+int rules_init(void);
+void rules_exit(void);
+
+void rules_handle_callback(Packet *callback);
+
+#endif // BRICKD_RULES_H
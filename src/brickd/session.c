@@ -0,0 +1,227 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * session.c: Resumable authentication sessions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * an authenticated client can ask for a session token. a token consists of a
+ * random ID, its expiry time and a truncated HMAC over both, keyed with the
+ * authentication secret. on a later connection the client sends the token
+ * together with a counter and an HMAC over token and counter as its first
+ * request and is authenticated right away.
+ *
+ * brickd remembers the highest counter used per token. a resume request with
+ * a counter that is not larger is rejected, so a recorded resume request
+ * cannot be replayed. tokens are only kept in memory, after a restart of
+ * brickd all clients have to do the full authentication handshake again.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "session.h"
+
+#include "hmac.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define SESSION_TOKEN_MAC_LENGTH 8
+
+typedef struct {
+	bool used;
+	uint32_t id;
+	uint32_t expires; // in seconds
+	uint32_t counter; // highest counter accepted so far
+} SessionEntry;
+
+static SessionEntry _entries[SESSION_MAX_TOKENS];
+
+static uint32_t session_get_time(void) {
+	return (uint32_t)(microseconds() / 1000000);
+}
+
+static const char *session_get_secret(void) {
+	return config_get_option_value("authentication.secret")->string;
+}
+
+static void session_compute_mac(uint32_t id, uint32_t expires,
+                                uint8_t mac[SESSION_TOKEN_MAC_LENGTH]) {
+	const char *secret = session_get_secret();
+	uint32_t data[2];
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+
+	data[0] = uint32_to_le(id);
+	data[1] = uint32_to_le(expires);
+
+	hmac_sha1((uint8_t *)secret, strlen(secret),
+	          (uint8_t *)data, sizeof(data), digest);
+
+	memcpy(mac, digest, SESSION_TOKEN_MAC_LENGTH);
+}
+
+static SessionEntry *session_find_entry(uint32_t id) {
+	int i;
+
+	for (i = 0; i < SESSION_MAX_TOKENS; ++i) {
+		if (_entries[i].used && _entries[i].id == id) {
+			return &_entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+// returns an unused or expired entry. if all entries are in use then the one
+// that expires first is reused
+static SessionEntry *session_get_free_entry(uint32_t now) {
+	SessionEntry *oldest = &_entries[0];
+	int i;
+
+	for (i = 0; i < SESSION_MAX_TOKENS; ++i) {
+		if (!_entries[i].used || _entries[i].expires <= now) {
+			return &_entries[i];
+		}
+
+		if (_entries[i].expires < oldest->expires) {
+			oldest = &_entries[i];
+		}
+	}
+
+	log_debug("All %d session tokens in use, dropping oldest token", SESSION_MAX_TOKENS);
+
+	return oldest;
+}
+
+const char *session_get_status_name(SessionStatus status) {
+	switch (status) {
+	case SESSION_STATUS_OK:       return "ok";
+	case SESSION_STATUS_DISABLED: return "disabled";
+	case SESSION_STATUS_EXPIRED:  return "expired";
+	case SESSION_STATUS_REPLAYED: return "replayed";
+	case SESSION_STATUS_INVALID:  return "invalid";
+
+	default:                      return "<unknown>";
+	}
+}
+
+SessionStatus session_create_token(uint8_t token[SESSION_TOKEN_LENGTH],
+                                   uint32_t *lifetime) {
+	uint32_t now = session_get_time();
+	SessionEntry *entry;
+	uint32_t id;
+	uint32_t value;
+
+	*lifetime = (uint32_t)config_get_option_value("authentication.session_lifetime")->integer;
+
+	if (*lifetime == 0 || session_get_secret() == NULL) {
+		memset(token, 0, SESSION_TOKEN_LENGTH);
+
+		return SESSION_STATUS_DISABLED;
+	}
+
+	do {
+		id = get_random_uint32();
+	} while (session_find_entry(id) != NULL);
+
+	entry = session_get_free_entry(now);
+
+	entry->used = true;
+	entry->id = id;
+	entry->expires = now + *lifetime;
+	entry->counter = 0;
+
+	value = uint32_to_le(entry->id);
+	memcpy(token, &value, sizeof(value));
+
+	value = uint32_to_le(entry->expires);
+	memcpy(token + 4, &value, sizeof(value));
+
+	session_compute_mac(entry->id, entry->expires, token + 8);
+
+	return SESSION_STATUS_OK;
+}
+
+SessionStatus session_resume(const uint8_t token[SESSION_TOKEN_LENGTH],
+                             uint32_t counter,
+                             const uint8_t digest[SHA1_DIGEST_LENGTH]) {
+	const char *secret = session_get_secret();
+	uint32_t id;
+	uint32_t expires;
+	uint8_t mac[SESSION_TOKEN_MAC_LENGTH];
+	uint8_t data[SESSION_TOKEN_LENGTH + sizeof(uint32_t)];
+	uint8_t expected_digest[SHA1_DIGEST_LENGTH];
+	SessionEntry *entry;
+
+	if (config_get_option_value("authentication.session_lifetime")->integer == 0 ||
+	    secret == NULL) {
+		return SESSION_STATUS_DISABLED;
+	}
+
+	memcpy(&id, token, sizeof(id));
+	memcpy(&expires, token + 4, sizeof(expires));
+
+	id = uint32_from_le(id);
+	expires = uint32_from_le(expires);
+
+	// the token has to be one issued by us...
+	session_compute_mac(id, expires, mac);
+
+	if (!hmac_compare(token + 8, mac, SESSION_TOKEN_MAC_LENGTH)) {
+		return SESSION_STATUS_INVALID;
+	}
+
+	// ...and the client has to know the secret, not just a recorded token
+	counter = uint32_to_le(counter);
+
+	memcpy(data, token, SESSION_TOKEN_LENGTH);
+	memcpy(data + SESSION_TOKEN_LENGTH, &counter, sizeof(counter));
+
+	counter = uint32_from_le(counter);
+
+	hmac_sha1((uint8_t *)secret, strlen(secret),
+	          data, sizeof(data), expected_digest);
+
+	if (!hmac_compare(digest, expected_digest, SHA1_DIGEST_LENGTH)) {
+		return SESSION_STATUS_INVALID;
+	}
+
+	entry = session_find_entry(id);
+
+	if (entry == NULL || entry->expires != expires) {
+		return SESSION_STATUS_EXPIRED;
+	}
+
+	if (entry->expires <= session_get_time()) {
+		entry->used = false;
+
+		return SESSION_STATUS_EXPIRED;
+	}
+
+	if (counter <= entry->counter) {
+		return SESSION_STATUS_REPLAYED;
+	}
+
+	entry->counter = counter;
+
+	return SESSION_STATUS_OK;
+}
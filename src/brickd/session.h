@@ -0,0 +1,84 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * session.h: Resumable authentication sessions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_SESSION_H
+#define BRICKD_SESSION_H
+
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+#include "sha1.h"
+
+// brickd functions (UID 1) to authenticate a new connection with a token from
+// an earlier one, without the get-authentication-nonce round trip
+#define FUNCTION_GET_SESSION_TOKEN 15
+#define FUNCTION_RESUME_SESSION    16
+
+#define SESSION_TOKEN_LENGTH 16
+#define SESSION_MAX_TOKENS 256
+
+typedef enum {
+	SESSION_STATUS_OK = 0,
+	SESSION_STATUS_DISABLED,
+	SESSION_STATUS_EXPIRED, // also used for unknown tokens
+	SESSION_STATUS_REPLAYED,
+	SESSION_STATUS_INVALID // wrong secret or tampered token
+} SessionStatus;
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+} ATTRIBUTE_PACKED GetSessionTokenRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t status;
+	uint8_t token[SESSION_TOKEN_LENGTH];
+	uint32_t lifetime; // in seconds
+} ATTRIBUTE_PACKED GetSessionTokenResponse;
+
+// digest = HMAC-SHA1(secret, token | counter). the counter has to be larger
+// than the counter of every earlier resume request with the same token
+typedef struct {
+	PacketHeader header;
+	uint8_t token[SESSION_TOKEN_LENGTH];
+	uint32_t counter;
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+} ATTRIBUTE_PACKED ResumeSessionRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t status;
+} ATTRIBUTE_PACKED ResumeSessionResponse;
+
+#include <daemonlib/packed_end.h>
+
+const char *session_get_status_name(SessionStatus status);
+
+SessionStatus session_create_token(uint8_t token[SESSION_TOKEN_LENGTH],
+                                   uint32_t *lifetime);
+SessionStatus session_resume(const uint8_t token[SESSION_TOKEN_LENGTH],
+                             uint32_t counter,
+                             const uint8_t digest[SHA1_DIGEST_LENGTH]);
+
+#endif // BRICKD_SESSION_H
@@ -0,0 +1,274 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * squash.c: Last-writer-wins squashing of queued setter requests
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a client that streams setters (LED colors, motor velocity, PWM duty cycle)
+ * faster than a device can take them fills the device queue with stale
+ * values that are all written out in order. for the function IDs listed in
+ * the squash.requests option a newer request replaces an older one for the
+ * same UID and function ID that is still waiting in the same device queue.
+ * the newer request takes the queue position of the older one, so it also
+ * gets written out earlier.
+ *
+ * only requests without response expected are squashed. a dropped request
+ * with response expected would leave a pending request behind that never gets
+ * a response. the request at the head of a queue is never replaced, because
+ * the device thread might be writing it out at that moment.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/base58.h>
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/utils.h>
+
+#include "squash.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+typedef struct {
+	uint32_t uid; // always little endian, 0 matches all UIDs
+	uint8_t function_id;
+} SquashRule;
+
+typedef struct {
+	uint32_t uid; // always little endian
+	uint8_t function_id;
+	Packet *queued_request;
+} SquashEntry;
+
+static SquashRule _rules[SQUASH_MAX_RULES];
+static int _rule_count = 0;
+static uint32_t _squashed_requests = 0;
+
+// parses "<uid>:<function-id>" with "*" as UID for all UIDs
+static int squash_parse_rule(const char *string, int length, SquashRule *rule) {
+	char buffer[64];
+	char *colon;
+	char *end = NULL;
+	long function_id;
+	uint32_t uid;
+
+	if (length >= (int)sizeof(buffer)) {
+		return -1;
+	}
+
+	memcpy(buffer, string, length);
+	buffer[length] = '\0';
+
+	colon = strchr(buffer, ':');
+
+	if (colon == NULL) {
+		return -1;
+	}
+
+	*colon = '\0';
+
+	if (strcmp(buffer, "*") == 0) {
+		uid = 0;
+	} else if (base58_decode(&uid, buffer) < 0 || uid == 0) {
+		return -1;
+	}
+
+	errno = 0;
+	function_id = strtol(colon + 1, &end, 0);
+
+	if (errno != 0 || end == colon + 1 || *end != '\0' || function_id < 1 || function_id > 255) {
+		return -1;
+	}
+
+	rule->uid = uint32_to_le(uid);
+	rule->function_id = (uint8_t)function_id;
+
+	return 0;
+}
+
+static bool squash_is_squashable(Packet *request) {
+	int i;
+
+	if (_rule_count == 0 || packet_header_get_response_expected(&request->header)) {
+		return false;
+	}
+
+	for (i = 0; i < _rule_count; ++i) {
+		if ((_rules[i].uid == 0 || _rules[i].uid == request->header.uid) &&
+		    _rules[i].function_id == request->header.function_id) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int squash_init(void) {
+	const char *string = config_get_option_value("squash.requests")->string;
+	const char *separators = " \t,";
+	int length;
+
+	_rule_count = 0;
+	_squashed_requests = 0;
+
+	if (string == NULL) {
+		return 0;
+	}
+
+	log_debug("Initializing squash subsystem");
+
+	for (string += strspn(string, separators); *string != '\0';
+	     string += strspn(string, separators)) {
+		length = (int)strcspn(string, separators);
+
+		if (_rule_count >= SQUASH_MAX_RULES) {
+			log_error("Too many squash.requests entries, only %d are supported",
+			          SQUASH_MAX_RULES);
+
+			return -1;
+		}
+
+		if (squash_parse_rule(string, length, &_rules[_rule_count]) < 0) {
+			log_error("Invalid squash.requests entry '%.*s', expecting <uid>:<function-id> or *:<function-id>",
+			          length, string);
+
+			return -1;
+		}
+
+		++_rule_count;
+		string += length;
+	}
+
+	if (_rule_count > 0) {
+		log_info("Squashing queued requests without response expected for %d UID/function ID combination(s)",
+		         _rule_count);
+	}
+
+	return 0;
+}
+
+void squash_exit(void) {
+	_rule_count = 0;
+}
+
+int squash_index_create(SquashIndex *index) {
+	if (array_create(&index->entries, 16, sizeof(SquashEntry), true) < 0) {
+		log_error("Could not create squash entry array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void squash_index_destroy(SquashIndex *index) {
+	array_destroy(&index->entries, NULL);
+}
+
+// returns the older queued request for the same UID and function ID if request
+// was copied over it, then request must not be queued again. otherwise NULL is
+// returned. in_flight_request is the request at the head of the queue, it is
+// not replaced
+Packet *squash_index_replace(SquashIndex *index, Packet *request, Packet *in_flight_request) {
+	int i;
+	SquashEntry *entry;
+
+	if (index->entries.count == 0 || !squash_is_squashable(request)) {
+		return NULL;
+	}
+
+	for (i = 0; i < index->entries.count; ++i) {
+		entry = array_get(&index->entries, i);
+
+		if (entry->uid != request->header.uid ||
+		    entry->function_id != request->header.function_id) {
+			continue;
+		}
+
+		if (entry->queued_request == in_flight_request) {
+			// the caller queues the request and adds a new entry for it
+			array_remove(&index->entries, i, NULL);
+
+			return NULL;
+		}
+
+		memcpy(entry->queued_request, request, request->header.length);
+
+		++_squashed_requests;
+
+		return entry->queued_request;
+	}
+
+	return NULL;
+}
+
+// has to be called for each request queued after squash_index_replace
+// returned false
+void squash_index_add(SquashIndex *index, Packet *queued_request) {
+	SquashEntry *entry;
+
+	if (!squash_is_squashable(queued_request)) {
+		return;
+	}
+
+	entry = array_append(&index->entries);
+
+	if (entry == NULL) {
+		log_error("Could not append to squash entry array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	entry->uid = queued_request->header.uid;
+	entry->function_id = queued_request->header.function_id;
+	entry->queued_request = queued_request;
+}
+
+// has to be called before a queued request is popped from the queue
+void squash_index_remove(SquashIndex *index, Packet *queued_request) {
+	int i;
+
+	for (i = 0; i < index->entries.count; ++i) {
+		if (((SquashEntry *)array_get(&index->entries, i))->queued_request == queued_request) {
+			array_remove(&index->entries, i, NULL);
+
+			return;
+		}
+	}
+}
+
+// has to be called if the queue gets emptied without popping each request
+void squash_index_clear(SquashIndex *index) {
+	while (index->entries.count > 0) {
+		array_remove(&index->entries, index->entries.count - 1, NULL);
+	}
+}
+
+void squash_log_statistics(void) {
+	if (_rule_count == 0) {
+		return;
+	}
+
+	log_info("Squash statistics (rules: %d, squashed requests: %u)",
+	         _rule_count, _squashed_requests);
+}
@@ -0,0 +1,53 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * squash.h: Last-writer-wins squashing of queued setter requests
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_SQUASH_H
+#define BRICKD_SQUASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/packet.h>
+
+#define SQUASH_MAX_RULES 32
+
+// tracks the squashable requests in one device queue. the queued requests
+// are referenced by pointer, this relies on queued items not moving in memory
+// while they are queued
+typedef struct {
+	Array entries;
+} SquashIndex;
+
+int squash_init(void);
+void squash_exit(void);
+
+int squash_index_create(SquashIndex *index);
+void squash_index_destroy(SquashIndex *index);
+
+Packet *squash_index_replace(SquashIndex *index, Packet *request, Packet *in_flight_request);
+void squash_index_add(SquashIndex *index, Packet *queued_request);
+void squash_index_remove(SquashIndex *index, Packet *queued_request);
+void squash_index_clear(SquashIndex *index);
+
+void squash_log_statistics(void);
+
+#endif // BRICKD_SQUASH_H
@@ -51,6 +51,7 @@ int stack_create(Stack *stack, const char *name,
 	string_copy(stack->name, sizeof(stack->name), name, -1);
 
 	stack->dispatch_request = dispatch_request;
+	stack->dispatch_request_batch = NULL;
 
 	if (array_create(&stack->recipients, 32, sizeof(Recipient), true) < 0) {
 		log_error("Could not create recipient array: %s (%d)",
@@ -139,6 +140,65 @@ int stack_dispatch_request(Stack *stack, Packet *request, bool force) {
 	return 1;
 }
 
+// sends all requests with a UID known to the stack. if the stack has no batch
+// function then the requests are sent one by one. returns the number of
+// dispatched requests, dispatched[i] is set to true for each request that was
+// dispatched. requests that could not be sent are left undispatched, so each
+// request is sent at most once
+int stack_dispatch_request_batch(Stack *stack, Packet *requests, int count, bool *dispatched) {
+	Packet *batch[STACK_MAX_BATCH_SIZE];
+	Recipient *recipients[STACK_MAX_BATCH_SIZE];
+	int indices[STACK_MAX_BATCH_SIZE];
+	Recipient *recipient;
+	int length = 0;
+	int sent = 0;
+	int i;
+
+	if (count > STACK_MAX_BATCH_SIZE) {
+		count = STACK_MAX_BATCH_SIZE;
+	}
+
+	for (i = 0; i < count; ++i) {
+		recipient = stack_get_recipient(stack, requests[i].header.uid);
+
+		if (recipient == NULL) {
+			continue;
+		}
+
+		packet_add_trace(&requests[i]);
+
+		batch[length] = &requests[i];
+		recipients[length] = recipient;
+		indices[length] = i;
+		++length;
+	}
+
+	if (length == 0) {
+		return 0;
+	}
+
+	if (stack->dispatch_request_batch == NULL || length == 1) {
+		for (i = 0; i < length; ++i) {
+			if (stack->dispatch_request(stack, batch[i], recipients[i]) < 0) {
+				continue;
+			}
+
+			dispatched[indices[i]] = true;
+			++sent;
+		}
+	} else {
+		sent = stack->dispatch_request_batch(stack, batch, recipients, length);
+
+		for (i = 0; i < sent; ++i) {
+			dispatched[indices[i]] = true;
+		}
+	}
+
+	log_packet_debug("Sent %d of %d request(s) to %s", sent, length, stack->name);
+
+	return sent;
+}
+
 void stack_announce_disconnect(Stack *stack) {
 	int i;
 	Recipient *recipient;
@@ -37,11 +37,19 @@ typedef struct {
 
 typedef int (*StackDispatchRequestFunction)(Stack *stack, Packet *request, Recipient *recipient);
 
+// optional, gets all requests for the stack from one client read at once.
+// returns the number of requests that were taken, starting with the first one.
+// the remaining requests were not sent and are left to the caller
+typedef int (*StackDispatchRequestBatchFunction)(Stack *stack, Packet **requests,
+                                                 Recipient **recipients, int count);
+
 #define STACK_MAX_NAME_LENGTH 128
+#define STACK_MAX_BATCH_SIZE 32
 
 struct _Stack {
 	char name[STACK_MAX_NAME_LENGTH]; // for display purpose
 	StackDispatchRequestFunction dispatch_request;
+	StackDispatchRequestBatchFunction dispatch_request_batch; // can be NULL
 	Array recipients;
 };
 
@@ -53,6 +61,7 @@ int stack_add_recipient(Stack *stack, uint32_t uid /* always little endian */, u
 Recipient *stack_get_recipient(Stack *stack, uint32_t uid /* always little endian */);
 
 int stack_dispatch_request(Stack *stack, Packet *request, bool force);
+int stack_dispatch_request_batch(Stack *stack, Packet *requests, int count, bool *dispatched);
 
 void stack_announce_disconnect(Stack *stack);
 
@@ -0,0 +1,170 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * statistics.c: Logs the statistics of all subsystems on SIGUSR2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * SIGUSR1 already makes brickd rescan or reopen USB devices, so the statistics
+ * get their own signal. the daemonlib signal handling only covers SIGHUP and
+ * SIGUSR1, SIGUSR2 is handled here the same way: the signal handler writes to
+ * a pipe and the statistics are logged from the event loop.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/pipe.h>
+#include <daemonlib/utils.h>
+
+#include "statistics.h"
+
+#include "hardware.h"
+#include "mesh.h"
+#include "network.h"
+#include "usb.h"
+#ifdef BRICKD_WITH_RED_BRICK
+	#include "red_stack.h"
+#endif
+#ifdef BRICKD_WITH_BRICKLET
+	#include "bricklet.h"
+#endif
+#if defined BRICKD_WITH_RED_BRICK || defined BRICKD_WITH_BRICKLET
+	#include "completion_queue.h"
+#endif
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+static Pipe _signal_pipe;
+
+static void statistics_handle_signal(int signal_number) {
+	uint8_t byte = (uint8_t)signal_number;
+	int saved_errno = errno;
+
+	// if the pipe is full then a dump is pending already
+	pipe_write(&_signal_pipe, &byte, sizeof(byte));
+
+	errno = saved_errno;
+}
+
+static void statistics_handle_read(void *opaque) {
+	uint8_t byte;
+
+	(void)opaque;
+
+	if (pipe_read(&_signal_pipe, &byte, sizeof(byte)) < 0) {
+		if (!errno_would_block()) {
+			log_error("Could not read from statistics signal pipe: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+
+		return;
+	}
+
+	log_info("Logging statistics, triggered by SIGUSR2");
+
+	statistics_log();
+}
+
+int statistics_init(void) {
+	int phase = 0;
+	struct sigaction action;
+
+	log_debug("Initializing statistics subsystem");
+
+	// the signal handler must not block if the event loop is busy
+	if (pipe_create(&_signal_pipe, PIPE_FLAG_NON_BLOCKING_READ | PIPE_FLAG_NON_BLOCKING_WRITE) < 0) {
+		log_error("Could not create statistics signal pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (event_add_source(_signal_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     "statistics-signal", EVENT_READ, statistics_handle_read, NULL) < 0) {
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	memset(&action, 0, sizeof(action));
+
+	action.sa_handler = statistics_handle_signal;
+	action.sa_flags = SA_RESTART;
+
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGUSR2, &action, NULL) < 0) {
+		log_error("Could not install signal handler for SIGUSR2: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		event_remove_source(_signal_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		// fall through
+
+	case 1:
+		pipe_destroy(&_signal_pipe);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 3 ? 0 : -1;
+}
+
+void statistics_exit(void) {
+	log_debug("Shutting down statistics subsystem");
+
+	signal(SIGUSR2, SIG_DFL);
+
+	event_remove_source(_signal_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	pipe_destroy(&_signal_pipe);
+}
+
+void statistics_log(void) {
+	network_log_statistics();
+	hardware_log_statistics();
+	usb_log_statistics();
+	mesh_log_statistics();
+
+#ifdef BRICKD_WITH_RED_BRICK
+	red_stack_log_statistics();
+#endif
+
+#ifdef BRICKD_WITH_BRICKLET
+	bricklet_log_statistics();
+#endif
+
+#if defined BRICKD_WITH_RED_BRICK || defined BRICKD_WITH_BRICKLET
+	completion_queue_log_statistics();
+#endif
+}
@@ -22,9 +22,15 @@
 /*
  * libudev is used to detect USB hot(un)plug in case the available libusb
  * version doesn't support this. libudev provides a fd that can be polled for
- * incoming events. the fd is directly polled by the main event loop. on
- * incoming USB add and remove events usb_update is called. it scans the bus
- * for added or removed devices.
+ * incoming events. the fd is directly polled by the main event loop.
+ *
+ * the monitor only receives events for whole USB devices, not for their
+ * interfaces. events for USB devices other than Bricks and RED Bricks are
+ * ignored. plugging in a Brick still results in a burst of events, for example
+ * if it is plugged in through a hub or if it reconnects after a reset.
+ * therefore the affected devices are collected for a short debounce delay and
+ * then only those devices are probed by usb_rescan_device. if an event does
+ * not tell bus number and device address then a full usb_rescan is done.
  *
  * libudev comes with two different SONAMEs: libudev.so.0 and libudev.so.1.
  * Ubuntu 12.10 ships libudev.so.0 and Ubuntu 13.04 ships libudev.so.1. To
@@ -60,11 +66,15 @@
 	#include <libudev.h>
 #endif
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
+#include <daemonlib/array.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
 #include <daemonlib/macros.h>
+#include <daemonlib/timer.h>
+#include <daemonlib/utils.h>
 
 #include "udev.h"
 
@@ -72,6 +82,9 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+#define UDEV_DEBOUNCE_DELAY 100000 // microseconds
+#define UDEV_MAX_PENDING_DEVICES 16
+
 #ifdef BRICKD_WITH_LIBUDEV_DLOPEN
 
 struct udev;
@@ -82,6 +95,7 @@ typedef struct udev_device *(*udev_monitor_receive_device_t)(struct udev_monitor
 typedef const char *(*udev_device_get_action_t)(struct udev_device *udev_device);
 typedef const char *(*udev_device_get_devnode_t)(struct udev_device *udev_device);
 typedef const char *(*udev_device_get_sysname_t)(struct udev_device *udev_device);
+typedef const char *(*udev_device_get_property_value_t)(struct udev_device *udev_device, const char *key);
 typedef void (*udev_device_unref_t)(struct udev_device *udev_device);
 typedef struct udev *(*udev_new_t)(void);
 typedef struct udev_monitor *(*udev_monitor_new_from_netlink_t)(struct udev *udev, const char *name);
@@ -95,6 +109,7 @@ static udev_monitor_receive_device_t udev_monitor_receive_device = NULL;
 static udev_device_get_action_t udev_device_get_action = NULL;
 static udev_device_get_devnode_t udev_device_get_devnode = NULL;
 static udev_device_get_sysname_t udev_device_get_sysname = NULL;
+static udev_device_get_property_value_t udev_device_get_property_value = NULL;
 static udev_device_unref_t udev_device_unref = NULL;
 static udev_new_t udev_new = NULL;
 static udev_monitor_new_from_netlink_t udev_monitor_new_from_netlink = NULL;
@@ -110,6 +125,16 @@ static struct udev *_udev_context = NULL;
 static struct udev_monitor *_udev_monitor = NULL;
 static int _udev_monitor_fd = -1;
 
+typedef struct {
+	uint8_t bus_number;
+	uint8_t device_address;
+} UDEVPendingDevice;
+
+static Array _pending_devices;
+static bool _full_rescan_pending = false;
+static Timer _debounce_timer;
+static bool _debounce_timer_armed = false;
+
 #ifdef BRICKD_WITH_LIBUDEV_DLOPEN
 
 static const char *_libudev0 = "libudev.so.0";
@@ -194,6 +219,7 @@ static int udev_dlopen(void) {
 	UDEV_DLSYM(udev_device_get_action);
 	UDEV_DLSYM(udev_device_get_devnode);
 	UDEV_DLSYM(udev_device_get_sysname);
+	UDEV_DLSYM(udev_device_get_property_value);
 	UDEV_DLSYM(udev_device_unref);
 	UDEV_DLSYM(udev_new);
 	UDEV_DLSYM(udev_monitor_new_from_netlink);
@@ -220,11 +246,115 @@ static void udev_dlclose(void) {
 
 #endif
 
+static void udev_handle_debounce_timer(void *opaque) {
+	int i;
+	UDEVPendingDevice *pending_device;
+
+	(void)opaque;
+
+	_debounce_timer_armed = false;
+
+	if (_full_rescan_pending) {
+		usb_rescan();
+	} else {
+		for (i = 0; i < _pending_devices.count; ++i) {
+			pending_device = array_get(&_pending_devices, i);
+
+			usb_rescan_device(pending_device->bus_number, pending_device->device_address);
+		}
+	}
+
+	_full_rescan_pending = false;
+
+	while (_pending_devices.count > 0) {
+		array_remove(&_pending_devices, _pending_devices.count - 1, NULL);
+	}
+}
+
+// returns true if the PRODUCT property (<vendor>/<product>/<release> in hex)
+// belongs to a Brick or a RED Brick
+static bool udev_is_brick(const char *product) {
+	unsigned int vendor_id;
+	unsigned int product_id;
+	unsigned int release;
+
+	if (product == NULL ||
+	    sscanf(product, "%x/%x/%x", &vendor_id, &product_id, &release) != 3) {
+		return false;
+	}
+
+	return (vendor_id == USB_BRICK_VENDOR_ID && product_id == USB_BRICK_PRODUCT_ID) ||
+	       (vendor_id == USB_RED_BRICK_VENDOR_ID && product_id == USB_RED_BRICK_PRODUCT_ID);
+}
+
+static int udev_parse_number(const char *string, uint8_t *number) {
+	unsigned int value;
+	char trailer;
+
+	if (string == NULL || sscanf(string, "%u%c", &value, &trailer) != 1 || value > 255) {
+		return -1;
+	}
+
+	*number = (uint8_t)value;
+
+	return 0;
+}
+
+static void udev_add_pending_device(struct udev_device *device) {
+	uint8_t bus_number;
+	uint8_t device_address;
+	int i;
+	UDEVPendingDevice *pending_device;
+
+	if (_full_rescan_pending) {
+		return;
+	}
+
+	if (udev_parse_number(udev_device_get_property_value(device, "BUSNUM"), &bus_number) < 0 ||
+	    udev_parse_number(udev_device_get_property_value(device, "DEVNUM"), &device_address) < 0) {
+		log_debug("udev event lacks bus number or device address, doing full rescan");
+
+		_full_rescan_pending = true;
+
+		return;
+	}
+
+	for (i = 0; i < _pending_devices.count; ++i) {
+		pending_device = array_get(&_pending_devices, i);
+
+		if (pending_device->bus_number == bus_number &&
+		    pending_device->device_address == device_address) {
+			return;
+		}
+	}
+
+	if (_pending_devices.count >= UDEV_MAX_PENDING_DEVICES) {
+		_full_rescan_pending = true;
+
+		return;
+	}
+
+	pending_device = array_append(&_pending_devices);
+
+	if (pending_device == NULL) {
+		log_error("Could not append to pending USB devices array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		_full_rescan_pending = true;
+
+		return;
+	}
+
+	pending_device->bus_number = bus_number;
+	pending_device->device_address = device_address;
+}
+
 static void udev_handle_event(void *opaque) {
 	struct udev_device* device;
 	const char *action;
 	const char *dev_node;
 	const char *sys_name;
+	const char *product;
 
 	(void)opaque;
 
@@ -254,14 +384,32 @@ static void udev_handle_event(void *opaque) {
 		goto cleanup;
 	}
 
-	if (strncmp(action, "add", 3) == 0 || strncmp(action, "remove", 6) == 0) {
-		log_debug("Received udev event (action: %s, dev node: %s, sys name: %s)",
-		          action, dev_node, sys_name);
+	// the sysfs attributes are already gone for remove events, but the
+	// PRODUCT property is included in add and remove events
+	product = udev_device_get_property_value(device, "PRODUCT");
 
-		usb_rescan();
-	} else {
-		log_debug("Ignoring udev event (action: %s, dev node: %s, sys name: %s)",
-		          action, dev_node, sys_name);
+	if ((strcmp(action, "add") != 0 && strcmp(action, "remove") != 0) ||
+	    !udev_is_brick(product)) {
+		log_debug("Ignoring udev event (action: %s, dev node: %s, sys name: %s, product: %s)",
+		          action, dev_node, sys_name, product != NULL ? product : "<unknown>");
+
+		goto cleanup;
+	}
+
+	log_debug("Received udev event (action: %s, dev node: %s, sys name: %s, product: %s)",
+	          action, dev_node, sys_name, product);
+
+	udev_add_pending_device(device);
+
+	if (!_debounce_timer_armed) {
+		if (timer_configure(&_debounce_timer, UDEV_DEBOUNCE_DELAY, 0) < 0) {
+			log_error("Could not start udev debounce timer, rescanning immediately: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			udev_handle_debounce_timer(NULL);
+		} else {
+			_debounce_timer_armed = true;
+		}
 	}
 
 cleanup:
@@ -304,11 +452,11 @@ int udev_init(void) {
 
 	phase = 3;
 
-	// create filter for USB
-	rc = udev_monitor_filter_add_match_subsystem_devtype(_udev_monitor, "usb", 0);
+	// create filter for USB devices, USB interfaces are not of interest
+	rc = udev_monitor_filter_add_match_subsystem_devtype(_udev_monitor, "usb", "usb_device");
 
 	if (rc != 0) {
-		log_error("Could not initialize udev monitor filter for 'usb' subsystem: %d", rc);
+		log_error("Could not initialize udev monitor filter for 'usb' subsystem and 'usb_device' devtype: %d", rc);
 
 		goto cleanup;
 	}
@@ -321,6 +469,26 @@ int udev_init(void) {
 		goto cleanup;
 	}
 
+	// create pending devices array and debounce timer
+	if (array_create(&_pending_devices, UDEV_MAX_PENDING_DEVICES,
+	                 sizeof(UDEVPendingDevice), true) < 0) {
+		log_error("Could not create pending USB devices array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	if (timer_create_(&_debounce_timer, udev_handle_debounce_timer, NULL) < 0) {
+		log_error("Could not create udev debounce timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 5;
+
 	// add event source
 	_udev_monitor_fd = udev_monitor_get_fd(_udev_monitor);
 
@@ -329,10 +497,18 @@ int udev_init(void) {
 		goto cleanup;
 	}
 
-	phase = 4;
+	phase = 6;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 5:
+		timer_destroy(&_debounce_timer);
+		// fall through
+
+	case 4:
+		array_destroy(&_pending_devices, NULL);
+		// fall through
+
 	case 3:
 		udev_monitor_unref(_udev_monitor);
 		// fall through
@@ -352,7 +528,7 @@ cleanup:
 		break;
 	}
 
-	return phase == 4 ? 0 : -1;
+	return phase == 6 ? 0 : -1;
 }
 
 void udev_exit(void) {
@@ -360,6 +536,9 @@ void udev_exit(void) {
 
 	event_remove_source(_udev_monitor_fd, EVENT_SOURCE_TYPE_GENERIC);
 
+	timer_destroy(&_debounce_timer);
+	array_destroy(&_pending_devices, NULL);
+
 	udev_monitor_unref(_udev_monitor);
 	udev_unref(_udev_context);
 
@@ -85,7 +85,9 @@ static void LIBUSB_CALL usb_forward_message(libusb_context *ctx,
 
 #endif
 
-static int usb_enumerate(void) {
+// if bus_number and device_address are not negative then only the matching
+// USB device is probed, all other USB devices are skipped
+static int usb_enumerate(int bus_number_filter, int device_address_filter) {
 	int result = -1;
 	libusb_device **devices;
 	libusb_device *device;
@@ -115,6 +117,11 @@ static int usb_enumerate(void) {
 		bus_number = libusb_get_bus_number(device);
 		device_address = libusb_get_device_address(device);
 
+		if (bus_number_filter >= 0 && device_address_filter >= 0 &&
+		    (bus_number != bus_number_filter || device_address != device_address_filter)) {
+			continue;
+		}
+
 		rc = libusb_get_device_descriptor(device, &descriptor);
 
 		if (rc < 0) {
@@ -365,22 +372,52 @@ void usb_exit(void) {
 #endif
 }
 
-int usb_rescan(void) {
+// destroys the USBStack at the given index and creates it again in place, its
+// recipients are kept. this also resets its transfer and retry state, including
+// the expecting_disconnect flag. if it cannot be created again then it is
+// removed from the array
+static void usb_recreate_stack(int i, Array *recipients) {
+	USBStack *usb_stack = array_get(&_usb_stacks, i);
+	uint8_t bus_number = usb_stack->bus_number;
+	uint8_t device_address = usb_stack->device_address;
+
+	log_debug("Reopening USB device (bus: %u, device: %u) at index %d: %s",
+	          bus_number, device_address, i, usb_stack->base.name);
+
+	array_swap(&usb_stack->base.recipients, recipients);
+
+	usb_stack_destroy(usb_stack);
+
+	if (usb_stack_create(usb_stack, bus_number, device_address) < 0) {
+		array_remove(&_usb_stacks, i, NULL);
+
+		log_warn("Could not reopen USB device (bus: %u, device: %u) due to an error",
+		         bus_number, device_address);
+	} else {
+		array_swap(recipients, &usb_stack->base.recipients);
+	}
+}
+
+static int usb_update(int bus_number, int device_address) {
 	int i;
 	USBStack *usb_stack;
+	Array recipients;
 
-	log_debug("Looking for added/removed USB devices");
-
-	// mark all known USB stacks as potentially removed
+	// mark all affected USB stacks as potentially removed
 	for (i = 0; i < _usb_stacks.count; ++i) {
 		usb_stack = array_get(&_usb_stacks, i);
 
+		if (bus_number >= 0 && device_address >= 0 &&
+		    (usb_stack->bus_number != bus_number || usb_stack->device_address != device_address)) {
+			continue;
+		}
+
 		usb_stack->connected = false;
 	}
 
-	// enumerate all USB devices, mark all USB stacks that are still connected
-	// and add USB stacks that are newly connected
-	if (usb_enumerate() < 0) {
+	// enumerate all affected USB devices, mark all USB stacks that are still
+	// connected and add USB stacks that are newly connected
+	if (usb_enumerate(bus_number, device_address) < 0) {
 		return -1;
 	}
 
@@ -402,15 +439,58 @@ int usb_rescan(void) {
 		array_remove(&_usb_stacks, i, (ItemDestroyFunction)usb_stack_destroy);
 	}
 
+	// a USBStack that expects a disconnect because of a failed or cancelled
+	// transfer doesn't submit transfers anymore. if its device is still
+	// connected then no disconnect is coming, reopen it to get it working again
+	for (i = _usb_stacks.count - 1; i >= 0; --i) {
+		usb_stack = array_get(&_usb_stacks, i);
+
+		if (!usb_stack->expecting_disconnect) {
+			continue;
+		}
+
+		if (bus_number >= 0 && device_address >= 0 &&
+		    (usb_stack->bus_number != bus_number || usb_stack->device_address != device_address)) {
+			continue;
+		}
+
+		if (array_create(&recipients, 1, sizeof(Recipient), true) < 0) {
+			log_error("Could not create temporary recipient array: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		log_info("USB device (bus: %u, device: %u) is still connected after a transfer error, reopening it: %s",
+		         usb_stack->bus_number, usb_stack->device_address, usb_stack->base.name);
+
+		usb_recreate_stack(i, &recipients);
+
+		array_destroy(&recipients, NULL);
+	}
+
 	return 0;
 }
 
+int usb_rescan(void) {
+	log_debug("Looking for added/removed USB devices");
+
+	return usb_update(-1, -1);
+}
+
+// only probes the given USB device. adds a USBStack for it if it is a newly
+// connected Brick and removes its USBStack if it is gone
+int usb_rescan_device(uint8_t bus_number, uint8_t device_address) {
+	log_debug("Looking for added/removed USB device (bus: %u, device: %u)",
+	          bus_number, device_address);
+
+	return usb_update(bus_number, device_address);
+}
+
 int usb_reopen(USBStack *usb_stack) {
 	Array recipients;
 	int i;
 	USBStack *candidate;
-	uint8_t bus_number;
-	uint8_t device_address;
 
 	log_info("Reopening all USB devices");
 
@@ -430,25 +510,7 @@ int usb_reopen(USBStack *usb_stack) {
 			continue;
 		}
 
-		log_debug("Reopening USB device (bus: %u, device: %u) at index %d: %s",
-		          candidate->bus_number, candidate->device_address, i,
-		          candidate->base.name);
-
-		bus_number = candidate->bus_number;
-		device_address = candidate->device_address;
-
-		array_swap(&candidate->base.recipients, &recipients);
-
-		usb_stack_destroy(candidate);
-
-		if (usb_stack_create(candidate, bus_number, device_address) < 0) {
-			array_remove(&_usb_stacks, i, NULL);
-
-			log_warn("Could not reopen USB device (bus: %u, device: %u) due to an error",
-			         bus_number, device_address);
-		} else {
-			array_swap(&recipients, &candidate->base.recipients);
-		}
+		usb_recreate_stack(i, &recipients);
 
 		if (usb_stack != NULL && candidate == usb_stack) {
 			break;
@@ -460,6 +522,20 @@ int usb_reopen(USBStack *usb_stack) {
 	return usb_rescan();
 }
 
+void usb_log_statistics(void) {
+	int i;
+
+	if (_usb_stacks.count == 0) {
+		log_info("No USB stacks connected");
+
+		return;
+	}
+
+	for (i = 0; i < _usb_stacks.count; ++i) {
+		usb_stack_log_statistics(array_get(&_usb_stacks, i));
+	}
+}
+
 int usb_create_context(libusb_context **context) {
 	int phase = 0;
 	int rc;
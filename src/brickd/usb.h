@@ -48,8 +48,11 @@ void usb_exit(void);
 bool usb_has_hotplug(void);
 
 int usb_rescan(void);
+int usb_rescan_device(uint8_t bus_number, uint8_t device_address);
 int usb_reopen(USBStack *usb_stack);
 
+void usb_log_statistics(void);
+
 int usb_create_context(libusb_context **context);
 void usb_destroy_context(libusb_context *context);
 
@@ -31,12 +31,14 @@
 
 #include <daemonlib/array.h>
 #include <daemonlib/log.h>
+#include <daemonlib/macros.h>
 #include <daemonlib/utils.h>
 
 #include "usb_stack.h"
 
 #include "hardware.h"
 #include "network.h"
+#include "purge.h"
 #include "usb.h"
 #include "usb_transfer.h"
 
@@ -46,6 +48,13 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 #define MAX_WRITE_TRANSFERS 10
 #define MAX_QUEUED_WRITES 32768
 #define STALL_TIMER_DELAY 1000000 // 1 second in microseconds
+#define MIN_RETRY_DELAY 10000 // 10 milliseconds in microseconds
+#define MAX_RETRY_DELAY 1000000 // 1 second in microseconds
+
+typedef struct {
+	Packet packet;
+	PurgeTag tag;
+} USBQueuedRequest;
 
 static void usb_stack_handle_stall(void *opaque) {
 	USBStack *usb_stack = opaque;
@@ -55,6 +64,162 @@ static void usb_stack_handle_stall(void *opaque) {
 	usb_reopen(usb_stack);
 }
 
+static void usb_stack_pop_queued_request(USBStack *usb_stack) {
+	USBQueuedRequest *queued_request = queue_peek(&usb_stack->write_queue);
+
+	squash_index_remove(&usb_stack->squash_index, &queued_request->packet);
+	queue_pop(&usb_stack->write_queue, NULL);
+}
+
+// returns the request at the head of the write queue, after dropping queued
+// requests that became stale while waiting. returns NULL if the write queue
+// is empty
+static Packet *usb_stack_peek_queued_request(USBStack *usb_stack) {
+	USBQueuedRequest *queued_request;
+
+	while ((queued_request = queue_peek(&usb_stack->write_queue)) != NULL) {
+		if (!purge_is_stale(&queued_request->packet, &queued_request->tag,
+		                    usb_stack->base.name)) {
+			return &queued_request->packet;
+		}
+
+		usb_stack_pop_queued_request(usb_stack);
+	}
+
+	return NULL;
+}
+
+static Packet *usb_stack_get_queue_head(USBStack *usb_stack) {
+	USBQueuedRequest *queued_request = queue_peek(&usb_stack->write_queue);
+
+	return queued_request != NULL ? &queued_request->packet : NULL;
+}
+
+static void usb_stack_schedule_retry(USBStack *usb_stack, USBStackRetry *retry) {
+	if (retry->armed || usb_stack->expecting_disconnect) {
+		return;
+	}
+
+	if (timer_configure(&retry->timer, retry->delay, 0) < 0) {
+		log_error("Could not start %s retry timer for %s: %s (%d)",
+		          retry == &usb_stack->read_retry ? "read" : "write",
+		          usb_stack->base.name, get_errno_name(errno), errno);
+
+		return;
+	}
+
+	retry->armed = true;
+}
+
+// if a retry failed again then the next one is done after twice the delay, up
+// to MAX_RETRY_DELAY
+static void usb_stack_finish_retry(USBStack *usb_stack, USBStackRetry *retry, bool failed) {
+	if (failed) {
+		retry->delay = MIN(retry->delay * 2, MAX_RETRY_DELAY);
+
+		usb_stack_schedule_retry(usb_stack, retry);
+	} else {
+		retry->delay = MIN_RETRY_DELAY;
+	}
+}
+
+// if the health of the USBStack dropped to zero then it is reopened instead of
+// retrying the failed submission. returns true if it was reopened
+static bool usb_stack_reopen_if_unhealthy(USBStack *usb_stack) {
+	if (usb_stack->health > 0) {
+		return false;
+	}
+
+	log_warn("Reopening %s to recover from repeated transfer submission failures (read: %u, write: %u)",
+	         usb_stack->base.name, usb_stack->read_submission_failures,
+	         usb_stack->write_submission_failures);
+
+	usb_reopen(usb_stack);
+
+	return true;
+}
+
+// resubmits read transfers whose submission failed
+static void usb_stack_handle_read_retry(void *opaque) {
+	USBStack *usb_stack = opaque;
+	int i;
+	USBTransfer *usb_transfer;
+	bool failed = false;
+
+	usb_stack->read_retry.armed = false;
+
+	if (usb_stack->expecting_disconnect || usb_stack_reopen_if_unhealthy(usb_stack)) {
+		return;
+	}
+
+	++usb_stack->submission_retries;
+
+	log_debug("Retrying failed read transfer submissions for %s (delay: %u us, health: %d)",
+	          usb_stack->base.name, usb_stack->read_retry.delay, usb_stack->health);
+
+	for (i = 0; i < usb_stack->read_transfers.count; ++i) {
+		usb_transfer = array_get(&usb_stack->read_transfers, i);
+
+		if (usb_transfer->submitted || usb_transfer->cancelled) {
+			continue;
+		}
+
+		if (usb_transfer_submit(usb_transfer) < 0) {
+			failed = true;
+
+			break;
+		}
+	}
+
+	usb_stack_finish_retry(usb_stack, &usb_stack->read_retry, failed);
+}
+
+// submits queued requests that are waiting because a submission failed
+static void usb_stack_handle_write_retry(void *opaque) {
+	USBStack *usb_stack = opaque;
+	int i;
+	USBTransfer *usb_transfer;
+	Packet *request;
+	bool failed = false;
+
+	usb_stack->write_retry.armed = false;
+
+	if (usb_stack->expecting_disconnect || usb_stack_reopen_if_unhealthy(usb_stack)) {
+		return;
+	}
+
+	++usb_stack->submission_retries;
+
+	log_debug("Retrying failed write transfer submissions for %s (delay: %u us, health: %d)",
+	          usb_stack->base.name, usb_stack->write_retry.delay, usb_stack->health);
+
+	for (i = 0; i < usb_stack->write_transfers.count; ++i) {
+		usb_transfer = array_get(&usb_stack->write_transfers, i);
+
+		if (usb_transfer->submitted) {
+			continue;
+		}
+
+		request = usb_stack_peek_queued_request(usb_stack);
+
+		if (request == NULL) {
+			break;
+		}
+
+		memcpy(&usb_transfer->packet, request, request->header.length);
+
+		if (usb_transfer_submit(usb_transfer) < 0) {
+			failed = true;
+
+			break;
+		}
+
+		usb_stack_pop_queued_request(usb_stack);
+	}
+
+	usb_stack_finish_retry(usb_stack, &usb_stack->write_retry, failed);
+}
+
 static void usb_stack_read_callback(USBTransfer *usb_transfer) {
 	const char *message = NULL;
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
@@ -163,21 +328,21 @@ static void usb_stack_write_callback(USBTransfer *usb_transfer) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
 	if (!usb_transfer->usb_stack->expecting_disconnect &&
-	    usb_transfer->usb_stack->write_queue.count > 0) {
-		request = queue_peek(&usb_transfer->usb_stack->write_queue);
-
+	    (request = usb_stack_peek_queued_request(usb_transfer->usb_stack)) != NULL) {
 		memcpy(&usb_transfer->packet, request, request->header.length);
 
 		if (usb_transfer_submit(usb_transfer) < 0) {
-			log_error("Could not send queued request (%s) to %s: %s (%d)",
+			log_error("Could not send queued request (%s) to %s, keeping it queued for retry: %s (%d)",
 			          packet_get_request_signature(packet_signature, &usb_transfer->packet),
 			          usb_transfer->usb_stack->base.name,
 			          get_errno_name(errno), errno);
 
+			usb_stack_schedule_write_retry(usb_transfer->usb_stack);
+
 			return;
 		}
 
-		queue_pop(&usb_transfer->usb_stack->write_queue, NULL);
+		usb_stack_pop_queued_request(usb_transfer->usb_stack);
 
 		log_packet_debug("Sent queued request (%s) to %s, %d request(s) left in write queue",
 		                 packet_get_request_signature(packet_signature, &usb_transfer->packet),
@@ -191,9 +356,11 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 	USBStack *usb_stack = (USBStack *)stack;
 	int i;
 	USBTransfer *usb_transfer;
-	Packet *queued_request;
+	USBQueuedRequest *queued_request;
+	Packet *replaced_request;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	uint32_t requests_to_drop;
+	bool submission_failed = false;
 
 	(void)recipient;
 
@@ -205,8 +372,9 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 		return 0;
 	}
 
-	// find free write transfer
-	for (i = 0; i < usb_stack->write_transfers.count; ++i) {
+	// find free write transfer. if a write retry is already pending then queue
+	// the request behind the requests that are waiting for the retry
+	for (i = 0; !usb_stack->write_retry.armed && i < usb_stack->write_transfers.count; ++i) {
 		usb_transfer = array_get(&usb_stack->write_transfers, i);
 
 		if (usb_transfer->submitted) {
@@ -216,17 +384,45 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 		memcpy(&usb_transfer->packet, request, request->header.length);
 
 		if (usb_transfer_submit(usb_transfer) < 0) {
-			// FIXME: how to handle a failed submission, try to re-submit?
+			// the submission is retried from the write queue after a delay.
+			// trying the next write transfer right away would most likely
+			// fail the same way
+			submission_failed = true;
 
-			continue;
+			break;
 		}
 
 		return 0;
 	}
 
-	// no free write transfer available, push request to write queue
-	log_packet_debug("Could not find a free write transfer for %s, pushing request to write queue (count: %d + 1)",
-	                 usb_stack->base.name, usb_stack->write_queue.count);
+	if (submission_failed) {
+		usb_stack_schedule_write_retry(usb_stack);
+	}
+
+	// replace an older queued request for the same UID and function ID, if
+	// squashing is enabled for them
+	replaced_request = squash_index_replace(&usb_stack->squash_index, request,
+	                                        usb_stack_get_queue_head(usb_stack));
+
+	if (replaced_request != NULL) {
+		purge_tag(&containerof(replaced_request, USBQueuedRequest, packet)->tag);
+
+		log_packet_debug("Replaced older queued request with request (%s) for %s",
+		                 packet_get_request_signature(packet_signature, request),
+		                 usb_stack->base.name);
+
+		return 0;
+	}
+
+	if (submission_failed) {
+		log_debug("Could not submit request (%s) to %s, pushing request to write queue for retry (count: %d + 1)",
+		          packet_get_request_signature(packet_signature, request),
+		          usb_stack->base.name, usb_stack->write_queue.count);
+	} else {
+		// no free write transfer available, push request to write queue
+		log_packet_debug("Could not find a free write transfer for %s, pushing request to write queue (count: %d + 1)",
+		                 usb_stack->base.name, usb_stack->write_queue.count);
+	}
 
 	if (usb_stack->write_queue.count >= MAX_QUEUED_WRITES) {
 		requests_to_drop = usb_stack->write_queue.count - MAX_QUEUED_WRITES + 1;
@@ -238,7 +434,7 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 		usb_stack->dropped_requests += requests_to_drop;
 
 		while (usb_stack->write_queue.count >= MAX_QUEUED_WRITES) {
-			queue_pop(&usb_stack->write_queue, NULL);
+			usb_stack_pop_queued_request(usb_stack);
 		}
 	}
 
@@ -253,7 +449,10 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 		return -1;
 	}
 
-	memcpy(queued_request, request, request->header.length);
+	memcpy(&queued_request->packet, request, request->header.length);
+	purge_tag(&queued_request->tag);
+
+	squash_index_add(&usb_stack->squash_index, &queued_request->packet);
 
 	return 0;
 }
@@ -277,7 +476,15 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 
 	usb_stack->context = NULL;
 	usb_stack->device_handle = NULL;
+	usb_stack->read_retry.armed = false;
+	usb_stack->read_retry.delay = MIN_RETRY_DELAY;
+	usb_stack->write_retry.armed = false;
+	usb_stack->write_retry.delay = MIN_RETRY_DELAY;
+	usb_stack->health = USB_STACK_MAX_HEALTH;
 	usb_stack->dropped_requests = 0;
+	usb_stack->read_submission_failures = 0;
+	usb_stack->write_submission_failures = 0;
+	usb_stack->submission_retries = 0;
 	usb_stack->connected = true;
 	usb_stack->expecting_short_Ax_response = false;
 	usb_stack->expecting_read_stall_before_removal = false;
@@ -487,6 +694,25 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 
 	phase = 5;
 
+	// create retry timers
+	if (timer_create_(&usb_stack->read_retry.timer, usb_stack_handle_read_retry, usb_stack) < 0) {
+		log_error("Could not create read retry timer for %s: %s (%d)",
+		          usb_stack->base.name, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 6;
+
+	if (timer_create_(&usb_stack->write_retry.timer, usb_stack_handle_write_retry, usb_stack) < 0) {
+		log_error("Could not create write retry timer for %s: %s (%d)",
+		          usb_stack->base.name, get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 7;
+
 	// allocate and submit read transfers
 	if (array_create(&usb_stack->read_transfers, MAX_READ_TRANSFERS,
 	                 sizeof(USBTransfer), true) < 0) {
@@ -496,7 +722,7 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		goto cleanup;
 	}
 
-	phase = 6;
+	phase = 8;
 
 	log_debug("Submitting read transfers to %s", usb_stack->base.name);
 
@@ -524,14 +750,20 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 	}
 
 	// allocate write queue
-	if (queue_create(&usb_stack->write_queue, sizeof(Packet)) < 0) {
+	if (queue_create(&usb_stack->write_queue, sizeof(USBQueuedRequest)) < 0) {
 		log_error("Could not create write queue for %s: %s (%d)",
 		          usb_stack->base.name, get_errno_name(errno), errno);
 
 		goto cleanup;
 	}
 
-	phase = 7;
+	phase = 9;
+
+	if (squash_index_create(&usb_stack->squash_index) < 0) {
+		goto cleanup;
+	}
+
+	phase = 10;
 
 	// allocate write transfers
 	if (array_create(&usb_stack->write_transfers, MAX_WRITE_TRANSFERS,
@@ -542,7 +774,7 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		goto cleanup;
 	}
 
-	phase = 8;
+	phase = 11;
 
 	for (i = 0; i < MAX_WRITE_TRANSFERS; ++i) {
 		usb_transfer = array_append(&usb_stack->write_transfers);
@@ -568,22 +800,34 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		goto cleanup;
 	}
 
-	phase = 9;
+	phase = 12;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 8:
+	case 11:
 		array_destroy(&usb_stack->write_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 		// fall through
 
-	case 7:
+	case 10:
+		squash_index_destroy(&usb_stack->squash_index);
+		// fall through
+
+	case 9:
 		queue_destroy(&usb_stack->write_queue, NULL);
 		// fall through
 
-	case 6:
+	case 8:
 		array_destroy(&usb_stack->read_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 		// fall through
 
+	case 7:
+		timer_destroy(&usb_stack->write_retry.timer);
+		// fall through
+
+	case 6:
+		timer_destroy(&usb_stack->read_retry.timer);
+		// fall through
+
 	case 5:
 		timer_destroy(&usb_stack->stall_timer);
 		// fall through
@@ -608,7 +852,7 @@ cleanup:
 		break;
 	}
 
-	return phase == 9 ? 0 : -1;
+	return phase == 12 ? 0 : -1;
 }
 
 void usb_stack_destroy(USBStack *usb_stack) {
@@ -621,8 +865,11 @@ void usb_stack_destroy(USBStack *usb_stack) {
 	array_destroy(&usb_stack->read_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 	array_destroy(&usb_stack->write_transfers, (ItemDestroyFunction)usb_transfer_destroy);
 
+	timer_destroy(&usb_stack->write_retry.timer);
+	timer_destroy(&usb_stack->read_retry.timer);
 	timer_destroy(&usb_stack->stall_timer);
 
+	squash_index_destroy(&usb_stack->squash_index);
 	queue_destroy(&usb_stack->write_queue, NULL);
 
 	libusb_release_interface(usb_stack->device_handle, usb_stack->interface_number);
@@ -647,3 +894,29 @@ void usb_stack_start_stall_timer(USBStack *usb_stack) {
 		return;
 	}
 }
+
+void usb_stack_schedule_read_retry(USBStack *usb_stack) {
+	usb_stack_schedule_retry(usb_stack, &usb_stack->read_retry);
+}
+
+void usb_stack_schedule_write_retry(USBStack *usb_stack) {
+	usb_stack_schedule_retry(usb_stack, &usb_stack->write_retry);
+}
+
+void usb_stack_log_statistics(USBStack *usb_stack) {
+	int i;
+	int unsubmitted_reads = 0;
+
+	for (i = 0; i < usb_stack->read_transfers.count; ++i) {
+		if (!((USBTransfer *)array_get(&usb_stack->read_transfers, i))->submitted) {
+			++unsubmitted_reads;
+		}
+	}
+
+	log_info("USB stack %s statistics (health: %d, submission failures: %u read %u write, retries: %u, unsubmitted reads: %d, queued writes: %d, dropped requests: %u)",
+	         usb_stack->base.name, usb_stack->health,
+	         usb_stack->read_submission_failures,
+	         usb_stack->write_submission_failures,
+	         usb_stack->submission_retries, unsubmitted_reads,
+	         usb_stack->write_queue.count, usb_stack->dropped_requests);
+}
@@ -30,8 +30,23 @@
 #include <daemonlib/queue.h>
 #include <daemonlib/timer.h>
 
+#include "squash.h"
 #include "stack.h"
 
+// the health of a USBStack drops by the penalty for each failed transfer
+// submission and recovers by one for each completed transfer. the USBStack
+// gets reopened if its health drops to zero
+#define USB_STACK_MAX_HEALTH 100
+#define USB_STACK_SUBMISSION_FAILURE_PENALTY 10
+
+// read transfers and requests are retried independently, so a read transfer
+// that cannot be resubmitted doesn't hold back requests and vice versa
+typedef struct {
+	Timer timer;
+	bool armed;
+	uint32_t delay; // in microseconds
+} USBStackRetry;
+
 typedef struct {
 	Stack base;
 
@@ -43,10 +58,17 @@ typedef struct {
 	uint8_t endpoint_in;
 	uint8_t endpoint_out;
 	Timer stall_timer;
+	USBStackRetry read_retry;
+	USBStackRetry write_retry;
+	int health;
 	Array read_transfers;
 	Array write_transfers;
 	Queue write_queue;
+	SquashIndex squash_index;
 	uint32_t dropped_requests;
+	uint32_t read_submission_failures;
+	uint32_t write_submission_failures;
+	uint32_t submission_retries;
 	bool connected;
 	bool expecting_short_Ax_response;
 	bool expecting_read_stall_before_removal;
@@ -57,5 +79,9 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 void usb_stack_destroy(USBStack *usb_stack);
 
 void usb_stack_start_stall_timer(USBStack *usb_stack);
+void usb_stack_schedule_read_retry(USBStack *usb_stack);
+void usb_stack_schedule_write_retry(USBStack *usb_stack);
+
+void usb_stack_log_statistics(USBStack *usb_stack);
 
 #endif // BRICKD_USB_STACK_H
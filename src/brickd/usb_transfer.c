@@ -23,6 +23,7 @@
 #include <time.h>
 
 #include <daemonlib/log.h>
+#include <daemonlib/macros.h>
 
 #include "usb_transfer.h"
 
@@ -125,6 +126,9 @@ static void LIBUSB_CALL usb_transfer_wrapper(struct libusb_transfer *handle) {
 		         handle, usb_transfer->submission, usb_transfer->usb_stack->base.name,
 		         usb_transfer_get_status_name(handle->status), handle->status);
 	} else {
+		usb_transfer->usb_stack->health = MIN(usb_transfer->usb_stack->health + 1,
+		                                      USB_STACK_MAX_HEALTH);
+
 		log_packet_debug("%s transfer %p (handle: %p, submission: %u) returned successfully from %s%s",
 		                 usb_transfer_get_type_name(usb_transfer->type, true),
 		                 usb_transfer, handle, usb_transfer->submission,
@@ -149,8 +153,9 @@ static void LIBUSB_CALL usb_transfer_wrapper(struct libusb_transfer *handle) {
 
 	if (usb_transfer->type == USB_TRANSFER_TYPE_READ &&
 	    !usb_transfer->cancelled &&
-	    !usb_transfer->usb_stack->expecting_disconnect) {
-		usb_transfer_submit(usb_transfer);
+	    !usb_transfer->usb_stack->expecting_disconnect &&
+	    usb_transfer_submit(usb_transfer) < 0) {
+		usb_stack_schedule_read_retry(usb_transfer->usb_stack);
 	}
 }
 
@@ -301,6 +306,19 @@ int usb_transfer_submit(USBTransfer *usb_transfer) {
 
 		usb_transfer->submitted = false;
 
+		if (usb_transfer->type == USB_TRANSFER_TYPE_READ) {
+			++usb_transfer->usb_stack->read_submission_failures;
+		} else {
+			++usb_transfer->usb_stack->write_submission_failures;
+		}
+
+		usb_transfer->usb_stack->health = MAX(usb_transfer->usb_stack->health - USB_STACK_SUBMISSION_FAILURE_PENALTY, 0);
+
+		// there is no point in retrying if the device is gone
+		if (rc == LIBUSB_ERROR_NO_DEVICE) {
+			usb_transfer->usb_stack->expecting_disconnect = true;
+		}
+
 		return -1;
 	}
 
@@ -0,0 +1,132 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+"""
+brickd accept latency benchmark
+
+Starts brickd with slow_getnameinfo.so preloaded, so every host name lookup
+takes --delay milliseconds. Then opens --connections connections in a burst
+and measures for each of them the time from connect until brickd answered a
+first request. The request goes to brickd itself (UID 1) with a function ID
+brickd does not implement, brickd answers it with an error response.
+
+If brickd looked up host names in the event loop thread then the latency
+would grow by the delay for every connection in the burst. With the lookup
+done in the background the latency stays independent of the delay.
+
+Linux only, needs the slow_getnameinfo.so from the Makefile.
+
+Example:
+
+  ./accept_latency_benchmark.py --brickd ../brickd/brickd --delay 2000
+  ./accept_latency_benchmark.py --brickd ../brickd/brickd --resolve off
+"""
+
+import argparse
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+def create_request(sequence_number):
+    return struct.pack('<IBBBB', 1, 8, 200, (sequence_number << 4) | 8, 0)
+
+def measure(port, results, index):
+    started = time.time()
+
+    try:
+        sock = socket.create_connection(('127.0.0.1', port), timeout=60)
+        sock.sendall(create_request(1))
+
+        response = b''
+
+        while len(response) < 8:
+            data = sock.recv(80)
+
+            if len(data) == 0:
+                raise Exception('connection closed by brickd')
+
+            response += data
+
+        results[index] = time.time() - started
+
+        sock.close()
+    except Exception as e:
+        print('connection {0} failed: {1}'.format(index, e))
+
+def get_percentile(values, percentile):
+    return values[min(int(percentile / 100.0 * len(values)), len(values) - 1)]
+
+def main():
+    parser = argparse.ArgumentParser(description='Measure brickd accept latency with a slow name service')
+    parser.add_argument('--brickd', required=True, help='path to the brickd binary')
+    parser.add_argument('--shim', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), 'slow_getnameinfo.so'),
+                        help='path to slow_getnameinfo.so')
+    parser.add_argument('--delay', type=int, default=2000, help='host name lookup delay in milliseconds')
+    parser.add_argument('--connections', type=int, default=20)
+    parser.add_argument('--port', type=int, default=14223)
+    parser.add_argument('--mesh-port', type=int, default=14240)
+    parser.add_argument('--resolve', choices=['on', 'off'], default='on', help='value of listen.resolve_client_names')
+    args = parser.parse_args()
+
+    env = dict(os.environ)
+    env['LD_PRELOAD'] = args.shim
+    env['SLOW_GETNAMEINFO_DELAY'] = str(args.delay)
+
+    with tempfile.TemporaryDirectory() as directory:
+        config_filename = os.path.join(directory, 'brickd.conf')
+        pid_filename = os.path.join(directory, 'brickd.pid')
+
+        with open(config_filename, 'w') as f:
+            f.write('listen.address = 127.0.0.1\n')
+            f.write('listen.plain_port = {0}\n'.format(args.port))
+            f.write('listen.websocket_port = 0\n')
+            f.write('listen.mesh_gateway_port = {0}\n'.format(args.mesh_port))
+            f.write('listen.resolve_client_names = {0}\n'.format(args.resolve))
+
+        brickd = subprocess.Popen([args.brickd, '--config-file', config_filename, '--pid-file', pid_filename],
+                                  stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, env=env)
+
+        try:
+            time.sleep(2)
+
+            if brickd.poll() != None:
+                print('brickd exited with {0}'.format(brickd.returncode))
+
+                return 1
+
+            results = [None] * args.connections
+            threads = [threading.Thread(target=measure, args=(args.port, results, i)) for i in range(args.connections)]
+            started = time.time()
+
+            for thread in threads:
+                thread.start()
+
+            for thread in threads:
+                thread.join()
+
+            duration = time.time() - started
+        finally:
+            brickd.terminate()
+            brickd.wait()
+
+    latencies = sorted(result * 1000.0 for result in results if result != None)
+
+    if len(latencies) == 0:
+        print('no connection succeeded')
+
+        return 1
+
+    print('connections: {0} of {1} answered in {2:.3f} s (lookup delay: {3} ms, resolve: {4})'
+          .format(len(latencies), args.connections, duration, args.delay, args.resolve))
+    print('latency: min {0:.1f} ms, p50 {1:.1f} ms, p90 {2:.1f} ms, max {3:.1f} ms'
+          .format(latencies[0], get_percentile(latencies, 50), get_percentile(latencies, 90), latencies[-1]))
+
+    return 0 if len(latencies) == args.connections else 1
+
+if __name__ == '__main__':
+    sys.exit(main())
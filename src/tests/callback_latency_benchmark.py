@@ -0,0 +1,189 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+"""
+brickd callback backlog benchmark
+
+Connects as a slow client that reads less than a device sends in callbacks,
+so brickd has to buffer callbacks for this client. Meanwhile a getter is sent
+every --probe-interval seconds. The time until its response arrives is the
+end-to-end latency that a slow client sees under a callback flood. brickd
+writes responses before held back callbacks, so the getter latency should stay
+close to the latency without load instead of growing with the buffered
+callbacks. Callbacks beyond the callbacks.max_backlog option of brickd are
+dropped, the received callback counter shows the gaps.
+
+The callback flood can be generated with usb_gadget_brick.py:
+
+  sudo ./usb_gadget_brick.py --uid 6wwv71 --callback-rate 5000 &
+  ../brickd/brickd --debug &
+  ./callback_latency_benchmark.py --uid 6wwv71 --read-rate 100000
+
+The default getter is get_identity (function ID 255), every device supports
+it.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+BASE58 = '123456789abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ'
+
+CALLBACK_FLOOD = 240
+
+def base58_decode(encoded):
+    value = 0
+
+    for c in encoded:
+        value = value * 58 + BASE58.index(c)
+
+    return value
+
+def create_packet(uid, function_id, sequence_number, response_expected, payload):
+    options = (sequence_number << 4) | (8 if response_expected else 0)
+
+    return struct.pack('<IBBBB', uid, 8 + len(payload), function_id, options, 0) + payload
+
+def get_percentile(values, percentile):
+    return values[min(int(percentile / 100.0 * len(values)), len(values) - 1)]
+
+class Benchmark:
+    def __init__(self, args):
+        self.args = args
+        self.uid = base58_decode(args.uid)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        # a small receive buffer, so the callbacks back up in brickd and not
+        # in the kernel
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, args.receive_buffer)
+        self.sock.connect((args.host, args.port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.lock = threading.Lock()
+        self.running = True
+        self.probes = {} # sequence number -> send time
+        self.latencies = []
+        self.callbacks = 0
+        self.callback_gaps = 0
+
+    def receive(self):
+        buffer = b''
+        chunk_length = 256
+        interval = chunk_length / float(self.args.read_rate)
+        next_time = time.time()
+        last_counter = None
+
+        while self.running:
+            try:
+                data = self.sock.recv(chunk_length)
+            except OSError:
+                break
+
+            if len(data) == 0:
+                break
+
+            buffer += data
+
+            while len(buffer) >= 8:
+                uid, length, function_id, options, flags = struct.unpack('<IBBBB', buffer[:8])
+
+                if len(buffer) < length:
+                    break
+
+                packet = buffer[:length]
+                buffer = buffer[length:]
+                sequence_number = options >> 4
+
+                if uid != self.uid:
+                    continue
+
+                if sequence_number == 0 and function_id == CALLBACK_FLOOD and length >= 12:
+                    counter = struct.unpack('<I', packet[8:12])[0]
+
+                    if last_counter != None and counter != (last_counter + 1) & 0xFFFFFFFF:
+                        self.callback_gaps += 1
+
+                    last_counter = counter
+                    self.callbacks += 1
+
+                    continue
+
+                if function_id != self.args.probe_function_id:
+                    continue
+
+                with self.lock:
+                    sent = self.probes.pop(sequence_number, None)
+
+                if sent != None:
+                    self.latencies.append((time.time() - sent) * 1000.0)
+
+            # read slower than the callbacks arrive
+            next_time += interval
+            delay = next_time - time.time()
+
+            if delay > 0:
+                time.sleep(delay)
+
+    def run(self):
+        receiver = threading.Thread(target=self.receive)
+
+        receiver.daemon = True
+        receiver.start()
+
+        sequence_number = 1
+        probes_sent = 0
+        end = time.time() + self.args.duration
+
+        while time.time() < end:
+            with self.lock:
+                # sequence numbers still in use belong to lost or very late
+                # probes, skip them
+                if sequence_number not in self.probes:
+                    self.probes[sequence_number] = time.time()
+                    self.sock.sendall(create_packet(self.uid, self.args.probe_function_id,
+                                                    sequence_number, True, b''))
+                    probes_sent += 1
+
+            sequence_number = sequence_number % 15 + 1
+
+            time.sleep(self.args.probe_interval)
+
+        time.sleep(1) # give late responses a chance
+
+        self.running = False
+        self.sock.close()
+
+        return probes_sent
+
+def main():
+    parser = argparse.ArgumentParser(description='Measure getter latency of a slow client under a callback flood')
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=4223)
+    parser.add_argument('--uid', required=True)
+    parser.add_argument('--read-rate', type=float, default=100000, help='bytes per second read by the client')
+    parser.add_argument('--receive-buffer', type=int, default=4096, help='socket receive buffer size in bytes')
+    parser.add_argument('--duration', type=float, default=10, help='seconds')
+    parser.add_argument('--probe-function-id', type=int, default=255, help='function ID of the getter')
+    parser.add_argument('--probe-interval', type=float, default=0.1, help='seconds between two getters')
+    args = parser.parse_args()
+
+    benchmark = Benchmark(args)
+    probes_sent = benchmark.run()
+    latencies = sorted(benchmark.latencies)
+
+    print('callbacks: {0} received ({1:.0f}/s), {2} gap(s), getters: {3} of {4} answered'
+          .format(benchmark.callbacks, benchmark.callbacks / args.duration, benchmark.callback_gaps,
+                  len(latencies), probes_sent))
+
+    if len(latencies) == 0:
+        return 1
+
+    print('getter latency: min {0:.1f} ms, p50 {1:.1f} ms, p90 {2:.1f} ms, p99 {3:.1f} ms, max {4:.1f} ms'
+          .format(latencies[0], get_percentile(latencies, 50), get_percentile(latencies, 90),
+                  get_percentile(latencies, 99), latencies[-1]))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -150,5 +150,20 @@ rem @set LD=link /nologo /debug
 @del *.obj *.res *.bin *.exp *.manifest
 
 
+%CC% container_benchmark.c^
+ ..\brickd\fixes_msvc.c^
+ ..\daemonlib\array.c^
+ ..\daemonlib\queue.c^
+ ..\daemonlib\node.c^
+ ..\daemonlib\base58.c^
+ ..\daemonlib\utils.c
+
+%LD% /out:container_benchmark.exe *.obj
+
+@if exist container_benchmark.exe.manifest^
+ %MT% /manifest container_benchmark.exe.manifest -outputresource:container_benchmark.exe
+
+@del *.obj *.res *.bin *.exp *.manifest
+
 :done
 @endlocal
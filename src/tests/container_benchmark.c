@@ -0,0 +1,357 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * container_benchmark.c: Benchmarks for the Array, Queue and Node types
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * each benchmark reports operations per second and, if the Makefile linked
+ * the benchmark with malloc/realloc/calloc wrapped (GNU ld only), the number
+ * of allocations it caused. the backlog benchmark replays the access pattern
+ * of a Writer backlog with a slow sink on a plain Queue: packets are pushed
+ * while the sink is busy and are taken out in the order they came in once it
+ * accepts more. it measures the Queue only, not writer_write itself. the
+ * failed write attempts and the event source changes of a real Writer are
+ * not part of it, as those need an IO and the event loop.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/macros.h>
+#include <daemonlib/node.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/queue.h>
+#include <daemonlib/utils.h>
+
+#define ITEM_COUNT 100000
+#define ROUNDS 10
+
+static uint64_t _allocations = 0;
+
+#ifdef CONTAINER_BENCHMARK_WRAP_MALLOC
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	++_allocations;
+
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	++_allocations;
+
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	++_allocations;
+
+	return __real_realloc(ptr, size);
+}
+
+#endif
+
+typedef struct {
+	Node node;
+	int value;
+} Number;
+
+typedef struct {
+	const char *name;
+	uint64_t started;
+	uint64_t allocations;
+} Measurement;
+
+static void measurement_start(Measurement *measurement, const char *name) {
+	measurement->name = name;
+	measurement->allocations = _allocations;
+	measurement->started = microseconds();
+}
+
+static void measurement_stop(Measurement *measurement, uint64_t operations) {
+	uint64_t duration = microseconds() - measurement->started;
+
+	if (duration == 0) {
+		duration = 1;
+	}
+
+#ifdef CONTAINER_BENCHMARK_WRAP_MALLOC
+	printf("%-40s %12.0f ops/s %10llu allocations\n", measurement->name,
+	       (double)operations * 1000000.0 / (double)duration,
+	       (unsigned long long)(_allocations - measurement->allocations));
+#else
+	printf("%-40s %12.0f ops/s\n", measurement->name,
+	       (double)operations * 1000000.0 / (double)duration);
+#endif
+}
+
+static int benchmark_array(bool relocatable) {
+	Array array;
+	Measurement measurement;
+	uint64_t sum = 0;
+	int round;
+	int i;
+
+	if (array_create(&array, 32, sizeof(Packet), relocatable) < 0) {
+		printf("benchmark_array: array_create failed\n");
+
+		return -1;
+	}
+
+	measurement_start(&measurement, relocatable ? "array append (relocatable)" : "array append");
+
+	for (i = 0; i < ITEM_COUNT; ++i) {
+		if (array_append(&array) == NULL) {
+			printf("benchmark_array: array_append failed\n");
+
+			return -1;
+		}
+	}
+
+	measurement_stop(&measurement, ITEM_COUNT);
+
+	measurement_start(&measurement, relocatable ? "array iterate (relocatable)" : "array iterate");
+
+	for (round = 0; round < ROUNDS; ++round) {
+		for (i = 0; i < array.count; ++i) {
+			sum += ((Packet *)array_get(&array, i))->header.length;
+		}
+	}
+
+	measurement_stop(&measurement, (uint64_t)ROUNDS * ITEM_COUNT);
+
+	// removing from the end is the cheap case, the client and zombie arrays
+	// remove from anywhere. remove from the front to show the worst case
+	measurement_start(&measurement, relocatable ? "array remove last (relocatable)" : "array remove last");
+
+	for (i = 0; i < ITEM_COUNT / 2; ++i) {
+		array_remove(&array, array.count - 1, NULL);
+	}
+
+	measurement_stop(&measurement, ITEM_COUNT / 2);
+
+	measurement_start(&measurement, relocatable ? "array remove first (relocatable)" : "array remove first");
+
+	for (i = 0; i < 1000; ++i) {
+		array_remove(&array, 0, NULL);
+	}
+
+	measurement_stop(&measurement, 1000);
+
+	array_destroy(&array, NULL);
+
+	return sum == UINT64_MAX ? -1 : 0; // keep the iteration from being optimized out
+}
+
+static int benchmark_queue(void) {
+	Queue queue;
+	Measurement measurement;
+	int i;
+
+	if (queue_create(&queue, sizeof(Packet)) < 0) {
+		printf("benchmark_queue: queue_create failed\n");
+
+		return -1;
+	}
+
+	measurement_start(&measurement, "queue push (growing)");
+
+	for (i = 0; i < ITEM_COUNT; ++i) {
+		if (queue_push(&queue) == NULL) {
+			printf("benchmark_queue: queue_push failed\n");
+
+			return -1;
+		}
+	}
+
+	measurement_stop(&measurement, ITEM_COUNT);
+
+	measurement_start(&measurement, "queue pop");
+
+	while (queue.count > 0) {
+		queue_pop(&queue, NULL);
+	}
+
+	measurement_stop(&measurement, ITEM_COUNT);
+
+	// steady state, the queue has already grown to its final size
+	measurement_start(&measurement, "queue push/pop (steady)");
+
+	for (i = 0; i < ITEM_COUNT; ++i) {
+		queue_push(&queue);
+		queue_push(&queue);
+		queue_pop(&queue, NULL);
+		queue_pop(&queue, NULL);
+	}
+
+	measurement_stop(&measurement, (uint64_t)ITEM_COUNT * 4);
+
+	queue_destroy(&queue, NULL);
+
+	return 0;
+}
+
+static int benchmark_node(void) {
+	Node sentinel;
+	Number *numbers;
+	Node *node;
+	Measurement measurement;
+	uint64_t sum = 0;
+	int round;
+	int i;
+
+	numbers = calloc(ITEM_COUNT, sizeof(Number));
+
+	if (numbers == NULL) {
+		printf("benchmark_node: calloc failed\n");
+
+		return -1;
+	}
+
+	node_reset(&sentinel);
+
+	measurement_start(&measurement, "node insert");
+
+	for (i = 0; i < ITEM_COUNT; ++i) {
+		numbers[i].value = i;
+
+		node_insert_before(&sentinel, &numbers[i].node);
+	}
+
+	measurement_stop(&measurement, ITEM_COUNT);
+
+	measurement_start(&measurement, "node iterate");
+
+	for (round = 0; round < ROUNDS; ++round) {
+		for (node = sentinel.next; node != &sentinel; node = node->next) {
+			sum += containerof(node, Number, node)->value;
+		}
+	}
+
+	measurement_stop(&measurement, (uint64_t)ROUNDS * ITEM_COUNT);
+
+	// pending requests are removed out of order when their response arrives
+	measurement_start(&measurement, "node remove (interleaved)");
+
+	for (i = 0; i < ITEM_COUNT; i += 2) {
+		node_remove(&numbers[i].node);
+	}
+
+	for (i = 1; i < ITEM_COUNT; i += 2) {
+		node_remove(&numbers[i].node);
+	}
+
+	measurement_stop(&measurement, ITEM_COUNT);
+
+	free(numbers);
+
+	return sum == UINT64_MAX ? -1 : 0;
+}
+
+// the producer writes 4 packets per tick, the sink accepts 3. the backlog
+// grows until the producer stops, then the sink drains it
+static int benchmark_queue_backlog(void) {
+	Queue backlog;
+	Measurement measurement;
+	Packet packet;
+	Packet *queued;
+	uint64_t written = 0;
+	int max_backlog = 0;
+	int tick;
+	int i;
+
+	memset(&packet, 0, sizeof(packet));
+
+	packet.header.length = sizeof(PacketHeader) + 8;
+
+	if (queue_create(&backlog, sizeof(Packet)) < 0) {
+		printf("benchmark_queue_backlog: queue_create failed\n");
+
+		return -1;
+	}
+
+	measurement_start(&measurement, "queue backlog (slow sink)");
+
+	for (tick = 0; tick < ITEM_COUNT || backlog.count > 0; ++tick) {
+		if (tick < ITEM_COUNT) {
+			for (i = 0; i < 4; ++i) {
+				queued = queue_push(&backlog);
+
+				if (queued == NULL) {
+					printf("benchmark_queue_backlog: queue_push failed\n");
+
+					return -1;
+				}
+
+				memcpy(queued, &packet, packet.header.length);
+			}
+		}
+
+		if (backlog.count > max_backlog) {
+			max_backlog = backlog.count;
+		}
+
+		for (i = 0; i < 3 && backlog.count > 0; ++i) {
+			queued = queue_peek(&backlog);
+			written += queued->header.length;
+
+			queue_pop(&backlog, NULL);
+		}
+	}
+
+	measurement_stop(&measurement, (uint64_t)ITEM_COUNT * 4 * 2);
+
+	printf("%-40s %12d packets max backlog, %llu bytes written\n", "",
+	       max_backlog, (unsigned long long)written);
+
+	queue_destroy(&backlog, NULL);
+
+	return 0;
+}
+
+int main(void) {
+	if (benchmark_array(false) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark_array(true) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark_queue() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark_node() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark_queue_backlog() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * faulty_libusb.c: LD_PRELOAD shim that makes USB transfer submissions fail
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// exercises the transfer submission retry and health handling of brickd's
+// USBStack. after FAULTY_LIBUSB_AFTER successful submissions (default 100, so
+// the initial read transfers of each USB device get submitted) every
+// libusb_submit_transfer call fails with FAULTY_LIBUSB_ERROR (default -1,
+// LIBUSB_ERROR_IO) at a chance of FAULTY_LIBUSB_RATE percent (default 10).
+// the failures are reproducible for a given FAULTY_LIBUSB_SEED.
+//
+//  LD_PRELOAD=./faulty_libusb.so FAULTY_LIBUSB_RATE=30 brickd --debug usb
+//
+// then send requests to a Brick, for example with throughput_test, and send
+// SIGUSR2 to brickd to log the submission failure counters and the health of
+// each USB device. at a rate of 100 the health drops to zero and the USB
+// device gets reopened
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct libusb_transfer;
+
+typedef int (*SubmitTransferFunction)(struct libusb_transfer *transfer);
+
+static int get_option(const char *name, int default_value) {
+	const char *value = getenv(name);
+
+	return value != NULL ? atoi(value) : default_value;
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer) {
+	static SubmitTransferFunction real_submit_transfer = NULL;
+	static int after = -1;
+	static int rate;
+	static int error;
+	static unsigned long submissions = 0;
+	static unsigned long failures = 0;
+
+	if (real_submit_transfer == NULL) {
+		real_submit_transfer = (SubmitTransferFunction)dlsym(RTLD_NEXT, "libusb_submit_transfer");
+
+		if (real_submit_transfer == NULL) {
+			return -99; // LIBUSB_ERROR_OTHER
+		}
+	}
+
+	if (after < 0) {
+		after = get_option("FAULTY_LIBUSB_AFTER", 100);
+		rate = get_option("FAULTY_LIBUSB_RATE", 10);
+		error = get_option("FAULTY_LIBUSB_ERROR", -1);
+
+		srand(get_option("FAULTY_LIBUSB_SEED", 1));
+	}
+
+	++submissions;
+
+	if (submissions > (unsigned long)after && rand() % 100 < rate) {
+		++failures;
+
+		if (failures % 100 == 1) {
+			fprintf(stderr, "faulty_libusb: failed %lu of %lu submission(s)\n",
+			        failures, submissions);
+		}
+
+		return error;
+	}
+
+	return real_submit_transfer(transfer);
+}
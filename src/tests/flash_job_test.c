@@ -0,0 +1,258 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * flash_job_test.c: Tests for the flash job request handling
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// the production flash_job.c is included here. the client and hardware
+// functions that it calls are replaced by the stubs below, they record the
+// responses to the client and the requests to the device. the tests check
+// that image writes beyond the maximum image length are rejected, also if
+// offset and length wrap around, and that device responses are routed to
+// the running flash job of the device
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../brickd/flash_job.c"
+
+#include "test_harness.h"
+
+#define DEVICE_UID 1234
+
+static IO _io;
+static Client _clients[2];
+static FlashJobStatus _last_status;
+static int _response_count = 0;
+static Packet _requests[64];
+static int _request_count = 0;
+
+// stubs for the brickd functions called by flash_job.c
+
+ConfigOptionValue *config_get_option_value(const char *name) {
+	static ConfigOptionValue value;
+
+	(void)name;
+
+	value.string = NULL;
+
+	return &value;
+}
+
+const char *client_get_authentication_state_name(ClientAuthenticationState state) {
+	(void)state;
+
+	return "disabled";
+}
+
+void client_dispatch_response(Client *client, PendingRequest *pending_request,
+                              Packet *response, bool force, bool ignore_authentication) {
+	(void)client;
+	(void)pending_request;
+	(void)force;
+	(void)ignore_authentication;
+
+	if (response->header.function_id != CALLBACK_FLASH_JOB_PROGRESS) {
+		_last_status = ((FlashJobResponse *)response)->status;
+		++_response_count;
+	}
+}
+
+void hardware_dispatch_request(Packet *request) {
+	if (_request_count < (int)(sizeof(_requests) / sizeof(_requests[0]))) {
+		memcpy(&_requests[_request_count], request, request->header.length);
+	}
+
+	++_request_count;
+}
+
+// test helpers
+
+static void create_request_header(PacketHeader *header, uint8_t length, uint8_t function_id) {
+	memset(header, 0, sizeof(PacketHeader));
+
+	header->uid = uint32_to_le(UID_BRICK_DAEMON);
+	header->length = length;
+	header->function_id = function_id;
+
+	packet_header_set_sequence_number(header, 1);
+	packet_header_set_response_expected(header, true);
+}
+
+static FlashJobStatus write_image(FlashJob *flash_job, uint32_t offset, uint8_t length) {
+	union {
+		WriteFlashJobImageRequest request;
+		Packet packet;
+	} u;
+
+	memset(&u.packet, 0, sizeof(u.packet));
+	create_request_header(&u.request.header, sizeof(u.request), FUNCTION_WRITE_FLASH_JOB_IMAGE);
+
+	u.request.offset = uint32_to_le(offset);
+	u.request.length = length;
+
+	memset(u.request.data, 0xAA, sizeof(u.request.data));
+
+	_last_status = (FlashJobStatus)-1;
+
+	flash_job_handle_request(flash_job, &u.packet);
+
+	return _last_status;
+}
+
+static FlashJobStatus start(FlashJob *flash_job, char port, uint32_t image_length) {
+	union {
+		StartFlashJobRequest request;
+		Packet packet;
+	} u;
+
+	memset(&u.packet, 0, sizeof(u.packet));
+	create_request_header(&u.request.header, sizeof(u.request), FUNCTION_START_FLASH_JOB);
+
+	u.request.uid = uint32_to_le(DEVICE_UID);
+	u.request.type = FLASH_JOB_TYPE_BRICKLET_PLUGIN;
+	u.request.port = port;
+	u.request.image_length = uint32_to_le(image_length);
+
+	_last_status = (FlashJobStatus)-1;
+
+	flash_job_handle_request(flash_job, &u.packet);
+
+	return _last_status;
+}
+
+static bool ack_request(Packet *request, uint32_t uid) {
+	Packet response;
+
+	memset(&response, 0, sizeof(response));
+
+	response.header = request->header;
+	response.header.uid = uint32_to_le(uid);
+	response.header.length = sizeof(PacketHeader);
+
+	return flash_job_dispatch_response(&response);
+}
+
+static int test_write_image_bounds(FlashJob *flash_job) {
+	bool ok = true;
+
+	ok = ok && write_image(flash_job, 0, 64) == FLASH_JOB_STATUS_OK;
+	ok = ok && write_image(flash_job, FLASH_JOB_MAX_IMAGE_LENGTH - 64, 64) == FLASH_JOB_STATUS_OK;
+	ok = ok && flash_job->image_length == FLASH_JOB_MAX_IMAGE_LENGTH;
+
+	// one byte beyond the maximum image length
+	ok = ok && write_image(flash_job, FLASH_JOB_MAX_IMAGE_LENGTH - 63, 64) == FLASH_JOB_STATUS_INVALID_PARAMETER;
+	ok = ok && write_image(flash_job, FLASH_JOB_MAX_IMAGE_LENGTH, 1) == FLASH_JOB_STATUS_INVALID_PARAMETER;
+
+	// offset + length wraps around to a small value
+	ok = ok && write_image(flash_job, UINT32_MAX - 31, 64) == FLASH_JOB_STATUS_INVALID_PARAMETER;
+	ok = ok && write_image(flash_job, UINT32_MAX, 1) == FLASH_JOB_STATUS_INVALID_PARAMETER;
+
+	// rejected writes don't change the image
+	ok = ok && flash_job->image_length == FLASH_JOB_MAX_IMAGE_LENGTH;
+	ok = ok && flash_job->image_allocated <= FLASH_JOB_MAX_IMAGE_LENGTH;
+
+	return harness_check("write image bounds", ok);
+}
+
+static int test_invalid_port(FlashJob *flash_job) {
+	bool ok;
+
+	ok = write_image(flash_job, 0, 64) == FLASH_JOB_STATUS_OK;
+	ok = ok && start(flash_job, 'e', 64) == FLASH_JOB_STATUS_INVALID_PARAMETER;
+	ok = ok && start(flash_job, '\0', 64) == FLASH_JOB_STATUS_INVALID_PARAMETER;
+	ok = ok && start(flash_job, 'A', 64) == FLASH_JOB_STATUS_INVALID_PARAMETER;
+	ok = ok && flash_job->state == FLASH_JOB_STATE_IDLE && _request_count == 0;
+
+	return harness_check("invalid port", ok);
+}
+
+// the responses of the device are routed to the running flash job of that
+// device only, a second flash job for the same device is rejected
+static int test_response_routing(FlashJob *flash_job, FlashJob *other_flash_job) {
+	int i;
+	bool ok;
+
+	_request_count = 0;
+
+	ok = write_image(flash_job, 0, 64) == FLASH_JOB_STATUS_OK;
+	ok = ok && start(flash_job, 'b', 64) == FLASH_JOB_STATUS_OK;
+	ok = ok && flash_job->state == FLASH_JOB_STATE_RUNNING && _request_count == 2;
+
+	ok = ok && write_image(other_flash_job, 0, 64) == FLASH_JOB_STATUS_OK;
+	ok = ok && start(other_flash_job, 'a', 64) == FLASH_JOB_STATUS_BUSY;
+	ok = ok && other_flash_job->state == FLASH_JOB_STATE_IDLE;
+
+	// a response of another device is not consumed
+	ok = ok && !ack_request(&_requests[0], DEVICE_UID + 1);
+
+	for (i = 0; ok && i < 2; ++i) {
+		ok = ack_request(&_requests[i], DEVICE_UID);
+	}
+
+	ok = ok && flash_job->state == FLASH_JOB_STATE_DONE;
+
+	// the finished flash job doesn't consume responses anymore
+	ok = ok && !ack_request(&_requests[1], DEVICE_UID);
+
+	// now the device can be flashed by the other client
+	ok = ok && start(other_flash_job, 'a', 64) == FLASH_JOB_STATUS_OK;
+	ok = ok && other_flash_job->state == FLASH_JOB_STATE_RUNNING;
+
+	return harness_check("response routing", ok);
+}
+
+int main(void) {
+	FlashJob flash_jobs[2];
+	int i;
+	int rc = 0;
+
+	log_init();
+
+	memset(&_io, 0, sizeof(_io));
+
+	_io.type = "test";
+
+	for (i = 0; i < 2; ++i) {
+		memset(&_clients[i], 0, sizeof(_clients[i]));
+
+		snprintf(_clients[i].name, sizeof(_clients[i].name), "client%d", i);
+
+		_clients[i].io = &_io;
+
+		if (flash_job_create(&flash_jobs[i], &_clients[i]) < 0) {
+			printf("flash_job_create error\n");
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	rc |= test_write_image_bounds(&flash_jobs[0]);
+	rc |= test_invalid_port(&flash_jobs[0]);
+	rc |= test_response_routing(&flash_jobs[0], &flash_jobs[1]);
+
+	// destroying a running flash job unlinks it
+	flash_job_destroy(&flash_jobs[1]);
+	flash_job_destroy(&flash_jobs[0]);
+
+	rc |= harness_check("no running flash jobs left", _running_flash_jobs.next == &_running_flash_jobs);
+
+	log_exit();
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
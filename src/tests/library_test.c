@@ -0,0 +1,295 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * library_test.c: Tests for the brickd library and its local clients
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// links libbrickd.a and runs the brickd subsystems in this process, the way
+// an embedding application does. the event loop runs in its own thread, the
+// requests are sent from the main thread and from several sender threads at
+// once. brickd itself answers requests to its own UID, so no device is needed.
+// the tests check the responses, that a local client stays usable after brickd
+// disconnected it and that closing and stopping work from another thread
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "../brickd/library.h"
+#include "../brickd/local_client.h"
+
+#include "test_harness.h"
+
+#define UID_BRICK_DAEMON 1
+#define FUNCTION_UNSUPPORTED 99
+#define SENDER_COUNT 4
+#define REQUESTS_PER_SENDER 250
+#define TIMEOUT 5000 // milliseconds
+
+typedef struct {
+	Mutex mutex;
+	int responses;
+	int unexpected_responses;
+	int disconnects;
+} Host;
+
+static void handle_response(Packet *response, void *opaque) {
+	Host *host = opaque;
+	bool expected = uint32_from_le(response->header.uid) == UID_BRICK_DAEMON &&
+	                response->header.function_id == FUNCTION_UNSUPPORTED &&
+	                packet_header_get_error_code(&response->header) == PACKET_E_FUNCTION_NOT_SUPPORTED;
+
+	mutex_lock(&host->mutex);
+
+	if (expected) {
+		++host->responses;
+	} else {
+		++host->unexpected_responses;
+	}
+
+	mutex_unlock(&host->mutex);
+}
+
+static void handle_disconnect(void *opaque) {
+	Host *host = opaque;
+
+	mutex_lock(&host->mutex);
+	++host->disconnects;
+	mutex_unlock(&host->mutex);
+}
+
+static void create_request(Packet *request, uint8_t function_id, uint8_t sequence_number) {
+	memset(request, 0, sizeof(*request));
+
+	request->header.uid = uint32_to_le(UID_BRICK_DAEMON);
+	request->header.length = sizeof(PacketHeader);
+	request->header.function_id = function_id;
+
+	packet_header_set_sequence_number(&request->header, sequence_number);
+	packet_header_set_response_expected(&request->header, true);
+}
+
+// waits until *counter reaches the expected value, *counter is protected by
+// the host mutex
+static bool wait_for(Host *host, int *counter, int expected) {
+	int value;
+	int i;
+
+	for (i = 0; i < TIMEOUT; ++i) {
+		mutex_lock(&host->mutex);
+		value = *counter;
+		mutex_unlock(&host->mutex);
+
+		if (value >= expected) {
+			return value == expected;
+		}
+
+		millisleep(1);
+	}
+
+	return false;
+}
+
+static void run_event_loop(void *opaque) {
+	int *rc = opaque;
+
+	*rc = library_run();
+}
+
+static LocalClient *_sender_client;
+
+// sends a request, waits and tries again while the request pipe is full
+static int send_request(LocalClient *local_client, Packet *request) {
+	int i;
+
+	for (i = 0; i < TIMEOUT; ++i) {
+		if (local_client_send(local_client, request) == 0) {
+			return 0;
+		}
+
+		if (!errno_would_block()) {
+			return -1;
+		}
+
+		millisleep(1);
+	}
+
+	return -1;
+}
+
+static void run_sender(void *opaque) {
+	int *failures = opaque;
+	Packet request;
+	int i;
+
+	for (i = 0; i < REQUESTS_PER_SENDER; ++i) {
+		create_request(&request, FUNCTION_UNSUPPORTED, 1 + i % 15);
+
+		if (send_request(_sender_client, &request) < 0) {
+			++*failures;
+		}
+	}
+}
+
+static int test_request_response(LocalClient *local_client, Host *host) {
+	Packet request;
+	bool ok;
+
+	create_request(&request, FUNCTION_UNSUPPORTED, 1);
+
+	ok = local_client_send(local_client, &request) == 0;
+	ok = ok && wait_for(host, &host->responses, 1);
+	ok = ok && host->unexpected_responses == 0;
+
+	return harness_check("request and response", ok);
+}
+
+// requests are sent from several threads at once, each of them has to arrive
+// in one piece and get its response
+static int test_concurrent_senders(LocalClient *local_client, Host *host) {
+	Thread threads[SENDER_COUNT];
+	int failures[SENDER_COUNT];
+	int i;
+	bool ok = true;
+
+	_sender_client = local_client;
+
+	mutex_lock(&host->mutex);
+	host->responses = 0;
+	mutex_unlock(&host->mutex);
+
+	for (i = 0; i < SENDER_COUNT; ++i) {
+		failures[i] = 0;
+
+		thread_create(&threads[i], run_sender, &failures[i]);
+	}
+
+	for (i = 0; i < SENDER_COUNT; ++i) {
+		thread_join(&threads[i]);
+		thread_destroy(&threads[i]);
+
+		ok = ok && failures[i] == 0;
+	}
+
+	ok = ok && wait_for(host, &host->responses, SENDER_COUNT * REQUESTS_PER_SENDER);
+	ok = ok && host->unexpected_responses == 0;
+
+	return harness_check("concurrent senders", ok);
+}
+
+// brickd disconnects a client that sends an authentication-nonce request with
+// a wrong length. the host is told about it and still owns the local client,
+// sending fails until the host closes it
+static int test_disconnect_by_brickd(LocalClient *local_client, Host *host) {
+	Packet request;
+	bool ok;
+
+	create_request(&request, FUNCTION_GET_AUTHENTICATION_NONCE, 1);
+
+	ok = local_client_send(local_client, &request) == 0;
+	ok = ok && wait_for(host, &host->disconnects, 1);
+
+	errno = 0;
+
+	ok = ok && local_client_send(local_client, &request) < 0 && errno == EPIPE;
+
+	local_client_close(local_client);
+
+	return harness_check("disconnect by brickd", ok);
+}
+
+int main(void) {
+	char config_filename[] = "/tmp/library_test_XXXXXX";
+	FILE *config_file;
+	int fd;
+	Host host;
+	Host other_host;
+	LocalClient *local_client;
+	LocalClient *other_local_client;
+	Thread event_thread;
+	int event_rc = -1;
+	int rc = 0;
+
+	// listen on a port that doesn't collide with a running brickd
+	fd = mkstemp(config_filename);
+
+	if (fd < 0 || (config_file = fdopen(fd, "w")) == NULL) {
+		printf("could not create config file: %s\n", strerror(errno));
+
+		return EXIT_FAILURE;
+	}
+
+	fprintf(config_file, "listen.address = 127.0.0.1\nlisten.plain_port = %d\n",
+	        20000 + getpid() % 20000);
+	fclose(config_file);
+
+	memset(&host, 0, sizeof(host));
+	memset(&other_host, 0, sizeof(other_host));
+
+	mutex_create(&host.mutex);
+	mutex_create(&other_host.mutex);
+
+	// running before init fails
+	rc |= harness_check("run before init", library_run() < 0);
+
+	if (library_init(config_filename) < 0) {
+		printf("library_init error\n");
+		unlink(config_filename);
+
+		return EXIT_FAILURE;
+	}
+
+	local_client = local_client_create("library-test", handle_response, handle_disconnect, &host);
+	other_local_client = local_client_create("library-test-other", handle_response, handle_disconnect, &other_host);
+
+	if (local_client == NULL || other_local_client == NULL) {
+		printf("local_client_create error\n");
+
+		return EXIT_FAILURE;
+	}
+
+	thread_create(&event_thread, run_event_loop, &event_rc);
+
+	rc |= test_request_response(local_client, &host);
+	rc |= test_concurrent_senders(local_client, &host);
+	rc |= test_disconnect_by_brickd(other_local_client, &other_host);
+
+	// the first client was not disconnected by brickd, closing it from this
+	// thread doesn't call the disconnect function
+	local_client_close(local_client);
+
+	library_stop();
+	thread_join(&event_thread);
+	thread_destroy(&event_thread);
+
+	rc |= harness_check("stop from another thread", event_rc == 0);
+	rc |= harness_check("no disconnect after close", host.disconnects == 0);
+
+	library_exit();
+
+	mutex_destroy(&other_host.mutex);
+	mutex_destroy(&host.mutex);
+	unlink(config_filename);
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,475 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * mesh_parser_test.c: Tests for the mesh stack response parser
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// the production mesh_stack.c is included here, so the real
+// mesh_stack_recv_handler is tested. the mesh stack reads from one end of a
+// socketpair, a fake mesh root node writes a stream of mixed mesh packets
+// (mostly TFP payload packets, some heart beat pong packets) into the other
+// end, split at arbitrary byte offsets. the brickd functions that
+// mesh_stack.c calls are replaced by the stubs below,
+// network_dispatch_response records the dispatched responses
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../brickd/mesh_stack.c"
+
+#include "test_harness.h"
+
+#define PACKET_COUNT 200000
+#define SEGMENT_SIZE 1460
+
+Array mesh_stacks;
+
+static uint8_t _root_addr[ESP_MESH_ADDRESS_LEN] = {1, 2, 3, 4, 5, 6};
+static uint8_t _gateway_addr[ESP_MESH_ADDRESS_LEN] = {0, 0, 0, 0, 0, 0};
+static int _dispatched_count = 0;
+static int _dispatched_mismatches = 0;
+static int _expected_index = 0;
+static MeshStack *_mesh_stack = NULL;
+static HarnessStream _fake_root;
+
+static bool is_pong(int index) {
+	return index % 20 == 19;
+}
+
+// fills the mesh packet with the given index of the stream and returns its
+// length. every 20th packet is a heart beat pong, all others carry a response
+static int fill_mesh_packet(MeshPayloadPacket *packet, int index) {
+	int length;
+	int i;
+
+	memset(packet, 0, sizeof(*packet));
+
+	if (is_pong(index)) {
+		mesh_packet_header_create(&packet->header, MESH_PACKET_DIRECTION_UPWARD,
+		                          false, MESH_PACKET_PROTOCOL_BINARY,
+		                          sizeof(MeshHeartBeatPacket), _gateway_addr,
+		                          _root_addr, MESH_PACKET_TYPE_HEART_BEAT_PONG);
+
+		return sizeof(MeshHeartBeatPacket);
+	}
+
+	length = (int)sizeof(PacketHeader) + (index * 7) % (int)(sizeof(Packet) - sizeof(PacketHeader) + 1);
+
+	mesh_packet_header_create(&packet->header, MESH_PACKET_DIRECTION_UPWARD,
+	                          false, MESH_PACKET_PROTOCOL_BINARY,
+	                          sizeof(MeshPacketHeader) + length, _gateway_addr,
+	                          _root_addr, MESH_PACKET_TYPE_PAYLOAD);
+
+	packet->payload.header.uid = uint32_to_le(1000 + index % 7);
+	packet->payload.header.length = (uint8_t)length;
+	packet->payload.header.function_id = (uint8_t)(1 + index % 200);
+
+	packet_header_set_sequence_number(&packet->payload.header, 1 + index % 15);
+
+	for (i = 0; i < length - (int)sizeof(PacketHeader); ++i) {
+		((uint8_t *)&packet->payload)[sizeof(PacketHeader) + i] = (uint8_t)(index + i);
+	}
+
+	return sizeof(MeshPacketHeader) + length;
+}
+
+// stubs for the brickd functions called by mesh_stack.c
+
+int stack_create(Stack *stack, const char *name,
+                 StackDispatchRequestFunction dispatch_request) {
+	(void)stack;
+	(void)name;
+	(void)dispatch_request;
+
+	return 0;
+}
+
+void stack_destroy(Stack *stack) {
+	(void)stack;
+}
+
+int stack_add_recipient(Stack *stack, uint32_t uid, uint64_t opaque) {
+	(void)stack;
+	(void)uid;
+	(void)opaque;
+
+	return 0;
+}
+
+Recipient *stack_get_recipient(Stack *stack, uint32_t uid) {
+	(void)stack;
+	(void)uid;
+
+	return NULL;
+}
+
+void stack_announce_disconnect(Stack *stack) {
+	(void)stack;
+}
+
+int hardware_add_stack(Stack *stack) {
+	(void)stack;
+
+	return 0;
+}
+
+int hardware_remove_stack(Stack *stack) {
+	(void)stack;
+
+	return 0;
+}
+
+void network_dispatch_response(Packet *response) {
+	MeshPayloadPacket expected;
+
+	while (is_pong(_expected_index)) {
+		++_expected_index;
+	}
+
+	fill_mesh_packet(&expected, _expected_index++);
+
+	if (response->header.length != expected.payload.header.length ||
+	    memcmp(response, &expected.payload, expected.payload.header.length) != 0) {
+		++_dispatched_mismatches;
+	}
+
+	++_dispatched_count;
+}
+
+// test helpers
+
+static int connect_fake_root(void) {
+	int sockets[2];
+	Socket *sock;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+		printf("socketpair error: %s\n", get_errno_name(errno));
+
+		return -1;
+	}
+
+	sock = calloc(1, sizeof(Socket));
+
+	if (sock == NULL || socket_create(sock) < 0) {
+		printf("socket_create error\n");
+
+		return -1;
+	}
+
+	sock->handle = sockets[0];
+	sock->base.read_handle = sockets[0];
+	sock->base.write_handle = sockets[0];
+
+	if (mesh_stack_create("test", sock) < 0) {
+		printf("mesh_stack_create error\n");
+
+		return -1;
+	}
+
+	// same state as after a hello packet from the root node
+	_mesh_stack = array_get(&mesh_stacks, mesh_stacks.count - 1);
+	_mesh_stack->state = MESH_STACK_STATE_OPERATIONAL;
+	_fake_root.fd = sockets[1];
+	_fake_root.opaque = _mesh_stack;
+	_dispatched_count = 0;
+	_dispatched_mismatches = 0;
+	_expected_index = 0;
+
+	return 0;
+}
+
+static void disconnect_fake_root(void) {
+	array_remove(&mesh_stacks, mesh_stacks.count - 1, (ItemDestroyFunction)mesh_stack_destroy);
+	close(_fake_root.fd);
+
+	_mesh_stack = NULL;
+}
+
+static bool is_cleaned_up(void *opaque) {
+	return ((MeshStack *)opaque)->cleanup;
+}
+
+// returns the stream length and the number of responses in it
+static int create_stream(uint8_t **stream, int count, int *response_count) {
+	int length = 0;
+	int i;
+	MeshPayloadPacket packet;
+	int packet_length;
+
+	*stream = malloc((size_t)(count + 1) * sizeof(MeshPayloadPacket)); // room for one more
+
+	if (*stream == NULL) {
+		printf("malloc error\n");
+
+		return -1;
+	}
+
+	*response_count = 0;
+
+	for (i = 0; i < count; ++i) {
+		packet_length = fill_mesh_packet(&packet, i);
+
+		memcpy(*stream + length, &packet, packet_length);
+
+		length += packet_length;
+
+		if (!is_pong(i)) {
+			++*response_count;
+		}
+	}
+
+	return length;
+}
+
+// every possible split position of a packet has to be handled, including
+// splits inside the mesh header and inside the TFP header
+static int test_split_at_every_offset(void) {
+	uint8_t *stream;
+	int response_count;
+	int length = create_stream(&stream, 64, &response_count);
+	int chunk_length;
+	int rc = 0;
+
+	if (length < 0) {
+		return -1;
+	}
+
+	for (chunk_length = 1; rc == 0 && chunk_length <= (int)sizeof(MeshPayloadPacket) + 1; ++chunk_length) {
+		if (connect_fake_root() < 0 || harness_feed(&_fake_root, stream, length, chunk_length) < 0) {
+			rc = -1;
+		} else if (_dispatched_count != response_count || _dispatched_mismatches != 0 ||
+		           _mesh_stack->cleanup) {
+			printf("chunk length %d: got %d of %d responses, %d mismatches\n",
+			       chunk_length, _dispatched_count, response_count, _dispatched_mismatches);
+
+			rc = -1;
+		}
+
+		disconnect_fake_root();
+	}
+
+	free(stream);
+
+	return harness_check("split at every offset", rc == 0);
+}
+
+// a stream that ends in the middle of a packet dispatches all complete
+// packets and keeps the truncated one until the rest of it arrives
+static int test_truncated_tail(void) {
+	uint8_t *stream;
+	int response_count;
+	int length = create_stream(&stream, 10, &response_count);
+	MeshPayloadPacket packet;
+	int packet_length = fill_mesh_packet(&packet, 10);
+	bool ok;
+
+	if (length < 0 || connect_fake_root() < 0) {
+		return -1;
+	}
+
+	memcpy(stream + length, &packet, packet_length);
+
+	ok = harness_feed(&_fake_root, stream, length + packet_length - 1, length + packet_length) == 0;
+	ok = ok && !_mesh_stack->cleanup && _dispatched_count == response_count;
+
+	ok = ok && harness_feed(&_fake_root, stream + length + packet_length - 1, 1, 1) == 0;
+	ok = ok && !_mesh_stack->cleanup && _dispatched_count == response_count + 1;
+	ok = ok && _dispatched_mismatches == 0;
+	ok = ok && _mesh_stack->response_buffer_used == 0;
+
+	disconnect_fake_root();
+	free(stream);
+
+	return harness_check("truncated tail", ok);
+}
+
+// a malformed packet after valid ones has to disconnect the mesh stack after
+// dispatching the valid ones and without dispatching the malformed one
+static int test_malformed(const char *name, void (*corrupt)(MeshPayloadPacket *packet)) {
+	uint8_t *stream;
+	int response_count;
+	int length = create_stream(&stream, 3, &response_count);
+	MeshPayloadPacket packet;
+	bool ok;
+
+	if (length < 0 || connect_fake_root() < 0) {
+		return -1;
+	}
+
+	fill_mesh_packet(&packet, 3);
+	corrupt(&packet);
+	memcpy(stream + length, &packet, sizeof(packet));
+
+	ok = harness_feed(&_fake_root, stream, length + (int)sizeof(packet), 5) == 0;
+	ok = ok && _mesh_stack->cleanup && _dispatched_count == response_count;
+	ok = ok && _dispatched_mismatches == 0;
+
+	disconnect_fake_root();
+	free(stream);
+
+	return harness_check(name, ok);
+}
+
+static void corrupt_too_small(MeshPayloadPacket *packet) {
+	packet->header.length = sizeof(MeshPacketHeader) - 1;
+}
+
+// longer than any mesh packet, the parser must not wait for it
+static void corrupt_oversized(MeshPayloadPacket *packet) {
+	packet->header.length = MESH_STACK_RESPONSE_BUFFER_SIZE + 1;
+}
+
+static void corrupt_oversized_payload(MeshPayloadPacket *packet) {
+	packet->header.length = sizeof(MeshPayloadPacket) + 1;
+}
+
+// the TFP packet is truncated by the mesh header length
+static void corrupt_truncated_payload(MeshPayloadPacket *packet) {
+	packet->header.length = sizeof(MeshPacketHeader) + packet->payload.header.length - 1;
+}
+
+static void corrupt_invalid_payload(MeshPayloadPacket *packet) {
+	packet->payload.header.length = sizeof(PacketHeader) - 1;
+	packet->header.length = sizeof(MeshPacketHeader) + packet->payload.header.length;
+}
+
+static void corrupt_pong_length(MeshPayloadPacket *packet) {
+	packet->header.type = MESH_PACKET_TYPE_HEART_BEAT_PONG;
+}
+
+// each packet carries the layer of its source node in the upper byte of the
+// flags. the hop count of a node follows the latest known layer, packets of
+// older firmware without a layer don't reset it
+static void fill_pong(MeshHeartBeatPacket *packet, uint8_t *src_addr, uint8_t layer) {
+	mesh_packet_header_create(&packet->header, MESH_PACKET_DIRECTION_UPWARD,
+	                          false, MESH_PACKET_PROTOCOL_BINARY,
+	                          sizeof(MeshHeartBeatPacket), _gateway_addr,
+	                          src_addr, MESH_PACKET_TYPE_HEART_BEAT_PONG);
+
+	packet->header.flags |= layer;
+}
+
+static MeshNode *find_node(uint8_t *addr) {
+	MeshNode *node;
+	int i;
+
+	for (i = 0; i < _mesh_stack->nodes.count; ++i) {
+		node = array_get(&_mesh_stack->nodes, i);
+
+		if (memcmp(node->addr, addr, ESP_MESH_ADDRESS_LEN) == 0) {
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+static int test_hop_count(void) {
+	uint8_t leaf_addr[ESP_MESH_ADDRESS_LEN] = {1, 2, 3, 4, 5, 7};
+	MeshHeartBeatPacket packets[4];
+	MeshNode *root_node;
+	MeshNode *leaf_node;
+	bool ok;
+
+	if (connect_fake_root() < 0) {
+		return -1;
+	}
+
+	fill_pong(&packets[0], _root_addr, 1);
+	fill_pong(&packets[1], leaf_addr, 3);
+	fill_pong(&packets[2], leaf_addr, 0); // older firmware
+	fill_pong(&packets[3], _root_addr, 0);
+
+	ok = harness_feed(&_fake_root, (uint8_t *)packets, sizeof(packets), sizeof(packets)) == 0 && !_mesh_stack->cleanup;
+
+	root_node = find_node(_root_addr);
+	leaf_node = find_node(leaf_addr);
+
+	ok = ok && root_node != NULL && root_node->hop_count == 1 && root_node->packets_received == 2;
+	ok = ok && leaf_node != NULL && leaf_node->hop_count == 3 && leaf_node->packets_received == 2;
+
+	// the leaf node moved up in the tree
+	fill_pong(&packets[0], leaf_addr, 2);
+
+	ok = ok && harness_feed(&_fake_root, (uint8_t *)packets, sizeof(MeshHeartBeatPacket), sizeof(MeshHeartBeatPacket)) == 0;
+	ok = ok && leaf_node->hop_count == 2;
+
+	disconnect_fake_root();
+
+	return harness_check("hop count", ok);
+}
+
+static int test_throughput(void) {
+	uint8_t *stream;
+	int response_count;
+	int length = create_stream(&stream, PACKET_COUNT, &response_count);
+	bool ok;
+
+	if (length < 0 || connect_fake_root() < 0) {
+		return -1;
+	}
+
+	ok = harness_measure_throughput(&_fake_root, stream, length, SEGMENT_SIZE,
+	                                &_dispatched_count, response_count);
+	ok = ok && _dispatched_mismatches == 0;
+
+	disconnect_fake_root();
+	free(stream);
+
+	return harness_check("throughput", ok);
+}
+
+int main(void) {
+	int rc = 0;
+
+	log_init();
+
+	if (event_init() < 0) {
+		printf("event_init error\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if (array_create(&mesh_stacks, MAX_MESH_STACKS, sizeof(MeshStack), false) < 0) {
+		printf("array_create error\n");
+
+		return EXIT_FAILURE;
+	}
+
+	_fake_root.handle_read = mesh_stack_recv_handler;
+	_fake_root.is_disconnected = is_cleaned_up;
+
+	rc |= test_split_at_every_offset();
+	rc |= test_truncated_tail();
+	rc |= test_malformed("length too small", corrupt_too_small);
+	rc |= test_malformed("oversized packet", corrupt_oversized);
+	rc |= test_malformed("oversized payload packet", corrupt_oversized_payload);
+	rc |= test_malformed("truncated payload", corrupt_truncated_payload);
+	rc |= test_malformed("invalid payload", corrupt_invalid_payload);
+	rc |= test_malformed("length mismatching type", corrupt_pong_length);
+	rc |= test_hop_count();
+	rc |= test_throughput();
+
+	array_destroy(&mesh_stacks, (ItemDestroyFunction)mesh_stack_destroy);
+	event_exit();
+	log_exit();
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
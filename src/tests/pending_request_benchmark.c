@@ -0,0 +1,352 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * pending_request_benchmark.c: Benchmark for matching responses to pending
+ *                              requests
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// the production network.c is included here, so the real
+// network_client_expects_response and network_dispatch_response are measured.
+// several clients keep a window of requests pending to each simulated device,
+// like getter loops do. devices answer at different speeds, so a response
+// doesn't belong to the oldest pending request of all devices. the benchmark
+// picks a random device and client for each response, answers their oldest
+// pending request and lets the client send the next request right away. it
+// reports the time per response and request for a growing number of
+// devices. pending_request_benchmark_unsharded.c builds the same benchmark
+// with a single shard, which is the global pending request list as it was
+// before it got sharded by UID
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../brickd/network.c"
+
+#define CLIENT_COUNT 8
+#define WINDOW 4 // pending requests per client and device
+#define RESPONSE_COUNT 200000
+
+static IO _io;
+static int _matched_responses = 0;
+static int _broadcast_responses = 0;
+
+// stubs for the brickd functions called by network.c
+
+void client_dispatch_response(Client *client, PendingRequest *pending_request,
+                              Packet *response, bool force, bool ignore_authentication) {
+	(void)client;
+	(void)response;
+	(void)force;
+	(void)ignore_authentication;
+
+	if (pending_request != NULL) {
+		pending_request_remove_and_free(pending_request);
+
+		++_matched_responses;
+	} else {
+		++_broadcast_responses;
+	}
+}
+
+void pending_request_remove_and_free(PendingRequest *pending_request) {
+	node_remove(&pending_request->global_node);
+	node_remove(&pending_request->client_node);
+
+	--pending_request->client->pending_request_count;
+
+	free(pending_request);
+}
+
+const char *client_get_authentication_state_name(ClientAuthenticationState state) {
+	(void)state;
+
+	return "disabled";
+}
+
+void zombie_dispatch_response(Zombie *zombie, PendingRequest *pending_request,
+                              Packet *response) {
+	(void)zombie;
+	(void)pending_request;
+	(void)response;
+}
+
+bool flash_job_dispatch_response(Packet *response) {
+	(void)response;
+
+	return false;
+}
+
+void rules_handle_callback(Packet *callback) {
+	(void)callback;
+}
+
+// stubs for the functions that network.c calls outside of matching, the
+// benchmark doesn't call them
+
+ConfigOptionValue *config_get_option_value(const char *name) {
+	static ConfigOptionValue value;
+
+	(void)name;
+
+	memset(&value, 0, sizeof(value));
+
+	return &value;
+}
+
+int client_create(Client *client, const char *name, IO *io,
+                  uint32_t authentication_nonce,
+                  ClientDestroyDoneFunction destroy_done) {
+	(void)client;
+	(void)name;
+	(void)io;
+	(void)authentication_nonce;
+	(void)destroy_done;
+
+	return -1;
+}
+
+void client_destroy(Client *client) {
+	(void)client;
+}
+
+void client_flush_callback_backlog(Client *client) {
+	(void)client;
+}
+
+int zombie_create(Zombie *zombie, Client *client) {
+	(void)zombie;
+	(void)client;
+
+	return -1;
+}
+
+void zombie_destroy(Zombie *zombie) {
+	(void)zombie;
+}
+
+int rules_init(void) {
+	return 0;
+}
+
+void rules_exit(void) {
+}
+
+int resolver_init(void) {
+	return 0;
+}
+
+void resolver_exit(void) {
+}
+
+int resolver_format_numeric_name(struct sockaddr *address, socklen_t length,
+                                 char *name, int name_length) {
+	(void)address;
+	(void)length;
+	(void)name;
+	(void)name_length;
+
+	return -1;
+}
+
+int resolver_resolve_name(struct sockaddr *address, socklen_t length,
+                          ResolverDoneFunction done, void *opaque) {
+	(void)address;
+	(void)length;
+	(void)done;
+	(void)opaque;
+
+	return -1;
+}
+
+void resolver_cancel(void *opaque) {
+	(void)opaque;
+}
+
+Socket *websocket_create_allocated(void) {
+	return NULL;
+}
+
+// benchmark helpers
+
+static void create_packet(Packet *packet, uint32_t uid, int client_index, uint8_t sequence_number) {
+	memset(packet, 0, sizeof(PacketHeader));
+
+	packet->header.uid = uint32_to_le(uid);
+	packet->header.length = sizeof(PacketHeader);
+	packet->header.function_id = (uint8_t)(1 + client_index);
+
+	packet_header_set_sequence_number(&packet->header, sequence_number);
+	packet_header_set_response_expected(&packet->header, true);
+}
+
+static uint8_t next_sequence_number(uint8_t sequence_number) {
+	return sequence_number % 15 + 1;
+}
+
+static int create_clients(void) {
+	Client *client;
+	int i;
+
+	if (array_create(&_clients, CLIENT_COUNT, sizeof(Client), false) < 0) {
+		printf("array_create error\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < CLIENT_COUNT; ++i) {
+		client = array_append(&_clients);
+
+		memset(client, 0, sizeof(Client));
+		snprintf(client->name, sizeof(client->name), "client%d", i);
+
+		client->id = i + 1;
+		client->io = &_io;
+
+		node_reset(&client->pending_request_sentinel);
+	}
+
+	return 0;
+}
+
+static void destroy_clients(void) {
+	Client *client;
+	int i;
+
+	for (i = 0; i < _clients.count; ++i) {
+		client = array_get(&_clients, i);
+
+		while (client->pending_request_count > 0) {
+			pending_request_remove_and_free(containerof(client->pending_request_sentinel.next,
+			                                            PendingRequest, client_node));
+		}
+	}
+
+	array_destroy(&_clients, NULL);
+}
+
+// the next sequence numbers to be sent and answered, per device and client
+static uint8_t *_next_request;
+static uint8_t *_next_response;
+
+static int benchmark(int device_count) {
+	Packet packet;
+	int device;
+	int client;
+	int slot;
+	int w;
+	int i;
+	uint64_t start;
+	uint64_t duration;
+	int pending_requests;
+	uint32_t seed = 1;
+	bool ok;
+
+	_next_request = calloc((size_t)device_count * CLIENT_COUNT, 1);
+	_next_response = calloc((size_t)device_count * CLIENT_COUNT, 1);
+
+	if (_next_request == NULL || _next_response == NULL || create_clients() < 0) {
+		printf("could not allocate benchmark state\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < PENDING_REQUEST_SHARD_COUNT; ++i) {
+		node_reset(&_pending_request_shards[i]);
+	}
+
+	// fill the windows, interleaved like concurrent clients would do
+	for (w = 0; w < WINDOW; ++w) {
+		for (device = 0; device < device_count; ++device) {
+			for (client = 0; client < CLIENT_COUNT; ++client) {
+				slot = device * CLIENT_COUNT + client;
+
+				if (w == 0) {
+					_next_request[slot] = 1;
+					_next_response[slot] = 1;
+				}
+
+				create_packet(&packet, 1000 + device, client, _next_request[slot]);
+				network_client_expects_response(array_get(&_clients, client), &packet);
+
+				_next_request[slot] = next_sequence_number(_next_request[slot]);
+			}
+		}
+	}
+
+	pending_requests = device_count * CLIENT_COUNT * WINDOW;
+	_matched_responses = 0;
+	_broadcast_responses = 0;
+	start = microseconds();
+
+	for (i = 0; i < RESPONSE_COUNT; ++i) {
+		// same sequence for each run, so the results are comparable
+		seed = seed * 1103515245 + 12345;
+		device = (int)((seed >> 8) % (uint32_t)device_count);
+		client = (int)((seed >> 24) % CLIENT_COUNT);
+		slot = device * CLIENT_COUNT + client;
+
+		create_packet(&packet, 1000 + device, client, _next_response[slot]);
+		network_dispatch_response(&packet);
+
+		_next_response[slot] = next_sequence_number(_next_response[slot]);
+
+		create_packet(&packet, 1000 + device, client, _next_request[slot]);
+		network_client_expects_response(array_get(&_clients, client), &packet);
+
+		_next_request[slot] = next_sequence_number(_next_request[slot]);
+	}
+
+	duration = MAX(microseconds() - start, 1);
+	ok = _matched_responses == RESPONSE_COUNT && _broadcast_responses == 0;
+
+	if (ok) {
+		printf("%5d device(s), %6d pending requests: %8.0f ns per response, %9.0f responses/sec\n",
+		       device_count, pending_requests, duration * 1000.0 / RESPONSE_COUNT,
+		       RESPONSE_COUNT * 1000000.0 / duration);
+	} else {
+		printf("%5d device(s): %d of %d responses matched, %d broadcast\n",
+		       device_count, _matched_responses, RESPONSE_COUNT, _broadcast_responses);
+	}
+
+	destroy_clients();
+	free(_next_request);
+	free(_next_response);
+
+	return ok ? 0 : -1;
+}
+
+int main(void) {
+	int device_counts[] = {1, 10, 100, 1000};
+	int i;
+	int rc = 0;
+
+	log_init();
+
+	_io.type = "benchmark";
+
+	printf("%d shard(s), %d clients, %d pending requests per client and device\n",
+	       PENDING_REQUEST_SHARD_COUNT, CLIENT_COUNT, WINDOW);
+
+	for (i = 0; i < (int)(sizeof(device_counts) / sizeof(device_counts[0])); ++i) {
+		rc |= benchmark(device_counts[i]);
+	}
+
+	log_exit();
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,312 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * red_usb_gadget_test.c: Tests for the RED Brick USB gadget transport
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// the production red_usb_gadget.c is included here with a FIFO standing in
+// for /dev/g_red_brick_data. the test reads from the other end of the FIFO
+// and checks that responses are batched, that a full FIFO pauses reading
+// requests until the write buffer could be flushed and that the reconnect
+// tries are only reset after a stable connection
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char *_data_filename = NULL;
+
+#define G_RED_BRICK_STATE_FILENAME "/dev/null"
+#define G_RED_BRICK_DATA_FILENAME _data_filename
+
+#include "../brickd/red_usb_gadget.c"
+
+#include "test_harness.h"
+
+static Client _test_client;
+static int _pause_count = 0;
+static int _resume_count = 0;
+static int _fifo = -1;
+
+// stubs for the brickd functions called by red_usb_gadget.c
+
+int red_brick_uid(uint32_t *uid) {
+	*uid = uint32_to_le(1);
+
+	return 0;
+}
+
+Client *network_create_client(const char *name, IO *io) {
+	(void)name;
+
+	memset(&_test_client, 0, sizeof(_test_client));
+
+	_test_client.io = io;
+
+	return &_test_client;
+}
+
+int client_pause_reading(Client *client) {
+	(void)client;
+
+	++_pause_count;
+
+	return 0;
+}
+
+int client_resume_reading(Client *client) {
+	(void)client;
+
+	++_resume_count;
+
+	return 0;
+}
+
+void client_send_red_brick_enumerate(Client *client, EnumerationType type) {
+	(void)client;
+	(void)type;
+}
+
+// test helpers
+
+static void fill_response(Packet *response, int index) {
+	memset(response, 0, sizeof(*response));
+
+	response->header.uid = uint32_to_le(1000 + index);
+	response->header.length = 80;
+	response->header.function_id = (uint8_t)(1 + index % 200);
+
+	packet_header_set_sequence_number(&response->header, 1 + index % 15);
+
+	memset(response->payload, (uint8_t)index, sizeof(response->payload));
+}
+
+static int write_response(int index) {
+	Packet response;
+
+	fill_response(&response, index);
+
+	return io_write(&_data->base.base, &response, response.header.length);
+}
+
+// reads everything that is currently in the FIFO and compares it against the
+// expected responses, starting at *index
+static int drain_fifo(int *index, int *read_calls) {
+	uint8_t buffer[4096];
+	static uint8_t pending[sizeof(Packet)];
+	static int pending_used = 0;
+	Packet expected;
+	int length;
+	int i;
+
+	for (;;) {
+		length = read(_fifo, buffer, sizeof(buffer));
+
+		if (length < 0) {
+			return errno_would_block() ? 0 : -1;
+		}
+
+		if (length == 0) {
+			return 0;
+		}
+
+		++*read_calls;
+
+		for (i = 0; i < length; ++i) {
+			pending[pending_used++] = buffer[i];
+
+			if (pending_used == 80) {
+				fill_response(&expected, (*index)++);
+
+				if (memcmp(pending, &expected, 80) != 0) {
+					printf("response %d mismatches\n", *index - 1);
+
+					return -1;
+				}
+
+				pending_used = 0;
+			}
+		}
+	}
+}
+
+// responses written during one event loop iteration reach the FIFO with a
+// single write call at the end of the iteration
+static int test_batching(void) {
+	int index = 0;
+	int read_calls = 0;
+	int i;
+	bool ok = true;
+
+	for (i = 0; i < 10; ++i) {
+		ok = ok && write_response(i) == 80;
+	}
+
+	// nothing is written before the end of the iteration
+	ok = ok && drain_fifo(&index, &read_calls) == 0 && index == 0;
+
+	red_usb_gadget_flush();
+
+	ok = ok && drain_fifo(&index, &read_calls) == 0 && index == 10 && read_calls == 1;
+
+	return harness_check("batching", ok);
+}
+
+// a full FIFO pauses reading requests, draining it and flushing from the
+// flush timer resumes reading, nothing is lost on the way
+static int test_congestion(void) {
+	int written = 0;
+	int index = 0;
+	int read_calls = 0;
+	bool ok;
+
+	_pause_count = 0;
+	_resume_count = 0;
+
+	while (written < 100000 && write_response(written) == 80) {
+		++written;
+	}
+
+	ok = written < 100000 && errno_would_block() && _data->congested && _pause_count == 1;
+
+	// the writer would put the rejected response into its backlog and retry it
+	while (ok && drain_fifo(&index, &read_calls) == 0) {
+		red_usb_gadget_handle_flush(NULL);
+
+		if (!_data->congested) {
+			break;
+		}
+	}
+
+	ok = ok && write_response(written++) == 80;
+
+	red_usb_gadget_flush();
+
+	ok = ok && drain_fifo(&index, &read_calls) == 0 && index == written;
+	ok = ok && !_data->congested && _resume_count == 1;
+
+	if (ok) {
+		printf("congestion: paused after %d responses\n", written - 1);
+	}
+
+	return harness_check("congestion", ok);
+}
+
+// connections that break right away consume reconnect tries, only a stable
+// connection resets them
+static int test_reconnect_tries(void) {
+	const char *data_filename = _data_filename;
+	bool ok;
+
+	_reconnect_tries = 5;
+	_connect_time = microseconds();
+
+	red_usb_gadget_client_destroy_done();
+
+	ok = _reconnect_tries == 6;
+
+	_connect_time = microseconds() - RECONNECT_STABLE_PERIOD;
+
+	red_usb_gadget_client_destroy_done();
+
+	ok = ok && _reconnect_tries == 1;
+
+	// reconnecting fails while the device file is missing
+	_data_filename = "/nonexistent/g_red_brick_data";
+
+	while (ok && _reconnect_tries > 0 && _reconnect_tries < RECONNECT_MAX_TRIES) {
+		red_usb_gadget_handle_reconnect(NULL);
+	}
+
+	ok = ok && _reconnect_tries == RECONNECT_MAX_TRIES;
+
+	// giving up resets the tries
+	red_usb_gadget_handle_reconnect(NULL);
+
+	ok = ok && _reconnect_tries == 0 && _client == NULL;
+
+	_data_filename = data_filename;
+
+	return harness_check("reconnect tries", ok);
+}
+
+int main(void) {
+	char filename[] = "/tmp/red_usb_gadget_test_XXXXXX";
+	char fifo_filename[sizeof(filename) + 16];
+	REDUSBGadgetData *data;
+	int rc = 0;
+
+	log_init();
+
+	if (mkdtemp(filename) == NULL) {
+		printf("mkdtemp error: %s\n", get_errno_name(errno));
+
+		return EXIT_FAILURE;
+	}
+
+	snprintf(fifo_filename, sizeof(fifo_filename), "%s/data", filename);
+
+	if (mkfifo(fifo_filename, 0600) < 0) {
+		printf("mkfifo error: %s\n", get_errno_name(errno));
+
+		return EXIT_FAILURE;
+	}
+
+	_fifo = open(fifo_filename, O_RDONLY | O_NONBLOCK);
+
+	if (_fifo < 0) {
+		printf("open error: %s\n", get_errno_name(errno));
+
+		return EXIT_FAILURE;
+	}
+
+	_data_filename = fifo_filename;
+
+	if (event_init() < 0 ||
+	    timer_create_(&_flush_timer, red_usb_gadget_handle_flush, NULL) < 0 ||
+	    timer_create_(&_reconnect_timer, red_usb_gadget_handle_reconnect, NULL) < 0 ||
+	    red_usb_gadget_create_client() < 0) {
+		printf("setup error\n");
+
+		return EXIT_FAILURE;
+	}
+
+	rc |= test_batching();
+	rc |= test_congestion();
+
+	data = _data;
+
+	red_usb_gadget_data_destroy(data);
+	free(data);
+
+	_client = NULL;
+
+	rc |= test_reconnect_tries();
+
+	timer_destroy(&_reconnect_timer);
+	timer_destroy(&_flush_timer);
+	event_exit();
+	log_exit();
+
+	close(_fifo);
+	unlink(fifo_filename);
+	rmdir(filename);
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,339 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * redapid_parser_test.c: Tests for the redapid response parser
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// the production redapid.c is included here, so the real redapid_handle_read
+// is tested. the socket to redapid is replaced by one end of a socketpair.
+// the brickd functions that redapid.c calls are replaced by the stubs below,
+// network_dispatch_response records the dispatched responses. a fake redapid
+// writes a stream of responses with mixed lengths into the other end of the
+// socketpair, in bursts that are split at arbitrary byte offsets
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../brickd/redapid.c"
+
+#include "test_harness.h"
+
+#define PACKET_COUNT 200000
+#define MAX_RESPONSE_LENGTH 80 // header, payload and optional data
+
+static int _dispatched_count = 0;
+static int _dispatched_mismatches = 0;
+static int _expected_index = 0;
+
+static int get_length(int index) {
+	return (int)sizeof(PacketHeader) + (index * 7) % (MAX_RESPONSE_LENGTH - (int)sizeof(PacketHeader) + 1);
+}
+
+static void fill_response(Packet *response, int index) {
+	int i;
+
+	memset(response, 0, sizeof(*response));
+
+	response->header.uid = uint32_to_le(1000 + index % 7);
+	response->header.length = (uint8_t)get_length(index);
+	response->header.function_id = (uint8_t)(1 + index % 200);
+
+	packet_header_set_sequence_number(&response->header, 1 + index % 15);
+
+	for (i = 0; i < response->header.length - (int)sizeof(PacketHeader); ++i) {
+		((uint8_t *)response)[sizeof(PacketHeader) + i] = (uint8_t)(index + i);
+	}
+}
+
+// stubs for the brickd functions called by redapid.c
+
+int stack_create(Stack *stack, const char *name,
+                 StackDispatchRequestFunction dispatch_request) {
+	(void)stack;
+	(void)name;
+	(void)dispatch_request;
+
+	return 0;
+}
+
+void stack_destroy(Stack *stack) {
+	(void)stack;
+}
+
+int stack_add_recipient(Stack *stack, uint32_t uid, uint64_t opaque) {
+	(void)stack;
+	(void)uid;
+	(void)opaque;
+
+	return 0;
+}
+
+int hardware_add_stack(Stack *stack) {
+	(void)stack;
+
+	return 0;
+}
+
+int hardware_remove_stack(Stack *stack) {
+	(void)stack;
+
+	return 0;
+}
+
+uint32_t red_usb_gadget_get_uid(void) {
+	return 0;
+}
+
+void network_dispatch_response(Packet *response) {
+	Packet expected;
+
+	fill_response(&expected, _expected_index++);
+
+	if (response->header.length != expected.header.length ||
+	    memcmp(response, &expected, expected.header.length) != 0) {
+		++_dispatched_mismatches;
+	}
+
+	++_dispatched_count;
+}
+
+// test helpers
+
+static HarnessStream _fake_redapid;
+
+static bool is_disconnected(void *opaque) {
+	(void)opaque;
+
+	return !_connected;
+}
+
+static int connect_fake_redapid(void) {
+	int sockets[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+		printf("socketpair error: %s\n", get_errno_name(errno));
+
+		return -1;
+	}
+
+	// same state as after a successful redapid_handle_reconnect
+	if (socket_create(&_redapid.socket) < 0) {
+		printf("socket_create error\n");
+
+		return -1;
+	}
+
+	_redapid.socket.handle = sockets[0];
+	_redapid.socket.base.read_handle = sockets[0];
+	_redapid.socket.base.write_handle = sockets[0];
+	_redapid.response_buffer_start = 0;
+	_redapid.response_buffer_used = 0;
+	_redapid.response_header_checked = false;
+
+	if (event_add_source(_redapid.socket.handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     "redapid", EVENT_READ, redapid_handle_read, NULL) < 0) {
+		printf("event_add_source error\n");
+
+		return -1;
+	}
+
+	if (writer_create(&_redapid.request_writer, &_redapid.socket.base,
+	                  "request", packet_get_request_signature,
+	                  "redapid", redapid_get_recipient_signature,
+	                  redapid_recipient_disconnect, NULL) < 0) {
+		printf("writer_create error\n");
+
+		return -1;
+	}
+
+	_fake_redapid.fd = sockets[1];
+	_connected = true;
+	_dispatched_count = 0;
+	_dispatched_mismatches = 0;
+	_expected_index = 0;
+
+	return 0;
+}
+
+static void disconnect_fake_redapid(void) {
+	if (_connected) {
+		redapid_disconnect(false);
+	}
+
+	close(_fake_redapid.fd);
+}
+
+static int create_stream(uint8_t **stream, int count) {
+	int length = 0;
+	int i;
+	Packet response;
+
+	*stream = malloc((size_t)(count + 1) * sizeof(Packet)); // room for one more
+
+	if (*stream == NULL) {
+		printf("malloc error\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		fill_response(&response, i);
+		memcpy(*stream + length, &response, response.header.length);
+
+		length += response.header.length;
+	}
+
+	return length;
+}
+
+// every possible split position of a packet has to be handled, including
+// splits inside the header
+static int test_split_at_every_offset(void) {
+	uint8_t *stream;
+	int count = 64;
+	int length = create_stream(&stream, count);
+	int chunk_length;
+	int rc = 0;
+
+	if (length < 0) {
+		return -1;
+	}
+
+	for (chunk_length = 1; rc == 0 && chunk_length <= MAX_RESPONSE_LENGTH + 1; ++chunk_length) {
+		if (connect_fake_redapid() < 0 || harness_feed(&_fake_redapid, stream, length, chunk_length) < 0) {
+			rc = -1;
+		} else if (_dispatched_count != count || _dispatched_mismatches != 0 || !_connected) {
+			printf("chunk length %d: got %d of %d responses, %d mismatches\n",
+			       chunk_length, _dispatched_count, count, _dispatched_mismatches);
+
+			rc = -1;
+		}
+
+		disconnect_fake_redapid();
+	}
+
+	free(stream);
+
+	return harness_check("split at every offset", rc == 0);
+}
+
+// a burst that is larger than the response buffer is received with several
+// reads, all packets in it have to be dispatched in order
+static int test_large_burst(void) {
+	uint8_t *stream;
+	int count = RESPONSE_BUFFER_SIZE / 8;
+	int length = create_stream(&stream, count);
+	bool ok;
+
+	if (length < 0 || connect_fake_redapid() < 0) {
+		return -1;
+	}
+
+	ok = harness_feed(&_fake_redapid, stream, length, RESPONSE_BUFFER_SIZE * 2) == 0;
+
+	// the socketpair might still hold data that did not fit the buffer
+	while (ok && _connected && _dispatched_count < count) {
+		redapid_handle_read(NULL);
+	}
+
+	ok = ok && _connected && _dispatched_count == count && _dispatched_mismatches == 0;
+
+	disconnect_fake_redapid();
+	free(stream);
+
+	return harness_check("burst larger than response buffer", ok);
+}
+
+// a header with an invalid length has to disconnect redapid without
+// dispatching anything, otherwise the parser would read beyond the packet
+static int test_invalid_length(uint8_t length, const char *name) {
+	uint8_t *stream;
+	int stream_length = create_stream(&stream, 3);
+	Packet invalid;
+	bool ok;
+
+	if (stream_length < 0 || connect_fake_redapid() < 0) {
+		return -1;
+	}
+
+	fill_response(&invalid, 3);
+	invalid.header.length = length;
+	memcpy(stream + stream_length, &invalid, sizeof(PacketHeader));
+
+	ok = harness_feed(&_fake_redapid, stream, stream_length + (int)sizeof(PacketHeader), 5) == 0;
+	ok = ok && !_connected && _dispatched_count == 3 && _dispatched_mismatches == 0;
+
+	disconnect_fake_redapid();
+	free(stream);
+
+	return harness_check(name, ok);
+}
+
+static int test_throughput(void) {
+	uint8_t *stream;
+	int length = create_stream(&stream, PACKET_COUNT);
+	bool ok;
+
+	if (length < 0 || connect_fake_redapid() < 0) {
+		return -1;
+	}
+
+	ok = harness_measure_throughput(&_fake_redapid, stream, length, 4096,
+	                                &_dispatched_count, PACKET_COUNT);
+	ok = ok && _dispatched_mismatches == 0;
+
+	disconnect_fake_redapid();
+	free(stream);
+
+	return harness_check("throughput", ok);
+}
+
+int main(void) {
+	int rc = 0;
+
+	log_init();
+
+	if (event_init() < 0) {
+		printf("event_init error\n");
+
+		return EXIT_FAILURE;
+	}
+
+	if (timer_create_(&_reconnect_timer, redapid_handle_reconnect, NULL) < 0) {
+		printf("timer_create_ error\n");
+
+		return EXIT_FAILURE;
+	}
+
+	_fake_redapid.handle_read = redapid_handle_read;
+	_fake_redapid.is_disconnected = is_disconnected;
+
+	rc |= test_split_at_every_offset();
+	rc |= test_large_burst();
+	rc |= test_invalid_length(sizeof(PacketHeader) - 1, "length too small");
+	rc |= test_invalid_length(MAX_RESPONSE_LENGTH + 1, "length too big");
+	rc |= test_throughput();
+
+	timer_destroy(&_reconnect_timer);
+	event_exit();
+	log_exit();
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,158 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+"""
+brickd rules latency benchmark
+
+Compares the callback to request latency of a rule with the round trip
+through a TCP client. usb_gadget_brick.py sends a stream of callbacks and
+measures the time until a request with the reaction function ID arrives
+after each callback. It reports that latency back in a callback that this
+script collects.
+
+In client mode this script reacts itself: it sends the reaction request as
+soon as it receives a callback, without response expected, just like a rule
+does. brickd has to run without rules in this mode:
+
+  sudo ./usb_gadget_brick.py --uid 6wwv71 --callback-rate 100 --reaction-function-id 200 &
+  ../brickd/brickd --debug &
+  ./rules_latency_benchmark.py --uid 6wwv71 --mode client
+
+In rule mode brickd reacts and this script only collects the latencies. The
+rules.file option has to point to a file with this rule:
+
+  rule0.name = latency
+  rule0.match.uid = 6wwv71
+  rule0.match.function_id = 240
+  rule0.match.type = uint32
+  rule0.match.offset = 0
+  rule0.match.condition = >=
+  rule0.match.value = 0
+  rule0.action.uid = 6wwv71
+  rule0.action.function_id = 200
+  rule0.action.payload = 01 00
+
+  ./rules_latency_benchmark.py --uid 6wwv71 --mode rule
+
+The gadget attributes a reaction to the last callback it sent. The callback
+interval has to be well above the reaction latency, otherwise a reaction is
+measured against a newer callback. The default rate of 100 callbacks per
+second leaves 10 ms. For a client on another host add --host and run brickd
+with the corresponding listen.address option.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+BASE58 = '123456789abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ'
+
+CALLBACK_FLOOD = 240
+CALLBACK_REACTION = 241
+
+def base58_decode(encoded):
+    value = 0
+
+    for c in encoded:
+        value = value * 58 + BASE58.index(c)
+
+    return value
+
+def create_packet(uid, function_id, sequence_number, response_expected, payload):
+    options = (sequence_number << 4) | (8 if response_expected else 0)
+
+    return struct.pack('<IBBBB', uid, 8 + len(payload), function_id, options, 0) + payload
+
+def get_percentile(values, percentile):
+    return values[min(int(percentile / 100.0 * len(values)), len(values) - 1)]
+
+class Benchmark:
+    def __init__(self, args):
+        self.args = args
+        self.uid = base58_decode(args.uid)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.connect((args.host, args.port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.sock.settimeout(0.1)
+        # the same request as the action of the rule
+        self.reaction = create_packet(self.uid, args.reaction_function_id, 1, False,
+                                      bytes(bytearray([1, 0])))
+        self.latencies = []
+        self.callbacks = 0
+
+    def handle_packet(self, packet):
+        uid, length, function_id, options, flags = struct.unpack('<IBBBB', packet[:8])
+
+        if uid != self.uid or options >> 4 != 0:
+            return
+
+        if function_id == CALLBACK_FLOOD:
+            self.callbacks += 1
+
+            if self.args.mode == 'client':
+                self.sock.sendall(self.reaction)
+        elif function_id == CALLBACK_REACTION and length >= 16:
+            counter, latency = struct.unpack('<II', packet[8:16])
+
+            self.latencies.append(latency / 1000.0)
+
+    def run(self):
+        buffer = b''
+        end = time.time() + self.args.duration
+
+        while time.time() < end:
+            try:
+                data = self.sock.recv(4096)
+            except socket.timeout:
+                continue
+
+            if len(data) == 0:
+                print('brickd closed the connection')
+                break
+
+            buffer += data
+
+            while len(buffer) >= 8:
+                length = buffer[4]
+
+                if len(buffer) < length:
+                    break
+
+                self.handle_packet(buffer[:length])
+
+                buffer = buffer[length:]
+
+        self.sock.close()
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare the callback to request latency of a rule with a TCP client')
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=4223)
+    parser.add_argument('--uid', required=True)
+    parser.add_argument('--mode', choices=['client', 'rule'], required=True,
+                        help='client: this script reacts on the callbacks, rule: a brickd rule reacts')
+    parser.add_argument('--duration', type=float, default=10, help='seconds')
+    parser.add_argument('--reaction-function-id', type=int, default=200,
+                        help='function ID of the reaction request, has to match the gadget and the rule')
+    args = parser.parse_args()
+
+    benchmark = Benchmark(args)
+    benchmark.run()
+    latencies = sorted(benchmark.latencies)
+
+    print('mode: {0}, callbacks: {1} received ({2:.0f}/s), reactions: {3} measured'
+          .format(args.mode, benchmark.callbacks, benchmark.callbacks / args.duration, len(latencies)))
+
+    if len(latencies) == 0:
+        return 1
+
+    print('callback to request latency: min {0:.3f} ms, p50 {1:.3f} ms, p90 {2:.3f} ms, p99 {3:.3f} ms, max {4:.3f} ms'
+          .format(latencies[0], get_percentile(latencies, 50), get_percentile(latencies, 90),
+                  get_percentile(latencies, 99), latencies[-1]))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
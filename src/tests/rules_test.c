@@ -0,0 +1,369 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * rules_test.c: Tests for the rules parser and matcher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// the production rules.c is included here. the rules.file option and
+// hardware_dispatch_request are replaced by the stubs below. the parse tests
+// write a rules file that differs from a valid rule in one option and check
+// that rules_init accepts or rejects it. the match tests check each value type
+// and condition against callbacks, including too short callbacks, and that
+// min_interval suppresses actions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../brickd/rules.c"
+
+#include "test_harness.h"
+
+#define MATCH_UID "XYZ"
+#define ACTION_UID "ABC"
+
+static char _rules_filename[] = "/tmp/rules_test_XXXXXX";
+static Packet _last_request;
+static int _request_count = 0;
+
+// stubs for the brickd functions called by rules.c
+
+ConfigOptionValue *config_get_option_value(const char *name) {
+	static ConfigOptionValue value;
+
+	(void)name;
+
+	value.string = _rules_filename;
+
+	return &value;
+}
+
+void hardware_dispatch_request(Packet *request) {
+	memcpy(&_last_request, request, sizeof(Packet));
+
+	++_request_count;
+}
+
+// test helpers
+
+// a valid rule, each parse case replaces or removes one of its options
+static const char *_valid_rule[][2] = {
+	{ "name",               "overheat" },
+	{ "match.uid",          MATCH_UID },
+	{ "match.function_id",  "8" },
+	{ "match.type",         "int16" },
+	{ "match.offset",       "2" },
+	{ "match.condition",    ">" },
+	{ "match.value",        "-3000" },
+	{ "action.uid",         ACTION_UID },
+	{ "action.function_id", "1" },
+	{ "action.payload",     "01 00 ff" },
+	{ "min_interval",       "1000" }
+};
+
+typedef struct {
+	const char *name;
+	const char *option; // NULL for the valid rule as is
+	const char *value; // NULL to remove the option
+	int rule_count; // -1 if rules_init has to fail
+} ParseCase;
+
+static const ParseCase _parse_cases[] = {
+	{ "valid rule",                     NULL,                 NULL,            1 },
+	{ "without name",                   "name",               NULL,            1 },
+	{ "without match.uid",              "match.uid",          NULL,            0 },
+	{ "invalid match.uid",              "match.uid",          "0OIl",          -1 },
+	{ "without match.function_id",      "match.function_id",  NULL,            -1 },
+	{ "match.function_id 0",            "match.function_id",  "0",             -1 },
+	{ "match.function_id 256",          "match.function_id",  "256",           -1 },
+	{ "match.function_id in hex",       "match.function_id",  "0x08",          1 },
+	{ "match.function_id with suffix",  "match.function_id",  "8x",            -1 },
+	{ "empty match.function_id",        "match.function_id",  "",              -1 },
+	{ "without match.type",             "match.type",         NULL,            -1 },
+	{ "unknown match.type",             "match.type",         "float",         -1 },
+	{ "without match.offset",           "match.offset",       NULL,            1 },
+	{ "negative match.offset",          "match.offset",       "-1",            -1 },
+	{ "last match.offset",              "match.offset",       "62",            1 },
+	{ "match.offset beyond payload",    "match.offset",       "63",            -1 },
+	{ "without match.condition",        "match.condition",    NULL,            -1 },
+	{ "unknown match.condition",        "match.condition",    "=>",            -1 },
+	{ "without match.value",            "match.value",        NULL,            -1 },
+	{ "match.value uint32 max",         "match.value",        "4294967295",    1 },
+	{ "match.value int32 min",          "match.value",        "-2147483648",   1 },
+	{ "match.value too big",            "match.value",        "4294967296",    -1 },
+	{ "match.value too small",          "match.value",        "-2147483649",   -1 },
+	{ "match.value not a number",       "match.value",        "hot",           -1 },
+	{ "without action.uid",             "action.uid",         NULL,            -1 },
+	{ "invalid action.uid",             "action.uid",         "A-C",           -1 },
+	{ "without action.function_id",     "action.function_id", NULL,            -1 },
+	{ "action.function_id 0",           "action.function_id", "0",             -1 },
+	{ "without action.payload",         "action.payload",     NULL,            1 },
+	{ "action.payload with tabs",       "action.payload",     "01\t00\tff",    1 },
+	{ "action.payload byte too big",    "action.payload",     "01 100",        -1 },
+	{ "action.payload not hex",         "action.payload",     "01 zz",         -1 },
+	{ "action.payload with commas",     "action.payload",     "01,00",         -1 },
+	{ "action.payload too long",        "action.payload",     "00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 "
+	                                                          "00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 "
+	                                                          "00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 "
+	                                                          "00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00", -1 },
+	{ "without min_interval",           "min_interval",       NULL,            1 },
+	{ "negative min_interval",          "min_interval",       "-5",            -1 }
+};
+
+static int write_rules_file(const ParseCase *parse_case) {
+	FILE *fp = fopen(_rules_filename, "w");
+	int i;
+	const char *value;
+
+	if (fp == NULL) {
+		printf("could not write rules file: %s\n", strerror(errno));
+
+		return -1;
+	}
+
+	for (i = 0; i < (int)(sizeof(_valid_rule) / sizeof(_valid_rule[0])); ++i) {
+		value = _valid_rule[i][1];
+
+		if (parse_case->option != NULL && strcmp(parse_case->option, _valid_rule[i][0]) == 0) {
+			value = parse_case->value;
+		}
+
+		if (value != NULL) {
+			fprintf(fp, "rule0.%s = %s\n", _valid_rule[i][0], value);
+		}
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static int test_parse(void) {
+	const ParseCase *parse_case;
+	int rc = 0;
+	int i;
+	bool ok;
+
+	for (i = 0; i < (int)(sizeof(_parse_cases) / sizeof(_parse_cases[0])); ++i) {
+		parse_case = &_parse_cases[i];
+
+		if (write_rules_file(parse_case) < 0) {
+			return -1;
+		}
+
+		if (parse_case->rule_count < 0) {
+			ok = rules_init() < 0 && _rule_count == 0;
+		} else {
+			ok = rules_init() == 0 && _rule_count == parse_case->rule_count;
+		}
+
+		rules_exit();
+
+		rc |= harness_check(parse_case->name, ok);
+	}
+
+	return rc;
+}
+
+// the fields of the valid rule
+static int test_parse_fields(void) {
+	uint32_t uid;
+	Rule *rule = &_rules[0];
+	bool ok;
+
+	if (write_rules_file(&_parse_cases[0]) < 0) {
+		return -1;
+	}
+
+	ok = rules_init() == 0 && _rule_count == 1;
+	ok = ok && strcmp(rule->name, "overheat") == 0;
+	ok = ok && base58_decode(&uid, MATCH_UID) == 0 && rule->uid == uint32_to_le(uid);
+	ok = ok && rule->function_id == 8;
+	ok = ok && rule->value_type == RULE_VALUE_TYPE_INT16;
+	ok = ok && rule->offset == 2;
+	ok = ok && rule->condition == RULE_CONDITION_GREATER;
+	ok = ok && rule->value == -3000;
+	ok = ok && base58_decode(&uid, ACTION_UID) == 0 && rule->action.header.uid == uint32_to_le(uid);
+	ok = ok && rule->action.header.function_id == 1;
+	ok = ok && rule->action.header.length == sizeof(PacketHeader) + 3;
+	ok = ok && memcmp(rule->action.payload, "\x01\x00\xff", 3) == 0;
+	ok = ok && packet_header_get_sequence_number(&rule->action.header) != 0;
+	ok = ok && !packet_header_get_response_expected(&rule->action.header);
+	ok = ok && rule->min_interval == 1000000;
+
+	rules_exit();
+
+	return harness_check("valid rule fields", ok);
+}
+
+typedef struct {
+	const char *name;
+	RuleValueType value_type;
+	RuleCondition condition;
+	int64_t value;
+	int offset;
+	uint8_t data[4]; // little endian, at the offset
+	int payload_length;
+	bool matching;
+} MatchCase;
+
+static const MatchCase _match_cases[] = {
+	{ "uint8 less",                  RULE_VALUE_TYPE_UINT8,  RULE_CONDITION_LESS,          200,         0, { 199 },                  1,  true },
+	{ "uint8 not less",              RULE_VALUE_TYPE_UINT8,  RULE_CONDITION_LESS,          200,         0, { 200 },                  1,  false },
+	{ "int8 negative",               RULE_VALUE_TYPE_INT8,   RULE_CONDITION_LESS_EQUAL,    -1,          0, { 0xff },                 1,  true },
+	{ "int8 not below -1",           RULE_VALUE_TYPE_INT8,   RULE_CONDITION_LESS_EQUAL,    -2,          0, { 0xff },                 1,  false },
+	{ "uint16 equal",                RULE_VALUE_TYPE_UINT16, RULE_CONDITION_EQUAL,         0x1234,      1, { 0x34, 0x12 },           3,  true },
+	{ "uint16 not equal",            RULE_VALUE_TYPE_UINT16, RULE_CONDITION_NOT_EQUAL,     0x1234,      1, { 0x12, 0x34 },           3,  true },
+	{ "int16 negative greater",      RULE_VALUE_TYPE_INT16,  RULE_CONDITION_GREATER,       -3000,       2, { 0x49, 0xf4 },           4,  true }, // -2999
+	{ "int16 negative not greater",  RULE_VALUE_TYPE_INT16,  RULE_CONDITION_GREATER,       -3000,       2, { 0x48, 0xf4 },           4,  false }, // -3000
+	{ "uint32 max",                  RULE_VALUE_TYPE_UINT32, RULE_CONDITION_GREATER_EQUAL, 4294967295LL, 0, { 0xff, 0xff, 0xff, 0xff }, 4, true },
+	{ "uint32 not sign extended",    RULE_VALUE_TYPE_UINT32, RULE_CONDITION_LESS,          0,           0, { 0xff, 0xff, 0xff, 0xff }, 4, false },
+	{ "int32 min",                   RULE_VALUE_TYPE_INT32,  RULE_CONDITION_EQUAL,         INT32_MIN,   0, { 0x00, 0x00, 0x00, 0x80 }, 4, true },
+	{ "value at last offset",        RULE_VALUE_TYPE_UINT16, RULE_CONDITION_EQUAL,         1,           62, { 0x01, 0x00 },          64, true },
+	{ "callback too short",          RULE_VALUE_TYPE_UINT16, RULE_CONDITION_EQUAL,         0x0034,      1, { 0x34, 0x00 },           2,  false },
+	{ "empty callback",              RULE_VALUE_TYPE_UINT8,  RULE_CONDITION_EQUAL,         0,           0, { 0 },                    0,  false }
+};
+
+static void create_rule(Rule *rule, RuleValueType value_type, RuleCondition condition,
+                        int64_t value, int offset, uint64_t min_interval) {
+	memset(rule, 0, sizeof(Rule));
+
+	snprintf(rule->name, sizeof(rule->name), "test");
+
+	rule->uid = uint32_to_le(1000);
+	rule->function_id = 8;
+	rule->value_type = value_type;
+	rule->offset = offset;
+	rule->condition = condition;
+	rule->value = value;
+	rule->action.header.uid = uint32_to_le(2000);
+	rule->action.header.length = sizeof(PacketHeader);
+	rule->action.header.function_id = 1;
+	rule->min_interval = min_interval;
+}
+
+static void create_callback(Packet *callback, uint32_t uid, uint8_t function_id,
+                            int offset, const uint8_t *data, int payload_length) {
+	memset(callback, 0, sizeof(Packet));
+
+	callback->header.uid = uint32_to_le(uid);
+	callback->header.length = sizeof(PacketHeader) + payload_length;
+	callback->header.function_id = function_id;
+
+	memcpy(callback->payload + offset, data, MIN(4, (int)sizeof(callback->payload) - offset));
+}
+
+static int test_match(void) {
+	const MatchCase *match_case;
+	Rule rule;
+	Packet callback;
+	int rc = 0;
+	int i;
+
+	for (i = 0; i < (int)(sizeof(_match_cases) / sizeof(_match_cases[0])); ++i) {
+		match_case = &_match_cases[i];
+
+		create_rule(&rule, match_case->value_type, match_case->condition,
+		            match_case->value, match_case->offset, 0);
+		create_callback(&callback, 1000, 8, match_case->offset,
+		                match_case->data, match_case->payload_length);
+
+		rc |= harness_check(match_case->name, rules_is_matching(&rule, &callback) == match_case->matching);
+	}
+
+	return rc;
+}
+
+// a callback of another device or with another function ID doesn't match,
+// even if the value does
+static int test_match_uid_and_function_id(void) {
+	static const uint8_t data[4] = { 1 };
+	Rule rule;
+	Packet callback;
+	bool ok;
+
+	create_rule(&rule, RULE_VALUE_TYPE_UINT8, RULE_CONDITION_EQUAL, 1, 0, 0);
+
+	create_callback(&callback, 1000, 8, 0, data, 1);
+	ok = rules_is_matching(&rule, &callback);
+
+	create_callback(&callback, 1001, 8, 0, data, 1);
+	ok = ok && !rules_is_matching(&rule, &callback);
+
+	create_callback(&callback, 1000, 9, 0, data, 1);
+	ok = ok && !rules_is_matching(&rule, &callback);
+
+	return harness_check("match uid and function id", ok);
+}
+
+// the first match triggers, the matches within min_interval are suppressed
+static int test_min_interval(void) {
+	static const uint8_t data[4] = { 1 };
+	Packet callback;
+	bool ok;
+
+	_rule_count = 2;
+	_request_count = 0;
+
+	create_rule(&_rules[0], RULE_VALUE_TYPE_UINT8, RULE_CONDITION_EQUAL, 1, 0, 3600000000ULL);
+	create_rule(&_rules[1], RULE_VALUE_TYPE_UINT8, RULE_CONDITION_EQUAL, 1, 0, 0);
+
+	create_callback(&callback, 1000, 8, 0, data, 1);
+
+	rules_handle_callback(&callback);
+	ok = _request_count == 2 && uint32_from_le(_last_request.header.uid) == 2000;
+
+	rules_handle_callback(&callback);
+	rules_handle_callback(&callback);
+	ok = ok && _request_count == 4;
+
+	ok = ok && _rules[0].triggered == 1 && _rules[0].suppressed == 2;
+	ok = ok && _rules[1].triggered == 3 && _rules[1].suppressed == 0;
+
+	rules_exit();
+
+	return harness_check("min_interval", ok);
+}
+
+int main(void) {
+	int fd;
+	int rc = 0;
+
+	log_init();
+
+	fd = mkstemp(_rules_filename);
+
+	if (fd < 0) {
+		printf("could not create rules file: %s\n", strerror(errno));
+
+		return EXIT_FAILURE;
+	}
+
+	close(fd);
+
+	rc |= test_parse();
+	rc |= test_parse_fields();
+	rc |= test_match();
+	rc |= test_match_uid_and_function_id();
+	rc |= test_min_interval();
+
+	unlink(_rules_filename);
+	log_exit();
+
+	return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
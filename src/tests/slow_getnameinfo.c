@@ -0,0 +1,57 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * slow_getnameinfo.c: LD_PRELOAD shim that makes host name lookups slow
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// simulates a slow name service for accept_latency_benchmark.py. every
+// getnameinfo call that is not limited to the numeric host is delayed by
+// SLOW_GETNAMEINFO_DELAY milliseconds before the real getnameinfo is called
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef int (*GetNameInfoFunction)(const struct sockaddr *address, socklen_t address_length,
+                                   char *host, socklen_t host_length,
+                                   char *service, socklen_t service_length, int flags);
+
+int getnameinfo(const struct sockaddr *address, socklen_t address_length,
+                char *host, socklen_t host_length,
+                char *service, socklen_t service_length, int flags) {
+	static GetNameInfoFunction real_getnameinfo = NULL;
+	const char *delay = getenv("SLOW_GETNAMEINFO_DELAY");
+
+	if (real_getnameinfo == NULL) {
+		real_getnameinfo = (GetNameInfoFunction)dlsym(RTLD_NEXT, "getnameinfo");
+
+		if (real_getnameinfo == NULL) {
+			return EAI_FAIL;
+		}
+	}
+
+	if (host != NULL && (flags & NI_NUMERICHOST) == 0 && delay != NULL) {
+		usleep(atoi(delay) * 1000);
+	}
+
+	return real_getnameinfo(address, address_length, host, host_length,
+	                        service, service_length, flags);
+}
@@ -0,0 +1,330 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+"""
+brickd soak test
+
+Runs brickd for a long time while randomly connecting and disconnecting
+clients, leaving requests pending so clients turn into zombies, connecting
+and dropping mesh stacks and triggering USB rescans. Periodically samples the
+RSS and the open file descriptor count of the brickd process and the internal
+object counts that brickd logs on SIGUSR2.
+
+After the load phase all connections are closed. The test fails if brickd
+does not get back to zero clients, zombies and pending requests, or if RSS or
+file descriptor count keep growing over the second half of the run.
+
+Linux only, needs /proc.
+
+Example:
+
+  ./soak_test.py --brickd ../brickd/brickd --duration 14400
+"""
+
+import argparse
+import os
+import random
+import re
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+STATISTICS_PATTERNS = [
+    re.compile(r'Network statistics \(clients: (?P<clients>\d+), zombies: (?P<zombies>\d+), pending requests: (?P<pending_requests>\d+)\)'),
+    re.compile(r'Hardware statistics \(stacks: (?P<stacks>\d+), recipients: (?P<recipients>\d+)\)'),
+]
+
+FUNCTION_ENUMERATE = 254
+FUNCTION_GET_IDENTITY = 255
+
+MESH_PACKET_TYPE_HELLO = 1
+MESH_PACKET_TYPE_HEART_BEAT_PING = 4
+MESH_PACKET_FLAGS_UPWARD_BINARY = (1 << 8) | (4 << 10)
+
+def create_tfp_request(uid, function_id, sequence_number, response_expected):
+    flags = (sequence_number << 4) | (8 if response_expected else 0)
+
+    return struct.pack('<IBBBB', uid, 8, function_id, flags, 0)
+
+def create_mesh_packet(packet_type, src_addr, payload=b''):
+    length = 17 + len(payload)
+
+    return struct.pack('<HH6s6sB', MESH_PACKET_FLAGS_UPWARD_BINARY, length,
+                       b'\x00' * 6, src_addr, packet_type) + payload
+
+def create_mesh_hello(src_addr):
+    payload = struct.pack('<B6s16s3s', 1, bytes(random.randrange(256) for _ in range(6)),
+                          b'soak', bytes([2, 0, 0]))
+
+    return create_mesh_packet(MESH_PACKET_TYPE_HELLO, src_addr, payload)
+
+class Brickd:
+    def __init__(self, path, plain_port, mesh_port, directory):
+        self.statistics = {}
+        self.statistics_lock = threading.Lock()
+        self.statistics_updated = threading.Event()
+
+        config_filename = os.path.join(directory, 'brickd.conf')
+        pid_filename = os.path.join(directory, 'brickd.pid')
+
+        with open(config_filename, 'w') as f:
+            f.write('listen.address = 127.0.0.1\n')
+            f.write('listen.plain_port = {0}\n'.format(plain_port))
+            f.write('listen.websocket_port = 0\n')
+            f.write('listen.mesh_gateway_port = {0}\n'.format(mesh_port))
+            f.write('log.level = info\n')
+
+        self.process = subprocess.Popen([path, '--config-file', config_filename, '--pid-file', pid_filename],
+                                        stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                                        universal_newlines=True)
+
+        self.reader = threading.Thread(target=self.read_log, daemon=True)
+        self.reader.start()
+
+    def read_log(self):
+        for line in self.process.stderr:
+            for pattern in STATISTICS_PATTERNS:
+                m = pattern.search(line)
+
+                if m != None:
+                    with self.statistics_lock:
+                        for key, value in m.groupdict().items():
+                            self.statistics[key] = int(value)
+
+                    if 'stacks' in m.groupdict():
+                        self.statistics_updated.set()
+
+            if ' <E> ' in line or ' <W> ' in line:
+                sys.stdout.write('brickd: ' + line)
+
+    def sample(self):
+        pid = self.process.pid
+        rss = 0
+
+        with open('/proc/{0}/status'.format(pid)) as f:
+            for line in f:
+                if line.startswith('VmRSS:'):
+                    rss = int(line.split()[1])
+
+        fds = len(os.listdir('/proc/{0}/fd'.format(pid)))
+
+        # SIGUSR1 makes brickd rescan USB devices, SIGUSR2 makes it log its
+        # statistics
+        os.kill(pid, signal.SIGUSR1)
+
+        self.statistics_updated.clear()
+        os.kill(pid, signal.SIGUSR2)
+
+        if not self.statistics_updated.wait(10):
+            raise Exception('brickd did not log statistics after SIGUSR2')
+
+        with self.statistics_lock:
+            sample = dict(self.statistics)
+
+        sample['rss'] = rss
+        sample['fds'] = fds
+
+        return sample
+
+    def stop(self):
+        self.process.terminate()
+
+        try:
+            self.process.wait(10)
+        except subprocess.TimeoutExpired:
+            self.process.kill()
+            self.process.wait()
+
+class Load:
+    def __init__(self, plain_port, mesh_port, max_clients, max_mesh_stacks):
+        self.plain_port = plain_port
+        self.mesh_port = mesh_port
+        self.max_clients = max_clients
+        self.max_mesh_stacks = max_mesh_stacks
+        self.clients = []
+        self.mesh_stacks = []
+        self.sequence_number = 1
+
+    def connect(self, port):
+        try:
+            return socket.create_connection(('127.0.0.1', port), timeout=5)
+        except OSError as e:
+            print('connect to port {0} failed: {1}'.format(port, e))
+
+            return None
+
+    def send(self, sock, data):
+        try:
+            sock.sendall(data)
+
+            return True
+        except OSError:
+            return False
+
+    def drain(self, sock):
+        sock.setblocking(False)
+
+        try:
+            while len(sock.recv(4096)) > 0:
+                pass
+        except OSError:
+            pass
+
+    def next_sequence_number(self):
+        self.sequence_number = self.sequence_number % 15 + 1
+
+        return self.sequence_number
+
+    def step(self):
+        action = random.random()
+
+        if action < 0.3 and len(self.clients) < self.max_clients:
+            sock = self.connect(self.plain_port)
+
+            if sock != None:
+                self.send(sock, create_tfp_request(0, FUNCTION_ENUMERATE, self.next_sequence_number(), False))
+                self.clients.append(sock)
+        elif action < 0.55 and len(self.clients) > 0:
+            # requests to unknown UIDs stay pending, closing the connection
+            # right after sending them turns the client into a zombie
+            sock = self.clients.pop(random.randrange(len(self.clients)))
+
+            for _ in range(random.randrange(1, 20)):
+                self.send(sock, create_tfp_request(random.randrange(2, 1 << 32), FUNCTION_GET_IDENTITY,
+                                                   self.next_sequence_number(), True))
+
+            sock.close()
+        elif action < 0.75 and len(self.clients) > 0:
+            sock = random.choice(self.clients)
+
+            self.send(sock, create_tfp_request(random.randrange(2, 1 << 32), FUNCTION_GET_IDENTITY,
+                                               self.next_sequence_number(), True))
+            self.drain(sock)
+        elif action < 0.85 and len(self.mesh_stacks) < self.max_mesh_stacks:
+            sock = self.connect(self.mesh_port)
+
+            if sock != None:
+                src_addr = bytes(random.randrange(256) for _ in range(6))
+
+                self.send(sock, create_mesh_hello(src_addr))
+                self.mesh_stacks.append((sock, src_addr))
+        elif action < 0.92 and len(self.mesh_stacks) > 0:
+            sock, src_addr = random.choice(self.mesh_stacks)
+
+            self.send(sock, create_mesh_packet(MESH_PACKET_TYPE_HEART_BEAT_PING, src_addr))
+            self.drain(sock)
+        elif len(self.mesh_stacks) > 0:
+            sock, _ = self.mesh_stacks.pop(random.randrange(len(self.mesh_stacks)))
+            sock.close()
+
+    def close_all(self):
+        for sock in self.clients:
+            sock.close()
+
+        for sock, _ in self.mesh_stacks:
+            sock.close()
+
+        self.clients = []
+        self.mesh_stacks = []
+
+def get_slope(values):
+    n = len(values)
+
+    if n < 2:
+        return 0.0
+
+    mean_x = (n - 1) / 2.0
+    mean_y = sum(values) / float(n)
+    numerator = sum((x - mean_x) * (y - mean_y) for x, y in enumerate(values))
+    denominator = sum((x - mean_x) ** 2 for x in range(n))
+
+    return numerator / denominator
+
+def main():
+    parser = argparse.ArgumentParser(description='Soak test brickd for memory and file descriptor leaks')
+    parser.add_argument('--brickd', required=True, help='path to the brickd binary')
+    parser.add_argument('--duration', type=int, default=4 * 3600, help='duration of the load phase in seconds')
+    parser.add_argument('--interval', type=int, default=60, help='seconds between two samples')
+    parser.add_argument('--plain-port', type=int, default=14223)
+    parser.add_argument('--mesh-port', type=int, default=14240)
+    parser.add_argument('--max-clients', type=int, default=50)
+    parser.add_argument('--max-mesh-stacks', type=int, default=8)
+    parser.add_argument('--max-rss-growth', type=float, default=64.0,
+                        help='allowed RSS growth in KiB per sample over the second half of the run')
+    parser.add_argument('--max-fd-growth', type=float, default=0.1,
+                        help='allowed file descriptor growth per sample over the second half of the run')
+    parser.add_argument('--seed', type=int, default=None)
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+
+    with tempfile.TemporaryDirectory() as directory:
+        brickd = Brickd(args.brickd, args.plain_port, args.mesh_port, directory)
+        load = Load(args.plain_port, args.mesh_port, args.max_clients, args.max_mesh_stacks)
+        samples = []
+        failures = []
+
+        try:
+            time.sleep(2)
+
+            started = time.time()
+            next_sample = started
+
+            while time.time() - started < args.duration:
+                if brickd.process.poll() != None:
+                    raise Exception('brickd exited with {0}'.format(brickd.process.returncode))
+
+                load.step()
+
+                if time.time() >= next_sample:
+                    sample = brickd.sample()
+                    samples.append(sample)
+                    next_sample += args.interval
+
+                    print('{0:8.0f}s {1}'.format(time.time() - started,
+                                                 ', '.join('{0}: {1}'.format(k, v) for k, v in sorted(sample.items()))))
+
+                time.sleep(random.uniform(0.001, 0.05))
+
+            load.close_all()
+
+            # give brickd time to time out all zombies and to notice the
+            # closed mesh connections
+            time.sleep(10)
+
+            final = brickd.sample()
+
+            print('final     {0}'.format(', '.join('{0}: {1}'.format(k, v) for k, v in sorted(final.items()))))
+
+            for key in ['clients', 'zombies', 'pending_requests']:
+                if final.get(key, 0) != 0:
+                    failures.append('{0} did not drop back to 0 after all connections were closed: {1}'.format(key, final[key]))
+
+            second_half = samples[len(samples) // 2:]
+
+            for key, limit in [('rss', args.max_rss_growth), ('fds', args.max_fd_growth)]:
+                slope = get_slope([sample[key] for sample in second_half])
+
+                if slope > limit:
+                    failures.append('{0} keeps growing: {1:.2f} per sample > {2:.2f}'.format(key, slope, limit))
+        finally:
+            load.close_all()
+            brickd.stop()
+
+    if len(failures) > 0:
+        for failure in failures:
+            print('FAILED: ' + failure)
+
+        return 1
+
+    print('PASSED ({0} samples)'.format(len(samples)))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,187 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+"""
+brickd request squashing benchmark
+
+Floods a device with setter requests without response expected, faster than
+the device can take them, so the device queue in brickd backs up. Meanwhile a
+getter is sent every --probe-interval seconds. The time until its response
+arrives is the end-to-end latency that a client sees under overload. The
+getter has to wait behind all setters queued before it.
+
+Run this twice against the same device, once without and once with the setter
+listed in the squash.requests option of brickd, and compare the latencies:
+
+  squash.requests = <uid>:<function-id>
+
+With squashing the queue holds at most one setter per UID and function ID,
+so the getter latency stays close to the latency without load.
+
+The default getter is get_identity (function ID 255), every device supports
+it. The default setter is function ID 1, which is a setter on most devices.
+Choose --function-id and --payload-length to match a real setter of the
+device under test, for example set_rgb_values of an RGB LED Bricklet.
+
+Example:
+
+  ./squash_benchmark.py --uid XYZ --function-id 1 --payload-length 3 --rate 5000
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+BASE58 = '123456789abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ'
+
+def base58_decode(encoded):
+    value = 0
+
+    for c in encoded:
+        value = value * 58 + BASE58.index(c)
+
+    return value
+
+def create_packet(uid, function_id, sequence_number, response_expected, payload):
+    options = (sequence_number << 4) | (8 if response_expected else 0)
+
+    return struct.pack('<IBBBB', uid, 8 + len(payload), function_id, options, 0) + payload
+
+def get_percentile(values, percentile):
+    return values[min(int(percentile / 100.0 * len(values)), len(values) - 1)]
+
+class Benchmark:
+    def __init__(self, args):
+        self.args = args
+        self.uid = base58_decode(args.uid)
+        self.sock = socket.create_connection((args.host, args.port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.lock = threading.Lock()
+        self.running = True
+        self.probes = {} # sequence number -> send time
+        self.latencies = []
+        self.setters_sent = 0
+
+    def send(self, data):
+        with self.lock:
+            self.sock.sendall(data)
+
+    def flood(self):
+        interval = 1.0 / self.args.rate
+        next_time = time.time()
+        counter = 0
+
+        while self.running:
+            payload = struct.pack('<I', counter)[:self.args.payload_length].ljust(self.args.payload_length, b'\0')
+            counter += 1
+
+            self.send(create_packet(self.uid, self.args.function_id, 0, False, payload))
+            self.setters_sent += 1
+
+            next_time += interval
+            delay = next_time - time.time()
+
+            if delay > 0:
+                time.sleep(delay)
+
+    def receive(self):
+        buffer = b''
+
+        while self.running:
+            try:
+                data = self.sock.recv(4096)
+            except OSError:
+                break
+
+            if len(data) == 0:
+                break
+
+            buffer += data
+
+            while len(buffer) >= 8:
+                uid, length, function_id, options, flags = struct.unpack('<IBBBB', buffer[:8])
+
+                if len(buffer) < length:
+                    break
+
+                buffer = buffer[length:]
+                sequence_number = options >> 4
+
+                if uid != self.uid or function_id != self.args.probe_function_id:
+                    continue
+
+                with self.lock:
+                    sent = self.probes.pop(sequence_number, None)
+
+                if sent != None:
+                    self.latencies.append((time.time() - sent) * 1000.0)
+
+    def run(self):
+        receiver = threading.Thread(target=self.receive)
+        flooder = threading.Thread(target=self.flood)
+
+        receiver.daemon = True
+        receiver.start()
+        flooder.start()
+
+        sequence_number = 1
+        probes_sent = 0
+        end = time.time() + self.args.duration
+
+        while time.time() < end:
+            with self.lock:
+                # sequence numbers still in use belong to lost or very late
+                # probes, skip them
+                if sequence_number not in self.probes:
+                    self.probes[sequence_number] = time.time()
+                    self.sock.sendall(create_packet(self.uid, self.args.probe_function_id,
+                                                    sequence_number, True, b''))
+                    probes_sent += 1
+
+            sequence_number = sequence_number % 15 + 1
+
+            time.sleep(self.args.probe_interval)
+
+        self.running = False
+        flooder.join()
+
+        time.sleep(1) # give late responses a chance
+
+        self.sock.close()
+
+        return probes_sent
+
+def main():
+    parser = argparse.ArgumentParser(description='Measure getter latency while flooding a device with setters')
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=4223)
+    parser.add_argument('--uid', required=True)
+    parser.add_argument('--function-id', type=int, default=1, help='function ID of the setter')
+    parser.add_argument('--payload-length', type=int, default=4, help='payload length of the setter')
+    parser.add_argument('--rate', type=float, default=5000, help='setters per second')
+    parser.add_argument('--duration', type=float, default=10, help='seconds')
+    parser.add_argument('--probe-function-id', type=int, default=255, help='function ID of the getter')
+    parser.add_argument('--probe-interval', type=float, default=0.1, help='seconds between two getters')
+    args = parser.parse_args()
+
+    benchmark = Benchmark(args)
+    probes_sent = benchmark.run()
+    latencies = sorted(benchmark.latencies)
+
+    print('setters: {0} sent ({1:.0f}/s), getters: {2} of {3} answered'
+          .format(benchmark.setters_sent, benchmark.setters_sent / args.duration, len(latencies), probes_sent))
+
+    if len(latencies) == 0:
+        return 1
+
+    print('getter latency: min {0:.1f} ms, p50 {1:.1f} ms, p90 {2:.1f} ms, p99 {3:.1f} ms, max {4:.1f} ms'
+          .format(latencies[0], get_percentile(latencies, 50), get_percentile(latencies, 90),
+                  get_percentile(latencies, 99), latencies[-1]))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,114 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * test_harness.c: Shared helpers for the tests
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <daemonlib/utils.h>
+
+#include "test_harness.h"
+
+// prints the result of a test and returns 0 if it passed, -1 otherwise
+int harness_check(const char *name, bool ok) {
+	printf("%s: %s\n", name, ok ? "ok" : "FAILED");
+
+	return ok ? 0 : -1;
+}
+
+int harness_write(HarnessStream *stream, const uint8_t *data, int length) {
+	int rc;
+
+	while (length > 0) {
+		rc = write(stream->fd, data, length);
+
+		if (rc < 0) {
+			printf("write error: %s\n", get_errno_name(errno));
+
+			return -1;
+		}
+
+		data += rc;
+		length -= rc;
+	}
+
+	return 0;
+}
+
+// writes data in chunks of chunk_length bytes and lets the parser handle
+// each chunk before the next one is written. stops early without an error if
+// the parser gave up
+int harness_feed(HarnessStream *stream, const uint8_t *data, int length, int chunk_length) {
+	int offset;
+	int part;
+
+	for (offset = 0; offset < length; offset += part) {
+		part = MIN(chunk_length, length - offset);
+
+		if (harness_write(stream, data + offset, part) < 0) {
+			return -1;
+		}
+
+		stream->handle_read(stream->opaque);
+
+		if (stream->is_disconnected(stream->opaque)) {
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+// writes data in segments of segment_length bytes and lets the parser handle
+// them until *dispatched_count reaches expected_count. prints the throughput
+// and returns true if all packets arrived while the parser stayed connected
+bool harness_measure_throughput(HarnessStream *stream, const uint8_t *data, int length,
+                                int segment_length, int *dispatched_count,
+                                int expected_count) {
+	uint64_t start = microseconds();
+	uint64_t duration;
+	int offset;
+	int part;
+	bool ok = true;
+
+	for (offset = 0; ok && offset < length; offset += part) {
+		part = MIN(segment_length, length - offset);
+		ok = harness_write(stream, data + offset, part) == 0;
+
+		stream->handle_read(stream->opaque);
+	}
+
+	// the socketpair might still hold data that the parser didn't read yet
+	while (ok && !stream->is_disconnected(stream->opaque) && *dispatched_count < expected_count) {
+		stream->handle_read(stream->opaque);
+	}
+
+	duration = microseconds() - start;
+	ok = ok && !stream->is_disconnected(stream->opaque) && *dispatched_count == expected_count;
+
+	if (ok) {
+		printf("throughput: %d packets, %.2f MiB in %.3f sec, %.2f MiB/sec\n",
+		       expected_count, length / 1048576.0, duration / 1000000.0,
+		       (length / 1048576.0) / (duration / 1000000.0));
+	}
+
+	return ok;
+}
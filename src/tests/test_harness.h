@@ -0,0 +1,46 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * test_harness.h: Shared helpers for the tests
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_TEST_HARNESS_H
+#define BRICKD_TEST_HARNESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// a parser under test that reads from one end of a socketpair. the test
+// writes into the other end and calls handle_read to let the parser handle
+// the written data, the same way the event loop would
+typedef struct {
+	int fd; // the end that the test writes to
+	void (*handle_read)(void *opaque);
+	bool (*is_disconnected)(void *opaque); // true if the parser gave up
+	void *opaque;
+} HarnessStream;
+
+int harness_check(const char *name, bool ok);
+
+int harness_write(HarnessStream *stream, const uint8_t *data, int length);
+int harness_feed(HarnessStream *stream, const uint8_t *data, int length, int chunk_length);
+bool harness_measure_throughput(HarnessStream *stream, const uint8_t *data, int length,
+                                int segment_length, int *dispatched_count,
+                                int expected_count);
+
+#endif // BRICKD_TEST_HARNESS_H
@@ -0,0 +1,143 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+"""
+Synthetic udev event source
+
+Sends udev events to the udev netlink multicast group in the same format as
+udevd does, so brickd's libudev monitor receives them as if a device had been
+plugged in or removed. No USB hardware or USB gadget is needed. This only
+matters for brickd builds that use libudev for hotplug, meaning builds against
+libusb versions without hotplug support or builds made with WITH_LIBUDEV=yes.
+
+libudev only accepts events sent by root, so this has to run as root.
+
+The default scenario is one Brick being plugged in: first a burst of
+interface events, then an unrelated USB stick, then the same Brick add event
+several times. brickd has to ignore the interface events and the USB stick.
+It has to probe the Brick's bus number and device address exactly once, after
+the debounce delay. Check this in the brickd debug log:
+
+  brickd --debug udev,usb
+  sudo ./udev_event_injector.py
+
+Use --busnum and --devnum of a real Brick, as shown by lsusb, to see it
+actually get added or removed.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+NETLINK_KOBJECT_UEVENT = 15
+UDEV_MONITOR_UDEV = 2
+UDEV_MONITOR_MAGIC = 0xfeedcafe
+
+BRICK_VENDOR_ID = 0x16D0
+BRICK_PRODUCT_ID = 0x063D
+
+# same hash as used by libudev for the subsystem and devtype socket filter
+def murmur_hash2(data):
+    m = 0x5bd1e995
+    h = len(data)
+
+    while len(data) >= 4:
+        k = struct.unpack('<I', data[:4])[0]
+        k = (k * m) & 0xffffffff
+        k ^= k >> 24
+        k = (k * m) & 0xffffffff
+        h = (h * m) & 0xffffffff
+        h ^= k
+        data = data[4:]
+
+    if len(data) == 3:
+        h ^= data[2] << 16
+
+    if len(data) >= 2:
+        h ^= data[1] << 8
+
+    if len(data) >= 1:
+        h ^= data[0]
+        h = (h * m) & 0xffffffff
+
+    h ^= h >> 13
+    h = (h * m) & 0xffffffff
+    h ^= h >> 15
+
+    return h
+
+class Injector:
+    def __init__(self):
+        self.sock = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, NETLINK_KOBJECT_UEVENT)
+        self.sock.bind((0, 0))
+        self.seqnum = int(time.time()) * 1000
+
+    def send(self, action, devpath, devtype, properties):
+        self.seqnum += 1
+
+        items = [('ACTION', action),
+                 ('DEVPATH', devpath),
+                 ('SUBSYSTEM', 'usb'),
+                 ('DEVTYPE', devtype),
+                 ('SEQNUM', str(self.seqnum))] + properties
+        payload = b''.join('{0}={1}'.format(key, value).encode('ascii') + b'\0' for key, value in items)
+
+        # struct monitor_netlink_header from libudev
+        header_size = 40
+        header = b'libudev\0' + struct.pack('>I', UDEV_MONITOR_MAGIC) + \
+                 struct.pack('=III', header_size, header_size, len(payload)) + \
+                 struct.pack('>IIII', murmur_hash2(b'usb'), murmur_hash2(devtype.encode('ascii')), 0, 0)
+
+        self.sock.sendto(header + payload, (0, UDEV_MONITOR_UDEV))
+
+        print('sent {0} {1} ({2})'.format(action, devpath, devtype))
+
+    def send_device(self, action, sysname, busnum, devnum, vendor_id, product_id):
+        devpath = '/devices/pci0000:00/0000:00:14.0/usb{0}/{1}'.format(busnum, sysname)
+
+        self.send(action, devpath, 'usb_device',
+                  [('DEVNAME', 'bus/usb/{0:03}/{1:03}'.format(busnum, devnum)),
+                   ('PRODUCT', '{0:x}/{1:x}/110'.format(vendor_id, product_id)),
+                   ('BUSNUM', '{0:03}'.format(busnum)),
+                   ('DEVNUM', '{0:03}'.format(devnum))])
+
+    def send_interface(self, action, sysname, busnum, vendor_id, product_id):
+        devpath = '/devices/pci0000:00/0000:00:14.0/usb{0}/{1}/{1}:1.0'.format(busnum, sysname)
+
+        self.send(action, devpath, 'usb_interface',
+                  [('PRODUCT', '{0:x}/{1:x}/110'.format(vendor_id, product_id)),
+                   ('INTERFACE', '255/0/0')])
+
+def main():
+    parser = argparse.ArgumentParser(description='Send synthetic udev USB events')
+    parser.add_argument('--action', choices=['add', 'remove'], default='add')
+    parser.add_argument('--busnum', type=int, default=1)
+    parser.add_argument('--devnum', type=int, default=42)
+    parser.add_argument('--sysname', default='1-4')
+    parser.add_argument('--repeat', type=int, default=3, help='how often to send the Brick event')
+    parser.add_argument('--interval', type=float, default=0.01, help='seconds between the events of the burst')
+    args = parser.parse_args()
+
+    injector = Injector()
+
+    for _ in range(args.repeat):
+        injector.send_interface(args.action, args.sysname, args.busnum, BRICK_VENDOR_ID, BRICK_PRODUCT_ID)
+        time.sleep(args.interval)
+
+    # a USB stick on the same bus
+    injector.send_device(args.action, '1-5', args.busnum, args.devnum + 1, 0x0781, 0x5567)
+    time.sleep(args.interval)
+
+    for _ in range(args.repeat):
+        injector.send_device(args.action, args.sysname, args.busnum, args.devnum, BRICK_VENDOR_ID, BRICK_PRODUCT_ID)
+        time.sleep(args.interval)
+
+    print('expected in the brickd log: 1 ignored udev event, {0} received udev event(s), '
+          '1 rescan of bus {1} device {2}'.format(args.repeat, args.busnum, args.devnum))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,471 @@
+#!/usr/bin/python3
+# -*- coding: utf-8 -*-
+
+"""
+brickd USB gadget Brick
+
+Impersonates a Master Brick on a virtual USB bus, so the unmodified libusb
+code path of brickd (usb.c, usb_stack.c, usb_transfer.c, usb_posix.c) can be
+tested and benchmarked without hardware.
+
+The Linux dummy_hcd module provides a virtual host controller that is
+connected to a virtual device controller on the same machine. A configfs USB
+gadget with a FunctionFS function is bound to that device controller. The
+gadget has the vendor and product ID of a Brick and one vendor specific
+interface with a bulk IN and a bulk OUT endpoint. brickd sees it as a normal
+Brick on the host side and this script answers its TFP requests on the
+gadget side:
+
+  - enumerate: enumerate-available callback
+  - get-identity: identity of a Master Brick
+  - get-usb-voltage: fixed 5000 mV, so throughput_test works unchanged
+  - any other request with response-expected set: the request is sent back
+    as its own response (echo)
+
+On start the gadget sends an enumerate-connected callback like a real Brick
+does after power-up. With --callback-rate the gadget also sends a stream of
+callbacks (function ID 240, 4 byte counter payload) at the given rate, for
+callback_latency_benchmark.py.
+
+With --reaction-function-id the gadget measures how long it takes until a
+request with that function ID arrives after a callback was sent. It reports
+the latency for the first such request after each callback as a callback
+(function ID 241, 4 byte counter and 4 byte latency in microseconds payload),
+for rules_latency_benchmark.py. The measurement is done on the gadget side,
+so the send and receive times come from the same clock.
+
+Linux only, needs root, configfs, the libcomposite and dummy_hcd modules.
+
+Example:
+
+  sudo ./usb_gadget_brick.py --uid 6wwv71 &
+  ../brickd/brickd --debug &
+  ./throughput_test
+  ./websocket_benchmark localhost 4280 16 5000 10 <numeric-uid> 200
+"""
+
+import argparse
+import errno
+import os
+import signal
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+CONFIGFS_GADGET_PATH = '/sys/kernel/config/usb_gadget'
+UDC_PATH = '/sys/class/udc'
+
+USB_BRICK_VENDOR_ID = 0x16D0
+USB_BRICK_PRODUCT_ID = 0x063D
+USB_BRICK_DEVICE_RELEASE = 0x0110
+
+FUNCTIONFS_DESCRIPTORS_MAGIC_V2 = 3
+FUNCTIONFS_STRINGS_MAGIC = 2
+FUNCTIONFS_HAS_FS_DESC = 1
+FUNCTIONFS_HAS_HS_DESC = 2
+
+FUNCTIONFS_EVENT_NAMES = ['bind', 'unbind', 'enable', 'disable', 'setup', 'suspend', 'resume']
+FUNCTIONFS_EVENT_ENABLE = 2
+FUNCTIONFS_EVENT_DISABLE = 3
+FUNCTIONFS_EVENT_UNBIND = 1
+
+FUNCTION_GET_USB_VOLTAGE = 40
+FUNCTION_ENUMERATE = 254
+FUNCTION_GET_IDENTITY = 255
+CALLBACK_ENUMERATE = 253
+CALLBACK_FLOOD = 240
+CALLBACK_REACTION = 241
+
+ENUMERATION_TYPE_AVAILABLE = 0
+ENUMERATION_TYPE_CONNECTED = 1
+
+MASTER_DEVICE_IDENTIFIER = 13
+
+BASE58_ALPHABET = '123456789abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ'
+
+def base58_decode(encoded):
+    value = 0
+
+    for c in encoded:
+        value = value * 58 + BASE58_ALPHABET.index(c)
+
+    return value
+
+def create_interface_descriptor():
+    # bLength, bDescriptorType, bInterfaceNumber, bAlternateSetting,
+    # bNumEndpoints, bInterfaceClass, bInterfaceSubClass, bInterfaceProtocol,
+    # iInterface
+    return struct.pack('<BBBBBBBBB', 9, 4, 0, 0, 2, 0xFF, 0, 0, 1)
+
+def create_endpoint_descriptor(address, max_packet_size):
+    # bLength, bDescriptorType, bEndpointAddress, bmAttributes (bulk),
+    # wMaxPacketSize, bInterval
+    return struct.pack('<BBBBHB', 7, 5, address, 2, max_packet_size, 0)
+
+def create_descriptors():
+    # the order of the endpoint descriptors defines the ep1 and ep2 files
+    fs = [create_interface_descriptor(),
+          create_endpoint_descriptor(0x81, 64),
+          create_endpoint_descriptor(0x02, 64)]
+    hs = [create_interface_descriptor(),
+          create_endpoint_descriptor(0x81, 512),
+          create_endpoint_descriptor(0x02, 512)]
+    body = struct.pack('<II', len(fs), len(hs)) + b''.join(fs) + b''.join(hs)
+
+    return struct.pack('<III', FUNCTIONFS_DESCRIPTORS_MAGIC_V2, 12 + len(body),
+                       FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC) + body
+
+def create_strings():
+    body = struct.pack('<IIH', 1, 1, 0x0409) + b'Brick API\0'
+
+    return struct.pack('<II', FUNCTIONFS_STRINGS_MAGIC, 8 + len(body)) + body
+
+def write_file(path, value):
+    with open(path, 'w') as f:
+        f.write(value)
+
+class Gadget:
+    def __init__(self, name, uid, udc):
+        self.name = name
+        self.path = os.path.join(CONFIGFS_GADGET_PATH, name)
+        self.function_path = os.path.join(self.path, 'functions', 'ffs.' + name)
+        self.config_path = os.path.join(self.path, 'configs', 'c.1')
+        self.mount_path = os.path.join('/tmp', 'ffs.' + name)
+        self.uid = uid
+        self.udc = udc
+        self.mounted = False
+        self.bound = False
+
+    def create(self):
+        subprocess.check_call(['modprobe', 'libcomposite'])
+        subprocess.check_call(['modprobe', 'dummy_hcd'])
+
+        if self.udc == None:
+            udcs = sorted(os.listdir(UDC_PATH))
+
+            if len(udcs) == 0:
+                raise Exception('no USB device controller found, is dummy_hcd loaded?')
+
+            self.udc = udcs[0]
+
+        os.mkdir(self.path)
+
+        write_file(os.path.join(self.path, 'idVendor'), '0x{0:04X}'.format(USB_BRICK_VENDOR_ID))
+        write_file(os.path.join(self.path, 'idProduct'), '0x{0:04X}'.format(USB_BRICK_PRODUCT_ID))
+        write_file(os.path.join(self.path, 'bcdDevice'), '0x{0:04X}'.format(USB_BRICK_DEVICE_RELEASE))
+        write_file(os.path.join(self.path, 'bcdUSB'), '0x0200')
+
+        strings_path = os.path.join(self.path, 'strings', '0x409')
+
+        os.mkdir(strings_path)
+
+        write_file(os.path.join(strings_path, 'manufacturer'), 'Tinkerforge GmbH')
+        write_file(os.path.join(strings_path, 'product'), 'Master Brick')
+        write_file(os.path.join(strings_path, 'serialnumber'), self.uid)
+
+        os.mkdir(self.config_path)
+        os.mkdir(os.path.join(self.config_path, 'strings', '0x409'))
+
+        write_file(os.path.join(self.config_path, 'strings', '0x409', 'configuration'), 'Brick')
+        write_file(os.path.join(self.config_path, 'MaxPower'), '100')
+
+        os.mkdir(self.function_path)
+        os.symlink(self.function_path, os.path.join(self.config_path, 'ffs.' + self.name))
+
+        os.makedirs(self.mount_path, exist_ok=True)
+        subprocess.check_call(['mount', '-t', 'functionfs', self.name, self.mount_path])
+
+        self.mounted = True
+
+    def bind(self):
+        write_file(os.path.join(self.path, 'UDC'), self.udc)
+
+        self.bound = True
+
+    def unbind(self):
+        if self.bound:
+            try:
+                write_file(os.path.join(self.path, 'UDC'), '\n')
+            except OSError:
+                pass
+
+            self.bound = False
+
+    def destroy(self):
+        self.unbind()
+
+        if self.mounted:
+            subprocess.call(['umount', self.mount_path])
+
+        # configfs needs the gadget to be taken apart in reverse order
+        for path, remove in [(os.path.join(self.config_path, 'ffs.' + self.name), os.unlink),
+                             (os.path.join(self.config_path, 'strings', '0x409'), os.rmdir),
+                             (self.config_path, os.rmdir),
+                             (self.function_path, os.rmdir),
+                             (os.path.join(self.path, 'strings', '0x409'), os.rmdir),
+                             (self.path, os.rmdir),
+                             (self.mount_path, os.rmdir)]:
+            try:
+                remove(path)
+            except OSError:
+                pass
+
+class Brick:
+    def __init__(self, gadget, uid, callback_rate, reaction_function_id):
+        self.gadget = gadget
+        self.uid = uid
+        self.uid_number = base58_decode(uid)
+        self.callback_rate = callback_rate
+        self.reaction_function_id = reaction_function_id
+        self.reaction_lock = threading.Lock()
+        self.last_callback = None # (counter, send time) not reacted to yet
+        self.enabled = threading.Event()
+        self.running = True
+        self.ep0 = None
+        self.ep_in = None
+        self.ep_out = None
+        self.requests = 0
+        self.responses = 0
+        self.bytes_received = 0
+        self.bytes_sent = 0
+        self.callbacks = 0
+        self.reactions = 0
+
+    def open(self):
+        self.ep0 = os.open(os.path.join(self.gadget.mount_path, 'ep0'), os.O_RDWR)
+
+        os.write(self.ep0, create_descriptors())
+        os.write(self.ep0, create_strings())
+
+        self.ep_in = os.open(os.path.join(self.gadget.mount_path, 'ep1'), os.O_RDWR)
+        self.ep_out = os.open(os.path.join(self.gadget.mount_path, 'ep2'), os.O_RDWR)
+
+        threading.Thread(target=self.handle_ep0, daemon=True).start()
+
+    def close(self):
+        for fd in [self.ep_out, self.ep_in, self.ep0]:
+            if fd != None:
+                os.close(fd)
+
+    def handle_ep0(self):
+        while self.running:
+            try:
+                event = os.read(self.ep0, 12)
+            except OSError as e:
+                if e.errno == errno.EINTR:
+                    continue
+
+                return
+
+            # struct usb_functionfs_event: 8 bytes setup request, type, padding
+            event_type = event[8]
+
+            if event_type < len(FUNCTIONFS_EVENT_NAMES):
+                print('ep0 event: {0}'.format(FUNCTIONFS_EVENT_NAMES[event_type]))
+
+            if event_type == FUNCTIONFS_EVENT_ENABLE:
+                self.enabled.set()
+            elif event_type in [FUNCTIONFS_EVENT_DISABLE, FUNCTIONFS_EVENT_UNBIND]:
+                self.enabled.clear()
+
+    def create_header(self, length, function_id, sequence_number, response_expected):
+        flags = (sequence_number << 4) | (8 if response_expected else 0)
+
+        return struct.pack('<IBBBB', self.uid_number, length, function_id, flags, 0)
+
+    def create_identity(self):
+        return struct.pack('<8s8sc3B3BH', self.uid.encode('ascii'), b'0', b'0',
+                           2, 1, 0, 2, 5, 0, MASTER_DEVICE_IDENTIFIER)
+
+    def create_enumerate_callback(self, enumeration_type):
+        payload = self.create_identity() + struct.pack('<B', enumeration_type)
+
+        return self.create_header(8 + len(payload), CALLBACK_ENUMERATE, 0, True) + payload
+
+    def create_response(self, request):
+        uid, length, function_id, flags = struct.unpack('<IBBB', request[:7])
+        sequence_number = (flags >> 4) & 0x0F
+        response_expected = (flags & 0x08) != 0
+
+        if function_id == FUNCTION_ENUMERATE and (uid == 0 or uid == self.uid_number):
+            return self.create_enumerate_callback(ENUMERATION_TYPE_AVAILABLE)
+
+        if uid != self.uid_number or not response_expected:
+            return None
+
+        if function_id == FUNCTION_GET_IDENTITY:
+            payload = self.create_identity()
+        elif function_id == FUNCTION_GET_USB_VOLTAGE:
+            payload = struct.pack('<H', 5000)
+        else:
+            payload = request[8:length]
+
+        return self.create_header(8 + len(payload), function_id, sequence_number, True) + payload
+
+    def send(self, packet):
+        # one packet per transfer, all packets are shorter than the maximum
+        # packet size, so every write ends the host side read transfer
+        os.write(self.ep_in, packet)
+
+        self.bytes_sent += len(packet)
+
+    def handle_reaction(self, request):
+        uid, length, function_id = struct.unpack('<IBB', request[:6])
+
+        if uid != self.uid_number or function_id != self.reaction_function_id:
+            return
+
+        received = time.monotonic()
+
+        with self.reaction_lock:
+            if self.last_callback == None:
+                return
+
+            counter, sent = self.last_callback
+            self.last_callback = None
+
+        latency = min(int((received - sent) * 1000000), 0xFFFFFFFF)
+        payload = struct.pack('<II', counter, latency)
+
+        self.send(self.create_header(8 + len(payload), CALLBACK_REACTION, 0, True) + payload)
+
+        self.reactions += 1
+
+    def flood(self):
+        interval = 1.0 / self.callback_rate
+        next_time = time.time()
+
+        while self.running:
+            if not self.enabled.wait(1):
+                next_time = time.time()
+                continue
+
+            counter = self.callbacks & 0xFFFFFFFF
+            payload = struct.pack('<I', counter)
+
+            try:
+                # record the time before the write, the reaction can arrive
+                # before the write returns
+                with self.reaction_lock:
+                    self.last_callback = (counter, time.monotonic())
+
+                self.send(self.create_header(8 + len(payload), CALLBACK_FLOOD, 0, True) + payload)
+            except OSError:
+                continue
+
+            self.callbacks += 1
+
+            next_time += interval
+            delay = next_time - time.time()
+
+            if delay > 0:
+                time.sleep(delay)
+
+    def run(self):
+        connected = False
+
+        if self.callback_rate > 0:
+            threading.Thread(target=self.flood, daemon=True).start()
+
+        while self.running:
+            if not self.enabled.wait(1):
+                continue
+
+            try:
+                if not connected:
+                    self.send(self.create_enumerate_callback(ENUMERATION_TYPE_CONNECTED))
+
+                    connected = True
+
+                data = os.read(self.ep_out, 1024)
+            except OSError as e:
+                # ESHUTDOWN if the host side disabled the interface meanwhile
+                if e.errno in [errno.EINTR, errno.ESHUTDOWN, errno.EAGAIN]:
+                    connected = False
+
+                    continue
+
+                raise
+
+            self.bytes_received += len(data)
+
+            # brickd writes one packet per transfer, but be tolerant
+            while len(data) >= 8:
+                length = data[4]
+
+                if length < 8 or length > len(data):
+                    print('dropping malformed transfer of {0} byte(s)'.format(len(data)))
+                    break
+
+                self.requests += 1
+
+                if self.reaction_function_id != None:
+                    self.handle_reaction(data[:length])
+
+                response = self.create_response(data[:length])
+
+                if response != None:
+                    self.send(response)
+                    self.responses += 1
+
+                data = data[length:]
+
+def main():
+    parser = argparse.ArgumentParser(description='Impersonate a Brick on a dummy_hcd USB bus for brickd')
+    parser.add_argument('--uid', default='6wwv71', help='UID of the Brick (default matches throughput_test)')
+    parser.add_argument('--name', default='brickd_test', help='name of the configfs gadget')
+    parser.add_argument('--udc', default=None, help='USB device controller to bind to, default is the first one')
+    parser.add_argument('--callback-rate', type=float, default=0, help='callbacks per second, default is no callbacks')
+    parser.add_argument('--reaction-function-id', type=int, default=None, help='report the latency of requests with this function ID after a callback')
+    args = parser.parse_args()
+
+    if os.geteuid() != 0:
+        print('must be run as root')
+
+        return 1
+
+    gadget = Gadget(args.name, args.uid, args.udc)
+    brick = None
+    started = time.time()
+
+    def stop(signum, frame):
+        raise KeyboardInterrupt()
+
+    signal.signal(signal.SIGTERM, stop)
+
+    try:
+        gadget.create()
+
+        brick = Brick(gadget, args.uid, args.callback_rate, args.reaction_function_id)
+        brick.open()
+
+        gadget.bind()
+
+        print('Brick {0} (numeric {1}) on {2}'.format(args.uid, brick.uid_number, gadget.udc))
+
+        brick.run()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if brick != None:
+            brick.running = False
+            duration = max(time.time() - started, 0.001)
+
+            print('requests: {0}, responses: {1}, callbacks: {2}, reactions: {3}, received: {4} bytes, sent: {5} bytes, {6:.0f} requests/s'
+                  .format(brick.requests, brick.responses, brick.callbacks, brick.reactions,
+                          brick.bytes_received, brick.bytes_sent, brick.requests / duration))
+
+        # the endpoint files have to be closed before FunctionFS can be unmounted
+        gadget.unbind()
+
+        if brick != None:
+            brick.close()
+
+        gadget.destroy()
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
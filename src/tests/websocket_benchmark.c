@@ -0,0 +1,485 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * websocket_benchmark.c: Load generator for the WebSocket port of brickd
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// opens many WebSocket connections to brickd, performs the handshake on each
+// of them and then sends masked binary frames with TFP requests at a fixed
+// rate spread over all connections. reports the handshake rate, the request
+// throughput and latency percentiles.
+//
+// by default the requests go to brickd itself (UID 1) and use a function ID
+// brickd does not implement. brickd answers them with a function-not-supported
+// error, so the full WebSocket and client path is measured without hardware.
+// to include a device use the <uid> argument with a numeric UID and pick a
+// getter of that device as <function-id>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <daemonlib/utils.h>
+
+#define HEADER_LENGTH 8
+#define MAX_SEQUENCE_NUMBER 15
+#define RECEIVE_BUFFER_LENGTH 4096
+
+#define HANDSHAKE_REQUEST \
+	"GET / HTTP/1.1\r\n" \
+	"Host: localhost\r\n" \
+	"Upgrade: websocket\r\n" \
+	"Connection: Upgrade\r\n" \
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+	"Sec-WebSocket-Protocol: tfp\r\n" \
+	"Sec-WebSocket-Version: 13\r\n" \
+	"\r\n"
+
+typedef struct {
+	int socket;
+	uint8_t next_sequence_number;
+	int in_flight;
+	uint64_t sent[MAX_SEQUENCE_NUMBER + 1]; // in microseconds, 0 if unused
+	uint8_t buffer[RECEIVE_BUFFER_LENGTH];
+	int buffer_used;
+} Connection;
+
+typedef struct {
+	uint32_t *values; // in microseconds
+	int count;
+	int allocated;
+} Latencies;
+
+static uint32_t _uid = 1;
+static uint8_t _function_id = 200;
+static uint64_t _requests_sent = 0;
+static uint64_t _responses_received = 0;
+static uint64_t _requests_skipped = 0; // all sequence numbers in flight
+static Latencies _latencies;
+
+static int latencies_add(uint32_t value) {
+	uint32_t *values;
+
+	if (_latencies.count == _latencies.allocated) {
+		_latencies.allocated = _latencies.allocated == 0 ? 65536 : _latencies.allocated * 2;
+		values = realloc(_latencies.values, _latencies.allocated * sizeof(uint32_t));
+
+		if (values == NULL) {
+			return -1;
+		}
+
+		_latencies.values = values;
+	}
+
+	_latencies.values[_latencies.count++] = value;
+
+	return 0;
+}
+
+static int compare_uint32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static uint32_t latencies_get_percentile(double percentile) {
+	int index;
+
+	if (_latencies.count == 0) {
+		return 0;
+	}
+
+	index = (int)(percentile / 100.0 * (_latencies.count - 1) + 0.5);
+
+	return _latencies.values[index];
+}
+
+static int write_all(int socket, const void *buffer, int length) {
+	const uint8_t *bytes = buffer;
+	int offset = 0;
+	int rc;
+
+	while (offset < length) {
+		rc = write(socket, bytes + offset, length - offset);
+
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		offset += rc;
+	}
+
+	return 0;
+}
+
+static int connect_to(const char *host, const char *port) {
+	struct addrinfo hints;
+	struct addrinfo *resolved;
+	int sock;
+	int flag = 1;
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &resolved) != 0) {
+		printf("could not resolve %s:%s\n", host, port);
+
+		return -1;
+	}
+
+	sock = socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+
+	if (sock < 0) {
+		printf("could not create socket: %s\n", strerror(errno));
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	if (connect(sock, resolved->ai_addr, resolved->ai_addrlen) < 0) {
+		printf("could not connect to %s:%s: %s\n", host, port, strerror(errno));
+		close(sock);
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	freeaddrinfo(resolved);
+
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	return sock;
+}
+
+static int handshake(Connection *connection) {
+	char response[1024];
+	int used = 0;
+	int rc;
+
+	if (write_all(connection->socket, HANDSHAKE_REQUEST, strlen(HANDSHAKE_REQUEST)) < 0) {
+		printf("could not send handshake: %s\n", strerror(errno));
+
+		return -1;
+	}
+
+	// brickd sends the handshake answer and nothing else until the first
+	// request arrives, so everything up to the empty line is the answer
+	while (used < (int)sizeof(response) - 1) {
+		rc = read(connection->socket, response + used, sizeof(response) - 1 - used);
+
+		if (rc <= 0) {
+			printf("could not receive handshake answer\n");
+
+			return -1;
+		}
+
+		used += rc;
+		response[used] = '\0';
+
+		if (strstr(response, "\r\n\r\n") != NULL) {
+			break;
+		}
+	}
+
+	if (strncmp(response, "HTTP/1.1 101", 12) != 0) {
+		printf("unexpected handshake answer: %s\n", response);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static int send_request(Connection *connection) {
+	uint8_t frame[2 + 4 + HEADER_LENGTH];
+	uint8_t *mask = frame + 2;
+	uint8_t *payload = frame + 6;
+	uint8_t sequence_number;
+	int i;
+
+	if (connection->in_flight >= MAX_SEQUENCE_NUMBER) {
+		++_requests_skipped;
+
+		return 0;
+	}
+
+	sequence_number = connection->next_sequence_number;
+
+	while (connection->sent[sequence_number] != 0) {
+		sequence_number = sequence_number % MAX_SEQUENCE_NUMBER + 1;
+	}
+
+	connection->next_sequence_number = sequence_number % MAX_SEQUENCE_NUMBER + 1;
+
+	frame[0] = 0x80 | 2; // fin, binary
+	frame[1] = 0x80 | HEADER_LENGTH; // masked
+
+	for (i = 0; i < 4; ++i) {
+		mask[i] = (uint8_t)rand();
+	}
+
+	payload[0] = _uid & 0xFF;
+	payload[1] = (_uid >> 8) & 0xFF;
+	payload[2] = (_uid >> 16) & 0xFF;
+	payload[3] = (_uid >> 24) & 0xFF;
+	payload[4] = HEADER_LENGTH;
+	payload[5] = _function_id;
+	payload[6] = (uint8_t)(sequence_number << 4) | 0x08; // response expected
+	payload[7] = 0;
+
+	for (i = 0; i < HEADER_LENGTH; ++i) {
+		payload[i] ^= mask[i % 4];
+	}
+
+	if (write_all(connection->socket, frame, sizeof(frame)) < 0) {
+		printf("could not send request: %s\n", strerror(errno));
+
+		return -1;
+	}
+
+	connection->sent[sequence_number] = microseconds();
+	++connection->in_flight;
+	++_requests_sent;
+
+	return 0;
+}
+
+static int receive_responses(Connection *connection) {
+	uint64_t now;
+	uint8_t *payload;
+	uint8_t sequence_number;
+	int offset = 0;
+	int length;
+	int rc;
+
+	rc = read(connection->socket, connection->buffer + connection->buffer_used,
+	          sizeof(connection->buffer) - connection->buffer_used);
+
+	if (rc <= 0) {
+		if (rc < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		}
+
+		printf("connection closed by brickd\n");
+
+		return -1;
+	}
+
+	connection->buffer_used += rc;
+	now = microseconds();
+
+	// brickd sends unmasked frames with an unextended payload length
+	while (connection->buffer_used - offset >= 2) {
+		length = connection->buffer[offset + 1] & 0x7F;
+
+		if (connection->buffer_used - offset < 2 + length) {
+			break;
+		}
+
+		payload = connection->buffer + offset + 2;
+
+		if (length >= HEADER_LENGTH) {
+			sequence_number = (payload[6] >> 4) & 0x0F;
+
+			// callbacks have sequence number 0 and are not counted
+			if (sequence_number != 0 && connection->sent[sequence_number] != 0) {
+				if (latencies_add((uint32_t)(now - connection->sent[sequence_number])) < 0) {
+					printf("could not allocate latency buffer\n");
+
+					return -1;
+				}
+
+				connection->sent[sequence_number] = 0;
+				--connection->in_flight;
+				++_responses_received;
+			}
+		}
+
+		offset += 2 + length;
+	}
+
+	memmove(connection->buffer, connection->buffer + offset, connection->buffer_used - offset);
+	connection->buffer_used -= offset;
+
+	return 0;
+}
+
+static void print_usage(void) {
+	printf("usage: websocket_benchmark <host> <port> [<connections> [<requests-per-second> [<seconds> [<uid> [<function-id>]]]]]\n");
+}
+
+int main(int argc, char **argv) {
+	const char *host;
+	const char *port;
+	int connection_count = 16;
+	int rate = 1000;
+	int duration = 10;
+	Connection *connections;
+	struct pollfd *pollfds;
+	uint64_t started;
+	uint64_t now;
+	uint64_t elapsed;
+	uint64_t due;
+	int next_connection = 0;
+	int i;
+
+	if (argc < 3) {
+		print_usage();
+
+		return EXIT_FAILURE;
+	}
+
+	host = argv[1];
+	port = argv[2];
+
+	if (argc > 3) {
+		connection_count = atoi(argv[3]);
+	}
+
+	if (argc > 4) {
+		rate = atoi(argv[4]);
+	}
+
+	if (argc > 5) {
+		duration = atoi(argv[5]);
+	}
+
+	if (argc > 6) {
+		_uid = (uint32_t)strtoul(argv[6], NULL, 0);
+	}
+
+	if (argc > 7) {
+		_function_id = (uint8_t)strtoul(argv[7], NULL, 0);
+	}
+
+	if (connection_count < 1 || rate < 1 || duration < 1) {
+		print_usage();
+
+		return EXIT_FAILURE;
+	}
+
+	connections = calloc(connection_count, sizeof(Connection));
+	pollfds = calloc(connection_count, sizeof(struct pollfd));
+
+	if (connections == NULL || pollfds == NULL) {
+		printf("could not allocate connections\n");
+
+		return EXIT_FAILURE;
+	}
+
+	// handshakes are done one after the other, so the rate is bound by the
+	// round trip to brickd
+	started = microseconds();
+
+	for (i = 0; i < connection_count; ++i) {
+		connections[i].socket = connect_to(host, port);
+		connections[i].next_sequence_number = 1;
+
+		if (connections[i].socket < 0 || handshake(&connections[i]) < 0) {
+			return EXIT_FAILURE;
+		}
+
+		pollfds[i].fd = connections[i].socket;
+		pollfds[i].events = POLLIN;
+	}
+
+	elapsed = microseconds() - started;
+
+	printf("handshakes: %d in %.3f s (%.0f/s)\n", connection_count,
+	       elapsed / 1000000.0, connection_count * 1000000.0 / (elapsed > 0 ? elapsed : 1));
+
+	started = microseconds();
+
+	for (;;) {
+		now = microseconds();
+		elapsed = now - started;
+
+		if (elapsed >= (uint64_t)duration * 1000000) {
+			break;
+		}
+
+		// send as many requests as are due at this point, round robin over
+		// all connections
+		due = elapsed * rate / 1000000;
+
+		while (_requests_sent + _requests_skipped < due) {
+			if (send_request(&connections[next_connection]) < 0) {
+				return EXIT_FAILURE;
+			}
+
+			next_connection = (next_connection + 1) % connection_count;
+		}
+
+		if (poll(pollfds, connection_count, 1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			printf("poll failed: %s\n", strerror(errno));
+
+			return EXIT_FAILURE;
+		}
+
+		for (i = 0; i < connection_count; ++i) {
+			if ((pollfds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+				if (receive_responses(&connections[i]) < 0) {
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	elapsed = microseconds() - started;
+
+	qsort(_latencies.values, _latencies.count, sizeof(uint32_t), compare_uint32);
+
+	printf("requests: %llu sent, %llu answered, %llu skipped (15 in flight) in %.3f s\n",
+	       (unsigned long long)_requests_sent, (unsigned long long)_responses_received,
+	       (unsigned long long)_requests_skipped, elapsed / 1000000.0);
+	printf("throughput: %.0f responses/s\n", _responses_received * 1000000.0 / elapsed);
+	printf("latency: p50 %u us, p90 %u us, p99 %u us, p99.9 %u us, max %u us\n",
+	       latencies_get_percentile(50), latencies_get_percentile(90),
+	       latencies_get_percentile(99), latencies_get_percentile(99.9),
+	       latencies_get_percentile(100));
+
+	for (i = 0; i < connection_count; ++i) {
+		close(connections[i].socket);
+	}
+
+	free(connections);
+	free(pollfds);
+	free(_latencies.values);
+
+	return EXIT_SUCCESS;
+}